@@ -0,0 +1,230 @@
+/*
+    small client for the CMS server mode (./project --serve)
+
+    build:
+        cc client.c -o cms-client
+
+    usage:
+        ./cms-client                        connect to unix:/tmp/cms-P10-4.sock
+        ./cms-client unix:/path/cms.sock
+        ./cms-client tcp:5555               (server on 127.0.0.1)
+        ./cms-client < commands.txt         send every line at once (pipelined)
+
+    protocol (same as runServer() in project.c):
+        - we send command lines, the same text you would type at the prompt
+        - the server sends one greeting frame after we connect, then exactly
+          one reply frame per line:  "<length>\n" + <length> bytes of output
+*/
+
+#include <stdio.h>      // printf, fwrite, fprintf
+#include <stdlib.h>     // malloc, realloc, free, strtol
+#include <string.h>     // strlen, strncmp, memcpy, memmove
+#include <errno.h>      // errno, strerror
+#include <unistd.h>     // read, write, close, isatty
+#include <poll.h>       // poll
+#include <signal.h>     // signal, SIGPIPE
+#include <sys/socket.h> // socket, connect, send, recv, shutdown
+#include <sys/un.h>     // sockaddr_un
+#include <netinet/in.h> // sockaddr_in
+#include <arpa/inet.h>  // htons, htonl
+
+#define OUR_GROUP_NAME "P10-4"
+#define DEFAULT_ADDRESS "unix:/tmp/cms-" OUR_GROUP_NAME ".sock"
+
+// connect to "unix:<path>", "tcp:<port>" or a bare unix socket path
+// returns the socket fd, or -1 on error
+static int connectToServer(const char *address)
+{
+    int fd;
+
+    if (strncmp(address, "tcp:", 4) == 0) {
+        long port = strtol(address + 4, NULL, 10);
+        if (port <= 0 || port > 65535) {
+            fprintf(stderr, "cms-client: invalid TCP port in \"%s\"\n", address);
+            return -1;
+        }
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((unsigned short)port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            return fd;
+        }
+    } else {
+        const char *path = strncmp(address, "unix:", 5) == 0 ? address + 5 : address;
+
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "cms-client: socket path too long\n");
+            return -1;
+        }
+        strcpy(addr.sun_path, path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            return fd;
+        }
+    }
+
+    fprintf(stderr, "cms-client: cannot connect to %s: %s\n", address, strerror(errno));
+    if (fd >= 0) {
+        close(fd);
+    }
+    return -1;
+}
+
+// send all bytes (the socket is blocking)
+static int sendAll(int fd, const char *data, size_t length)
+{
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, 0);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        data += sent;
+        length -= (size_t)sent;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *address = argc >= 2 ? argv[1] : DEFAULT_ADDRESS;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int fd = connectToServer(address);
+    if (fd < 0) {
+        return 1;
+    }
+
+    // only show the "P10-4: " prompt when a person is typing
+    int interactive = isatty(STDIN_FILENO);
+
+    int stdinOpen = 1;
+    int greetingSeen = 0;
+    long repliesPending = 0;        // lines sent but not answered yet
+    int endsWithNewline = 1;        // did the last partial line we sent end?
+
+    char *frames = NULL;            // bytes received from the server
+    size_t framesLength = 0;
+    size_t framesCapacity = 0;
+
+    while (1) {
+        struct pollfd fds[2];
+        int count = 0;
+
+        fds[count].fd = fd;
+        fds[count].events = POLLIN;
+        count++;
+
+        if (stdinOpen) {
+            fds[count].fd = STDIN_FILENO;
+            fds[count].events = POLLIN;
+            count++;
+        }
+
+        if (poll(fds, (nfds_t)count, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        // user input: forward whole chunks, every newline is one command
+        if (stdinOpen && (fds[1].revents & (POLLIN | POLLHUP))) {
+            char buffer[64 * 1024];
+            ssize_t got = read(STDIN_FILENO, buffer, sizeof(buffer));
+
+            if (got > 0) {
+                for (ssize_t i = 0; i < got; ++i) {
+                    if (buffer[i] == '\n') {
+                        repliesPending++;
+                    }
+                }
+                endsWithNewline = buffer[got - 1] == '\n';
+                if (!sendAll(fd, buffer, (size_t)got)) {
+                    break;
+                }
+            } else if (got == 0) {
+                // end of input: finish the last line, then tell the server we are done
+                if (!endsWithNewline) {
+                    sendAll(fd, "\n", 1);
+                    repliesPending++;
+                }
+                shutdown(fd, SHUT_WR);
+                stdinOpen = 0;
+            }
+        }
+
+        if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+            continue;
+        }
+
+        // server output: collect bytes and print every complete frame
+        if (framesCapacity - framesLength < 64 * 1024) {
+            framesCapacity = framesLength + 64 * 1024;
+            char *newMemory = (char *)realloc(frames, framesCapacity);
+            if (!newMemory) {
+                fprintf(stderr, "cms-client: out of memory\n");
+                break;
+            }
+            frames = newMemory;
+        }
+
+        ssize_t got = recv(fd, frames + framesLength, framesCapacity - framesLength, 0);
+        if (got <= 0) {
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            break;  // server closed the connection (EXIT, or it stopped)
+        }
+        framesLength += (size_t)got;
+
+        size_t start = 0;
+        while (1) {
+            char *newline = memchr(frames + start, '\n', framesLength - start);
+            if (!newline) {
+                break;
+            }
+
+            size_t headerLength = (size_t)(newline - (frames + start)) + 1;
+            size_t payloadLength = (size_t)strtoul(frames + start, NULL, 10);
+            if (framesLength - start < headerLength + payloadLength) {
+                break;  // frame not complete yet
+            }
+
+            const char *payload = frames + start + headerLength;
+            fwrite(payload, 1, payloadLength, stdout);
+            start += headerLength + payloadLength;
+
+            if (greetingSeen) {
+                repliesPending--;
+            }
+            greetingSeen = 1;
+
+            // replies that end in a question (password, Y/N) already prompt
+            int endsLine = payloadLength == 0 || payload[payloadLength - 1] == '\n';
+            if (interactive && repliesPending <= 0 && endsLine) {
+                printf(OUR_GROUP_NAME ": ");
+            }
+        }
+        fflush(stdout);
+
+        memmove(frames, frames + start, framesLength - start);
+        framesLength -= start;
+    }
+
+    free(frames);
+    close(fd);
+    return 0;
+}
@@ -3,7 +3,7 @@
         - student ID (integer)
         - name (string)
         - programme (string)
-        - mark (float)
+        - mark (one decimal, stored in tenths)
 
     main features:
         - OPEN:    read all records from a database file
@@ -18,23 +18,92 @@
         - sorting:
             SHOW ALL SORT BY ID ASC / DESC
             SHOW ALL SORT BY MARK ASC / DESC
+            SHOW ALL SORT BY MARK DESC, ID ASC  (several columns, stable)
+            SHOW ALL SORT BY NAME / PROGRAMME   (case-insensitive)
+        - pages:
+            SHOW ALL ... LIMIT 20 OFFSET 40, FIND ... LIMIT 20  (only the
+            page is formatted, FIND stops once it is full)
+            SHOW ALL [WHERE ...] AFTER ID=<id> LIMIT 20  (keyset page in ID
+            order, walks the bitmap indexes from that ID)
         - summary:
-            SHOW SUMMARY  (total students, average, highest, lowest)
+            SHOW SUMMARY  (total students, average, highest, lowest, grades)
+            marks are kept as whole tenths, so the average is exact, and
+            the mark column is summed 8 rows at a time (SSE2)
+        - partitions:
+            rows are stored per intake (ID without its last 5 digits), each
+            partition keeps the min/max ID and mark (zone map), so
+            SHOW ALL WHERE INTAKE = 25 AND MARK >= 50 skips other intakes
+            SHOW PARTITIONS
+        - bitmap indexes:
+            one compressed bitmap of IDs per programme and per grade band
+            (A >= 80, B >= 70, C >= 50, F below), so
+            COUNT WHERE PROGRAMME IN ("...", "...") AND GRADE = A
+            is a few bitmap ANDs/ORs instead of a table scan
+        - rankings:
+            SHOW TOP 3 BY MARK [PER PROGRAMME]  (bounded heaps, one pass)
+            RANK ID=<id>  (rank inside the programme, O(log n) index)
+        - query plans:
+            EXPLAIN [ANALYZE] <QUERY / RANK / FIND / COUNT / SHOW ALL / SHOW SUMMARY>
+            (index probe, bitmaps or zone map pruned scan, estimated and real rows)
+            ANALYZE / SHOW STATISTICS  (distinct counts and histograms; WHERE
+            uses them to pick the bitmap indexes or a zone map scan)
         - search:
             FIND NAME "..."       (case-insensitive substring search)
             FIND PROGRAMME "..."  (case-insensitive substring search)
         - CSV import/export:
             IMPORT CSV <file.csv>
             EXPORT CSV <file.csv>
+        - JSON Lines import/export (one SET OUTPUT json object per line):
+            IMPORT JSONL <file.jsonl>
+            EXPORT JSONL <file.jsonl>
         - SQL export:
             EXPORT SQL <file.sql>
+        - sorted export (external merge sort, bounded memory):
+            EXPORT CSV <file.csv> SORT BY MARK DESC, ID
+        - result formats:
+            SET OUTPUT text / tsv / csv / json / binary  (how SHOW ALL, SHOW TOP,
+            FIND and QUERY write their rows)
+            SHOW ID, MARK [WHERE ...] [SORT BY ...], FIND ... COLUMNS ID
+            (only those columns; the others are not read)
+            <query command> INTO <file>  (the rows go into the file)
         - backup:
             BACKUP  (creates timestamped backup of current database file)
+        - command statistics:
+            STATS / STATS RESET  (latency histogram, rows and bytes per command type)
+            TIMING ON / TIMING OFF  (time, cpu time, phases and, on linux, IPC and
+            cache / branch misses per row after every command)
+            TRACE START <file.json> / TRACE STOP  (Chrome trace of commands,
+            file reads, sorts, index growth and worker tasks)
+            SET SLOWLOG <ms> [FILE <path>] / SHOW SLOWLOG  (slow commands
+            with their phases, student data masked)
+            CAPTURE START <file> / CAPTURE STOP, then
+            ./project --replay <file> [--db <database>] [--paced]  (runs the
+            captured commands again and prints their latency distribution)
+        - memory:
+            SHOW MEMORY  (used / reserved / peak bytes of records, indexes and buffers)
+        - test data and benchmarks:
+            GENERATE <rows> [seed]   (realistic made-up students, same seed = same rows)
+            ./project --bench [max rows]  (times every command at 10^3 .. max rows)
+            ./project --stress [seconds] [seed]  (random INSERT / UPDATE / DELETE /
+            QUERY / FIND / SORT / COUNT / EXPORT + IMPORT checked against a shadow
+            copy, ops/s and memory every 10 s)
 
     extra unique feature we added:
         - database password:
           When the program starts, after the declaration, the user must enter
           the correct password, or the CMS program will exit and nothing can be used.
+
+    server mode (linux):
+        - ./project --serve [unix:<path> | tcp:<port>]
+          many clients (see client.c) share one in-memory database,
+          each client logs in with the same database password
+        - records live in copy-on-write chunks; read-only commands work on a
+          snapshot, so exports/backups stay consistent while others write
+
+    multi-core (linux / macOS):
+        - FIND, SHOW SUMMARY, EXPORT and SAVE split the table into chunk
+          ranges and run them on a work-stealing thread pool (one worker per
+          core, CMS_THREADS=<n> to change); results come out in table order
 */
 
 #include <stdio.h>      // printf, fgets, FILE, fopen, etc
@@ -43,6 +112,10 @@
 #include <ctype.h>      // toupper, tolower, isspace
 #include <time.h>       // time, localtime, strftime (for backup + declaration date)
 #include <errno.h>      // errno, strerror (for error messages)
+#include <stdarg.h>     // va_list (for outputPrintf)
+#include <stdatomic.h>  // atomic_int (chunk reference counts shared with snapshots)
+#include <stdint.h>     // uint32_t, uint64_t (sort keys)
+#include <limits.h>     // INT_MIN, INT_MAX (zone maps)
 
 // for windows file path
 #ifdef _WIN32
@@ -57,39 +130,218 @@
     #define PATH_SEP '/'
 #endif
 
+// for the --serve mode (many clients over a local socket, epoll event loop)
+// only linux has epoll, other platforms just get the normal interactive shell
+#ifdef __linux__
+    #include <sys/epoll.h>   // epoll_create1, epoll_ctl, epoll_wait
+    #include <sys/socket.h>  // socket, bind, listen, accept, send, recv
+    #include <sys/un.h>      // sockaddr_un (unix domain socket)
+    #include <netinet/in.h>  // sockaddr_in (tcp on localhost)
+    #include <arpa/inet.h>   // htons, htonl
+    #include <signal.h>      // signal, SIGPIPE, SIGINT, SIGTERM
+    #include <fcntl.h>       // fcntl, O_NONBLOCK
+    #include <poll.h>        // poll (waiting for running jobs at shutdown)
+    #define CMS_HAVE_SERVER 1
+#else
+    #define CMS_HAVE_SERVER 0
+#endif
+
+// hardware counters for TIMING ON and --bench (linux perf events)
+#ifdef __linux__
+    #include <linux/perf_event.h>   // perf_event_attr, PERF_COUNT_HW_*
+    #include <sys/syscall.h>        // SYS_perf_event_open (glibc has no wrapper)
+    #define CMS_HAVE_PERF 1
+#else
+    #define CMS_HAVE_PERF 0
+#endif
+
+// worker threads (thread pool for scans, server jobs); windows runs everything on one thread
+#ifndef _WIN32
+    #include <pthread.h>     // pthread_create, mutexes, condition variables
+    #define CMS_HAVE_THREADS 1
+#else
+    #define CMS_HAVE_THREADS 0
+#endif
+
+// the mark column kernels use SSE2 where every x86-64 compiler has it,
+// other platforms get plain loops (which compilers vectorize on their own)
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>   // _mm_min_epi16, _mm_madd_epi16, ...
+    #define CMS_HAVE_SSE2 1
+#else
+    #define CMS_HAVE_SSE2 0
+#endif
+
+// variables marked CMS_THREAD_LOCAL have one copy per thread
+#ifdef _MSC_VER
+    #define CMS_THREAD_LOCAL __declspec(thread)
+#else
+    #define CMS_THREAD_LOCAL _Thread_local
+#endif
+
 // our group name to show in the prompt and declaration
 #define OUR_GROUP_NAME "P10-4"
 
 // global constants to control lengths of strings
 #define NAME_MAX_LENGTH 128
 #define PROGRAMME_MAX_LENGTH 128
-#define INITIAL_CAPACITY 128
 
 // simple database password
 #define DATABASE_PASSWORD "password"
 #define MAX_PASSWORD_ATTEMPTS 3
 
+/*
+Mark: a mark in tenths (88.8 is stored as 888)
+marks are always shown with one decimal, so tenths keep every mark exact
+(no float rounding surprises, sums and averages come out right) and the
+mark column is half the size it would be with floats.
+text is converted only at the edges: markFromText when reading, markToDouble
+when printing.
+*/
+typedef int16_t Mark;
+#define MARK_LOWEST  (-32767)   // -3276.7
+#define MARK_HIGHEST 32767      //  3276.7
+
 // StudentRecord: represents one row in the StudentRecords table
 typedef struct {
     int   id;                                     // student ID
     char  name[NAME_MAX_LENGTH];                  // student name
     char  programme[PROGRAMME_MAX_LENGTH];        // programme name
-    float mark;                                   // mark
+    Mark  mark;                                   // mark, in tenths
 } StudentRecord;
 
+// how many rows are stored together in one RecordChunk
+#define CHUNK_ROWS 1024
+
+/*
+ZoneMap: smallest and largest ID and mark stored in a chunk or a segment
+scans compare it with a WHERE clause to skip data that cannot match.
+it is kept conservative: DELETE or a lower mark may leave it a bit wider
+than the rows really are, it is made exact again when a segment is compacted.
+(an empty zone has idMin > idMax)
+*/
+typedef struct {
+    int   idMin;
+    int   idMax;
+    Mark  markMin;
+    Mark  markMax;
+} ZoneMap;
+
+// a chunk's first allocation holds this many rows, it doubles up to CHUNK_ROWS
+#define CHUNK_FIRST_ROWS 4
+
+// where one string of a row is kept in its chunk's text (NUL-terminated there)
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} ChunkText;
+
+/*
+RecordChunk: a block of up to CHUNK_ROWS rows, stored column by column
+- refs: how many owners use this chunk (the live table and/or snapshots)
+- used: how many row slots are filled (deleted slots included)
+- capacity: how many row slots the columns have room for (grows by doubling)
+- live: 0 for a slot whose record was deleted
+- zone: ID / mark bounds of the rows in this chunk
+- names / programmes: where each row's strings are in "text"
+- text / textUsed / textCapacity: the strings of all rows, one after another
+- textGarbage: bytes of "text" no row points at any more (old names after UPDATE)
+
+the columns are one allocation and the text another, both only as big as
+the rows in the chunk need, so a small partition stays small.
+
+a chunk with refs > 1 is shared with a snapshot and must never be changed,
+writers make a private copy first (copy-on-write, see studentTableWritableChunk)
+*/
+typedef struct {
+    atomic_int     refs;
+    unsigned       used;
+    unsigned       capacity;
+    unsigned       liveRows;
+    ZoneMap        zone;
+    unsigned char *live;
+    int           *ids;
+    Mark          *marks;
+    ChunkText     *names;
+    ChunkText     *programmes;
+    char          *text;
+    size_t         textUsed;
+    size_t         textCapacity;
+    size_t         textGarbage;
+} RecordChunk;
+
+/*
+TableSegment: the rows of one partition (one intake year by default)
+every student goes to the segment of its partition key (see partitionKeyOf),
+so a query about one cohort only has to look at one segment
+- chunks / chunkCount / chunkCapacity: dynamic array of chunk pointers
+- count: how many records are currently in the segment
+- deletedSlots: slots freed by DELETE, reclaimed by segmentCompact
+- zone: ID / mark bounds of the whole segment
+a row's "slot" is chunk number (inside the segment) * CHUNK_ROWS + offset
+*/
+typedef struct {
+    int key;
+    RecordChunk **chunks;
+    size_t chunkCount;
+    size_t chunkCapacity;
+    size_t count;
+    size_t deletedSlots;
+    ZoneMap zone;
+} TableSegment;
+
 // StudentTable:
-// a simple dynamic array of StudentRecord
-// - records: pointer to heap memory
-// - count: how many records currently used
-// - capacity: how many records allocated
+// the live table, partitioned into segments
+// - segments: in the order they were created (a segment keeps its number)
+// - order: segment numbers sorted by key, this is the table order
+// - count: how many records are currently in the table
 typedef struct {
-    StudentRecord *records;
+    TableSegment *segments;
+    size_t segmentCount;
+    size_t segmentCapacity;
+    size_t *order;
     size_t count;
-    size_t capacity;
 } StudentTable;
 
+// where a row lives in the table: segment number and slot inside it
+typedef struct {
+    int segment;
+    int slot;
+} RowLocation;
+
+// one segment as seen by a snapshot: a run of the snapshot's chunks
+typedef struct {
+    int key;
+    size_t firstChunk;
+    size_t chunkCount;
+    size_t count;
+    ZoneMap zone;
+} SnapshotSegment;
+
+/*
+TableSnapshot: a frozen, read-only view of the whole database
+readers (SHOW ALL, FIND, EXPORT, SAVE, ...) work on a snapshot, so writers
+never wait for them and they never see half-updated records.
+the chunks of all segments are listed one after another (segments in key
+order), so scans can simply split the chunk list between threads.
+the snapshot also remembers which database file was open at that moment.
+*/
+typedef struct {
+    RecordChunk **chunks;
+    size_t chunkCount;
+    size_t count;
+    SnapshotSegment *segments;
+    size_t segmentCount;
+    char databaseFileName[256];
+} TableSnapshot;
+
 // global student table used by the whole program
-static StudentTable studentTable = { NULL, 0, 0 };
+static StudentTable studentTable = { NULL, 0, 0, NULL, 0 };
+
+// partition key of a student: the ID without its last CMS_PARTITION_DIGITS
+// digits (default 5, so 2501234 -> 25, the intake year)
+#define PARTITION_DEFAULT_DIGITS 5
+static int partitionDivisor = 100000;
 
 // remember last opened/saved database file name (the logical name typed by user)
 static char lastDatabaseFileName[256] = { 0 };
@@ -98,1547 +350,13917 @@ static char lastDatabaseFileName[256] = { 0 };
 // used so that exports and backups are placed next to the executable
 static char programDirectoryPath[1024] = { 0 };
 
-// removes whitespace at the start and end of a string
-// whitespace includes space, tab, newline, etc
-// an example: "  hello \n"  ->  "hello"
-static void trimSpaces(char *s)
+// MEMORY ACCOUNTING (SHOW MEMORY)
+/*
+every heap block of the CMS is allocated through memoryAlloc / memoryCalloc /
+memoryRealloc and released with memoryFree, tagged with what it is for.
+each block starts with a small header that remembers its size and tag, so
+the counters per tag always know how many bytes are reserved right now, the
+highest it ever was, and how many blocks there are. SHOW MEMORY prints them
+next to what the data structures really use.
+(the header is counted as well, malloc's own overhead is not)
+*/
+typedef enum {
+    MEMORY_RECORDS,         // record chunks (also old copies still held by snapshots)
+    MEMORY_TABLE,           // segment list and chunk pointer arrays
+    MEMORY_ID_INDEX,        // ID hash index
+    MEMORY_RANK_INDEX,      // ranking treap
+    MEMORY_BITMAPS,         // programme / grade band bitmaps
+    MEMORY_PROGRAMMES,      // programme dictionary
+    MEMORY_SNAPSHOTS,       // snapshots and WHERE views
+    MEMORY_OUTPUT,          // output buffers
+    MEMORY_SORT,            // sort items, radix counts, merge runs
+    MEMORY_QUERY,           // scratch of scans (TOP, FIND, parallel reduce)
+    MEMORY_SERVER,          // client connections and jobs
+    MEMORY_OTHER,           // thread pool, trace rings, benchmark samples
+    MEMORY_KIND_COUNT
+} MemoryKind;
+
+static const char *const memoryKindNames[MEMORY_KIND_COUNT] = {
+    "records", "table arrays", "id index", "rank index", "bitmaps", "programmes",
+    "snapshots", "output buffers", "sort buffers", "query buffers", "server", "other"
+};
+
+typedef struct {
+    atomic_ullong bytes;
+    atomic_ullong peakBytes;
+    atomic_ullong blocks;
+} MemoryCounter;
+
+static MemoryCounter memoryCounters[MEMORY_KIND_COUNT];
+static MemoryCounter memoryTotal;   // all kinds together (its peak is not the sum of theirs)
+
+// in front of every block; a union keeps the block itself aligned for any type
+typedef union {
+    struct {
+        size_t size;
+        MemoryKind kind;
+    } block;
+    long double alignLongDouble;
+    void *alignPointer;
+    uint64_t alignInteger;
+} MemoryHeader;
+
+static void memoryCounterAdd(MemoryCounter *counter, size_t bytes, int blocks)
 {
-    // first, trim leading spaces
-    size_t i = 0;
-    while (s[i] && isspace((unsigned char)s[i])) {
-        i++;
-    }
-    if (i > 0) {
-        // shift the string to the left to remove the leading spaces
-        memmove(s, s + i, strlen(s + i) + 1);
+    unsigned long long now =
+        atomic_fetch_add_explicit(&counter->bytes, bytes, memory_order_relaxed) + bytes;
+    if (blocks) {
+        atomic_fetch_add_explicit(&counter->blocks, 1, memory_order_relaxed);
     }
 
-    // then, trim trailing spaces
-    int j = (int)strlen(s) - 1;
-    while (j >= 0 && isspace((unsigned char)s[j])) {
-        s[j] = '\0';
-        j--;
+    unsigned long long peak = atomic_load_explicit(&counter->peakBytes, memory_order_relaxed);
+    while (now > peak &&
+           !atomic_compare_exchange_weak_explicit(&counter->peakBytes, &peak, now,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
     }
 }
 
-// compare two strings after making it all lowercase so case dont matter
-static int equalsIgnoreCase(const char *a, const char *b)
+static void memoryCounterSub(MemoryCounter *counter, size_t bytes, int blocks)
 {
-    while (*a && *b) {
-        if (tolower((unsigned char)*a) != tolower((unsigned char)*b)) {
-            return 0;
-        }
-        a++;
-        b++;
+    atomic_fetch_sub_explicit(&counter->bytes, bytes, memory_order_relaxed);
+    if (blocks) {
+        atomic_fetch_sub_explicit(&counter->blocks, 1, memory_order_relaxed);
     }
-    return (*a == '\0' && *b == '\0');
 }
 
-// check if "needle" is inside "haystack", ignoring case.
-// used for FIND NAME and FIND PROGRAMME.
-// returns pointer to first match inside haystack, or NULL if not found.
-static const char *containsIgnoreCase(const char *haystack, const char *needle)
+static void memoryCount(MemoryKind kind, size_t bytes, int blocks)
 {
-    if (!*needle) {
-        return haystack;    // empty needle always "found" at start
-    }
+    memoryCounterAdd(&memoryCounters[kind], bytes, blocks);
+    memoryCounterAdd(&memoryTotal, bytes, blocks);
+}
 
-    size_t needleLength = strlen(needle);
+static void memoryUncount(MemoryKind kind, size_t bytes, int blocks)
+{
+    memoryCounterSub(&memoryCounters[kind], bytes, blocks);
+    memoryCounterSub(&memoryTotal, bytes, blocks);
+}
 
-    for (const char *p = haystack; *p; ++p) {
-        size_t i = 0;
-        while (i < needleLength && p[i] && 
-               tolower((unsigned char)p[i]) == tolower((unsigned char)needle[i])) {
-            i++;
-        }
-        if (i == needleLength) {
-            return p;       // found full needle
-        }
+/*
+malloc that counts the block under "kind"
+returns NULL if there is no memory (like malloc)
+*/
+static void *memoryAlloc(MemoryKind kind, size_t size)
+{
+    if (size > (size_t)-1 - sizeof(MemoryHeader)) {
+        return NULL;
     }
-    return NULL;
+
+    MemoryHeader *header = (MemoryHeader *)malloc(sizeof(MemoryHeader) + size);
+    if (!header) {
+        return NULL;
+    }
+    header->block.size = size;
+    header->block.kind = kind;
+    memoryCount(kind, sizeof(MemoryHeader) + size, 1);
+    return header + 1;
 }
 
-// from a full path, extract only the file name without extension.
-// e.g.  "/a/b/db.txt" -> "db"
-static void getFileNameStem(const char *path, char *out, size_t outSize)
+static void *memoryCalloc(MemoryKind kind, size_t count, size_t size)
 {
-    const char *slash1 = strrchr(path, '/');
-    const char *slash2 = strrchr(path, '\\');
-    const char *slash = slash1 ? (slash2 && slash2 > slash1 ? slash2 : slash1) : slash2;
+    if (size && count > ((size_t)-1 - sizeof(MemoryHeader)) / size) {
+        return NULL;
+    }
 
-    const char *baseName = slash ? slash + 1 : path;
-    const char *dot = strrchr(baseName, '.');
+    void *memory = memoryAlloc(kind, count * size);
+    if (memory) {
+        memset(memory, 0, count * size);
+    }
+    return memory;
+}
 
-    size_t length = dot ? (size_t)(dot - baseName) : strlen(baseName);
-    if (length >= outSize) {
-        length = outSize - 1;
+/*
+realloc for blocks from memoryAlloc (a NULL block is allocated under "kind";
+an existing block keeps the kind it was allocated with)
+*/
+static void *memoryRealloc(MemoryKind kind, void *memory, size_t size)
+{
+    if (!memory) {
+        return memoryAlloc(kind, size);
+    }
+    if (size > (size_t)-1 - sizeof(MemoryHeader)) {
+        return NULL;
     }
 
-    memcpy(out, baseName, length);
-    out[length] = '\0';
+    MemoryHeader *header = (MemoryHeader *)memory - 1;
+    size_t oldSize = header->block.size;
+    kind = header->block.kind;
+
+    MemoryHeader *grown = (MemoryHeader *)realloc(header, sizeof(MemoryHeader) + size);
+    if (!grown) {
+        return NULL;
+    }
+    grown->block.size = size;
+    if (size >= oldSize) {
+        memoryCount(kind, size - oldSize, 0);
+    } else {
+        memoryUncount(kind, oldSize - size, 0);
+    }
+    return grown + 1;
 }
 
-// check if a path is relative or absolute
-// for windows: - treat "C:\..." or "\something" or "/something" as absolute
-// for linux/macOS: - treat "/something" as absolute
-static int isPathRelative(const char *p)
+static void memoryFree(void *memory)
 {
-#ifdef _WIN32
-    if (strlen(p) >= 2 && p[1] == ':') return 0;    // "C:\..."
-    if (p[0] == '\\' || p[0] == '/') return 0;      // "\foo" or "/foo"
-    return 1;
-#else
-    return p[0] != '/';
-#endif
+    if (!memory) {
+        return;
+    }
+
+    MemoryHeader *header = (MemoryHeader *)memory - 1;
+    memoryUncount(header->block.kind, sizeof(MemoryHeader) + header->block.size, 1);
+    free(header);
 }
 
-// this function is to build "dir/filename" or "dir\filename" safely
-static void joinPath(char *out, size_t outSize, const char *dir, const char *file)
+#if CMS_HAVE_SERVER
+// a counted copy of a string (the command lines queued by --serve)
+static char *memoryStrdup(MemoryKind kind, const char *text)
 {
-    size_t dirLength = strlen(dir);
-    int needSeparator = (dirLength > 0 && dir[dirLength - 1] != PATH_SEP);
+    size_t length = strlen(text) + 1;
+    char *copy = (char *)memoryAlloc(kind, length);
+    if (copy) {
+        memcpy(copy, text, length);
+    }
+    return copy;
+}
+#endif
 
-    if (needSeparator) {
-        snprintf(out, outSize, "%s%c%s", dir, PATH_SEP, file);
-    } else {
-        snprintf(out, outSize, "%s%s", dir, file);
+// OUTPUT BUFFER
+/*
+every command writes its output through outputPrintf() instead of printf()
+so the same command code can answer the local terminal or a socket client.
+
+    - data/length/capacity: growable text buffer
+    - sink: if set (e.g. stdout), the buffer is written there on flush,
+            if NULL the text stays in memory (server mode sends it later)
+*/
+typedef struct {
+    char  *data;
+    size_t length;
+    size_t capacity;
+    FILE  *sink;
+} OutputBuffer;
+
+// flush the buffer to its sink once it grows past this many bytes
+#define OUTPUT_FLUSH_THRESHOLD (64 * 1024)
+
+// the buffer that outputPrintf() currently writes into
+// (per thread: server commands may run on worker threads)
+static CMS_THREAD_LOCAL OutputBuffer *currentOutput = NULL;
+
+// the steps of OPEN / IMPORT and of SAVE / EXPORT / SHOW ALL that TIMING ON shows
+typedef enum {
+    PHASE_READ,
+    PHASE_PARSE,
+    PHASE_INSERT,
+    PHASE_SORT,
+    PHASE_MERGE,
+    PHASE_FORMAT,
+    PHASE_WRITE,
+    PHASE_COUNT
+} CommandPhase;
+
+static const char *const commandPhaseNames[PHASE_COUNT] = {
+    "read", "parse", "insert", "sort", "merge", "format", "write"
+};
+
+/*
+what the running command did, for STATS (see COMMAND STATISTICS) and TIMING
+    - rows        : rows it read or changed
+    - bytesRead   : bytes read from files
+    - bytesWritten: bytes written to files or sent as output
+    - timePhases  : 1 if phaseLap should measure (TIMING ON), the time per
+                    phase goes to phaseNanoseconds
+only the thread that runs the command counts (currentCounters is NULL elsewhere)
+*/
+typedef struct {
+    uint64_t rows;
+    uint64_t bytesRead;
+    uint64_t bytesWritten;
+    int timePhases;
+    uint64_t phaseNanoseconds[PHASE_COUNT];
+} CommandCounters;
+
+static CMS_THREAD_LOCAL CommandCounters *currentCounters = NULL;
+
+static void countRows(uint64_t rows)
+{
+    if (currentCounters) {
+        currentCounters->rows += rows;
     }
 }
 
-// find the directory where the executable (.exe) is located
-// windows: Use GetModuleFileNameA to get full path of program, then cut off file name
-// on linux/macOS: use readlink("/proc/self/exe", ...) to get full path, then cut off file name
-static void fillProgramDirectoryPath(char *out, size_t outSize)
+static void countBytesRead(uint64_t bytes)
 {
-#ifdef _WIN32
-    char buffer[1024];
-    DWORD length = GetModuleFileNameA(NULL, buffer, (DWORD)sizeof(buffer));
-    if (length == 0 || length >= sizeof(buffer)) {
-        out[0] = '\0';
-        return;
+    if (currentCounters) {
+        currentCounters->bytesRead += bytes;
     }
+}
 
-    char *lastSlash = strrchr(buffer, '\\');
-    if (lastSlash) {
-        *lastSlash = '\0';     // remove "\program.exe"
+static void countBytesWritten(uint64_t bytes)
+{
+    if (currentCounters) {
+        currentCounters->bytesWritten += bytes;
     }
+}
 
-    strncpy(out, buffer, outSize - 1);
-    out[outSize - 1] = '\0';
-#else
-    char buffer[PATH_MAX];
-    ssize_t length = readlink("/proc/self/exe", buffer, sizeof(buffer) - 1);
-    if (length <= 0) {
-        out[0] = '\0';
+// make sure there is room for "extra" more bytes (plus a '\0')
+static void outputReserve(OutputBuffer *out, size_t extra)
+{
+    if (out->length + extra + 1 <= out->capacity) {
         return;
     }
 
-    buffer[length] = '\0';
-    char *lastSlash = strrchr(buffer, '/');
-    if (lastSlash) {
-        *lastSlash = '\0';     // remove "/program"
+    size_t newCapacity = out->capacity ? out->capacity : 4096;
+    while (newCapacity < out->length + extra + 1) {
+        newCapacity *= 2;
     }
 
-    strncpy(out, buffer, outSize - 1);
-    out[outSize - 1] = '\0';
-#endif
+    char *newMemory = (char *)memoryRealloc(MEMORY_OUTPUT, out->data, newCapacity);
+    if (!newMemory) {
+        fprintf(stderr, "CMS: Out of memory when growing output buffer.\n");
+        exit(1);
+    }
+    out->data = newMemory;
+    out->capacity = newCapacity;
 }
 
-// convert string to int safely using strtol
-static int stringToInt(const char *s, int *out)
+// write everything in the buffer to its sink (does nothing for in-memory buffers)
+static void outputFlush(OutputBuffer *out)
 {
-    char *end = NULL;
-    long value = strtol(s, &end, 10);
-    if (s == end) {
-        return 0;   // no digits found
+    if (!out->sink) {
+        return;
     }
-    *out = (int)value;
-    return 1;
+    if (out->length) {
+        fwrite(out->data, 1, out->length, out->sink);
+        countBytesWritten(out->length);
+        out->length = 0;
+    }
+    fflush(out->sink);
 }
 
-// convert string to float safely using strtof
-static int stringToFloat(const char *s, float *out)
+// append raw bytes to a given output buffer
+static void outputAppend(OutputBuffer *out, const char *data, size_t length)
 {
-    char *end = NULL;
-    float value = strtof(s, &end);
-    if (s == end) {
-        return 0;   // no digits found
+    outputReserve(out, length);
+    memcpy(out->data + out->length, data, length);
+    out->length += length;
+    out->data[out->length] = '\0';
+
+    if (out->sink && out->length >= OUTPUT_FLUSH_THRESHOLD) {
+        outputFlush(out);
     }
-    *out = value;
-    return 1;
 }
 
-/*
-from a command string like the following:
-    "INSERT ID=2301234 Name=\"Brian\" Programme=\"Digital Supply Chain\" Mark=88.8"
-    extract the value after a given key (e.g. "ID", "Name", "Programme", "Mark")
-    - supports values with spaces if quoted using double quotes
-    - case-insensitive for the key
-returns:
-    1 if key found and value extracted, 0 if not found or invalid
-*/
-static int readKeyValueFromCommand(const char *src,
-                                   const char *key,
-                                   char *out,
-                                   size_t outLen)
+// append raw bytes to the current output
+static void outputWrite(const char *data, size_t length)
 {
-    const char *p = src;
-    size_t keyLength = strlen(key);
+    outputAppend(currentOutput, data, length);
+}
 
-    while ((p = containsIgnoreCase(p, key))) {
-        // makes sure character before key is space (or start of string)
-        if (p != src && !isspace((unsigned char)p[-1])) {
-            p++;
-            continue;
-        }
+// same as puts(): the text plus a newline
+static void outputPuts(const char *text)
+{
+    outputWrite(text, strlen(text));
+    outputWrite("\n", 1);
+}
 
-        // move to the position after key, skip spaces
-        const char *eq = p + keyLength;
-        while (*eq && isspace((unsigned char)*eq)) {
-            eq++;
+// printf() into a given output buffer (args as a va_list)
+static void outputFormatV(OutputBuffer *out, const char *format, va_list args)
+{
+    va_list retryArgs;
+    va_copy(retryArgs, args);
+
+    // first try to format straight into the free space
+    outputReserve(out, 256);
+    int needed = vsnprintf(out->data + out->length, out->capacity - out->length, format, args);
+
+    if (needed >= 0) {
+        // did not fit, grow and format again
+        if ((size_t)needed >= out->capacity - out->length) {
+            outputReserve(out, (size_t)needed);
+            vsnprintf(out->data + out->length, out->capacity - out->length, format, retryArgs);
         }
 
-        if (*eq != '=') {
-            p++;
-            continue;   // not really a "key=" pattern
-        }
+        out->length += (size_t)needed;
 
-        eq++;   // skip '='
-
-        // skip spaces after '='
-        while (*eq && isspace((unsigned char)*eq)) {
-            eq++;
+        if (out->sink && out->length >= OUTPUT_FLUSH_THRESHOLD) {
+            outputFlush(out);
         }
+    }
 
-        // if first character is a quote, read until closing quote
-        if (*eq == '"') {
-            eq++;   // skip opening quote
-            const char *end = strchr(eq, '"');
-            if (!end) {
-                return 0;   // no closing quote
-            }
+    va_end(retryArgs);
+}
 
-            size_t len = (size_t)(end - eq);
-            if (len >= outLen) {
-                len = outLen - 1;
-            }
+// printf() into a given output buffer
+static void outputAppendPrintf(OutputBuffer *out, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    outputFormatV(out, format, args);
+    va_end(args);
+}
 
-            memcpy(out, eq, len);
-            out[len] = '\0';
-            return 1;
-        } else {
-            // unquoted value: read until next whitespace
-            size_t i = 0;
-            while (*eq && !isspace((unsigned char)*eq) && i + 1 < outLen) {
-                out[i++] = *eq++;
-            }
-            out[i] = '\0';
-            return i > 0;
-        }
+// same as printf(), but into the current output buffer
+static void outputPrintf(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    outputFormatV(currentOutput, format, args);
+    va_end(args);
+}
+
+// release the memory of an output buffer
+static void outputFree(OutputBuffer *out)
+{
+    memoryFree(out->data);
+    out->data = NULL;
+    out->length = 0;
+    out->capacity = 0;
+}
+
+// a clock for measuring how long something took, in nanoseconds
+// (monotonic: it never jumps when the wall clock is changed)
+static uint64_t monotonicNanoseconds(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER now;
+    if (!frequency.QuadPart) {
+        QueryPerformanceFrequency(&frequency);
     }
+    QueryPerformanceCounter(&now);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+#endif
+}
 
-    return 0;
+// CPU time used so far by the whole process (all threads), in nanoseconds
+static uint64_t processCpuNanoseconds(void)
+{
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) {
+        return 0;
+    }
+    uint64_t kernelTime = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+    uint64_t userTime = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+    return (kernelTime + userTime) * 100;   // FILETIME counts 100 ns steps
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+#endif
 }
 
-// find student by ID in the global studentTable
-static int findIndexById(int id)
+// HARDWARE COUNTERS (TIMING ON, --bench)
+/*
+cycles, instructions, last level cache misses and branch misses, read with
+perf_event_open (linux). every thread that runs command work (the command
+thread and the pool workers) opens its own counters the first time it is
+needed after perfEnable(); perfRead adds up the calling thread's counters and
+the pool workers', so what a command cost is the difference of two reads,
+wherever its scans ran, without the work of other clients' command threads.
+a thread that ends (a server job) closes its counters (perfThreadDetach).
+containers and locked-down kernels often refuse perf events: then
+perfAvailable() is 0 and perfUnavailableReason() says why. an event the
+cpu cannot count (common in VMs) is left out on its own.
+*/
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_EVENT_COUNT
+} PerfEvent;
+
+typedef struct {
+    uint64_t values[PERF_EVENT_COUNT];
+    int have[PERF_EVENT_COUNT];     // 0: the event is not counted
+} PerfCounts;
+
+#if CMS_HAVE_PERF
+
+// the counters of one thread (-1: event not available)
+typedef struct PerfThread {
+    int fds[PERF_EVENT_COUNT];
+    int poolWorker;                 // counted in every perfRead
+    struct PerfThread *next;
+} PerfThread;
+
+static struct {
+    atomic_int wanted;              // perfEnable() was called
+    int state;                      // 0 not tried yet, 1 counting, -1 refused
+    int error;                      // errno of the refusal
+    PerfThread *threads;
+    pthread_mutex_t lock;
+} perf = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static CMS_THREAD_LOCAL int perfAttached = 0;
+static CMS_THREAD_LOCAL PerfThread *perfOwnThread = NULL;
+
+static pthread_key_t perfThreadKey;
+static pthread_once_t perfThreadKeyOnce = PTHREAD_ONCE_INIT;
+
+// runs when a thread with counters ends (e.g. a server job): close and forget them
+static void perfThreadDetach(void *node)
 {
-    for (size_t i = 0; i < studentTable.count; ++i) {
-        if (studentTable.records[i].id == id) {
-            return (int)i;
+    PerfThread *thread = (PerfThread *)node;
+    pthread_mutex_lock(&perf.lock);
+    for (PerfThread **link = &perf.threads; *link; link = &(*link)->next) {
+        if (*link == thread) {
+            *link = thread->next;
+            break;
         }
     }
-    return -1;
+    pthread_mutex_unlock(&perf.lock);
+
+    for (int e = 0; e < PERF_EVENT_COUNT; ++e) {
+        if (thread->fds[e] >= 0) {
+            close(thread->fds[e]);
+        }
+    }
+    memoryFree(thread);
 }
 
-// allocate initial memory for the student table.
-// - set capacity to INITIAL_CAPACITY
-// - set count to 0
-// - allocate memory for that many StudentRecord
-static void studentTableInit(StudentTable *table)
+static void perfThreadKeyCreate(void)
 {
-    table->capacity = INITIAL_CAPACITY;
-    table->count = 0;
-    table->records = (StudentRecord *)malloc(table->capacity * sizeof(StudentRecord));
-    if (!table->records) {
-        fprintf(stderr, "CMS: Out of memory when creating student table.\n");
-        exit(1);
-    }
+    pthread_key_create(&perfThreadKey, perfThreadDetach);
 }
 
-// free all memory used by the student table. (calls this at program end)
-static void studentTableFree(StudentTable *table)
+static int perfOpenEvent(uint64_t config)
 {
-    free(table->records);
-    table->records = NULL;
-    table->count = 0;
-    table->capacity = 0;
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1;        // allowed with the default perf_event_paranoid
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
 }
 
-// make sure there is space for at least one more student record
-// if full, double the capacity using realloc
-static void ensureStudentTableCapacity(StudentTable *table)
+// open the counters of the calling thread (once, and only after perfEnable)
+// poolWorker: set for a thread pool worker, whose counters every read includes
+static void perfAttachThisThread(int poolWorker)
 {
-    if (table->count >= table->capacity) {
-        table->capacity *= 2;
-        StudentRecord *newMemory =
-            (StudentRecord *)realloc(table->records, table->capacity * sizeof(StudentRecord));
-        if (!newMemory) {
-            fprintf(stderr, "CMS: Out of memory when expanding student table.\n");
-            exit(1);
+    if (perfAttached || !atomic_load_explicit(&perf.wanted, memory_order_relaxed)) {
+        return;
+    }
+    perfAttached = 1;
+    pthread_once(&perfThreadKeyOnce, perfThreadKeyCreate);
+
+    static const uint64_t configs[PERF_EVENT_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    pthread_mutex_lock(&perf.lock);
+    if (perf.state >= 0) {
+        PerfThread *thread = (PerfThread *)memoryAlloc(MEMORY_OTHER, sizeof(PerfThread));
+        int opened = 0;
+        int error = 0;
+        for (int e = 0; thread && e < PERF_EVENT_COUNT; ++e) {
+            thread->fds[e] = perfOpenEvent(configs[e]);
+            if (thread->fds[e] >= 0) {
+                opened++;
+            } else if (!error) {
+                error = errno;
+            }
+        }
+
+        if (opened) {
+            perf.state = 1;
+            thread->poolWorker = poolWorker;
+            thread->next = perf.threads;
+            perf.threads = thread;
+            perfOwnThread = thread;
+        } else {
+            memoryFree(thread);
+            if (perf.state == 0) {
+                perf.state = -1;
+                perf.error = thread ? error : ENOMEM;
+            }
         }
-        table->records = newMemory;
+    }
+    pthread_mutex_unlock(&perf.lock);
+    if (perfOwnThread) {
+        pthread_setspecific(perfThreadKey, perfOwnThread);
     }
 }
 
-// insert a new student record into the table, if ID is not duplicated
-static int addStudentRecord(int id,
-                            const char *name,
-                            const char *programme,
-                            float mark)
+// start counting (TIMING ON, --bench); threads join in as they run work
+static void perfEnable(void)
 {
-    // Check duplicate ID
-    if (findIndexById(id) != -1) {
-        return 0; // a record with the same ID already exists
+    atomic_store(&perf.wanted, 1);
+    perfAttachThisThread(0);
+}
+
+static int perfAvailable(void)
+{
+    pthread_mutex_lock(&perf.lock);
+    int available = perf.state == 1;
+    pthread_mutex_unlock(&perf.lock);
+    return available;
+}
+
+static void perfUnavailableReason(char *text, size_t size)
+{
+    snprintf(text, size, "perf_event_open: %s%s", strerror(perf.error),
+             perf.error == EACCES || perf.error == EPERM ? " (see kernel.perf_event_paranoid)" : "");
+}
+
+// the counts of the calling thread and the pool workers added up
+// (scaled if the kernel had to multiplex)
+static void perfRead(PerfCounts *counts)
+{
+    memset(counts, 0, sizeof(*counts));
+    perfAttachThisThread(0);
+
+    pthread_mutex_lock(&perf.lock);
+    for (const PerfThread *thread = perf.threads; thread; thread = thread->next) {
+        if (thread != perfOwnThread && !thread->poolWorker) {
+            continue;
+        }
+        for (int e = 0; e < PERF_EVENT_COUNT; ++e) {
+            uint64_t reading[3];    // value, time enabled, time running
+            if (thread->fds[e] < 0 || read(thread->fds[e], reading, sizeof(reading)) != sizeof(reading)) {
+                continue;
+            }
+            if (reading[2]) {
+                counts->values[e] += reading[2] < reading[1]
+                    ? (uint64_t)((double)reading[0] * (double)reading[1] / (double)reading[2])
+                    : reading[0];
+            }
+            counts->have[e] = 1;
+        }
     }
+    pthread_mutex_unlock(&perf.lock);
+}
 
-    // fill in a StudentRecord struct
-    StudentRecord newStudent;
-    newStudent.id = id;
-    newStudent.mark = mark;
+#else
 
-    strncpy(newStudent.name, name ? name : "", NAME_MAX_LENGTH - 1);
-    newStudent.name[NAME_MAX_LENGTH - 1] = '\0';
+static void perfAttachThisThread(int poolWorker)
+{
+    (void)poolWorker;
+}
 
-    strncpy(newStudent.programme, programme ? programme : "", PROGRAMME_MAX_LENGTH - 1);
-    newStudent.programme[PROGRAMME_MAX_LENGTH - 1] = '\0';
+static void perfEnable(void)
+{
+}
 
-    // ensure we have capacity, then append record
-    ensureStudentTableCapacity(&studentTable);
-    studentTable.records[studentTable.count++] = newStudent;
+static int perfAvailable(void)
+{
+    return 0;
+}
 
-    return 1; // record inserted successfully
+static void perfUnavailableReason(char *text, size_t size)
+{
+    snprintf(text, size, "perf events only exist on linux");
 }
 
-// get a pointer to the StudentRecord with the given ID
-// returns the pointer to StudentRecord if found, or NULL if not found
-static StudentRecord *getStudentRecordById(int id)
+static void perfRead(PerfCounts *counts)
 {
-    int index = findIndexById(id);
-    return (index == -1) ? NULL : &studentTable.records[index];
+    memset(counts, 0, sizeof(*counts));
 }
 
-/*
-update only the fields that the user provided
-parameters:
-    id         : student ID to update
-    newName    : new name or NULL (if not updating name)
-    newProgramme: new programme or NULL
-    newMarkPtr : pointer to new mark, or NULL if not updating mark
+#endif
 
-returns:
-        1 if record updated successfully
-        0 if record with given ID does not exist
+/*
+the difference of two perfRead results as text, e.g.
+"IPC 1.92, LLC misses 0.41 per row, branch misses 1.20 per row"
+(per row only if rows > 0, otherwise the totals)
+returns 0 (and an empty text) if nothing was counted
 */
-static int updateStudentRecord(int id,
-                               const char *newName,
-                               const char *newProgramme,
-                               const float *newMarkPtr)
+static int perfDescribe(const PerfCounts *before, const PerfCounts *after, uint64_t rows,
+                        char *text, size_t size)
 {
-    int index = findIndexById(id);
-    if (index == -1) {
-        return 0;
+    uint64_t spent[PERF_EVENT_COUNT];
+    for (int e = 0; e < PERF_EVENT_COUNT; ++e) {
+        spent[e] = after->have[e] && after->values[e] > before->values[e]
+                       ? after->values[e] - before->values[e] : 0;
     }
 
-    if (newName) {
-        strncpy(studentTable.records[index].name, newName, NAME_MAX_LENGTH - 1);
-        studentTable.records[index].name[NAME_MAX_LENGTH - 1] = '\0';
+    size_t length = 0;
+    text[0] = '\0';
+    if (after->have[PERF_CYCLES]) {
+        length += (size_t)snprintf(text + length, size - length, "%.2f M cycles",
+                                   (double)spent[PERF_CYCLES] / 1e6);
     }
-
-    if (newProgramme) {
-        strncpy(studentTable.records[index].programme, newProgramme, PROGRAMME_MAX_LENGTH - 1);
-        studentTable.records[index].programme[PROGRAMME_MAX_LENGTH - 1] = '\0';
+    if (after->have[PERF_INSTRUCTIONS] && length < size) {
+        length += (size_t)snprintf(text + length, size - length, "%s%.2f M instructions",
+                                   length ? ", " : "", (double)spent[PERF_INSTRUCTIONS] / 1e6);
+        if (after->have[PERF_CYCLES] && spent[PERF_CYCLES] && length < size) {
+            length += (size_t)snprintf(text + length, size - length, " (IPC %.2f)",
+                                       (double)spent[PERF_INSTRUCTIONS] / (double)spent[PERF_CYCLES]);
+        }
     }
 
-    if (newMarkPtr) {
-        studentTable.records[index].mark = *newMarkPtr;
+    static const char *const missNames[] = { "LLC misses", "branch misses" };
+    for (int m = 0; m < 2; ++m) {
+        int e = m == 0 ? PERF_LLC_MISSES : PERF_BRANCH_MISSES;
+        if (!after->have[e] || length >= size) {
+            continue;
+        }
+        if (rows) {
+            length += (size_t)snprintf(text + length, size - length, "%s%s %.2f per row",
+                                       length ? ", " : "", missNames[m], (double)spent[e] / (double)rows);
+        } else {
+            length += (size_t)snprintf(text + length, size - length, "%s%s %llu",
+                                       length ? ", " : "", missNames[m], (unsigned long long)spent[e]);
+        }
     }
-
-    return 1;
+    return length > 0;
 }
 
 /*
-remove a student record with the given ID
-internally, we shift all later records left by one
+phase timing (TIMING ON): a function that has phases does
+    uint64_t phase = phaseStart();
+    ... read ...
+    phaseLap(PHASE_READ, &phase);
+    ... parse ...
+    phaseLap(PHASE_PARSE, &phase);
+when phases are not measured phaseStart gives 0 and phaseLap does nothing,
+so there is no clock call per row unless someone asked for it
+(TIMING ON or a running TRACE)
 */
-static int deleteStudentRecord(int id)
+static uint64_t phaseStart(void)
 {
-    int index = findIndexById(id);
-    if (index == -1) {
-        return 0; //if record not found
-    }
+    return currentCounters && currentCounters->timePhases ? monotonicNanoseconds() : 0;
+}
 
-    // Shift every record after "index" one step to the left
-    for (size_t i = (size_t)index + 1; i < studentTable.count; ++i) {
-        studentTable.records[i - 1] = studentTable.records[i];
+// charge the time since *since to "phase", the next phase starts now
+static void phaseLap(CommandPhase phase, uint64_t *since)
+{
+    if (*since) {
+        uint64_t now = monotonicNanoseconds();
+        currentCounters->phaseNanoseconds[phase] += now - *since;
+        *since = now;
     }
-
-    studentTable.count--;
-    return 1; //if deleted successfully,
 }
 
-
+// TRACING (TRACE START / TRACE STOP)
 /*
-try to open a file for reading
+TRACE START <file> records what the CMS is doing as Chrome trace-event JSON
+(open the file in chrome://tracing or ui.perfetto.dev) until TRACE STOP.
+a span is one finished piece of work, measured like this:
+    uint64_t span = traceBegin();
+    ... work ...
+    traceEnd(span, "sort", "%zu rows", count);
+while nobody traces, traceBegin gives 0 and traceEnd returns at once.
+
+every thread writes its spans into a ring of its own (one writer, one reader,
+no locks on the way); a flusher thread empties all rings into the file every
+TRACE_FLUSH_MILLISECONDS, so traced code never waits for the disk. a span
+that finds its ring full is dropped and counted instead.
+without threads (windows) the rings are emptied after every command.
+*/
+#define TRACE_RING_EVENTS 4096          // per thread, a power of two
+#define TRACE_FLUSH_MILLISECONDS 20
+#define TRACE_DETAIL_LENGTH 64
 
-1. try the name exactly as the user typed.
-2. if fail and the name is relative, also try "<programDirectoryPath>/<name>".
+typedef struct {
+    const char *name;                   // a string literal
+    uint64_t start;                     // monotonicNanoseconds
+    uint64_t duration;
+    unsigned session;                   // the TRACE START it belongs to
+    char detail[TRACE_DETAIL_LENGTH];   // shown as "args", may be empty
+} TraceEvent;
+
+typedef struct TraceRing {
+    TraceEvent events[TRACE_RING_EVENTS];
+    atomic_size_t head;                 // next event the owner writes
+    atomic_size_t tail;                 // next event the flusher reads
+    atomic_int abandoned;               // the owner thread ended, another thread may take it
+    unsigned threadNumber;              // "tid" in the trace
+    struct TraceRing *next;
+} TraceRing;
+
+static struct {
+    atomic_uint session;                // 0 while not tracing
+    unsigned lastSession;
+    FILE *file;
+    uint64_t origin;                    // TRACE START time, ts 0 in the file
+    int wroteEvent;                     // for the commas between events
+    unsigned long long written;
+    atomic_ullong dropped;
+    TraceRing *rings;                   // every ring made so far, rings are reused, not freed
+    unsigned ringCount;
+#if CMS_HAVE_THREADS
+    pthread_mutex_t lock;               // rings list and file
+    pthread_cond_t wakeFlusher;
+    pthread_t flusher;
+    int flusherRunning;
+    int stopFlusher;
+#endif
+} tracer = {
+#if CMS_HAVE_THREADS
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wakeFlusher = PTHREAD_COND_INITIALIZER
+#else
+    .lastSession = 0
+#endif
+};
 
-parameters:
-    fileName   : what user typed
-    actualUsed : will point to the path that successfully opened (for debug, if needed)
-*/
-static FILE *openFileForReadSearch(const char *fileName, const char **actualUsed)
+static CMS_THREAD_LOCAL TraceRing *traceOwnRing = NULL;
+
+#if CMS_HAVE_THREADS
+static pthread_key_t traceRingKey;
+static pthread_once_t traceRingKeyOnce = PTHREAD_ONCE_INIT;
+
+// runs when a thread that traced ends (e.g. a server job): its ring becomes free
+static void traceRingAbandon(void *ring)
 {
-    FILE *fp = fopen(fileName, "r");
-    *actualUsed = fileName;
+    atomic_store(&((TraceRing *)ring)->abandoned, 1);
+}
 
-    if (!fp && isPathRelative(fileName) && programDirectoryPath[0]) {
-        static char alternativePath[1024];
-        joinPath(alternativePath, sizeof(alternativePath), programDirectoryPath, fileName);
+static void traceRingKeyCreate(void)
+{
+    pthread_key_create(&traceRingKey, traceRingAbandon);
+}
+#endif
 
-        fp = fopen(alternativePath, "r");
-        if (fp) {
-            *actualUsed = alternativePath;
+// the ring of the calling thread (NULL if there is no memory for one)
+static TraceRing *traceThisRing(void)
+{
+    if (traceOwnRing) {
+        return traceOwnRing;
+    }
+
+#if CMS_HAVE_THREADS
+    pthread_once(&traceRingKeyOnce, traceRingKeyCreate);
+    pthread_mutex_lock(&tracer.lock);
+#endif
+    TraceRing *ring = tracer.rings;
+    int expected = 1;
+    while (ring && !atomic_compare_exchange_strong(&ring->abandoned, &expected, 0)) {
+        expected = 1;
+        ring = ring->next;
+    }
+    if (!ring) {
+        ring = (TraceRing *)memoryCalloc(MEMORY_OTHER, 1, sizeof(TraceRing));
+        if (ring) {
+            ring->threadNumber = ++tracer.ringCount;
+            ring->next = tracer.rings;
+            tracer.rings = ring;
         }
     }
+#if CMS_HAVE_THREADS
+    pthread_mutex_unlock(&tracer.lock);
+    if (ring) {
+        pthread_setspecific(traceRingKey, ring);
+    }
+#endif
 
-    return fp; //if opened successfully
+    traceOwnRing = ring;
+    return ring;
 }
 
-/*
-open a file for writing. if the file name is relative, we write it into
-the same folder as the .exe / if absolute, use as it is.
+static uint64_t traceBegin(void)
+{
+    return atomic_load_explicit(&tracer.session, memory_order_relaxed) ? monotonicNanoseconds() : 0;
+}
 
-parameters:
-    fileName      : logical file name (e.g. "P10-4-CMS.txt" or "output.csv")
-    actualPathOut : buffer to store actual full path
-    pathCapacity  : size of buffer
+/*
+record the span that started at "start" (from traceBegin)
+    name        : a string literal, e.g. "sort"
+    detailFormat: printf format for the span's details, or NULL
 */
-static FILE *openFileForWriteInProgramFolder(const char *fileName,
-                                             char *actualPathOut,
-                                             size_t pathCapacity)
+static void traceEnd(uint64_t start, const char *name, const char *detailFormat, ...)
 {
-    if (!fileName || !fileName[0]) {
-        return NULL;
+    if (!start) {
+        return;
+    }
+    unsigned session = atomic_load_explicit(&tracer.session, memory_order_relaxed);
+    if (!session) {
+        return;
     }
+    uint64_t end = monotonicNanoseconds();
 
-    if (isPathRelative(fileName) && programDirectoryPath[0]) {
-        joinPath(actualPathOut, pathCapacity, programDirectoryPath, fileName);
-        return fopen(actualPathOut, "w");
-    } else {
-        if (pathCapacity) {
-            strncpy(actualPathOut, fileName, pathCapacity - 1);
-            actualPathOut[pathCapacity - 1] = '\0';
-        }
-        return fopen(fileName, "w");
+    TraceRing *ring = traceThisRing();
+    if (!ring) {
+        atomic_fetch_add_explicit(&tracer.dropped, 1, memory_order_relaxed);
+        return;
+    }
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= TRACE_RING_EVENTS) {
+        atomic_fetch_add_explicit(&tracer.dropped, 1, memory_order_relaxed);
+        return;
     }
-}
 
-/*
-read a tab-separated database file into the global studentTable
+    TraceEvent *event = &ring->events[head & (TRACE_RING_EVENTS - 1)];
+    event->name = name;
+    event->start = start;
+    event->duration = end - start;
+    event->session = session;
+    event->detail[0] = '\0';
+    if (detailFormat) {
+        va_list args;
+        va_start(args, detailFormat);
+        vsnprintf(event->detail, sizeof(event->detail), detailFormat, args);
+        va_end(args);
+    }
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
 
-file format (TSV):
-    ID<TAB>Name<TAB>Programme<TAB>Mark
-*/
-static int loadDatabaseFromFile(const char *fileName)
+// one event as JSON; ts and dur are microseconds since TRACE START
+static void traceWriteEvent(const TraceEvent *event, unsigned threadNumber)
 {
-    const char *usedPath = NULL;
+    double ts = event->start >= tracer.origin ? (double)(event->start - tracer.origin) / 1000.0 : 0.0;
+
+    fprintf(tracer.file, "%s{\"name\":\"%s\",\"cat\":\"cms\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                         "\"ts\":%.3f,\"dur\":%.3f",
+            tracer.wroteEvent ? ",\n" : "", event->name, threadNumber, ts, (double)event->duration / 1000.0);
+
+    if (event->detail[0]) {
+        fputs(",\"args\":{\"detail\":\"", tracer.file);
+        for (const char *c = event->detail; *c; ++c) {
+            if (*c == '"' || *c == '\\') {
+                fputc('\\', tracer.file);
+                fputc(*c, tracer.file);
+            } else if ((unsigned char)*c < 0x20) {
+                fputc(' ', tracer.file);
+            } else {
+                fputc(*c, tracer.file);
+            }
+        }
+        fputs("\"}", tracer.file);
+    }
+    fputc('}', tracer.file);
 
-    FILE *fp = openFileForReadSearch(fileName, &usedPath);
-    if (!fp) {
-        char cwd[1024];
+    tracer.wroteEvent = 1;
+    tracer.written++;
+}
 
-        if (!getcwd(cwd, sizeof(cwd))) {
-            strncpy(cwd, "<unknown>", sizeof(cwd));
+// empty every ring into the trace file (with tracer.lock held)
+static void traceDrain(void)
+{
+    for (TraceRing *ring = tracer.rings; ring; ring = ring->next) {
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        for (; tail != head; ++tail) {
+            const TraceEvent *event = &ring->events[tail & (TRACE_RING_EVENTS - 1)];
+            // (a span that ended just after an earlier TRACE STOP is skipped)
+            if (event->session == tracer.lastSession) {
+                traceWriteEvent(event, ring->threadNumber);
+            }
         }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+}
 
-        fprintf(stderr, "CMS: fopen failed for \"%s\": %s\n",
-                fileName, strerror(errno));
-        fprintf(stderr, "CMS: Current working directory: %s\n", cwd);
-        fprintf(stderr, "CMS: Executable directory   : %s\n",
-                programDirectoryPath[0] ? programDirectoryPath : "<unknown>");
-
-        return 0;
+#if CMS_HAVE_THREADS
+static void *traceFlusherMain(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&tracer.lock);
+    while (!tracer.stopFlusher) {
+        traceDrain();
+
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += TRACE_FLUSH_MILLISECONDS * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&tracer.wakeFlusher, &tracer.lock, &until);
     }
+    pthread_mutex_unlock(&tracer.lock);
+    return NULL;
+}
+#endif
 
-    // reset table before loading new data
-    studentTable.count = 0;
+// without a flusher thread the rings are emptied here, after every command
+static void traceAfterCommand(void)
+{
+#if !CMS_HAVE_THREADS
+    if (tracer.file) {
+        traceDrain();
+    }
+#endif
+}
+
+/*
+TRACE START: start writing spans into fileName
+returns 0 if a trace is already running or the file cannot be created
+*/
+static int traceStart(const char *fileName)
+{
+    if (tracer.file) {
+        return 0;
+    }
+    FILE *file = fopen(fileName, "w");
+    if (!file) {
+        return 0;
+    }
+    fputs("{\"traceEvents\":[\n", file);
+
+    tracer.file = file;
+    tracer.origin = monotonicNanoseconds();
+    tracer.wroteEvent = 0;
+    tracer.written = 0;
+    atomic_store(&tracer.dropped, 0);
+    tracer.lastSession++;
+
+#if CMS_HAVE_THREADS
+    tracer.stopFlusher = 0;
+    tracer.flusherRunning = pthread_create(&tracer.flusher, NULL, traceFlusherMain, NULL) == 0;
+#endif
+    atomic_store(&tracer.session, tracer.lastSession);
+    return 1;
+}
+
+/*
+TRACE STOP: write out what is left and close the file
+    written / dropped: how many spans went into the file / were lost (may be NULL)
+returns 0 if no trace was running
+*/
+static int traceStop(unsigned long long *written, unsigned long long *dropped)
+{
+    if (!tracer.file) {
+        return 0;
+    }
+    atomic_store(&tracer.session, 0);
+
+#if CMS_HAVE_THREADS
+    if (tracer.flusherRunning) {
+        pthread_mutex_lock(&tracer.lock);
+        tracer.stopFlusher = 1;
+        pthread_cond_signal(&tracer.wakeFlusher);
+        pthread_mutex_unlock(&tracer.lock);
+        pthread_join(tracer.flusher, NULL);
+        tracer.flusherRunning = 0;
+    }
+    pthread_mutex_lock(&tracer.lock);
+#endif
+    traceDrain();
+    fputs("\n],\"displayTimeUnit\":\"ms\"}\n", tracer.file);
+    fclose(tracer.file);
+    tracer.file = NULL;
+#if CMS_HAVE_THREADS
+    pthread_mutex_unlock(&tracer.lock);
+#endif
+
+    if (written) {
+        *written = tracer.written;
+    }
+    if (dropped) {
+        *dropped = atomic_load(&tracer.dropped);
+    }
+    return 1;
+}
+
+/*
+spans for a loop over many rows (OPEN, IMPORT): one span per TRACE_BATCH_ROWS
+rows instead of one per row, its details say how the time of those rows was
+split over the phases (phases are measured while tracing, see phaseLap)
+*/
+#define TRACE_BATCH_ROWS 16384
+
+typedef struct {
+    uint64_t start;
+    size_t rows;
+    uint64_t phaseNanoseconds[PHASE_COUNT];     // phase totals when the batch began
+} TraceBatch;
+
+static void traceBatchBegin(TraceBatch *batch)
+{
+    batch->start = traceBegin();
+    batch->rows = 0;
+    if (batch->start && currentCounters) {
+        memcpy(batch->phaseNanoseconds, currentCounters->phaseNanoseconds, sizeof(batch->phaseNanoseconds));
+    }
+}
+
+static void traceBatchEnd(TraceBatch *batch, const char *name)
+{
+    if (!batch->start || !batch->rows) {
+        return;
+    }
+
+    char detail[TRACE_DETAIL_LENGTH];
+    int length = snprintf(detail, sizeof(detail), "%zu rows", batch->rows);
+    for (int p = 0; currentCounters && p < PHASE_COUNT && length < (int)sizeof(detail); ++p) {
+        uint64_t spent = currentCounters->phaseNanoseconds[p] - batch->phaseNanoseconds[p];
+        if (spent) {
+            length += snprintf(detail + length, sizeof(detail) - (size_t)length, ", %s %.2f ms",
+                               commandPhaseNames[p], (double)spent / 1e6);
+        }
+    }
+    traceEnd(batch->start, name, "%s", detail);
+}
+
+// count one row; a full batch becomes a span and the next batch begins
+static void traceBatchRow(TraceBatch *batch, const char *name)
+{
+    if (batch->start && ++batch->rows == TRACE_BATCH_ROWS) {
+        traceBatchEnd(batch, name);
+        traceBatchBegin(batch);
+    }
+}
+
+// removes whitespace at the start and end of a string
+// whitespace includes space, tab, newline, etc
+// an example: "  hello \n"  ->  "hello"
+static void trimSpaces(char *s)
+{
+    // first, trim leading spaces
+    size_t i = 0;
+    while (s[i] && isspace((unsigned char)s[i])) {
+        i++;
+    }
+    if (i > 0) {
+        // shift the string to the left to remove the leading spaces
+        memmove(s, s + i, strlen(s + i) + 1);
+    }
+
+    // then, trim trailing spaces
+    int j = (int)strlen(s) - 1;
+    while (j >= 0 && isspace((unsigned char)s[j])) {
+        s[j] = '\0';
+        j--;
+    }
+}
+
+// compare two strings after making it all lowercase so case dont matter
+static int equalsIgnoreCase(const char *a, const char *b)
+{
+    while (*a && *b) {
+        if (tolower((unsigned char)*a) != tolower((unsigned char)*b)) {
+            return 0;
+        }
+        a++;
+        b++;
+    }
+    return (*a == '\0' && *b == '\0');
+}
+
+// check if "needle" is inside "haystack", ignoring case.
+// used for FIND NAME and FIND PROGRAMME.
+// returns pointer to first match inside haystack, or NULL if not found.
+static const char *containsIgnoreCase(const char *haystack, const char *needle)
+{
+    if (!*needle) {
+        return haystack;    // empty needle always "found" at start
+    }
+
+    size_t needleLength = strlen(needle);
+
+    for (const char *p = haystack; *p; ++p) {
+        size_t i = 0;
+        while (i < needleLength && p[i] && 
+               tolower((unsigned char)p[i]) == tolower((unsigned char)needle[i])) {
+            i++;
+        }
+        if (i == needleLength) {
+            return p;       // found full needle
+        }
+    }
+    return NULL;
+}
+
+// from a full path, extract only the file name without extension.
+// e.g.  "/a/b/db.txt" -> "db"
+static void getFileNameStem(const char *path, char *out, size_t outSize)
+{
+    const char *slash1 = strrchr(path, '/');
+    const char *slash2 = strrchr(path, '\\');
+    const char *slash = slash1 ? (slash2 && slash2 > slash1 ? slash2 : slash1) : slash2;
+
+    const char *baseName = slash ? slash + 1 : path;
+    const char *dot = strrchr(baseName, '.');
+
+    size_t length = dot ? (size_t)(dot - baseName) : strlen(baseName);
+    if (length >= outSize) {
+        length = outSize - 1;
+    }
+
+    memcpy(out, baseName, length);
+    out[length] = '\0';
+}
+
+// check if a path is relative or absolute
+// for windows: - treat "C:\..." or "\something" or "/something" as absolute
+// for linux/macOS: - treat "/something" as absolute
+static int isPathRelative(const char *p)
+{
+#ifdef _WIN32
+    if (strlen(p) >= 2 && p[1] == ':') return 0;    // "C:\..."
+    if (p[0] == '\\' || p[0] == '/') return 0;      // "\foo" or "/foo"
+    return 1;
+#else
+    return p[0] != '/';
+#endif
+}
+
+// this function is to build "dir/filename" or "dir\filename" safely
+static void joinPath(char *out, size_t outSize, const char *dir, const char *file)
+{
+    size_t dirLength = strlen(dir);
+    int needSeparator = (dirLength > 0 && dir[dirLength - 1] != PATH_SEP);
+
+    if (needSeparator) {
+        snprintf(out, outSize, "%s%c%s", dir, PATH_SEP, file);
+    } else {
+        snprintf(out, outSize, "%s%s", dir, file);
+    }
+}
+
+// find the directory where the executable (.exe) is located
+// windows: Use GetModuleFileNameA to get full path of program, then cut off file name
+// on linux/macOS: use readlink("/proc/self/exe", ...) to get full path, then cut off file name
+static void fillProgramDirectoryPath(char *out, size_t outSize)
+{
+#ifdef _WIN32
+    char buffer[1024];
+    DWORD length = GetModuleFileNameA(NULL, buffer, (DWORD)sizeof(buffer));
+    if (length == 0 || length >= sizeof(buffer)) {
+        out[0] = '\0';
+        return;
+    }
+
+    char *lastSlash = strrchr(buffer, '\\');
+    if (lastSlash) {
+        *lastSlash = '\0';     // remove "\program.exe"
+    }
+
+    strncpy(out, buffer, outSize - 1);
+    out[outSize - 1] = '\0';
+#else
+    char buffer[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", buffer, sizeof(buffer) - 1);
+    if (length <= 0) {
+        out[0] = '\0';
+        return;
+    }
+
+    buffer[length] = '\0';
+    char *lastSlash = strrchr(buffer, '/');
+    if (lastSlash) {
+        *lastSlash = '\0';     // remove "/program"
+    }
+
+    strncpy(out, buffer, outSize - 1);
+    out[outSize - 1] = '\0';
+#endif
+}
+
+// convert string to int safely using strtol
+static int stringToInt(const char *s, int *out)
+{
+    char *end = NULL;
+    long value = strtol(s, &end, 10);
+    if (s == end) {
+        return 0;   // no digits found
+    }
+    *out = (int)value;
+    return 1;
+}
+
+/*
+read a mark written as a decimal number ("88.8", "-3", "70.25", "1e2") straight
+into tenths, without going through float
+parameters:
+    text      : the number (spaces in front are skipped)
+    floorOut  : the largest number of tenths <= the number
+    ceilOut   : the smallest number of tenths >= the number
+                (the same as floorOut unless there are more than one decimal)
+    nearestOut: the nearest tenth, halves rounded away from zero
+    (outputs may be NULL; huge numbers stop growing at about 10^16)
+returns:
+    the text after the number, or NULL if there is no number
+*/
+static const char *markParse(const char *text, long long *floorOut, long long *ceilOut, long long *nearestOut)
+{
+    const char *p = text;
+    while (*p && isspace((unsigned char)*p)) {
+        p++;
+    }
+    int negative = *p == '-';
+    if (*p == '+' || *p == '-') {
+        p++;
+    }
+
+    // the significant digits d1 d2 ... and the power of ten: number = 0.d1d2... * 10^scale
+    char digits[40];
+    int digitCount = 0;
+    int dropped = 0;    // a non-zero digit did not fit in "digits"
+    int scale = 0;
+    int seen = 0;
+    int fraction = 0;
+    for (;; p++) {
+        if (*p == '.' && !fraction) {
+            fraction = 1;
+            continue;
+        }
+        if (!isdigit((unsigned char)*p)) {
+            break;
+        }
+        seen = 1;
+        if (digitCount == 0 && *p == '0') {
+            scale -= fraction;  // leading zeros only move the point after it
+            continue;
+        }
+        if (digitCount < (int)sizeof(digits)) {
+            digits[digitCount++] = *p;
+        } else {
+            dropped |= *p != '0';
+        }
+        scale += !fraction;
+    }
+    if (!seen) {
+        return NULL;
+    }
+
+    // an exponent counts only with at least one digit: "1e" is 1 followed by "e"
+    const char *e = p;
+    if (*e == 'e' || *e == 'E') {
+        e++;
+        int exponentNegative = *e == '-';
+        if (*e == '+' || *e == '-') {
+            e++;
+        }
+        if (isdigit((unsigned char)*e)) {
+            int exponent = 0;
+            while (isdigit((unsigned char)*e)) {
+                exponent = exponent < 10000 ? exponent * 10 + (*e - '0') : exponent;
+                e++;
+            }
+            scale += exponentNegative ? -exponent : exponent;
+            p = e;
+        }
+    }
+
+    // tenths are the first scale + 1 digits, the digit after them rounds
+    int keep = digitCount ? scale + 1 : 0;
+    long long tenths = 0;
+    for (int i = 0; i < keep && i < 20; ++i) {
+        if (tenths < 1000000000000000LL) {
+            tenths = tenths * 10 + (i < digitCount ? digits[i] - '0' : 0);
+        }
+    }
+    int first = keep > 0 ? keep : 0;
+    int roundUp = keep >= 0 && keep < digitCount && digits[keep] >= '5';   // next digit is 5 or more
+    int rest = dropped;                                                     // something after the tenths
+    for (int i = first; i < digitCount; ++i) {
+        rest |= digits[i] != '0';
+    }
+
+    if (floorOut) {
+        *floorOut = negative ? -(tenths + rest) : tenths;
+    }
+    if (ceilOut) {
+        *ceilOut = negative ? -tenths : tenths + rest;
+    }
+    if (nearestOut) {
+        *nearestOut = negative ? -(tenths + roundUp) : tenths + roundUp;
+    }
+    return p;
+}
+
+// convert a string like "88.8" to a Mark (rounded to one decimal)
+// returns 0 if it is not one number (spaces around it are fine) or it is outside -3276.7 .. 3276.7
+static int markFromText(const char *s, Mark *out)
+{
+    long long tenths;
+    const char *end = markParse(s, NULL, NULL, &tenths);
+    if (!end || tenths < MARK_LOWEST || tenths > MARK_HIGHEST) {
+        return 0;
+    }
+    while (isspace((unsigned char)*end)) {
+        end++;
+    }
+    if (*end) {
+        return 0;
+    }
+    *out = (Mark)tenths;
+    return 1;
+}
+
+// a Mark as a number for printf ("%.1f" prints it exactly)
+static double markToDouble(Mark mark)
+{
+    return mark / 10.0;
+}
+
+/*
+from a command string like the following:
+    "INSERT ID=2301234 Name=\"Brian\" Programme=\"Digital Supply Chain\" Mark=88.8"
+    extract the value after a given key (e.g. "ID", "Name", "Programme", "Mark")
+    - supports values with spaces if quoted using double quotes
+    - case-insensitive for the key
+returns:
+    1 if key found and value extracted, 0 if not found or invalid
+*/
+static int readKeyValueFromCommand(const char *src,
+                                   const char *key,
+                                   char *out,
+                                   size_t outLen)
+{
+    const char *p = src;
+    size_t keyLength = strlen(key);
+
+    while ((p = containsIgnoreCase(p, key))) {
+        // makes sure character before key is space (or start of string)
+        if (p != src && !isspace((unsigned char)p[-1])) {
+            p++;
+            continue;
+        }
+
+        // move to the position after key, skip spaces
+        const char *eq = p + keyLength;
+        while (*eq && isspace((unsigned char)*eq)) {
+            eq++;
+        }
+
+        if (*eq != '=') {
+            p++;
+            continue;   // not really a "key=" pattern
+        }
+
+        eq++;   // skip '='
+
+        // skip spaces after '='
+        while (*eq && isspace((unsigned char)*eq)) {
+            eq++;
+        }
+
+        // if first character is a quote, read until closing quote
+        if (*eq == '"') {
+            eq++;   // skip opening quote
+            const char *end = strchr(eq, '"');
+            if (!end) {
+                return 0;   // no closing quote
+            }
+
+            size_t len = (size_t)(end - eq);
+            if (len >= outLen) {
+                len = outLen - 1;
+            }
+
+            memcpy(out, eq, len);
+            out[len] = '\0';
+            return 1;
+        } else {
+            // unquoted value: read until next whitespace
+            size_t i = 0;
+            while (*eq && !isspace((unsigned char)*eq) && i + 1 < outLen) {
+                out[i++] = *eq++;
+            }
+            out[i] = '\0';
+            return i > 0;
+        }
+    }
+
+    return 0;
+}
+
+// THREAD POOL
+/*
+a small work-stealing thread pool for scans over the whole table
+(FIND, SHOW SUMMARY, EXPORT, SAVE ...), one worker per CPU core.
+
+    parallelFor(count, grain, function, context)
+        splits [0, count) into tasks of about "grain" items and runs
+        function(context, taskIndex, begin, end) for every task.
+        the caller helps to run tasks and returns when all are done.
+        taskIndex goes from 0 to parallelTaskCount(count, grain) - 1 in
+        table order, so results stored per task can be merged in order.
+
+    parallelReduce(...)
+        the same, but every task fills its own partial result, and the
+        partials are combined in task order (so the answer does not
+        depend on which thread ran what).
+
+every worker owns a deque of tasks: it takes work from its own end and,
+when that is empty, steals from the other end of another worker's deque.
+the CMS_THREADS environment variable overrides the number of workers.
+without threads (windows) every task simply runs on the calling thread.
+*/
+typedef void (*ParallelTaskFunction)(void *context, size_t taskIndex, size_t begin, size_t end);
+
+// pick a grain automatically: about 8 tasks per worker
+#define PARALLEL_AUTO_GRAIN 0
+#define PARALLEL_TASKS_PER_WORKER 8
+#define THREAD_POOL_MAX_WORKERS 256
+
+static unsigned threadPoolWorkerCount(void);
+
+// how many tasks parallelFor will create for these arguments
+static size_t parallelTaskCount(size_t count, size_t grain)
+{
+    if (count == 0) {
+        return 0;
+    }
+    if (grain == PARALLEL_AUTO_GRAIN) {
+        size_t wanted = (size_t)threadPoolWorkerCount() * PARALLEL_TASKS_PER_WORKER;
+        grain = (count + wanted - 1) / wanted;
+    }
+    return (count + grain - 1) / grain;
+}
+
+#if CMS_HAVE_THREADS
+
+// one parallelFor call
+typedef struct {
+    ParallelTaskFunction function;
+    void *context;
+    atomic_size_t remaining;    // tasks not finished yet
+} ParallelJob;
+
+typedef struct {
+    ParallelJob *job;
+    size_t taskIndex;
+    size_t begin;
+    size_t end;
+} PoolTask;
+
+// ring buffer of tasks; the owner uses the tail, thieves the head
+typedef struct {
+    pthread_mutex_t lock;
+    PoolTask *tasks;
+    size_t head;
+    size_t count;
+    size_t capacity;
+} WorkDeque;
+
+static struct {
+    int started;
+    unsigned workerCount;
+    WorkDeque *deques;
+    pthread_t *threads;
+    pthread_mutex_t sleepLock;
+    pthread_cond_t wakeWorkers;     // new tasks were queued
+    pthread_cond_t jobFinished;     // some parallelFor call is complete
+    atomic_size_t queuedTasks;      // tasks sitting in any deque
+    atomic_uint nextDeque;          // round-robin start for outside callers
+    int stopping;
+} threadPool = {
+    .sleepLock = PTHREAD_MUTEX_INITIALIZER,
+    .wakeWorkers = PTHREAD_COND_INITIALIZER,
+    .jobFinished = PTHREAD_COND_INITIALIZER
+};
+
+static pthread_once_t threadPoolOnce = PTHREAD_ONCE_INIT;
+
+// index of the worker running on this thread, or -1 for other threads
+static CMS_THREAD_LOCAL int poolWorkerIndex = -1;
+
+static void dequePushTail(WorkDeque *deque, const PoolTask *task)
+{
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count == deque->capacity) {
+        size_t newCapacity = deque->capacity ? deque->capacity * 2 : 64;
+        PoolTask *newTasks = (PoolTask *)memoryAlloc(MEMORY_OTHER, newCapacity * sizeof(PoolTask));
+        if (!newTasks) {
+            fprintf(stderr, "CMS: Out of memory in thread pool.\n");
+            exit(1);
+        }
+        // unroll the ring so head starts at 0 again
+        for (size_t i = 0; i < deque->count; ++i) {
+            newTasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+        }
+        memoryFree(deque->tasks);
+        deque->tasks = newTasks;
+        deque->head = 0;
+        deque->capacity = newCapacity;
+    }
+    deque->tasks[(deque->head + deque->count) % deque->capacity] = *task;
+    deque->count++;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+// owner side: newest task first (it is most likely still in cache)
+static int dequePopTail(WorkDeque *deque, PoolTask *out)
+{
+    int found = 0;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        deque->count--;
+        *out = deque->tasks[(deque->head + deque->count) % deque->capacity];
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// thief side: oldest task first (usually the biggest piece of work left)
+static int dequeStealHead(WorkDeque *deque, PoolTask *out)
+{
+    int found = 0;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        *out = deque->tasks[deque->head];
+        deque->head = (deque->head + 1) % deque->capacity;
+        deque->count--;
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// find any task: own deque first, then steal from the others
+static int poolTakeTask(PoolTask *out)
+{
+    unsigned workers = threadPool.workerCount;
+    unsigned start = poolWorkerIndex >= 0 ? (unsigned)poolWorkerIndex
+                                          : atomic_load(&threadPool.nextDeque) % workers;
+
+    if (atomic_load(&threadPool.queuedTasks) == 0) {
+        return 0;
+    }
+
+    if (poolWorkerIndex >= 0 && dequePopTail(&threadPool.deques[start], out)) {
+        atomic_fetch_sub(&threadPool.queuedTasks, 1);
+        return 1;
+    }
+
+    for (unsigned k = 0; k < workers; ++k) {
+        unsigned victim = (start + k) % workers;
+        if (dequeStealHead(&threadPool.deques[victim], out)) {
+            atomic_fetch_sub(&threadPool.queuedTasks, 1);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void poolRunTask(const PoolTask *task)
+{
+    ParallelJob *job = task->job;
+    perfAttachThisThread(poolWorkerIndex >= 0);
+    uint64_t span = traceBegin();
+    job->function(job->context, task->taskIndex, task->begin, task->end);
+    traceEnd(span, "task", "items %zu-%zu", task->begin, task->end);
+
+    if (atomic_fetch_sub(&job->remaining, 1) == 1) {
+        pthread_mutex_lock(&threadPool.sleepLock);
+        pthread_cond_broadcast(&threadPool.jobFinished);
+        pthread_mutex_unlock(&threadPool.sleepLock);
+    }
+}
+
+static void *poolWorkerMain(void *arg)
+{
+    poolWorkerIndex = (int)(size_t)arg;
+
+    while (1) {
+        PoolTask task;
+        if (poolTakeTask(&task)) {
+            poolRunTask(&task);
+            continue;
+        }
+
+        pthread_mutex_lock(&threadPool.sleepLock);
+        while (!threadPool.stopping && atomic_load(&threadPool.queuedTasks) == 0) {
+            pthread_cond_wait(&threadPool.wakeWorkers, &threadPool.sleepLock);
+        }
+        int stop = threadPool.stopping;
+        pthread_mutex_unlock(&threadPool.sleepLock);
+
+        if (stop) {
+            return NULL;
+        }
+    }
+}
+
+// start the workers (once, the first time a scan needs them)
+static void threadPoolStart(void)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *override = getenv("CMS_THREADS");
+    int wanted;
+
+    if (override && stringToInt(override, &wanted) && wanted > 0) {
+        cores = wanted;
+    }
+    if (cores < 1) {
+        cores = 1;
+    }
+    if (cores > THREAD_POOL_MAX_WORKERS) {
+        cores = THREAD_POOL_MAX_WORKERS;
+    }
+
+    threadPool.workerCount = (unsigned)cores;
+    threadPool.deques = (WorkDeque *)memoryCalloc(MEMORY_OTHER, threadPool.workerCount, sizeof(WorkDeque));
+    threadPool.threads = (pthread_t *)memoryCalloc(MEMORY_OTHER, threadPool.workerCount, sizeof(pthread_t));
+    if (!threadPool.deques || !threadPool.threads) {
+        fprintf(stderr, "CMS: Out of memory when starting the thread pool.\n");
+        exit(1);
+    }
+
+    for (unsigned i = 0; i < threadPool.workerCount; ++i) {
+        pthread_mutex_init(&threadPool.deques[i].lock, NULL);
+    }
+
+    // a single core gets no worker threads at all, the caller does everything
+    if (threadPool.workerCount > 1) {
+        for (unsigned i = 0; i < threadPool.workerCount; ++i) {
+            if (pthread_create(&threadPool.threads[i], NULL, poolWorkerMain, (void *)(size_t)i) != 0) {
+                fprintf(stderr, "CMS: Could not start worker thread %u.\n", i);
+                exit(1);
+            }
+        }
+    }
+    threadPool.started = 1;
+}
+
+static unsigned threadPoolWorkerCount(void)
+{
+    pthread_once(&threadPoolOnce, threadPoolStart);
+    return threadPool.workerCount;
+}
+
+// stop the workers at program end
+static void threadPoolStop(void)
+{
+    if (!threadPool.started) {
+        return;
+    }
+
+    pthread_mutex_lock(&threadPool.sleepLock);
+    threadPool.stopping = 1;
+    pthread_cond_broadcast(&threadPool.wakeWorkers);
+    pthread_mutex_unlock(&threadPool.sleepLock);
+
+    if (threadPool.workerCount > 1) {
+        for (unsigned i = 0; i < threadPool.workerCount; ++i) {
+            pthread_join(threadPool.threads[i], NULL);
+        }
+    }
+    for (unsigned i = 0; i < threadPool.workerCount; ++i) {
+        pthread_mutex_destroy(&threadPool.deques[i].lock);
+        memoryFree(threadPool.deques[i].tasks);
+    }
+    memoryFree(threadPool.deques);
+    memoryFree(threadPool.threads);
+    threadPool.started = 0;
+}
+
+static void parallelFor(size_t count, size_t grain, ParallelTaskFunction function, void *context)
+{
+    size_t taskCount = parallelTaskCount(count, grain);
+    if (taskCount == 0) {
+        return;
+    }
+    if (grain == PARALLEL_AUTO_GRAIN) {
+        grain = (count + taskCount - 1) / taskCount;
+    }
+
+    // small jobs (or one core): not worth waking anybody
+    if (taskCount == 1 || threadPool.workerCount <= 1) {
+        for (size_t t = 0; t < taskCount; ++t) {
+            size_t begin = t * grain;
+            size_t end = begin + grain < count ? begin + grain : count;
+            function(context, t, begin, end);
+        }
+        return;
+    }
+
+    ParallelJob job;
+    job.function = function;
+    job.context = context;
+    atomic_init(&job.remaining, taskCount);
+
+    // deal the tasks out over the deques (a worker calling us keeps them local)
+    unsigned first = poolWorkerIndex >= 0 ? (unsigned)poolWorkerIndex
+                                          : atomic_fetch_add(&threadPool.nextDeque, 1);
+    for (size_t t = 0; t < taskCount; ++t) {
+        PoolTask task;
+        task.job = &job;
+        task.taskIndex = t;
+        task.begin = t * grain;
+        task.end = task.begin + grain < count ? task.begin + grain : count;
+
+        unsigned target = poolWorkerIndex >= 0 ? first : (unsigned)((first + t) % threadPool.workerCount);
+        // count first, so queuedTasks never drops below the real number
+        atomic_fetch_add(&threadPool.queuedTasks, 1);
+        dequePushTail(&threadPool.deques[target], &task);
+    }
+
+    pthread_mutex_lock(&threadPool.sleepLock);
+    pthread_cond_broadcast(&threadPool.wakeWorkers);
+    pthread_mutex_unlock(&threadPool.sleepLock);
+
+    // help until our own job is done (we may run other callers' tasks too)
+    while (atomic_load(&job.remaining) > 0) {
+        PoolTask task;
+        if (poolTakeTask(&task)) {
+            poolRunTask(&task);
+            continue;
+        }
+
+        pthread_mutex_lock(&threadPool.sleepLock);
+        while (atomic_load(&job.remaining) > 0 && atomic_load(&threadPool.queuedTasks) == 0) {
+            pthread_cond_wait(&threadPool.jobFinished, &threadPool.sleepLock);
+        }
+        pthread_mutex_unlock(&threadPool.sleepLock);
+    }
+}
+
+#else
+
+static unsigned threadPoolWorkerCount(void)
+{
+    return 1;
+}
+
+static void threadPoolStop(void)
+{
+}
+
+static void parallelFor(size_t count, size_t grain, ParallelTaskFunction function, void *context)
+{
+    size_t taskCount = parallelTaskCount(count, grain);
+    if (grain == PARALLEL_AUTO_GRAIN && taskCount) {
+        grain = (count + taskCount - 1) / taskCount;
+    }
+    for (size_t t = 0; t < taskCount; ++t) {
+        size_t begin = t * grain;
+        size_t end = begin + grain < count ? begin + grain : count;
+        function(context, t, begin, end);
+    }
+}
+
+#endif
+
+// parallelReduce: map fills one partial result per task, combine folds them in task order
+typedef void (*ParallelReduceMap)(void *context, void *partial, size_t begin, size_t end);
+typedef void (*ParallelReduceCombine)(void *context, void *result, const void *partial);
+
+typedef struct {
+    ParallelReduceMap map;
+    void *context;
+    unsigned char *partials;
+    size_t partialSize;
+} ParallelReduceState;
+
+static void parallelReduceTask(void *context, size_t taskIndex, size_t begin, size_t end)
+{
+    ParallelReduceState *state = (ParallelReduceState *)context;
+    state->map(state->context, state->partials + taskIndex * state->partialSize, begin, end);
+}
+
+/*
+parameters:
+    count, grain  : same as parallelFor
+    partialSize   : size of one partial result
+    identity      : starting value copied into every partial (and the result)
+    result        : receives the combined answer
+*/
+static void parallelReduce(size_t count, size_t grain, void *context,
+                           size_t partialSize, const void *identity,
+                           ParallelReduceMap map, ParallelReduceCombine combine,
+                           void *result)
+{
+    size_t taskCount = parallelTaskCount(count, grain);
+    memcpy(result, identity, partialSize);
+    if (taskCount == 0) {
+        return;
+    }
+
+    ParallelReduceState state;
+    state.map = map;
+    state.context = context;
+    state.partialSize = partialSize;
+    state.partials = (unsigned char *)memoryAlloc(MEMORY_QUERY, taskCount * partialSize);
+    if (!state.partials) {
+        fprintf(stderr, "CMS: Out of memory in parallelReduce.\n");
+        exit(1);
+    }
+    for (size_t t = 0; t < taskCount; ++t) {
+        memcpy(state.partials + t * partialSize, identity, partialSize);
+    }
+
+    parallelFor(count, grain, parallelReduceTask, &state);
+
+    for (size_t t = 0; t < taskCount; ++t) {
+        combine(context, result, state.partials + t * partialSize);
+    }
+    memoryFree(state.partials);
+}
+
+// ======================= RECORD INDEXES ===========================
+/*
+small indexes kept next to the table by the thread that changes it
+(addStudentRecord, updateStudentRecord, deleteStudentRecord, compact, clear)
+snapshots never look at them, so they need no locking
+*/
+
+// hash a string (FNV-1a), used for the programme tables below
+static uint32_t hashText(const char *text)
+{
+    uint32_t hash = 2166136261u;
+    while (*text) {
+        hash ^= (unsigned char)*text++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// spread the bits of a student ID over the whole hash
+static uint32_t hashId(int id)
+{
+    uint32_t hash = (uint32_t)id * 2654435761u;
+    return hash ^ (hash >> 16);
+}
+
+/*
+ID -> row hash table, so QUERY / UPDATE / DELETE / INSERT do not have to
+walk every chunk (OPEN of a big file used to take O(n^2) time)
+open addressing with linear probing; slot -1 marks an empty entry
+*/
+typedef struct {
+    int id;
+    RowLocation where;
+} IdSlot;
+
+static struct {
+    IdSlot *entries;
+    size_t capacity;    // power of two (0 before the first insert)
+    size_t count;
+} idIndex = { NULL, 0, 0 };
+
+// returns 1 and fills "where" if the ID is in the table
+static int idIndexFind(int id, RowLocation *where)
+{
+    if (idIndex.count == 0) {
+        return 0;
+    }
+
+    size_t mask = idIndex.capacity - 1;
+    for (size_t e = hashId(id) & mask; idIndex.entries[e].where.slot != -1; e = (e + 1) & mask) {
+        if (idIndex.entries[e].id == id) {
+            *where = idIndex.entries[e].where;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// add the ID, or move it to a new place if it is already there
+static void idIndexPut(int id, int segment, int slot)
+{
+    // keep the table at most half full, so probe runs stay short
+    if ((idIndex.count + 1) * 2 > idIndex.capacity) {
+        uint64_t span = traceBegin();
+        size_t oldCapacity = idIndex.capacity;
+        IdSlot *oldEntries = idIndex.entries;
+
+        idIndex.capacity = oldCapacity ? oldCapacity * 2 : 1024;
+        idIndex.entries = (IdSlot *)memoryAlloc(MEMORY_ID_INDEX, idIndex.capacity * sizeof(IdSlot));
+        if (!idIndex.entries) {
+            fprintf(stderr, "CMS: Out of memory when growing the ID index.\n");
+            exit(1);
+        }
+        for (size_t e = 0; e < idIndex.capacity; ++e) {
+            idIndex.entries[e].where.slot = -1;
+        }
+
+        idIndex.count = 0;
+        for (size_t e = 0; e < oldCapacity; ++e) {
+            if (oldEntries[e].where.slot != -1) {
+                idIndexPut(oldEntries[e].id, oldEntries[e].where.segment, oldEntries[e].where.slot);
+            }
+        }
+        memoryFree(oldEntries);
+        traceEnd(span, "grow id index", "%zu slots", idIndex.capacity);
+    }
+
+    size_t mask = idIndex.capacity - 1;
+    size_t e = hashId(id) & mask;
+    while (idIndex.entries[e].where.slot != -1 && idIndex.entries[e].id != id) {
+        e = (e + 1) & mask;
+    }
+    if (idIndex.entries[e].where.slot == -1) {
+        idIndex.count++;
+    }
+    idIndex.entries[e].id = id;
+    idIndex.entries[e].where.segment = segment;
+    idIndex.entries[e].where.slot = slot;
+}
+
+// remove an ID; later entries of the same probe run move back into the gap
+static void idIndexRemove(int id)
+{
+    if (idIndex.count == 0) {
+        return;
+    }
+
+    size_t mask = idIndex.capacity - 1;
+    size_t gap = hashId(id) & mask;
+    while (idIndex.entries[gap].id != id || idIndex.entries[gap].where.slot == -1) {
+        if (idIndex.entries[gap].where.slot == -1) {
+            return;     // not in the table
+        }
+        gap = (gap + 1) & mask;
+    }
+
+    size_t e = gap;
+    while (1) {
+        e = (e + 1) & mask;
+        if (idIndex.entries[e].where.slot == -1) {
+            break;
+        }
+        // an entry may fill the gap only if its home is not between the gap and itself
+        size_t home = hashId(idIndex.entries[e].id) & mask;
+        if (((e - home) & mask) >= ((e - gap) & mask)) {
+            idIndex.entries[gap] = idIndex.entries[e];
+            gap = e;
+        }
+    }
+    idIndex.entries[gap].where.slot = -1;
+    idIndex.count--;
+}
+
+static void idIndexClear(void)
+{
+    for (size_t e = 0; e < idIndex.capacity; ++e) {
+        idIndex.entries[e].where.slot = -1;
+    }
+    idIndex.count = 0;
+}
+
+static void idIndexFree(void)
+{
+    memoryFree(idIndex.entries);
+    idIndex.entries = NULL;
+    idIndex.capacity = 0;
+    idIndex.count = 0;
+}
+
+/*
+ROARING BITMAPS: compressed sets of 32-bit values (we store student IDs)
+the values are grouped by their high 16 bits; every group is a container:
+    - array container : sorted list of the low 16 bits (up to 4096 values)
+    - bitmap container: 65536 bits (8 KB), used once a group is denser
+AND / OR work container by container and popcount gives the set size, so
+questions like "how many Data Science students have grade A" are answered
+from the bitmaps alone, without reading a single record.
+*/
+#define ROARING_ARRAY_MAX 4096
+#define ROARING_WORDS 1024          // 65536 bits / 64
+
+typedef struct {
+    uint16_t key;           // high 16 bits of every value in this container
+    uint8_t isBitmap;
+    uint32_t cardinality;
+    uint32_t capacity;      // array container: values allocated
+    uint16_t *values;       // array container
+    uint64_t *words;        // bitmap container
+} RoaringContainer;
+
+typedef struct {
+    RoaringContainer *containers;   // sorted by key
+    size_t count;
+    size_t capacity;
+} Roaring;
+
+static unsigned popcount64(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ull);
+    x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return (unsigned)((x * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+// student IDs are signed, flip the sign bit so the order stays the same
+static uint32_t roaringValueOfId(int id)
+{
+    return (uint32_t)id ^ 0x80000000u;
+}
+
+static void *roaringAlloc(size_t size)
+{
+    void *memory = memoryAlloc(MEMORY_BITMAPS, size ? size : 1);
+    if (!memory) {
+        fprintf(stderr, "CMS: Out of memory in a bitmap index.\n");
+        exit(1);
+    }
+    return memory;
+}
+
+static void roaringContainerFree(RoaringContainer *container)
+{
+    memoryFree(container->values);
+    memoryFree(container->words);
+    container->values = NULL;
+    container->words = NULL;
+}
+
+static void roaringFree(Roaring *r)
+{
+    for (size_t c = 0; c < r->count; ++c) {
+        roaringContainerFree(&r->containers[c]);
+    }
+    memoryFree(r->containers);
+    r->containers = NULL;
+    r->count = 0;
+    r->capacity = 0;
+}
+
+static uint64_t roaringCardinality(const Roaring *r)
+{
+    uint64_t total = 0;
+    for (size_t c = 0; c < r->count; ++c) {
+        total += r->containers[c].cardinality;
+    }
+    return total;
+}
+
+// position of the container with "key", or where it would go (*found = 0)
+static size_t roaringFind(const Roaring *r, uint16_t key, int *found)
+{
+    size_t low = 0;
+    size_t high = r->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (r->containers[middle].key < key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    *found = low < r->count && r->containers[low].key == key;
+    return low;
+}
+
+// add an empty container at position "at" (an array container, or a bitmap)
+static RoaringContainer *roaringInsertContainer(Roaring *r, size_t at, uint16_t key, int isBitmap)
+{
+    if (r->count == r->capacity) {
+        r->capacity = r->capacity ? r->capacity * 2 : 4;
+        RoaringContainer *newMemory =
+            (RoaringContainer *)memoryRealloc(MEMORY_BITMAPS, r->containers,
+                                              r->capacity * sizeof(RoaringContainer));
+        if (!newMemory) {
+            fprintf(stderr, "CMS: Out of memory in a bitmap index.\n");
+            exit(1);
+        }
+        r->containers = newMemory;
+    }
+    memmove(&r->containers[at + 1], &r->containers[at], (r->count - at) * sizeof(RoaringContainer));
+    r->count++;
+
+    RoaringContainer *container = &r->containers[at];
+    memset(container, 0, sizeof(*container));
+    container->key = key;
+    container->isBitmap = (uint8_t)isBitmap;
+    if (isBitmap) {
+        container->words = (uint64_t *)roaringAlloc(ROARING_WORDS * sizeof(uint64_t));
+        memset(container->words, 0, ROARING_WORDS * sizeof(uint64_t));
+    }
+    return container;
+}
+
+static void roaringRemoveContainer(Roaring *r, size_t at)
+{
+    roaringContainerFree(&r->containers[at]);
+    memmove(&r->containers[at], &r->containers[at + 1], (r->count - at - 1) * sizeof(RoaringContainer));
+    r->count--;
+}
+
+// array -> bitmap once an array container grows past ROARING_ARRAY_MAX values
+static void roaringToBitmap(RoaringContainer *container)
+{
+    uint64_t *words = (uint64_t *)roaringAlloc(ROARING_WORDS * sizeof(uint64_t));
+    memset(words, 0, ROARING_WORDS * sizeof(uint64_t));
+    for (uint32_t i = 0; i < container->cardinality; ++i) {
+        uint16_t low = container->values[i];
+        words[low >> 6] |= 1ull << (low & 63);
+    }
+    memoryFree(container->values);
+    container->values = NULL;
+    container->capacity = 0;
+    container->words = words;
+    container->isBitmap = 1;
+}
+
+// bitmap -> array when a bitmap container becomes sparse again
+static void roaringToArray(RoaringContainer *container)
+{
+    uint16_t *values = (uint16_t *)roaringAlloc(container->cardinality * sizeof(uint16_t));
+    uint32_t n = 0;
+    for (uint32_t w = 0; w < ROARING_WORDS; ++w) {
+        uint64_t bits = container->words[w];
+        while (bits) {
+            values[n++] = (uint16_t)(w * 64 + popcount64((bits & (0 - bits)) - 1));  // lowest set bit
+            bits &= bits - 1;
+        }
+    }
+    memoryFree(container->words);
+    container->words = NULL;
+    container->values = values;
+    container->capacity = container->cardinality;
+    container->isBitmap = 0;
+}
+
+// position of "low" in an array container, or where it would go
+static uint32_t roaringArrayFind(const RoaringContainer *container, uint16_t low, int *found)
+{
+    uint32_t first = 0;
+    uint32_t last = container->cardinality;
+    while (first < last) {
+        uint32_t middle = first + (last - first) / 2;
+        if (container->values[middle] < low) {
+            first = middle + 1;
+        } else {
+            last = middle;
+        }
+    }
+    *found = first < container->cardinality && container->values[first] == low;
+    return first;
+}
+
+static void roaringAdd(Roaring *r, uint32_t value)
+{
+    uint16_t key = (uint16_t)(value >> 16);
+    uint16_t low = (uint16_t)value;
+    int found;
+    size_t at = roaringFind(r, key, &found);
+    RoaringContainer *container = found ? &r->containers[at] : roaringInsertContainer(r, at, key, 0);
+
+    if (container->isBitmap) {
+        uint64_t bit = 1ull << (low & 63);
+        if (!(container->words[low >> 6] & bit)) {
+            container->words[low >> 6] |= bit;
+            container->cardinality++;
+        }
+        return;
+    }
+
+    uint32_t position = roaringArrayFind(container, low, &found);
+    if (found) {
+        return;
+    }
+    if (container->cardinality == ROARING_ARRAY_MAX) {
+        roaringToBitmap(container);
+        container->words[low >> 6] |= 1ull << (low & 63);
+        container->cardinality++;
+        return;
+    }
+    if (container->cardinality == container->capacity) {
+        container->capacity = container->capacity ? container->capacity * 2 : 4;
+        if (container->capacity > ROARING_ARRAY_MAX) {
+            container->capacity = ROARING_ARRAY_MAX;
+        }
+        uint16_t *newMemory =
+            (uint16_t *)memoryRealloc(MEMORY_BITMAPS, container->values, container->capacity * sizeof(uint16_t));
+        if (!newMemory) {
+            fprintf(stderr, "CMS: Out of memory in a bitmap index.\n");
+            exit(1);
+        }
+        container->values = newMemory;
+    }
+    memmove(&container->values[position + 1], &container->values[position],
+            (container->cardinality - position) * sizeof(uint16_t));
+    container->values[position] = low;
+    container->cardinality++;
+}
+
+static void roaringRemove(Roaring *r, uint32_t value)
+{
+    int found;
+    size_t at = roaringFind(r, (uint16_t)(value >> 16), &found);
+    if (!found) {
+        return;
+    }
+
+    RoaringContainer *container = &r->containers[at];
+    uint16_t low = (uint16_t)value;
+    if (container->isBitmap) {
+        uint64_t bit = 1ull << (low & 63);
+        if (!(container->words[low >> 6] & bit)) {
+            return;
+        }
+        container->words[low >> 6] &= ~bit;
+        container->cardinality--;
+        // a little below the limit, so add/remove at the edge does not flip every time
+        if (container->cardinality < ROARING_ARRAY_MAX / 2) {
+            roaringToArray(container);
+        }
+    } else {
+        uint32_t position = roaringArrayFind(container, low, &found);
+        if (!found) {
+            return;
+        }
+        memmove(&container->values[position], &container->values[position + 1],
+                (container->cardinality - position - 1) * sizeof(uint16_t));
+        container->cardinality--;
+    }
+
+    if (container->cardinality == 0) {
+        roaringRemoveContainer(r, at);
+    }
+}
+
+static void roaringCopyContainer(RoaringContainer *out, const RoaringContainer *in)
+{
+    *out = *in;
+    if (in->isBitmap) {
+        out->words = (uint64_t *)roaringAlloc(ROARING_WORDS * sizeof(uint64_t));
+        memcpy(out->words, in->words, ROARING_WORDS * sizeof(uint64_t));
+    } else {
+        out->capacity = in->cardinality;
+        out->values = (uint16_t *)roaringAlloc(in->cardinality * sizeof(uint16_t));
+        memcpy(out->values, in->values, in->cardinality * sizeof(uint16_t));
+    }
+}
+
+static void roaringPush(Roaring *out, const RoaringContainer *container)
+{
+    if (out->count == out->capacity) {
+        out->capacity = out->capacity ? out->capacity * 2 : 4;
+        RoaringContainer *newMemory =
+            (RoaringContainer *)memoryRealloc(MEMORY_BITMAPS, out->containers,
+                                              out->capacity * sizeof(RoaringContainer));
+        if (!newMemory) {
+            fprintf(stderr, "CMS: Out of memory in a bitmap index.\n");
+            exit(1);
+        }
+        out->containers = newMemory;
+    }
+    out->containers[out->count++] = *container;
+}
+
+// "words" as a bitmap container (a copy, or the bits of an array container)
+static void roaringContainerWords(const RoaringContainer *container, uint64_t *words)
+{
+    if (container->isBitmap) {
+        memcpy(words, container->words, ROARING_WORDS * sizeof(uint64_t));
+        return;
+    }
+    memset(words, 0, ROARING_WORDS * sizeof(uint64_t));
+    for (uint32_t i = 0; i < container->cardinality; ++i) {
+        words[container->values[i] >> 6] |= 1ull << (container->values[i] & 63);
+    }
+}
+
+// out = a AND b (out must be empty)
+static void roaringAnd(const Roaring *a, const Roaring *b, Roaring *out)
+{
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a->count && j < b->count) {
+        const RoaringContainer *x = &a->containers[i];
+        const RoaringContainer *y = &b->containers[j];
+        if (x->key < y->key) {
+            i++;
+            continue;
+        }
+        if (y->key < x->key) {
+            j++;
+            continue;
+        }
+        i++;
+        j++;
+
+        RoaringContainer result;
+        memset(&result, 0, sizeof(result));
+        result.key = x->key;
+
+        if (x->isBitmap && y->isBitmap) {
+            result.isBitmap = 1;
+            result.words = (uint64_t *)roaringAlloc(ROARING_WORDS * sizeof(uint64_t));
+            for (uint32_t w = 0; w < ROARING_WORDS; ++w) {
+                result.words[w] = x->words[w] & y->words[w];
+                result.cardinality += popcount64(result.words[w]);
+            }
+            if (result.cardinality <= ROARING_ARRAY_MAX) {
+                roaringToArray(&result);
+            }
+        } else {
+            // at least one side is an array: the result is never bigger than it
+            if (x->isBitmap) {
+                const RoaringContainer *swap = x;
+                x = y;
+                y = swap;
+            }
+            result.values = (uint16_t *)roaringAlloc(x->cardinality * sizeof(uint16_t));
+            result.capacity = x->cardinality;
+            if (y->isBitmap) {
+                for (uint32_t k = 0; k < x->cardinality; ++k) {
+                    uint16_t low = x->values[k];
+                    if (y->words[low >> 6] & (1ull << (low & 63))) {
+                        result.values[result.cardinality++] = low;
+                    }
+                }
+            } else {
+                uint32_t p = 0;
+                uint32_t q = 0;
+                while (p < x->cardinality && q < y->cardinality) {
+                    if (x->values[p] < y->values[q]) {
+                        p++;
+                    } else if (y->values[q] < x->values[p]) {
+                        q++;
+                    } else {
+                        result.values[result.cardinality++] = x->values[p];
+                        p++;
+                        q++;
+                    }
+                }
+            }
+        }
+
+        if (result.cardinality == 0) {
+            roaringContainerFree(&result);
+        } else {
+            roaringPush(out, &result);
+        }
+    }
+}
+
+// out = a OR b (out must be empty)
+static void roaringOr(const Roaring *a, const Roaring *b, Roaring *out)
+{
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a->count || j < b->count) {
+        RoaringContainer result;
+        if (j == b->count || (i < a->count && a->containers[i].key < b->containers[j].key)) {
+            roaringCopyContainer(&result, &a->containers[i++]);
+            roaringPush(out, &result);
+            continue;
+        }
+        if (i == a->count || b->containers[j].key < a->containers[i].key) {
+            roaringCopyContainer(&result, &b->containers[j++]);
+            roaringPush(out, &result);
+            continue;
+        }
+
+        const RoaringContainer *x = &a->containers[i++];
+        const RoaringContainer *y = &b->containers[j++];
+        memset(&result, 0, sizeof(result));
+        result.key = x->key;
+
+        if (!x->isBitmap && !y->isBitmap && x->cardinality + y->cardinality <= ROARING_ARRAY_MAX) {
+            // merge two sorted arrays
+            result.values = (uint16_t *)roaringAlloc((x->cardinality + y->cardinality) * sizeof(uint16_t));
+            result.capacity = x->cardinality + y->cardinality;
+            uint32_t p = 0;
+            uint32_t q = 0;
+            while (p < x->cardinality || q < y->cardinality) {
+                uint16_t next;
+                if (q == y->cardinality || (p < x->cardinality && x->values[p] < y->values[q])) {
+                    next = x->values[p++];
+                } else if (p == x->cardinality || y->values[q] < x->values[p]) {
+                    next = y->values[q++];
+                } else {
+                    next = x->values[p++];
+                    q++;
+                }
+                result.values[result.cardinality++] = next;
+            }
+        } else {
+            result.isBitmap = 1;
+            result.words = (uint64_t *)roaringAlloc(ROARING_WORDS * sizeof(uint64_t));
+            roaringContainerWords(x, result.words);
+            if (y->isBitmap) {
+                for (uint32_t w = 0; w < ROARING_WORDS; ++w) {
+                    result.words[w] |= y->words[w];
+                }
+            } else {
+                for (uint32_t k = 0; k < y->cardinality; ++k) {
+                    result.words[y->values[k] >> 6] |= 1ull << (y->values[k] & 63);
+                }
+            }
+            for (uint32_t w = 0; w < ROARING_WORDS; ++w) {
+                result.cardinality += popcount64(result.words[w]);
+            }
+            if (result.cardinality <= ROARING_ARRAY_MAX) {
+                roaringToArray(&result);
+            }
+        }
+        roaringPush(out, &result);
+    }
+}
+
+// in place: r = r AND other (used to fold a list of conditions)
+static void roaringAndInPlace(Roaring *r, const Roaring *other)
+{
+    Roaring result = { NULL, 0, 0 };
+    roaringAnd(r, other, &result);
+    roaringFree(r);
+    *r = result;
+}
+
+// in place: r = r OR other
+static void roaringOrInPlace(Roaring *r, const Roaring *other)
+{
+    Roaring result = { NULL, 0, 0 };
+    roaringOr(r, other, &result);
+    roaringFree(r);
+    *r = result;
+}
+
+// how many values of "r" lie in [first, last]
+static uint64_t roaringRangeCardinality(const Roaring *r, uint32_t first, uint32_t last)
+{
+    uint64_t total = 0;
+    for (size_t c = 0; c < r->count; ++c) {
+        const RoaringContainer *container = &r->containers[c];
+        uint32_t base = (uint32_t)container->key << 16;
+        if (base + 0xffffu < first || base > last) {
+            continue;
+        }
+        if (base >= first && base + 0xffffu <= last) {
+            total += container->cardinality;    // the whole container is inside
+            continue;
+        }
+
+        uint32_t low = first > base ? first - base : 0;
+        uint32_t high = last < base + 0xffffu ? last - base : 0xffffu;
+        if (container->isBitmap) {
+            for (uint32_t w = low >> 6; w <= high >> 6; ++w) {
+                uint64_t bits = container->words[w];
+                if (w == low >> 6) {
+                    bits &= ~0ull << (low & 63);
+                }
+                if (w == high >> 6 && (high & 63) != 63) {
+                    bits &= (1ull << ((high & 63) + 1)) - 1;
+                }
+                total += popcount64(bits);
+            }
+        } else {
+            for (uint32_t k = 0; k < container->cardinality; ++k) {
+                total += container->values[k] >= low && container->values[k] <= high;
+            }
+        }
+    }
+    return total;
+}
+
+// write the student IDs whose values are in [first, last] to "ids", smallest
+// first, but at most "max" of them; returns how many
+static size_t roaringCollectIds(const Roaring *r, uint32_t first, uint32_t last, int *ids, size_t max)
+{
+    size_t count = 0;
+    for (size_t c = 0; c < r->count && count < max; ++c) {
+        const RoaringContainer *container = &r->containers[c];
+        uint32_t base = (uint32_t)container->key << 16;
+        if (base + 0xffffu < first || base > last) {
+            continue;
+        }
+        uint32_t low = first > base ? first - base : 0;
+        uint32_t high = last < base + 0xffffu ? last - base : 0xffffu;
+        if (container->isBitmap) {
+            for (uint32_t w = low >> 6; w <= high >> 6; ++w) {
+                uint64_t bits = container->words[w];
+                while (bits && count < max) {
+                    uint32_t value = w * 64 + popcount64((bits & (0 - bits)) - 1);   // lowest set bit
+                    bits &= bits - 1;
+                    if (value >= low && value <= high) {
+                        ids[count++] = (int)((base + value) ^ 0x80000000u);
+                    }
+                }
+            }
+        } else {
+            for (uint32_t k = 0; k < container->cardinality && count < max; ++k) {
+                if (container->values[k] >= low && container->values[k] <= high) {
+                    ids[count++] = (int)((base + container->values[k]) ^ 0x80000000u);
+                }
+            }
+        }
+    }
+    return count;
+}
+
+/*
+PROGRAMME DICTIONARY
+every programme name in the table gets a small code (0, 1, 2, ... in the
+order the names first appear); the per-programme indexes hang off its entry:
+    - rankRoot: treap of the programme's students by mark (RANK)
+    - ids     : bitmap of the programme's student IDs (COUNT, WHERE PROGRAMME)
+codes are only forgotten when the whole table is cleared (OPEN)
+*/
+typedef struct {
+    char name[PROGRAMME_MAX_LENGTH];
+    int rankRoot;       // -1 while the programme has no students
+    Roaring ids;
+} ProgrammeEntry;
+
+static struct {
+    ProgrammeEntry *entries;
+    size_t count;
+    size_t capacity;
+    int *buckets;       // name hash: code or -1
+    size_t bucketCount; // power of two
+} programmeDictionary = { NULL, 0, 0, NULL, 0 };
+
+static void programmeBucketInsert(size_t code)
+{
+    size_t mask = programmeDictionary.bucketCount - 1;
+    size_t b = hashText(programmeDictionary.entries[code].name) & mask;
+    while (programmeDictionary.buckets[b] != -1) {
+        b = (b + 1) & mask;
+    }
+    programmeDictionary.buckets[b] = (int)code;
+}
+
+// code of a programme name (a new code when "create" is set), or -1
+static int programmeCode(const char *name, int create)
+{
+    if (programmeDictionary.bucketCount) {
+        size_t mask = programmeDictionary.bucketCount - 1;
+        for (size_t b = hashText(name) & mask; programmeDictionary.buckets[b] != -1; b = (b + 1) & mask) {
+            int code = programmeDictionary.buckets[b];
+            if (strcmp(programmeDictionary.entries[code].name, name) == 0) {
+                return code;
+            }
+        }
+    }
+    if (!create) {
+        return -1;
+    }
+
+    if (programmeDictionary.count >= programmeDictionary.capacity) {
+        programmeDictionary.capacity = programmeDictionary.capacity ? programmeDictionary.capacity * 2 : 16;
+        ProgrammeEntry *newMemory =
+            (ProgrammeEntry *)memoryRealloc(MEMORY_PROGRAMMES, programmeDictionary.entries,
+                                            programmeDictionary.capacity * sizeof(ProgrammeEntry));
+        if (!newMemory) {
+            fprintf(stderr, "CMS: Out of memory when growing the programme dictionary.\n");
+            exit(1);
+        }
+        programmeDictionary.entries = newMemory;
+    }
+
+    size_t code = programmeDictionary.count++;
+    ProgrammeEntry *entry = &programmeDictionary.entries[code];
+    strncpy(entry->name, name, PROGRAMME_MAX_LENGTH - 1);
+    entry->name[PROGRAMME_MAX_LENGTH - 1] = '\0';
+    entry->rankRoot = -1;
+    memset(&entry->ids, 0, sizeof(entry->ids));
+
+    // keep the bucket array at most half full (rebuilt when it grows)
+    if (programmeDictionary.count * 2 > programmeDictionary.bucketCount) {
+        memoryFree(programmeDictionary.buckets);
+        programmeDictionary.bucketCount = programmeDictionary.bucketCount ? programmeDictionary.bucketCount * 2 : 64;
+        programmeDictionary.buckets =
+            (int *)memoryAlloc(MEMORY_PROGRAMMES, programmeDictionary.bucketCount * sizeof(int));
+        if (!programmeDictionary.buckets) {
+            fprintf(stderr, "CMS: Out of memory when growing the programme dictionary.\n");
+            exit(1);
+        }
+        for (size_t b = 0; b < programmeDictionary.bucketCount; ++b) {
+            programmeDictionary.buckets[b] = -1;
+        }
+        for (size_t c = 0; c < code; ++c) {
+            programmeBucketInsert(c);
+        }
+    }
+    programmeBucketInsert(code);
+    return (int)code;
+}
+
+static void programmeDictionaryClear(void)
+{
+    for (size_t c = 0; c < programmeDictionary.count; ++c) {
+        roaringFree(&programmeDictionary.entries[c].ids);
+    }
+    programmeDictionary.count = 0;
+    for (size_t b = 0; b < programmeDictionary.bucketCount; ++b) {
+        programmeDictionary.buckets[b] = -1;
+    }
+}
+
+static void programmeDictionaryFree(void)
+{
+    programmeDictionaryClear();
+    memoryFree(programmeDictionary.entries);
+    memoryFree(programmeDictionary.buckets);
+    programmeDictionary.entries = NULL;
+    programmeDictionary.buckets = NULL;
+    programmeDictionary.capacity = 0;
+    programmeDictionary.bucketCount = 0;
+}
+
+// GRADE BANDS: A (80 and above), B (70 to below 80), C (50 to below 70), F (below 50)
+typedef enum {
+    GRADE_A,
+    GRADE_B,
+    GRADE_C,
+    GRADE_F,
+    GRADE_COUNT
+} GradeBand;
+
+#define GRADE_A_MIN 800    // in tenths, like every Mark
+#define GRADE_B_MIN 700
+#define GRADE_C_MIN 500
+
+static const char gradeLetters[GRADE_COUNT + 1] = "ABCF";
+
+static GradeBand gradeOfMark(Mark mark)
+{
+    if (mark >= GRADE_A_MIN) {
+        return GRADE_A;
+    }
+    if (mark >= GRADE_B_MIN) {
+        return GRADE_B;
+    }
+    if (mark >= GRADE_C_MIN) {
+        return GRADE_C;
+    }
+    return GRADE_F;
+}
+
+/*
+bitmap indexes over student IDs (next to the per-programme bitmaps)
+    - grades: one bitmap per grade band
+    - all   : every ID in the table (COUNT WHERE INTAKE / ID ranges)
+*/
+static struct {
+    Roaring grades[GRADE_COUNT];
+    Roaring all;
+} bitmapIndex;
+
+static void bitmapIndexInsert(int code, Mark mark, int id)
+{
+    uint32_t value = roaringValueOfId(id);
+    roaringAdd(&programmeDictionary.entries[code].ids, value);
+    roaringAdd(&bitmapIndex.grades[gradeOfMark(mark)], value);
+    roaringAdd(&bitmapIndex.all, value);
+}
+
+static void bitmapIndexRemove(int code, Mark mark, int id)
+{
+    uint32_t value = roaringValueOfId(id);
+    roaringRemove(&programmeDictionary.entries[code].ids, value);
+    roaringRemove(&bitmapIndex.grades[gradeOfMark(mark)], value);
+    roaringRemove(&bitmapIndex.all, value);
+}
+
+static void bitmapIndexFree(void)
+{
+    for (int g = 0; g < GRADE_COUNT; ++g) {
+        roaringFree(&bitmapIndex.grades[g]);
+    }
+    roaringFree(&bitmapIndex.all);
+}
+
+/*
+RANK ID=<id> needs "how many students of my programme have a higher mark"
+every programme keeps its students in a treap (a binary search tree that
+stays balanced thanks to random priorities), ordered by mark (high first)
+then ID. each node also knows the size of its subtree, so the rank is found
+in O(log n) steps instead of sorting the programme for every query.
+
+nodes live in one array and point to each other by index (-1: none);
+removed nodes go to a free list and are reused
+*/
+typedef struct {
+    Mark mark;
+    int id;
+    uint32_t priority;
+    uint32_t size;      // nodes in this subtree, this one included
+    int left;           // higher marks
+    int right;          // lower marks
+    int code;           // programme code (see programmeDictionary)
+} RankNode;
+
+static struct {
+    RankNode *nodes;
+    size_t nodeCount;
+    size_t nodeCapacity;
+    int freeNodes;      // unused nodes, linked through "left"
+    uint32_t seed;      // xorshift state for the priorities
+} rankIndex = { NULL, 0, 0, -1, 2463534242u };
+
+static uint32_t rankNodeSize(int node)
+{
+    return node < 0 ? 0 : rankIndex.nodes[node].size;
+}
+
+static void rankNodeUpdate(int node)
+{
+    RankNode *n = &rankIndex.nodes[node];
+    n->size = 1 + rankNodeSize(n->left) + rankNodeSize(n->right);
+}
+
+// does node "n" come before the student (mark, id)?
+static int rankNodeBefore(const RankNode *n, Mark mark, int id)
+{
+    return n->mark > mark || (n->mark == mark && n->id < id);
+}
+
+// join two treaps where every node of "a" comes before every node of "b"
+static int rankTreapMerge(int a, int b)
+{
+    if (a < 0) {
+        return b;
+    }
+    if (b < 0) {
+        return a;
+    }
+
+    RankNode *nodes = rankIndex.nodes;
+    if (nodes[a].priority > nodes[b].priority) {
+        nodes[a].right = rankTreapMerge(nodes[a].right, b);
+        rankNodeUpdate(a);
+        return a;
+    }
+    nodes[b].left = rankTreapMerge(a, nodes[b].left);
+    rankNodeUpdate(b);
+    return b;
+}
+
+// split a treap into the nodes before (mark, id) and the rest
+static void rankTreapSplit(int node, Mark mark, int id, int *before, int *rest)
+{
+    if (node < 0) {
+        *before = -1;
+        *rest = -1;
+        return;
+    }
+
+    RankNode *n = &rankIndex.nodes[node];
+    if (rankNodeBefore(n, mark, id)) {
+        rankTreapSplit(n->right, mark, id, &n->right, rest);
+        *before = node;
+    } else {
+        rankTreapSplit(n->left, mark, id, before, &n->left);
+        *rest = node;
+    }
+    rankNodeUpdate(node);
+}
+
+// remove the node of (mark, id) from a treap, returns the new root
+static int rankTreapRemove(int node, Mark mark, int id)
+{
+    if (node < 0) {
+        return -1;
+    }
+
+    RankNode *n = &rankIndex.nodes[node];
+    if (n->id == id && n->mark == mark) {
+        int rest = rankTreapMerge(n->left, n->right);
+        n->left = rankIndex.freeNodes;
+        rankIndex.freeNodes = node;
+        return rest;
+    }
+
+    if (rankNodeBefore(n, mark, id)) {
+        n->right = rankTreapRemove(n->right, mark, id);
+    } else {
+        n->left = rankTreapRemove(n->left, mark, id);
+    }
+    rankNodeUpdate(node);
+    return node;
+}
+
+static void rankIndexInsert(int code, Mark mark, int id)
+{
+    int node = rankIndex.freeNodes;
+    if (node >= 0) {
+        rankIndex.freeNodes = rankIndex.nodes[node].left;
+    } else {
+        if (rankIndex.nodeCount >= rankIndex.nodeCapacity) {
+            rankIndex.nodeCapacity = rankIndex.nodeCapacity ? rankIndex.nodeCapacity * 2 : 1024;
+            RankNode *newMemory =
+                (RankNode *)memoryRealloc(MEMORY_RANK_INDEX, rankIndex.nodes,
+                                          rankIndex.nodeCapacity * sizeof(RankNode));
+            if (!newMemory) {
+                fprintf(stderr, "CMS: Out of memory when growing the rank index.\n");
+                exit(1);
+            }
+            rankIndex.nodes = newMemory;
+        }
+        node = (int)rankIndex.nodeCount++;
+    }
+
+    uint32_t x = rankIndex.seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rankIndex.seed = x;
+
+    RankNode *n = &rankIndex.nodes[node];
+    n->mark = mark;
+    n->id = id;
+    n->priority = x;
+    n->size = 1;
+    n->left = -1;
+    n->right = -1;
+    n->code = code;
+
+    // walk down while the nodes have a higher priority (every subtree on the
+    // way gets one more node), then the new node takes the place of the
+    // rest of the path, which is split into its two children
+    int *link = &programmeDictionary.entries[code].rankRoot;
+    while (*link >= 0 && rankIndex.nodes[*link].priority > n->priority) {
+        RankNode *parent = &rankIndex.nodes[*link];
+        parent->size++;
+        link = rankNodeBefore(parent, n->mark, id) ? &parent->right : &parent->left;
+    }
+    rankTreapSplit(*link, n->mark, id, &n->left, &n->right);
+    rankNodeUpdate(node);
+    *link = node;
+}
+
+static void rankIndexRemove(int code, Mark mark, int id)
+{
+    ProgrammeEntry *entry = &programmeDictionary.entries[code];
+    entry->rankRoot = rankTreapRemove(entry->rankRoot, mark, id);
+}
+
+/*
+competition ranking inside one programme: students with the same mark share
+a rank, the next mark skips ahead (1, 2, 2, 4)
+parameters:
+    programme, mark : the student's current programme and mark
+    rankOut         : 1 + number of students of the programme with a higher mark
+    groupSizeOut    : number of students in the programme
+returns 0 if the programme has no students
+*/
+static int rankIndexLookup(const char *programme, Mark mark, size_t *rankOut, size_t *groupSizeOut)
+{
+    int code = programmeCode(programme, 0);
+    if (code < 0 || programmeDictionary.entries[code].rankRoot < 0) {
+        return 0;
+    }
+
+    size_t higher = 0;
+    int node = programmeDictionary.entries[code].rankRoot;
+    while (node >= 0) {
+        const RankNode *n = &rankIndex.nodes[node];
+        if (n->mark > mark) {
+            higher += rankNodeSize(n->left) + 1;
+            node = n->right;
+        } else {
+            node = n->left;
+        }
+    }
+
+    *rankOut = higher + 1;
+    *groupSizeOut = rankNodeSize(programmeDictionary.entries[code].rankRoot);
+    return 1;
+}
+
+static void rankIndexFree(void)
+{
+    memoryFree(rankIndex.nodes);
+    rankIndex.nodes = NULL;
+    rankIndex.nodeCount = 0;
+    rankIndex.nodeCapacity = 0;
+    rankIndex.freeNodes = -1;
+}
+
+// keep the programme indexes (rank treap, bitmaps) in step with one row
+static void programmeIndexesInsert(const char *programme, Mark mark, int id)
+{
+    int code = programmeCode(programme, 1);
+    rankIndexInsert(code, mark, id);
+    bitmapIndexInsert(code, mark, id);
+}
+
+static void programmeIndexesRemove(const char *programme, Mark mark, int id)
+{
+    int code = programmeCode(programme, 0);
+    if (code >= 0) {
+        rankIndexRemove(code, mark, id);
+        bitmapIndexRemove(code, mark, id);
+    }
+}
+
+// forget every row (OPEN), or free everything (end of the program)
+static void programmeIndexesClear(void)
+{
+    rankIndex.nodeCount = 0;
+    rankIndex.freeNodes = -1;
+    programmeDictionaryClear();
+    bitmapIndexFree();
+}
+
+static void programmeIndexesFree(void)
+{
+    rankIndexFree();
+    programmeDictionaryFree();
+    bitmapIndexFree();
+}
+
+// COLUMN STATISTICS
+/*
+what the planner knows about the data, kept up to date by the functions
+that change the table (like the indexes above, only that thread uses them):
+    - rows: the number of students
+    - names / programmes: HyperLogLog sketches of the distinct values
+      (2048 registers, about 2% error, 2 KB each)
+    - marks / ids: equi-depth histograms, 32 buckets that held about the same
+      number of rows when they were built; inserts, updates and deletes keep
+      the bucket counts exact, but the buckets drift out of balance
+deletes cannot be taken out of a sketch, so the distinct counts only grow.
+ANALYZE rebuilds everything from a snapshot (in parallel); a query that
+plans a WHERE also does it by itself once "changes" is over a fifth of the
+rows. EXPLAIN does not: it plans with what there is and says it is stale.
+*/
+#define STATS_HLL_BITS 11
+#define STATS_HLL_REGISTERS (1u << STATS_HLL_BITS)
+#define STATS_BUCKETS 32
+#define STATS_STALE_ROWS 1000       // changes that never make the statistics stale
+
+/*
+bucket b holds the values in [bounds[b], bounds[b + 1]), the last bucket
+also its upper bound; bucketCount 0: no value seen yet
+*/
+typedef struct {
+    size_t bucketCount;
+    long long bounds[STATS_BUCKETS + 1];
+    uint64_t rows[STATS_BUCKETS];
+} EquiDepthHistogram;
+
+static struct {
+    uint64_t rows;
+    uint64_t changes;               // rows inserted, updated or deleted since the last ANALYZE
+    int analyzed;                   // 0 until the first ANALYZE
+    uint64_t analyzeNanoseconds;    // how long the last ANALYZE took
+    size_t analyzeTasks;
+    uint8_t names[STATS_HLL_REGISTERS];
+    uint8_t programmes[STATS_HLL_REGISTERS];
+    EquiDepthHistogram marks;
+    EquiDepthHistogram ids;
+} columnStats;
+
+// 64-bit hash of a text for the sketches (FNV-1a, then mixed like splitmix64)
+static uint64_t statsHashText(const char *text)
+{
+    uint64_t hash = 14695981039346656037ull;
+    while (*text) {
+        hash ^= (unsigned char)*text++;
+        hash *= 1099511628211ull;
+    }
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+    return hash ^ (hash >> 31);
+}
+
+// the first STATS_HLL_BITS bits pick a register, it keeps the longest run of
+// leading zeros (+1) seen in the other bits
+static void hllAdd(uint8_t *registers, const char *text)
+{
+    uint64_t hash = statsHashText(text);
+    uint32_t index = (uint32_t)(hash >> (64 - STATS_HLL_BITS));
+    uint64_t rest = hash << STATS_HLL_BITS;
+    uint8_t rank = 1;
+    while (rank <= 64 - STATS_HLL_BITS && !(rest & (1ull << 63))) {
+        rest <<= 1;
+        rank++;
+    }
+    if (registers[index] < rank) {
+        registers[index] = rank;
+    }
+}
+
+static void hllMerge(uint8_t *registers, const uint8_t *other)
+{
+    for (uint32_t r = 0; r < STATS_HLL_REGISTERS; ++r) {
+        if (registers[r] < other[r]) {
+            registers[r] = other[r];
+        }
+    }
+}
+
+// distinct values seen (linear counting while many registers are still empty)
+static double hllEstimate(const uint8_t *registers)
+{
+    double m = (double)STATS_HLL_REGISTERS;
+    double sum = 0.0;
+    uint32_t zeros = 0;
+    for (uint32_t r = 0; r < STATS_HLL_REGISTERS; ++r) {
+        sum += 1.0 / (double)(1ull << registers[r]);
+        zeros += registers[r] == 0;
+    }
+    double estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0) {
+        // m * ln(m / zeros), without libm
+        double x = m / (double)zeros;
+        double ln = 0.0;
+        while (x > 2.0) {
+            x /= 2.0;
+            ln += 0.6931471805599453;
+        }
+        double y = (x - 1.0) / (x + 1.0);
+        double term = y;
+        for (int k = 1; k < 40; k += 2) {
+            ln += 2.0 * term / k;
+            term *= y * y;
+        }
+        estimate = m * ln;
+    }
+    return estimate;
+}
+
+// the bucket of a value (a value outside the bounds must not be asked for)
+static size_t histogramBucket(const EquiDepthHistogram *h, long long value)
+{
+    size_t low = 0;
+    size_t high = h->bucketCount;       // the answer is in [low, high)
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+        if (h->bounds[middle] <= value) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// one more row (added 1) or one less (added -1) with this value;
+// a new lowest / highest value widens the first / last bucket
+static void histogramAdd(EquiDepthHistogram *h, long long value, int added)
+{
+    if (h->bucketCount == 0) {
+        if (added < 0) {
+            return;
+        }
+        h->bucketCount = 1;
+        h->bounds[0] = value;
+        h->bounds[1] = value;
+        h->rows[0] = 0;
+    }
+    if (value < h->bounds[0]) {
+        h->bounds[0] = value;
+    }
+    if (value > h->bounds[h->bucketCount]) {
+        h->bounds[h->bucketCount] = value;
+    }
+    uint64_t *rows = &h->rows[histogramBucket(h, value)];
+    if (added > 0) {
+        (*rows)++;
+    } else if (*rows > 0) {
+        (*rows)--;
+    }
+}
+
+// share of [min, max] (whole numbers, both ends included) that is inside [low, high]
+static double rangeOverlap(long long low, long long high, long long min, long long max)
+{
+    if (min > max) {
+        return 0.0;
+    }
+    long long first = low > min ? low : min;
+    long long last = high < max ? high : max;
+    return first > last ? 0.0 : (double)(last - first + 1) / (double)(max - min + 1);
+}
+
+// estimated rows with a value in [low, high] (values taken as evenly spread inside a bucket)
+static double histogramRows(const EquiDepthHistogram *h, long long low, long long high)
+{
+    double rows = 0.0;
+    for (size_t b = 0; b < h->bucketCount; ++b) {
+        long long last = b + 1 < h->bucketCount ? h->bounds[b + 1] - 1 : h->bounds[b + 1];
+        if (h->rows[b]) {
+            rows += (double)h->rows[b] * rangeOverlap(low, high, h->bounds[b], last);
+        }
+    }
+    return rows;
+}
+
+// estimated students with a mark in [low, high] and one of the grades in gradeMask
+static double statsMarkRows(long long low, long long high, unsigned gradeMask)
+{
+    static const int bandLow[GRADE_COUNT] = { GRADE_A_MIN, GRADE_B_MIN, GRADE_C_MIN, MARK_LOWEST };
+    static const int bandHigh[GRADE_COUNT] = { MARK_HIGHEST, GRADE_A_MIN - 1, GRADE_B_MIN - 1, GRADE_C_MIN - 1 };
+
+    double rows = 0.0;
+    for (int g = 0; g < GRADE_COUNT; ++g) {
+        if (gradeMask & (1u << g)) {
+            rows += histogramRows(&columnStats.marks, low > bandLow[g] ? low : bandLow[g],
+                                  high < bandHigh[g] ? high : bandHigh[g]);
+        }
+    }
+    return rows;
+}
+
+static void statsRowAdded(int id, const char *name, const char *programme, Mark mark)
+{
+    columnStats.rows++;
+    columnStats.changes++;
+    hllAdd(columnStats.names, name);
+    hllAdd(columnStats.programmes, programme);
+    histogramAdd(&columnStats.marks, mark, 1);
+    histogramAdd(&columnStats.ids, id, 1);
+}
+
+static void statsRowRemoved(int id, Mark mark)
+{
+    columnStats.rows--;
+    columnStats.changes++;
+    histogramAdd(&columnStats.marks, mark, -1);
+    histogramAdd(&columnStats.ids, id, -1);
+}
+
+// forget every row (OPEN), the next ANALYZE starts from scratch
+static void statsClear(void)
+{
+    memset(&columnStats, 0, sizeof(columnStats));
+}
+
+// find student by ID in the global studentTable (through the ID index)
+// returns 1 and fills "where" if found, or 0 if not found
+static int findIndexById(int id, RowLocation *where)
+{
+    return idIndexFind(id, where);
+}
+
+// ZONE MAPS
+static void zoneMapClear(ZoneMap *zone)
+{
+    zone->idMin = INT_MAX;
+    zone->idMax = INT_MIN;
+    zone->markMin = MARK_HIGHEST;
+    zone->markMax = MARK_LOWEST;
+}
+
+// widen a zone so it also covers one row
+static void zoneMapAdd(ZoneMap *zone, int id, Mark mark)
+{
+    if (id < zone->idMin) {
+        zone->idMin = id;
+    }
+    if (id > zone->idMax) {
+        zone->idMax = id;
+    }
+    if (mark < zone->markMin) {
+        zone->markMin = mark;
+    }
+    if (mark > zone->markMax) {
+        zone->markMax = mark;
+    }
+}
+
+static void zoneMapMerge(ZoneMap *zone, const ZoneMap *other)
+{
+    if (other->idMin > other->idMax) {
+        return;     // empty
+    }
+    if (other->idMin < zone->idMin) {
+        zone->idMin = other->idMin;
+    }
+    if (other->idMax > zone->idMax) {
+        zone->idMax = other->idMax;
+    }
+    if (other->markMin < zone->markMin) {
+        zone->markMin = other->markMin;
+    }
+    if (other->markMax > zone->markMax) {
+        zone->markMax = other->markMax;
+    }
+}
+
+// partition key of a student ID (see CMS_PARTITION_DIGITS)
+static int partitionKeyOf(int id)
+{
+    return id / partitionDivisor;
+}
+
+/*
+make room for at least "rows" rows in a chunk's columns (at most CHUNK_ROWS)
+the columns share one block: names, programmes, ids, marks, live; a bigger
+block doubles the capacity and takes over the filled slots.
+only for a chunk nobody else reads (a new one, or refs == 1 in the table)
+*/
+static void chunkReserveRows(RecordChunk *chunk, unsigned rows)
+{
+    if (rows <= chunk->capacity) {
+        return;
+    }
+    unsigned capacity = chunk->capacity ? chunk->capacity : CHUNK_FIRST_ROWS;
+    while (capacity < rows) {
+        capacity *= 2;
+    }
+    if (capacity > CHUNK_ROWS) {
+        capacity = CHUNK_ROWS;
+    }
+
+    size_t rowBytes = 2 * sizeof(ChunkText) + sizeof(int) + sizeof(Mark) + 1;
+    char *block = (char *)memoryAlloc(MEMORY_RECORDS, capacity * rowBytes);
+    if (!block) {
+        fprintf(stderr, "CMS: Out of memory when growing a record chunk.\n");
+        exit(1);
+    }
+    ChunkText *names = (ChunkText *)block;
+    ChunkText *programmes = names + capacity;
+    int *ids = (int *)(programmes + capacity);
+    Mark *marks = (Mark *)(ids + capacity);
+    unsigned char *live = (unsigned char *)(marks + capacity);
+
+    unsigned used = chunk->used;
+    if (used) {
+        memcpy(names, chunk->names, used * sizeof(ChunkText));
+        memcpy(programmes, chunk->programmes, used * sizeof(ChunkText));
+        memcpy(ids, chunk->ids, used * sizeof(int));
+        memcpy(marks, chunk->marks, used * sizeof(Mark));
+        memcpy(live, chunk->live, used);
+    }
+    memoryFree(chunk->names);
+
+    chunk->names = names;
+    chunk->programmes = programmes;
+    chunk->ids = ids;
+    chunk->marks = marks;
+    chunk->live = live;
+    chunk->capacity = capacity;
+}
+
+// copy the strings of the first "used" rows of "source" into the (empty)
+// text of "target", leaving out the garbage
+static void chunkCopyText(RecordChunk *target, const RecordChunk *source, unsigned used)
+{
+    size_t bytes = source->textUsed - source->textGarbage;
+    target->text = (char *)memoryAlloc(MEMORY_RECORDS, bytes + 1);
+    if (!target->text) {
+        fprintf(stderr, "CMS: Out of memory when copying a record chunk.\n");
+        exit(1);
+    }
+    target->textCapacity = bytes + 1;
+    target->textUsed = 0;
+    target->textGarbage = 0;
+
+    if (source->textGarbage == 0) {
+        if (source->textUsed) {
+            memcpy(target->text, source->text, source->textUsed);
+        }
+        target->textUsed = source->textUsed;
+        memcpy(target->names, source->names, used * sizeof(ChunkText));
+        memcpy(target->programmes, source->programmes, used * sizeof(ChunkText));
+        return;
+    }
+    for (unsigned i = 0; i < used; ++i) {
+        const ChunkText *from[2] = { &source->names[i], &source->programmes[i] };
+        ChunkText *to[2] = { &target->names[i], &target->programmes[i] };
+        for (int k = 0; k < 2; ++k) {
+            ChunkText old = *from[k];   // "to" may be "from" when a chunk packs itself
+            to[k]->offset = (uint32_t)target->textUsed;
+            to[k]->length = old.length;
+            memcpy(target->text + target->textUsed, source->text + old.offset, old.length + 1);
+            target->textUsed += old.length + 1;
+        }
+    }
+}
+
+/*
+make room for "bytes" more bytes of text in a chunk
+if a good part of the text is garbage it is packed first, otherwise the
+text doubles. (same rule as chunkReserveRows: only for unshared chunks)
+*/
+static void chunkReserveText(RecordChunk *chunk, size_t bytes)
+{
+    if (chunk->textUsed + bytes <= chunk->textCapacity) {
+        return;
+    }
+    if (chunk->textGarbage > 0 && chunk->textGarbage >= chunk->textUsed / 2) {
+        RecordChunk packed = *chunk;
+        chunkCopyText(&packed, chunk, chunk->used);
+        memoryFree(chunk->text);
+        chunk->text = packed.text;
+        chunk->textUsed = packed.textUsed;
+        chunk->textCapacity = packed.textCapacity;
+        chunk->textGarbage = 0;
+        if (chunk->textUsed + bytes <= chunk->textCapacity) {
+            return;
+        }
+    }
+
+    size_t capacity = chunk->textCapacity ? chunk->textCapacity * 2 : 32;
+    while (capacity < chunk->textUsed + bytes) {
+        capacity *= 2;
+    }
+    char *text = (char *)memoryRealloc(MEMORY_RECORDS, chunk->text, capacity);
+    if (!text) {
+        fprintf(stderr, "CMS: Out of memory when growing a record chunk.\n");
+        exit(1);
+    }
+    chunk->text = text;
+    chunk->textCapacity = capacity;
+}
+
+// length of a string cut to fit a buffer of "size" bytes (with its NUL)
+static size_t chunkTextLength(const char *text, size_t size)
+{
+    size_t length = 0;
+    while (length + 1 < size && text[length]) {
+        length++;
+    }
+    return length;
+}
+
+// put a string at the end of a chunk's text and point "where" at it
+static void chunkStoreText(RecordChunk *chunk, ChunkText *where, const char *text, size_t size)
+{
+    size_t length = chunkTextLength(text ? text : "", size);
+    chunkReserveText(chunk, length + 1);
+    where->offset = (uint32_t)chunk->textUsed;
+    where->length = (uint32_t)length;
+    memcpy(chunk->text + chunk->textUsed, text ? text : "", length);
+    chunk->text[chunk->textUsed + length] = '\0';
+    chunk->textUsed += length + 1;
+}
+
+// give a row a new string (UPDATE): a shorter one is written over the old one
+static void chunkReplaceText(RecordChunk *chunk, ChunkText *where, const char *text, size_t size)
+{
+    size_t length = chunkTextLength(text, size);
+    if (length <= where->length) {
+        memcpy(chunk->text + where->offset, text, length);
+        chunk->text[where->offset + length] = '\0';
+        chunk->textGarbage += where->length - length;
+        where->length = (uint32_t)length;
+        return;
+    }
+    // make room while the old string still belongs to the row (packing copies it),
+    // only then is it garbage
+    chunkReserveText(chunk, length + 1);
+    chunk->textGarbage += where->length + 1;
+    chunkStoreText(chunk, where, text, size);
+}
+
+// add one live row at the end of an unshared chunk; returns its offset
+static unsigned chunkAppendRow(RecordChunk *chunk, int id, const char *name, const char *programme, Mark mark)
+{
+    unsigned slot = chunk->used;
+    chunkReserveRows(chunk, slot + 1);
+    chunk->ids[slot] = id;
+    chunk->marks[slot] = mark;
+    chunkStoreText(chunk, &chunk->names[slot], name, NAME_MAX_LENGTH);
+    chunkStoreText(chunk, &chunk->programmes[slot], programme, PROGRAMME_MAX_LENGTH);
+    chunk->live[slot] = 1;
+    chunk->liveRows++;
+    chunk->used++;
+    zoneMapAdd(&chunk->zone, id, mark);
+    return slot;
+}
+
+// allocate one empty chunk with room for "rows" rows, owned by whoever
+// asked for it (refs = 1); the text is allocated by the first string
+static RecordChunk *chunkCreate(unsigned rows)
+{
+    RecordChunk *chunk = (RecordChunk *)memoryCalloc(MEMORY_RECORDS, 1, sizeof(RecordChunk));
+    if (!chunk) {
+        fprintf(stderr, "CMS: Out of memory when creating a record chunk.\n");
+        exit(1);
+    }
+    atomic_init(&chunk->refs, 1);
+    zoneMapClear(&chunk->zone);
+    chunkReserveRows(chunk, rows);
+    return chunk;
+}
+
+// give up one reference to a chunk; the last owner frees it
+// (may run on any thread, e.g. when a background EXPORT finishes)
+static void chunkRelease(RecordChunk *chunk)
+{
+    if (atomic_fetch_sub_explicit(&chunk->refs, 1, memory_order_acq_rel) == 1) {
+        memoryFree(chunk->names);
+        memoryFree(chunk->text);
+        memoryFree(chunk);
+    }
+}
+
+// the name / programme of row i of a chunk
+static const char *chunkName(const RecordChunk *chunk, unsigned i)
+{
+    return chunk->text + chunk->names[i].offset;
+}
+
+static const char *chunkProgramme(const RecordChunk *chunk, unsigned i)
+{
+    return chunk->text + chunk->programmes[i].offset;
+}
+
+// copy one row out of a chunk into a StudentRecord
+static void chunkReadRow(const RecordChunk *chunk, unsigned i, StudentRecord *out)
+{
+    out->id = chunk->ids[i];
+    out->mark = chunk->marks[i];
+    memcpy(out->name, chunkName(chunk, i), chunk->names[i].length + 1);
+    memcpy(out->programme, chunkProgramme(chunk, i), chunk->programmes[i].length + 1);
+}
+// allocate initial memory for the student table.
+// - no segments yet (they are made by the first INSERT of each partition)
+// - set count to 0
+// - read CMS_PARTITION_DIGITS (how many ID digits follow the partition key)
+static void studentTableInit(StudentTable *table)
+{
+    table->segmentCapacity = 16;
+    table->segmentCount = 0;
+    table->count = 0;
+    table->segments = (TableSegment *)memoryAlloc(MEMORY_TABLE, table->segmentCapacity * sizeof(TableSegment));
+    table->order = (size_t *)memoryAlloc(MEMORY_TABLE, table->segmentCapacity * sizeof(size_t));
+    if (!table->segments || !table->order) {
+        fprintf(stderr, "CMS: Out of memory when creating student table.\n");
+        exit(1);
+    }
+
+    int digits = PARTITION_DEFAULT_DIGITS;
+    const char *setting = getenv("CMS_PARTITION_DIGITS");
+    if (setting && setting[0]) {
+        long value = strtol(setting, NULL, 10);
+        if (value >= 0 && value <= 9) {
+            digits = (int)value;
+        }
+    }
+    partitionDivisor = 1;
+    while (digits-- > 0) {
+        partitionDivisor *= 10;
+    }
+}
+
+// drop every record (used by OPEN before loading a file)
+// chunks still used by a snapshot stay alive until that snapshot is released
+static void studentTableClear(StudentTable *table)
+{
+    for (size_t s = 0; s < table->segmentCount; ++s) {
+        TableSegment *segment = &table->segments[s];
+        for (size_t c = 0; c < segment->chunkCount; ++c) {
+            chunkRelease(segment->chunks[c]);
+        }
+        memoryFree(segment->chunks);
+    }
+    table->segmentCount = 0;
+    table->count = 0;
+    idIndexClear();
+    programmeIndexesClear();
+    statsClear();
+}
+
+// free all memory used by the student table. (calls this at program end)
+static void studentTableFree(StudentTable *table)
+{
+    studentTableClear(table);
+    memoryFree(table->segments);
+    memoryFree(table->order);
+    table->segments = NULL;
+    table->order = NULL;
+    table->segmentCapacity = 0;
+    idIndexFree();
+    programmeIndexesFree();
+}
+
+/*
+find the segment of a partition key (binary search over table->order)
+if there is none yet and "create" is set, a new empty segment is added
+returns the segment number, or -1
+*/
+static int studentTableSegment(StudentTable *table, int key, int create)
+{
+    size_t low = 0;
+    size_t high = table->segmentCount;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        int middleKey = table->segments[table->order[middle]].key;
+        if (middleKey == key) {
+            return (int)table->order[middle];
+        }
+        if (middleKey < key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (!create) {
+        return -1;
+    }
+
+    if (table->segmentCount >= table->segmentCapacity) {
+        table->segmentCapacity *= 2;
+        TableSegment *newSegments =
+            (TableSegment *)memoryRealloc(MEMORY_TABLE, table->segments,
+                                          table->segmentCapacity * sizeof(TableSegment));
+        size_t *newOrder =
+            (size_t *)memoryRealloc(MEMORY_TABLE, table->order, table->segmentCapacity * sizeof(size_t));
+        if (!newSegments || !newOrder) {
+            fprintf(stderr, "CMS: Out of memory when adding a table segment.\n");
+            exit(1);
+        }
+        table->segments = newSegments;
+        table->order = newOrder;
+    }
+
+    size_t number = table->segmentCount++;
+    TableSegment *segment = &table->segments[number];
+    segment->key = key;
+    // sparse IDs make many partitions of a few rows: each one starts with a
+    // single small chunk (see ensureSegmentCapacity) and room for its pointer
+    segment->chunkCapacity = 1;
+    segment->chunkCount = 0;
+    segment->count = 0;
+    segment->deletedSlots = 0;
+    zoneMapClear(&segment->zone);
+    segment->chunks = (RecordChunk **)memoryAlloc(MEMORY_TABLE, segment->chunkCapacity * sizeof(RecordChunk *));
+    if (!segment->chunks) {
+        fprintf(stderr, "CMS: Out of memory when adding a table segment.\n");
+        exit(1);
+    }
+
+    // keep "order" sorted: the new segment goes where the search stopped
+    memmove(&table->order[low + 1], &table->order[low],
+            (table->segmentCount - 1 - low) * sizeof(size_t));
+    table->order[low] = number;
+    return (int)number;
+}
+
+// make sure a segment has a chunk that can take one more student record
+// if its last chunk is full, add a new chunk: the first chunk of a segment
+// starts small and grows with its rows, later ones are made full size
+// (the chunk pointer array doubles its capacity using realloc)
+static void ensureSegmentCapacity(TableSegment *segment)
+{
+    if (segment->chunkCount > 0 && segment->chunks[segment->chunkCount - 1]->used < CHUNK_ROWS) {
+        return;
+    }
+
+    if (segment->chunkCount >= segment->chunkCapacity) {
+        segment->chunkCapacity *= 2;
+        RecordChunk **newMemory =
+            (RecordChunk **)memoryRealloc(MEMORY_TABLE, segment->chunks,
+                                          segment->chunkCapacity * sizeof(RecordChunk *));
+        if (!newMemory) {
+            fprintf(stderr, "CMS: Out of memory when expanding student table.\n");
+            exit(1);
+        }
+        segment->chunks = newMemory;
+    }
+
+    segment->chunks[segment->chunkCount] = chunkCreate(segment->chunkCount ? CHUNK_ROWS : 0);
+    segment->chunkCount++;
+}
+
+/*
+get chunk number "c" of a segment ready to be changed by a writer (copy-on-write)
+if a snapshot still shares the chunk, the table switches to a private copy
+and the snapshot keeps reading the old one, so writers never wait for readers.
+
+only the thread that changes the table creates snapshots, so once refs is 1
+nobody else can start sharing the chunk while we write into it.
+*/
+static RecordChunk *studentTableWritableChunk(TableSegment *segment, size_t c)
+{
+    RecordChunk *chunk = segment->chunks[c];
+    if (atomic_load_explicit(&chunk->refs, memory_order_acquire) == 1) {
+        return chunk;
+    }
+
+    unsigned used = chunk->used;
+    RecordChunk *copy = chunkCreate(chunk->capacity);
+
+    copy->used = used;
+    copy->liveRows = chunk->liveRows;
+    copy->zone = chunk->zone;
+    memcpy(copy->live, chunk->live, used * sizeof(chunk->live[0]));
+    memcpy(copy->ids, chunk->ids, used * sizeof(chunk->ids[0]));
+    memcpy(copy->marks, chunk->marks, used * sizeof(chunk->marks[0]));
+    chunkCopyText(copy, chunk, used);
+
+    segment->chunks[c] = copy;
+    chunkRelease(chunk);
+    return copy;
+}
+
+/*
+pack the rows of one segment again once many slots were freed by DELETE
+the live rows keep their order; they are copied into new chunks, so
+snapshots that still use the old chunks are not disturbed
+(the ID index is pointed at the new slots, the zone maps become exact)
+*/
+static void segmentCompact(StudentTable *table, size_t number)
+{
+    uint64_t span = traceBegin();
+    TableSegment *segment = &table->segments[number];
+    RecordChunk **oldChunks = segment->chunks;
+    size_t oldChunkCount = segment->chunkCount;
+
+    segment->chunks = (RecordChunk **)memoryAlloc(MEMORY_TABLE, segment->chunkCapacity * sizeof(RecordChunk *));
+    if (!segment->chunks) {
+        fprintf(stderr, "CMS: Out of memory when compacting student table.\n");
+        exit(1);
+    }
+    segment->chunkCount = 0;
+    zoneMapClear(&segment->zone);
+
+    for (size_t c = 0; c < oldChunkCount; ++c) {
+        const RecordChunk *chunk = oldChunks[c];
+        for (unsigned i = 0; i < chunk->used; ++i) {
+            if (!chunk->live[i]) {
+                continue;
+            }
+            ensureSegmentCapacity(segment);
+            RecordChunk *target = segment->chunks[segment->chunkCount - 1];
+            unsigned slot = chunkAppendRow(target, chunk->ids[i], chunkName(chunk, i),
+                                           chunkProgramme(chunk, i), chunk->marks[i]);
+            idIndexPut(chunk->ids[i], (int)number,
+                       (int)((segment->chunkCount - 1) * CHUNK_ROWS + slot));
+        }
+    }
+
+    for (size_t c = 0; c < segment->chunkCount; ++c) {
+        zoneMapMerge(&segment->zone, &segment->chunks[c]->zone);
+    }
+    for (size_t c = 0; c < oldChunkCount; ++c) {
+        chunkRelease(oldChunks[c]);
+    }
+    memoryFree(oldChunks);
+    segment->deletedSlots = 0;
+    traceEnd(span, "compact segment", "intake %d, %zu rows", segment->key, segment->count);
+}
+
+/*
+take a snapshot of the live table: copy the list of chunk pointers and add
+one reference to each chunk (cheap, no records are copied)
+must be called by the thread that changes the table
+*/
+static TableSnapshot *tableSnapshotAcquire(void)
+{
+    size_t chunkCount = 0;
+    for (size_t s = 0; s < studentTable.segmentCount; ++s) {
+        chunkCount += studentTable.segments[s].chunkCount;
+    }
+
+    TableSnapshot *snapshot = (TableSnapshot *)memoryAlloc(MEMORY_SNAPSHOTS, sizeof(TableSnapshot));
+    RecordChunk **chunks = (RecordChunk **)memoryAlloc(MEMORY_SNAPSHOTS, (chunkCount + 1) * sizeof(RecordChunk *));
+    SnapshotSegment *segments =
+        (SnapshotSegment *)memoryAlloc(MEMORY_SNAPSHOTS, (studentTable.segmentCount + 1) * sizeof(SnapshotSegment));
+    if (!snapshot || !chunks || !segments) {
+        fprintf(stderr, "CMS: Out of memory when creating a snapshot.\n");
+        exit(1);
+    }
+
+    // segments in key order, each one's chunks one after another
+    size_t next = 0;
+    for (size_t k = 0; k < studentTable.segmentCount; ++k) {
+        const TableSegment *segment = &studentTable.segments[studentTable.order[k]];
+        segments[k].key = segment->key;
+        segments[k].firstChunk = next;
+        segments[k].chunkCount = segment->chunkCount;
+        segments[k].count = segment->count;
+        segments[k].zone = segment->zone;
+
+        for (size_t c = 0; c < segment->chunkCount; ++c) {
+            chunks[next] = segment->chunks[c];
+            atomic_fetch_add_explicit(&chunks[next]->refs, 1, memory_order_relaxed);
+            next++;
+        }
+    }
+
+    snapshot->chunks = chunks;
+    snapshot->chunkCount = chunkCount;
+    snapshot->count = studentTable.count;
+    snapshot->segments = segments;
+    snapshot->segmentCount = studentTable.segmentCount;
+    memcpy(snapshot->databaseFileName, lastDatabaseFileName, sizeof(snapshot->databaseFileName));
+    return snapshot;
+}
+
+// release a snapshot (any thread); chunks no one uses any more are freed
+static void tableSnapshotRelease(TableSnapshot *snapshot)
+{
+    if (!snapshot) {
+        return;
+    }
+    for (size_t c = 0; c < snapshot->chunkCount; ++c) {
+        chunkRelease(snapshot->chunks[c]);
+    }
+    memoryFree(snapshot->chunks);
+    memoryFree(snapshot->segments);
+    memoryFree(snapshot);
+}
+
+// a read-only command running on a server worker thread uses this snapshot,
+// pinned when the command was accepted (NULL: take a fresh snapshot)
+static CMS_THREAD_LOCAL TableSnapshot *pinnedSnapshot = NULL;
+
+// snapshot for one read-only command (SHOW ALL, FIND, EXPORT, SAVE, ...)
+static TableSnapshot *commandSnapshotBegin(void)
+{
+    return pinnedSnapshot ? pinnedSnapshot : tableSnapshotAcquire();
+}
+
+static void commandSnapshotEnd(TableSnapshot *snapshot)
+{
+    if (snapshot != pinnedSnapshot) {
+        tableSnapshotRelease(snapshot);
+    }
+}
+
+// insert a new student record into the table, if ID is not duplicated
+// (the record goes to the end of its partition's segment)
+static int addStudentRecord(int id,
+                            const char *name,
+                            const char *programme,
+                            Mark mark)
+{
+    // Check duplicate ID
+    RowLocation where;
+    if (findIndexById(id, &where)) {
+        return 0; // a record with the same ID already exists
+    }
+    countRows(1);
+
+    // ensure we have capacity, then append record into the segment's last chunk
+    int number = studentTableSegment(&studentTable, partitionKeyOf(id), 1);
+    TableSegment *segment = &studentTable.segments[number];
+    ensureSegmentCapacity(segment);
+    RecordChunk *chunk = studentTableWritableChunk(segment, segment->chunkCount - 1);
+    unsigned slot = chunkAppendRow(chunk, id, name, programme, mark);
+    zoneMapAdd(&segment->zone, id, mark);
+    segment->count++;
+    studentTable.count++;
+
+    idIndexPut(id, number, (int)((segment->chunkCount - 1) * CHUNK_ROWS + slot));
+    programmeIndexesInsert(chunkProgramme(chunk, slot), mark, id);
+    statsRowAdded(id, chunkName(chunk, slot), chunkProgramme(chunk, slot), mark);
+
+    return 1; // record inserted successfully
+}
+
+// copy the StudentRecord with the given ID into "out"
+// returns 1 if found, or 0 if not found
+static int getStudentRecordById(int id, StudentRecord *out)
+{
+    RowLocation where;
+    if (!findIndexById(id, &where)) {
+        return 0;
+    }
+    const TableSegment *segment = &studentTable.segments[where.segment];
+    chunkReadRow(segment->chunks[where.slot / CHUNK_ROWS], (unsigned)(where.slot % CHUNK_ROWS), out);
+    countRows(1);
+    return 1;
+}
+
+/*
+update only the fields that the user provided
+parameters:
+    id         : student ID to update
+    newName    : new name or NULL (if not updating name)
+    newProgramme: new programme or NULL
+    newMarkPtr : pointer to new mark, or NULL if not updating mark
+
+returns:
+        1 if record updated successfully
+        0 if record with given ID does not exist
+*/
+static int updateStudentRecord(int id,
+                               const char *newName,
+                               const char *newProgramme,
+                               const Mark *newMarkPtr)
+{
+    RowLocation where;
+    if (!findIndexById(id, &where)) {
+        return 0;
+    }
+    countRows(1);
+
+    TableSegment *segment = &studentTable.segments[where.segment];
+    RecordChunk *chunk = studentTableWritableChunk(segment, (size_t)where.slot / CHUNK_ROWS);
+    unsigned slot = (unsigned)(where.slot % CHUNK_ROWS);
+
+    // a new programme or mark moves the student inside the rank and bitmap indexes
+    int moveRank = newProgramme || newMarkPtr;
+    if (moveRank) {
+        programmeIndexesRemove(chunkProgramme(chunk, slot), chunk->marks[slot], id);
+    }
+
+    if (newName) {
+        chunkReplaceText(chunk, &chunk->names[slot], newName, NAME_MAX_LENGTH);
+        hllAdd(columnStats.names, chunkName(chunk, slot));
+    }
+
+    if (newProgramme) {
+        chunkReplaceText(chunk, &chunk->programmes[slot], newProgramme, PROGRAMME_MAX_LENGTH);
+        hllAdd(columnStats.programmes, chunkProgramme(chunk, slot));
+    }
+
+    if (newMarkPtr) {
+        histogramAdd(&columnStats.marks, chunk->marks[slot], -1);
+        histogramAdd(&columnStats.marks, *newMarkPtr, 1);
+        chunk->marks[slot] = *newMarkPtr;
+        zoneMapAdd(&chunk->zone, id, *newMarkPtr);
+        zoneMapAdd(&segment->zone, id, *newMarkPtr);
+    }
+
+    if (moveRank) {
+        programmeIndexesInsert(chunkProgramme(chunk, slot), chunk->marks[slot], id);
+    }
+    columnStats.changes++;
+
+    return 1;
+}
+
+/*
+remove a student record with the given ID
+internally, the slot is only marked as deleted (so later records keep
+their place); once a segment has more deleted slots than records we compact it
+*/
+static int deleteStudentRecord(int id)
+{
+    RowLocation where;
+    if (!findIndexById(id, &where)) {
+        return 0; //if record not found
+    }
+    countRows(1);
+
+    TableSegment *segment = &studentTable.segments[where.segment];
+    RecordChunk *chunk = studentTableWritableChunk(segment, (size_t)where.slot / CHUNK_ROWS);
+    unsigned slot = (unsigned)(where.slot % CHUNK_ROWS);
+    chunk->live[slot] = 0;
+    chunk->liveRows--;
+
+    idIndexRemove(id);
+    programmeIndexesRemove(chunkProgramme(chunk, slot), chunk->marks[slot], id);
+    statsRowRemoved(id, chunk->marks[slot]);
+
+    segment->count--;
+    segment->deletedSlots++;
+    studentTable.count--;
+
+    if (segment->deletedSlots > CHUNK_ROWS &&
+        segment->deletedSlots > segment->count) {
+        segmentCompact(&studentTable, (size_t)where.segment);
+    }
+    return 1; //if deleted successfully,
+}
+
+// ANALYZE: rebuild the column statistics from a snapshot
+typedef struct {
+    uint8_t names[STATS_HLL_REGISTERS];
+    uint8_t programmes[STATS_HLL_REGISTERS];
+    size_t runBegin;            // this task's sorted values: [runBegin, runEnd)
+    size_t runEnd;
+} StatsPartial;
+
+typedef struct {
+    const TableSnapshot *snapshot;
+    const size_t *firstRow;     // the live rows of chunk c go to [firstRow[c], firstRow[c + 1])
+    int *marks;
+    int *ids;
+    int *scratch;               // room for the radix sort, same positions as marks / ids
+    size_t *runs;               // run r is [runs[2r], runs[2r + 1]) of marks and of ids
+    size_t runCount;
+} StatsBuild;
+
+// sort ints with four 8-bit radix passes (the sign bit flipped, so negatives come first)
+static void statsSortInts(int *values, int *scratch, size_t count)
+{
+    int *from = values;
+    int *to = scratch;
+    for (unsigned shift = 0; shift < 32; shift += 8) {
+        size_t counts[256] = { 0 };
+        for (size_t k = 0; k < count; ++k) {
+            counts[(((uint32_t)from[k] ^ 0x80000000u) >> shift) & 0xff]++;
+        }
+        size_t position = 0;
+        for (unsigned b = 0; b < 256; ++b) {
+            size_t n = counts[b];
+            counts[b] = position;
+            position += n;
+        }
+        for (size_t k = 0; k < count; ++k) {
+            to[counts[(((uint32_t)from[k] ^ 0x80000000u) >> shift) & 0xff]++] = from[k];
+        }
+        int *swap = from;
+        from = to;
+        to = swap;
+    }
+}
+
+// one task: copy the marks and IDs of its chunks, sketch the texts, sort its run
+static void statsAnalyzeMap(void *context, void *partialResult, size_t begin, size_t end)
+{
+    StatsBuild *build = (StatsBuild *)context;
+    StatsPartial *partial = (StatsPartial *)partialResult;
+
+    size_t row = build->firstRow[begin];
+    partial->runBegin = row;
+    for (size_t c = begin; c < end; ++c) {
+        const RecordChunk *chunk = build->snapshot->chunks[c];
+        for (unsigned i = 0; i < chunk->used; ++i) {
+            if (!chunk->live[i]) {
+                continue;
+            }
+            build->marks[row] = chunk->marks[i];
+            build->ids[row] = chunk->ids[i];
+            row++;
+            hllAdd(partial->names, chunkName(chunk, i));
+            hllAdd(partial->programmes, chunkProgramme(chunk, i));
+        }
+    }
+    partial->runEnd = row;
+
+    statsSortInts(build->marks + partial->runBegin, build->scratch + partial->runBegin, row - partial->runBegin);
+    statsSortInts(build->ids + partial->runBegin, build->scratch + partial->runBegin, row - partial->runBegin);
+}
+
+static void statsAnalyzeCombine(void *context, void *result, const void *partialResult)
+{
+    StatsBuild *build = (StatsBuild *)context;
+    StatsPartial *total = (StatsPartial *)result;
+    const StatsPartial *partial = (const StatsPartial *)partialResult;
+
+    hllMerge(total->names, partial->names);
+    hllMerge(total->programmes, partial->programmes);
+    build->runs[2 * build->runCount] = partial->runBegin;
+    build->runs[2 * build->runCount + 1] = partial->runEnd;
+    build->runCount++;
+}
+
+// how many of the values (sorted run by run) are smaller than "value"
+static size_t statsCountBelow(const StatsBuild *build, const int *values, long long value)
+{
+    size_t count = 0;
+    for (size_t r = 0; r < build->runCount; ++r) {
+        size_t low = build->runs[2 * r];
+        size_t high = build->runs[2 * r + 1];
+        size_t first = low;
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            if (values[middle] < value) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        count += low - first;
+    }
+    return count;
+}
+
+// the value with "rank" smaller ones before it in sorted order (0: the smallest)
+static int statsValueAtRank(const StatsBuild *build, const int *values, size_t rank)
+{
+    long long low = INT_MIN;
+    long long high = INT_MAX;
+    while (low < high) {
+        long long middle = low + (high - low) / 2;
+        if (statsCountBelow(build, values, middle + 1) > rank) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    return (int)low;
+}
+
+// equi-depth: bucket b starts at the (b * count / buckets)-th smallest value
+static void statsBuildHistogram(EquiDepthHistogram *h, const StatsBuild *build, const int *values, size_t count)
+{
+    memset(h, 0, sizeof(*h));
+    if (count == 0) {
+        return;
+    }
+    size_t buckets = count < STATS_BUCKETS ? count : STATS_BUCKETS;
+    for (size_t b = 0; b < buckets; ++b) {
+        h->bounds[b] = statsValueAtRank(build, values, b * count / buckets);
+    }
+    h->bounds[buckets] = statsValueAtRank(build, values, count - 1);
+    h->bucketCount = buckets;
+
+    // the same rows histogramBucket gives a bucket (a bucket whose bounds are equal stays empty)
+    for (size_t b = 0; b < buckets; ++b) {
+        size_t upTo = b + 1 < buckets ? statsCountBelow(build, values, h->bounds[b + 1]) : count;
+        h->rows[b] = upTo - statsCountBelow(build, values, h->bounds[b]);
+    }
+}
+
+/*
+rebuild the column statistics from a fresh snapshot: every task copies the
+marks and IDs of its chunks, sorts them and fills its own sketches; the
+sketches are merged and the bucket bounds are found in the sorted runs
+must run on the thread that changes the table
+*/
+static void statsAnalyze(void)
+{
+    uint64_t start = monotonicNanoseconds();
+    uint64_t span = traceBegin();
+    TableSnapshot *snapshot = tableSnapshotAcquire();
+
+    size_t taskCount = parallelTaskCount(snapshot->chunkCount, PARALLEL_AUTO_GRAIN);
+    size_t *firstRow = (size_t *)memoryAlloc(MEMORY_QUERY, (snapshot->chunkCount + 1) * sizeof(size_t));
+    size_t *runs = (size_t *)memoryAlloc(MEMORY_QUERY, (2 * taskCount + 1) * sizeof(size_t));
+    int *marks = (int *)memoryAlloc(MEMORY_QUERY, (snapshot->count + 1) * sizeof(int));
+    int *ids = (int *)memoryAlloc(MEMORY_QUERY, (snapshot->count + 1) * sizeof(int));
+    int *scratch = (int *)memoryAlloc(MEMORY_QUERY, (snapshot->count + 1) * sizeof(int));
+    if (!firstRow || !runs || !marks || !ids || !scratch) {
+        fprintf(stderr, "CMS: Out of memory when analyzing the table.\n");
+        exit(1);
+    }
+    firstRow[0] = 0;
+    for (size_t c = 0; c < snapshot->chunkCount; ++c) {
+        firstRow[c + 1] = firstRow[c] + snapshot->chunks[c]->liveRows;
+    }
+
+    StatsBuild build;
+    build.snapshot = snapshot;
+    build.firstRow = firstRow;
+    build.marks = marks;
+    build.ids = ids;
+    build.scratch = scratch;
+    build.runs = runs;
+    build.runCount = 0;
+
+    static const StatsPartial identity;
+    static StatsPartial result;
+    parallelReduce(snapshot->chunkCount, PARALLEL_AUTO_GRAIN, &build, sizeof(StatsPartial), &identity,
+                   statsAnalyzeMap, statsAnalyzeCombine, &result);
+
+    size_t count = firstRow[snapshot->chunkCount];
+    memcpy(columnStats.names, result.names, sizeof(columnStats.names));
+    memcpy(columnStats.programmes, result.programmes, sizeof(columnStats.programmes));
+    statsBuildHistogram(&columnStats.marks, &build, marks, count);
+    statsBuildHistogram(&columnStats.ids, &build, ids, count);
+    columnStats.rows = count;
+    columnStats.changes = 0;
+    columnStats.analyzed = 1;
+    columnStats.analyzeTasks = taskCount;
+
+    memoryFree(firstRow);
+    memoryFree(runs);
+    memoryFree(marks);
+    memoryFree(ids);
+    memoryFree(scratch);
+    tableSnapshotRelease(snapshot);
+    columnStats.analyzeNanoseconds = monotonicNanoseconds() - start;
+    traceEnd(span, "analyze", "%zu rows, %zu tasks", count, taskCount);
+}
+
+// 1 once so many rows changed that the statistics should be rebuilt
+static int statsAreStale(void)
+{
+    return columnStats.changes > STATS_STALE_ROWS + columnStats.rows / 5;
+}
+
+// a query calls this before it plans with the statistics
+static void statsRefreshIfStale(void)
+{
+    if (statsAreStale()) {
+        statsAnalyze();
+    }
+}
+
+// one histogram, four buckets a line ("from .. to: rows")
+static void showHistogram(const char *column, const EquiDepthHistogram *h, int isMark)
+{
+    outputPrintf("  %s histogram, %zu buckets:\n", column, h->bucketCount);
+    for (size_t b = 0; b < h->bucketCount; ++b) {
+        long long last = b + 1 < h->bucketCount ? h->bounds[b + 1] - 1 : h->bounds[b + 1];
+        if (isMark) {
+            outputPrintf("    %5.1f..%5.1f %7llu", markToDouble((Mark)h->bounds[b]),
+                         markToDouble((Mark)(last < h->bounds[b] ? h->bounds[b] : last)),
+                         (unsigned long long)h->rows[b]);
+        } else {
+            outputPrintf("    %lld..%lld %7llu", h->bounds[b], last < h->bounds[b] ? h->bounds[b] : last,
+                         (unsigned long long)h->rows[b]);
+        }
+        if (b % 4 == 3 || b + 1 == h->bucketCount) {
+            outputPrintf("\n");
+        }
+    }
+}
+
+// SHOW STATISTICS (also printed by ANALYZE)
+static void showColumnStatistics(void)
+{
+    if (columnStats.analyzed) {
+        outputPrintf("CMS: Column statistics of %llu rows, %llu changes since ANALYZE "
+                     "(it took %.3f ms on %zu parallel tasks).\n",
+                     (unsigned long long)columnStats.rows, (unsigned long long)columnStats.changes,
+                     (double)columnStats.analyzeNanoseconds / 1e6, columnStats.analyzeTasks);
+    } else {
+        outputPrintf("CMS: Column statistics of %llu rows, kept up to date since OPEN (no ANALYZE yet).\n",
+                     (unsigned long long)columnStats.rows);
+    }
+    outputPrintf("  NAME       about %.0f distinct values\n", columnStats.rows ? hllEstimate(columnStats.names) : 0.0);
+    outputPrintf("  PROGRAMME  about %.0f distinct values\n",
+                 columnStats.rows ? hllEstimate(columnStats.programmes) : 0.0);
+    showHistogram("MARK", &columnStats.marks, 1);
+    showHistogram("ID", &columnStats.ids, 0);
+}
+
+// WHERE CLAUSE (partition, zone map and bitmap pruning)
+#define FILTER_MAX_PROGRAMMES 8
+#define GRADE_ANY ((1u << GRADE_COUNT) - 1)
+
+/*
+QueryFilter: the rows a WHERE clause asks for (every condition narrows it)
+    - active: 0 when the command has no WHERE clause
+    - idMin..idMax, markMin..markMax: ranges, both ends included
+      (marks in tenths, "MARK > 50" is markMin 501)
+    - gradeMask: one bit per GradeBand that may match (GRADE_ANY: all)
+    - programmes: the programme has to be one of these (upper/lower case
+      ignored), programmeCount 0 means any programme
+*/
+typedef struct {
+    int active;
+    int idMin;
+    int idMax;
+    int markMin;
+    int markMax;
+    unsigned gradeMask;
+    size_t programmeCount;
+    char programmes[FILTER_MAX_PROGRAMMES][PROGRAMME_MAX_LENGTH];
+} QueryFilter;
+
+static void queryFilterInit(QueryFilter *filter)
+{
+    filter->active = 0;
+    filter->idMin = INT_MIN;
+    filter->idMax = INT_MAX;
+    filter->markMin = MARK_LOWEST;
+    filter->markMax = MARK_HIGHEST;
+    filter->gradeMask = GRADE_ANY;
+    filter->programmeCount = 0;
+}
+
+// does the filter have a MARK range (not just grades)?
+static int filterHasMarkRange(const QueryFilter *filter)
+{
+    return filter->markMin > MARK_LOWEST || filter->markMax < MARK_HIGHEST;
+}
+
+static int filterMatchesProgramme(const QueryFilter *filter, const char *programme)
+{
+    if (filter->programmeCount == 0) {
+        return 1;
+    }
+    for (size_t k = 0; k < filter->programmeCount; ++k) {
+        if (equalsIgnoreCase(programme, filter->programmes[k])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int filterMatchesRow(const QueryFilter *filter, const RecordChunk *chunk, unsigned i)
+{
+    int id = chunk->ids[i];
+    Mark mark = chunk->marks[i];
+    return id >= filter->idMin && id <= filter->idMax &&
+           mark >= filter->markMin && mark <= filter->markMax &&
+           (filter->gradeMask & (1u << gradeOfMark(mark))) &&
+           filterMatchesProgramme(filter, chunkProgramme(chunk, i));
+}
+
+// the grade bands a zone's marks can fall in (one bit per GradeBand)
+static unsigned zoneGradeMask(const ZoneMap *zone)
+{
+    unsigned mask = 0;
+    for (int g = gradeOfMark(zone->markMax); g <= (int)gradeOfMark(zone->markMin); ++g) {
+        mask |= 1u << g;
+    }
+    return mask;
+}
+
+// can no row of this zone match? (an empty zone never matches)
+static int filterSkipsZone(const QueryFilter *filter, const ZoneMap *zone)
+{
+    return zone->idMin > zone->idMax ||
+           zone->idMax < filter->idMin || zone->idMin > filter->idMax ||
+           zone->markMax < filter->markMin || zone->markMin > filter->markMax ||
+           !(filter->gradeMask & zoneGradeMask(zone));
+}
+
+// does every row of this zone match? (zone maps know nothing about programmes)
+static int filterCoversZone(const QueryFilter *filter, const ZoneMap *zone)
+{
+    return zone->idMin >= filter->idMin && zone->idMax <= filter->idMax &&
+           zone->markMin >= filter->markMin && zone->markMax <= filter->markMax &&
+           (zoneGradeMask(zone) & ~filter->gradeMask) == 0 &&
+           filter->programmeCount == 0;
+}
+
+// a WHERE clause that can never match (e.g. two different programmes)
+static void filterMatchNothing(QueryFilter *filter)
+{
+    filter->idMin = INT_MAX;
+    filter->idMax = INT_MIN;
+}
+
+// does "text" start with the keyword "word" (any case)?
+static int whereKeyword(const char *text, const char *word)
+{
+    size_t length = strlen(word);
+    for (size_t i = 0; i < length; ++i) {
+        if (toupper((unsigned char)text[i]) != word[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+read a number for a WHERE condition, returns the text after it (NULL if none)
+an ID is a whole number (ceil = floor), a mark is read in tenths: "MARK >= 50.05"
+needs ceil (501), "MARK <= 50.05" needs floor (500)
+*/
+static const char *whereReadNumber(const char *text, int isMark, long long *ceilOut, long long *floorOut)
+{
+    if (isMark) {
+        return markParse(text, floorOut, ceilOut, NULL);
+    }
+    char *end = NULL;
+    *ceilOut = *floorOut = strtoll(text, &end, 10);
+    return end == text ? NULL : end;
+}
+
+static const char *whereSkipSpaces(const char *text)
+{
+    while (*text && isspace((unsigned char)*text)) {
+        text++;
+    }
+    return text;
+}
+
+// read "quoted text" or one word, returns the text after it (NULL if none)
+static const char *whereReadText(const char *text, char *out, size_t outSize)
+{
+    size_t n = 0;
+    text = whereSkipSpaces(text);
+    if (*text == '"') {
+        text++;
+        while (*text && *text != '"') {
+            if (n + 1 < outSize) {
+                out[n++] = *text;
+            }
+            text++;
+        }
+        if (*text != '"') {
+            return NULL;
+        }
+        text++;
+    } else {
+        while (*text && !isspace((unsigned char)*text) && *text != ',' && *text != ')') {
+            if (n + 1 < outSize) {
+                out[n++] = *text;
+            }
+            text++;
+        }
+        if (n == 0) {
+            return NULL;
+        }
+    }
+    out[n] = '\0';
+    return text;
+}
+
+/*
+read the values of "= value" or "IN (value, value, ...)" for PROGRAMME / GRADE
+    values: room for "maxValues" strings of "valueSize" bytes
+returns the text after it (NULL if not valid), *countOut = number of values
+*/
+static const char *whereReadList(const char *text, char *values, size_t valueSize,
+                                 size_t maxValues, size_t *countOut)
+{
+    *countOut = 0;
+    if (*text == '=') {
+        *countOut = 1;
+        return whereReadText(text + 1, values, valueSize);
+    }
+    if (!whereKeyword(text, "IN")) {
+        return NULL;
+    }
+
+    text = whereSkipSpaces(text + 2);
+    if (*text != '(') {
+        return NULL;
+    }
+    text++;
+    while (1) {
+        if (*countOut == maxValues) {
+            return NULL;
+        }
+        text = whereReadText(text, values + *countOut * valueSize, valueSize);
+        if (!text) {
+            return NULL;
+        }
+        (*countOut)++;
+        text = whereSkipSpaces(text);
+        if (*text == ')') {
+            return text + 1;
+        }
+        if (*text != ',') {
+            return NULL;
+        }
+        text++;
+    }
+}
+
+/*
+parse the text after WHERE, e.g.
+    INTAKE = 25
+    ID BETWEEN 2500000 AND 2509999 AND MARK >= 50
+    PROGRAMME IN ("Data Science", "Applied AI") AND GRADE = A
+columns:
+    ID, MARK, INTAKE (the partition key, ID without its last digits)
+        with =, <, <=, >, >= or BETWEEN <low> AND <high>
+    PROGRAMME, GRADE (A, B, C or F) with = <value> or IN (<value>, ...)
+conditions are joined with AND
+returns 0 (after printing why) if the clause is not valid
+*/
+static int parseWhereClause(const char *text, QueryFilter *filter)
+{
+    queryFilterInit(filter);
+    filter->active = 1;
+
+    const char *p = whereSkipSpaces(text);
+    if (!*p) {
+        outputPrintf("CMS: WHERE needs a condition, e.g. WHERE INTAKE = 25 AND MARK >= 50\n");
+        return 0;
+    }
+
+    while (*p) {
+        int column;     // 0: ID, 1: MARK, 2: INTAKE, 3: PROGRAMME, 4: GRADE
+        if (whereKeyword(p, "INTAKE")) {
+            column = 2;
+            p += 6;
+        } else if (whereKeyword(p, "MARK")) {
+            column = 1;
+            p += 4;
+        } else if (whereKeyword(p, "PROGRAMME")) {
+            column = 3;
+            p += 9;
+        } else if (whereKeyword(p, "GRADE")) {
+            column = 4;
+            p += 5;
+        } else if (whereKeyword(p, "ID")) {
+            column = 0;
+            p += 2;
+        } else {
+            outputPrintf("CMS: WHERE can only use ID, MARK, INTAKE, PROGRAMME or GRADE (near \"%s\").\n", p);
+            return 0;
+        }
+        p = whereSkipSpaces(p);
+
+        if (column == 3) {
+            char names[FILTER_MAX_PROGRAMMES][PROGRAMME_MAX_LENGTH];
+            size_t count;
+            const char *next = whereReadList(p, names[0], PROGRAMME_MAX_LENGTH, FILTER_MAX_PROGRAMMES, &count);
+            if (!next) {
+                outputPrintf("CMS: Use PROGRAMME = \"...\" or PROGRAMME IN (\"...\", \"...\") (at most %d).\n",
+                             FILTER_MAX_PROGRAMMES);
+                return 0;
+            }
+            p = whereSkipSpaces(next);
+
+            if (filter->programmeCount == 0) {
+                memcpy(filter->programmes, names, count * PROGRAMME_MAX_LENGTH);
+                filter->programmeCount = count;
+            } else {
+                // PROGRAMME ... AND PROGRAMME ...: only names in both lists stay
+                size_t kept = 0;
+                for (size_t k = 0; k < filter->programmeCount; ++k) {
+                    for (size_t n = 0; n < count; ++n) {
+                        if (equalsIgnoreCase(filter->programmes[k], names[n])) {
+                            memmove(filter->programmes[kept++], filter->programmes[k], PROGRAMME_MAX_LENGTH);
+                            break;
+                        }
+                    }
+                }
+                filter->programmeCount = kept;
+                if (kept == 0) {
+                    filterMatchNothing(filter);
+                }
+            }
+        } else if (column == 4) {
+            char letters[GRADE_COUNT][8];
+            size_t count;
+            const char *next = whereReadList(p, letters[0], sizeof(letters[0]), GRADE_COUNT, &count);
+            unsigned mask = 0;
+            for (size_t k = 0; next && k < count; ++k) {
+                const char *found = strchr(gradeLetters, toupper((unsigned char)letters[k][0]));
+                if (!found || !letters[k][0] || letters[k][1]) {
+                    next = NULL;
+                } else {
+                    mask |= 1u << (found - gradeLetters);
+                }
+            }
+            if (!next) {
+                outputPrintf("CMS: Use GRADE = A or GRADE IN (A, B); grades are A (80+), B (70+), C (50+), F.\n");
+                return 0;
+            }
+            p = whereSkipSpaces(next);
+            filter->gradeMask &= mask;
+            if (filter->gradeMask == 0) {
+                filterMatchNothing(filter);
+            }
+        } else {
+            // the condition as a range [lowWhole, highWhole] (IDs, or marks in tenths)
+            long long lowWhole = LLONG_MIN, highWhole = LLONG_MAX;
+            long long up = 0, down = 0;     // the number rounded up / down
+            int isMark = column == 1;
+            const char *next = NULL;
+
+            if (whereKeyword(p, "BETWEEN")) {
+                next = whereReadNumber(p + 7, isMark, &up, &down);
+                lowWhole = up;
+                if (next) {
+                    next = whereSkipSpaces(next);
+                    next = whereKeyword(next, "AND") ? whereReadNumber(next + 3, isMark, &up, &down) : NULL;
+                    highWhole = down;
+                }
+            } else {
+                int op = 0;     // '<', 'l' (<=), '>', 'g' (>=), '='
+                if (strncmp(p, "<=", 2) == 0) {
+                    op = 'l';
+                    p += 2;
+                } else if (strncmp(p, ">=", 2) == 0) {
+                    op = 'g';
+                    p += 2;
+                } else if (*p == '<' || *p == '>' || *p == '=') {
+                    op = *p++;
+                }
+
+                next = op ? whereReadNumber(p, isMark, &up, &down) : NULL;
+                if (op == '<' || op == 'l' || op == '=') {
+                    highWhole = op == '<' ? up - 1 : down;
+                }
+                if (op == '>' || op == 'g' || op == '=') {
+                    lowWhole = op == '>' ? down + 1 : up;
+                }
+            }
+
+            if (!next) {
+                outputPrintf("CMS: Use =, <, <=, >, >= or BETWEEN <low> AND <high> with a number in WHERE.\n");
+                return 0;
+            }
+            p = whereSkipSpaces(next);
+
+            if (isMark) {
+                // one past the highest/lowest mark is enough to match nothing
+                if (lowWhole > filter->markMin) {
+                    filter->markMin = lowWhole > MARK_HIGHEST ? MARK_HIGHEST + 1 : (int)lowWhole;
+                }
+                if (highWhole < filter->markMax) {
+                    filter->markMax = highWhole < MARK_LOWEST ? MARK_LOWEST - 1 : (int)highWhole;
+                }
+            } else {
+                if (column == 2) {
+                    // a range of partition keys is a range of IDs
+                    if (lowWhole != LLONG_MIN) {
+                        lowWhole = lowWhole > LLONG_MIN / partitionDivisor ? lowWhole * partitionDivisor : LLONG_MIN;
+                    }
+                    if (highWhole != LLONG_MAX) {
+                        highWhole = highWhole < LLONG_MAX / partitionDivisor
+                                  ? highWhole * partitionDivisor + (partitionDivisor - 1) : LLONG_MAX;
+                    }
+                }
+                if (lowWhole > filter->idMin) {
+                    filter->idMin = lowWhole > INT_MAX ? INT_MAX : (int)lowWhole;
+                    if (lowWhole > INT_MAX) {
+                        filter->idMax = INT_MIN;    // nothing can match
+                    }
+                }
+                if (highWhole < filter->idMax) {
+                    filter->idMax = highWhole < INT_MIN ? INT_MIN : (int)highWhole;
+                    if (highWhole < INT_MIN) {
+                        filter->idMin = INT_MAX;
+                    }
+                }
+            }
+        }
+
+        if (*p) {
+            if (!whereKeyword(p, "AND")) {
+                outputPrintf("CMS: Join WHERE conditions with AND (near \"%s\").\n", p);
+                return 0;
+            }
+            p = whereSkipSpaces(p + 3);
+            if (!*p) {
+                outputPrintf("CMS: WHERE ends with AND.\n");
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ACCESS PATH: zone map scan or bitmap indexes
+a WHERE filter can get its rows in two ways:
+    - scan: the zone maps prune partitions and chunks, the chunks on the
+      edge are read row by row (tableSnapshotWhere, countSnapshotWhere)
+    - bitmaps: the programme and grade bitmaps give the candidate IDs (a
+      MARK range picks the grades it overlaps), every candidate in the ID
+      range is found through the ID index and checked
+the planner estimates both from the column statistics and the zone maps
+and takes the cheaper one. the bitmap path only works where the indexes
+live: on the thread that changes the table, with a fresh snapshot
+*/
+#define WHERE_FETCH_COST 15.0       // one ID fetched through the ID index, in rows read by a scan
+#define WHERE_TEXT_COST 3.0         // a scanned row whose programme is compared, in rows read
+
+typedef struct {
+    size_t partitionsKept;
+    size_t chunksShared;        // every row matches, used as they are
+    size_t chunksRead;          // read row by row
+    size_t chunksSkipped;
+    size_t rowsShared;
+    size_t rowsRead;
+    double estimatedRows;       // rows that match
+    unsigned bitmapGrades;      // grade bitmaps the bitmap path ANDs in (GRADE_ANY: none)
+    int bitmapsUsable;          // PROGRAMME, GRADE or MARK narrow the candidates
+    double bitmapRows;          // estimated candidate IDs
+    double scanCost;
+    double bitmapCost;
+    int useBitmaps;
+} WherePlan;
+
+// share of the students in a zone whose mark the filter allows (MARK range and grades)
+static double whereMarkShare(const QueryFilter *filter, const ZoneMap *zone)
+{
+    double inZone = statsMarkRows(zone->markMin, zone->markMax, GRADE_ANY);
+    if (inZone <= 0.0) {
+        return rangeOverlap(filter->markMin, filter->markMax, zone->markMin, zone->markMax);
+    }
+    long long low = filter->markMin > zone->markMin ? filter->markMin : zone->markMin;
+    long long high = filter->markMax < zone->markMax ? filter->markMax : zone->markMax;
+    return low > high ? 0.0 : statsMarkRows(low, high, filter->gradeMask) / inZone;
+}
+
+// share of the students in a zone whose ID is in the filter's range
+static double whereIdShare(const QueryFilter *filter, const ZoneMap *zone)
+{
+    double inZone = histogramRows(&columnStats.ids, zone->idMin, zone->idMax);
+    if (inZone <= 0.0) {
+        return rangeOverlap(filter->idMin, filter->idMax, zone->idMin, zone->idMax);
+    }
+    long long low = filter->idMin > zone->idMin ? filter->idMin : zone->idMin;
+    long long high = filter->idMax < zone->idMax ? filter->idMax : zone->idMax;
+    return low > high ? 0.0 : histogramRows(&columnStats.ids, low, high) / inZone;
+}
+
+// share of all students that are in one of the filter's programmes (from the programme bitmaps)
+static double whereProgrammeShare(const QueryFilter *filter)
+{
+    if (filter->programmeCount == 0) {
+        return 1.0;
+    }
+    uint64_t all = roaringCardinality(&bitmapIndex.all);
+    uint64_t matching = 0;
+    for (size_t code = 0; code < programmeDictionary.count; ++code) {
+        if (filterMatchesProgramme(filter, programmeDictionary.entries[code].name)) {
+            matching += roaringCardinality(&programmeDictionary.entries[code].ids);
+        }
+    }
+    return all ? (double)matching / (double)all : 0.0;
+}
+
+// the grade bitmaps that narrow a filter: its GRADE list, and a MARK range
+// can only use the grades it overlaps (GRADE_ANY: no grade bitmap helps)
+static unsigned filterBitmapGrades(const QueryFilter *filter)
+{
+    unsigned grades = filter->gradeMask;
+    if (filterHasMarkRange(filter) && filter->markMin <= filter->markMax) {
+        unsigned overlapped = 0;
+        for (int g = gradeOfMark((Mark)filter->markMax); g <= (int)gradeOfMark((Mark)filter->markMin); ++g) {
+            overlapped |= 1u << g;
+        }
+        grades &= overlapped;
+    }
+    return grades;
+}
+
+/*
+plan a WHERE filter on a fresh snapshot: the zone map decisions
+tableSnapshotWhere would make, the estimated matching rows, and what the
+bitmap path would cost. must run on the thread that changes the table
+(it uses the statistics as they are, a query refreshes them first)
+*/
+static void planWhere(const TableSnapshot *snapshot, const QueryFilter *filter, WherePlan *out)
+{
+    memset(out, 0, sizeof(*out));
+    double programmeShare = whereProgrammeShare(filter);
+
+    for (size_t s = 0; s < snapshot->segmentCount; ++s) {
+        const SnapshotSegment *segment = &snapshot->segments[s];
+        if (filterSkipsZone(filter, &segment->zone)) {
+            out->chunksSkipped += segment->chunkCount;
+            continue;
+        }
+        out->partitionsKept++;
+        int coversSegment = filterCoversZone(filter, &segment->zone);
+
+        for (size_t c = segment->firstChunk; c < segment->firstChunk + segment->chunkCount; ++c) {
+            const RecordChunk *chunk = snapshot->chunks[c];
+            if (chunk->liveRows == 0 || (!coversSegment && filterSkipsZone(filter, &chunk->zone))) {
+                out->chunksSkipped++;
+            } else if (coversSegment || filterCoversZone(filter, &chunk->zone)) {
+                out->chunksShared++;
+                out->rowsShared += chunk->liveRows;
+            } else {
+                out->chunksRead++;
+                out->rowsRead += chunk->liveRows;
+                out->estimatedRows += chunk->liveRows * programmeShare * whereIdShare(filter, &chunk->zone) *
+                                      whereMarkShare(filter, &chunk->zone);
+            }
+        }
+    }
+    out->estimatedRows += (double)out->rowsShared;
+    out->scanCost = (double)out->rowsRead * (filter->programmeCount ? WHERE_TEXT_COST : 1.0);
+
+    unsigned grades = filterBitmapGrades(filter);
+    out->bitmapGrades = grades;
+    out->bitmapsUsable = filter->programmeCount > 0 || grades != GRADE_ANY;
+    if (out->bitmapsUsable && columnStats.rows > 0) {
+        double all = (double)columnStats.rows;
+        double gradeRows = 0.0;
+        for (int g = 0; g < GRADE_COUNT; ++g) {
+            if (grades & (1u << g)) {
+                gradeRows += (double)roaringCardinality(&bitmapIndex.grades[g]);
+            }
+        }
+        double idRows = filter->idMin == INT_MIN && filter->idMax == INT_MAX
+                            ? all
+                            : histogramRows(&columnStats.ids, filter->idMin, filter->idMax);
+        out->bitmapRows = all * programmeShare * (gradeRows / all) * (idRows / all);
+        out->bitmapCost = out->bitmapRows * WHERE_FETCH_COST;
+        out->useBitmaps = out->bitmapCost < out->scanCost;
+    }
+}
+
+// the candidate IDs of the bitmap path: programme bitmaps ORed, ANDed with the
+// ORed grade bitmaps; "programmes" and "grades" are scratch bitmaps to free after
+static const Roaring *whereBitmaps(const QueryFilter *filter, unsigned gradeMask, Roaring *programmes, Roaring *grades)
+{
+    const Roaring *result = &bitmapIndex.all;
+
+    if (filter->programmeCount > 0) {
+        // every dictionary entry the list names (upper/lower case ignored)
+        for (size_t code = 0; code < programmeDictionary.count; ++code) {
+            if (filterMatchesProgramme(filter, programmeDictionary.entries[code].name)) {
+                roaringOrInPlace(programmes, &programmeDictionary.entries[code].ids);
+            }
+        }
+        result = programmes;
+    }
+
+    if (gradeMask != GRADE_ANY) {
+        for (int g = 0; g < GRADE_COUNT; ++g) {
+            if (gradeMask & (1u << g)) {
+                roaringOrInPlace(grades, &bitmapIndex.grades[g]);
+            }
+        }
+        if (result == programmes) {
+            roaringAndInPlace(programmes, grades);
+        } else {
+            result = grades;
+        }
+    }
+    return result;
+}
+
+static int compareRowPositions(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+the bitmap path: fetch every candidate ID through the ID index and check it
+against the whole filter
+    gradeMask : the grade bitmaps to use (WherePlan.bitmapGrades)
+    rowsOut   : NULL to only count, or gets the matching rows in table order
+                as (position of the segment in studentTable.order) << 32 | slot
+                (free with memoryFree)
+returns the number of matching rows
+*/
+static size_t whereBitmapRows(const QueryFilter *filter, unsigned gradeMask, uint64_t **rowsOut)
+{
+    Roaring programmes = { NULL, 0, 0 };
+    Roaring grades = { NULL, 0, 0 };
+    const Roaring *candidates = whereBitmaps(filter, gradeMask, &programmes, &grades);
+    uint32_t first = roaringValueOfId(filter->idMin);
+    uint32_t last = roaringValueOfId(filter->idMax);
+
+    size_t candidateCount = first <= last ? (size_t)roaringRangeCardinality(candidates, first, last) : 0;
+    int *ids = (int *)memoryAlloc(MEMORY_QUERY, (candidateCount + 1) * sizeof(int));
+    uint64_t *rows = rowsOut ? (uint64_t *)memoryAlloc(MEMORY_QUERY, (candidateCount + 1) * sizeof(uint64_t)) : NULL;
+    size_t *positionOf = (size_t *)memoryAlloc(MEMORY_QUERY, (studentTable.segmentCount + 1) * sizeof(size_t));
+    if (!ids || (rowsOut && !rows) || !positionOf) {
+        fprintf(stderr, "CMS: Out of memory when reading the bitmap indexes.\n");
+        exit(1);
+    }
+    if (candidateCount) {
+        roaringCollectIds(candidates, first, last, ids, candidateCount);
+    }
+    for (size_t k = 0; k < studentTable.segmentCount; ++k) {
+        positionOf[studentTable.order[k]] = k;
+    }
+
+    size_t count = 0;
+    for (size_t k = 0; k < candidateCount; ++k) {
+        RowLocation where;
+        if (!idIndexFind(ids[k], &where)) {
+            continue;
+        }
+        const RecordChunk *chunk = studentTable.segments[where.segment].chunks[where.slot / CHUNK_ROWS];
+        if (!filterMatchesRow(filter, chunk, (unsigned)(where.slot % CHUNK_ROWS))) {
+            continue;
+        }
+        if (rows) {
+            rows[count] = (uint64_t)positionOf[where.segment] << 32 | (uint32_t)where.slot;
+        }
+        count++;
+    }
+    countRows(candidateCount);
+
+    if (rows) {
+        qsort(rows, count, sizeof(uint64_t), compareRowPositions);
+        *rowsOut = rows;
+    }
+    memoryFree(ids);
+    memoryFree(positionOf);
+    roaringFree(&programmes);
+    roaringFree(&grades);
+    return count;
+}
+
+// tableSnapshotWhere through the bitmaps: the matching rows packed into new
+// chunks, in table order (the same view the scan gives)
+static TableSnapshot *tableSnapshotWhereBitmaps(const TableSnapshot *snapshot, const QueryFilter *filter,
+                                                unsigned gradeMask)
+{
+    uint64_t *rows = NULL;
+    size_t count = whereBitmapRows(filter, gradeMask, &rows);
+
+    TableSnapshot *view = (TableSnapshot *)memoryAlloc(MEMORY_SNAPSHOTS, sizeof(TableSnapshot));
+    RecordChunk **chunks = (RecordChunk **)memoryAlloc(MEMORY_SNAPSHOTS,
+                                                       (count / CHUNK_ROWS + studentTable.segmentCount + 1) *
+                                                       sizeof(RecordChunk *));
+    SnapshotSegment *segments =
+        (SnapshotSegment *)memoryAlloc(MEMORY_SNAPSHOTS, (studentTable.segmentCount + 1) * sizeof(SnapshotSegment));
+    if (!view || !chunks || !segments) {
+        fprintf(stderr, "CMS: Out of memory when filtering a snapshot.\n");
+        exit(1);
+    }
+
+    size_t chunkCount = 0;
+    size_t segmentCount = 0;
+    SnapshotSegment *out = NULL;
+    size_t outPosition = 0;
+    RecordChunk *packed = NULL;
+    for (size_t k = 0; k < count; ++k) {
+        size_t position = (size_t)(rows[k] >> 32);
+        int slot = (int)(uint32_t)rows[k];
+        const TableSegment *segment = &studentTable.segments[studentTable.order[position]];
+        if (!out || outPosition != position) {
+            out = &segments[segmentCount++];
+            outPosition = position;
+            out->key = segment->key;
+            out->firstChunk = chunkCount;
+            out->chunkCount = 0;
+            out->count = 0;
+            zoneMapClear(&out->zone);
+            packed = NULL;
+        }
+        if (!packed || packed->used == CHUNK_ROWS) {
+            packed = chunkCreate(0);
+            chunks[chunkCount++] = packed;
+            out->chunkCount++;
+        }
+
+        const RecordChunk *chunk = segment->chunks[slot / CHUNK_ROWS];
+        unsigned i = (unsigned)(slot % CHUNK_ROWS);
+        chunkAppendRow(packed, chunk->ids[i], chunkName(chunk, i), chunkProgramme(chunk, i), chunk->marks[i]);
+        zoneMapAdd(&out->zone, chunk->ids[i], chunk->marks[i]);
+        out->count++;
+    }
+    memoryFree(rows);
+
+    view->chunks = chunks;
+    view->chunkCount = chunkCount;
+    view->count = count;
+    view->segments = segments;
+    view->segmentCount = segmentCount;
+    memcpy(view->databaseFileName, snapshot->databaseFileName, sizeof(view->databaseFileName));
+    return view;
+}
+
+// a chunk that only partly matches: its matching rows are copied into the view
+// (all of them into one packed chunk, their strings from textOffset on)
+typedef struct {
+    const RecordChunk *source;
+    unsigned matches;
+    size_t textBytes;           // bytes the matching rows' strings need
+    size_t target;              // view chunk that gets the matching rows
+    unsigned targetOffset;
+    size_t textOffset;
+} WhereCopy;
+
+typedef struct {
+    const QueryFilter *filter;
+    WhereCopy *copies;
+    RecordChunk **viewChunks;
+} WhereBuild;
+
+static void whereCountTask(void *context, size_t taskIndex, size_t begin, size_t end)
+{
+    WhereBuild *build = (WhereBuild *)context;
+    (void)taskIndex;
+
+    for (size_t k = begin; k < end; ++k) {
+        const RecordChunk *chunk = build->copies[k].source;
+        unsigned matches = 0;
+        size_t textBytes = 0;
+        for (unsigned i = 0; i < chunk->used; ++i) {
+            if (chunk->live[i] && filterMatchesRow(build->filter, chunk, i)) {
+                matches++;
+                textBytes += chunk->names[i].length + chunk->programmes[i].length + 2;
+            }
+        }
+        build->copies[k].matches = matches;
+        build->copies[k].textBytes = textBytes;
+    }
+}
+
+static void whereCopyTask(void *context, size_t taskIndex, size_t begin, size_t end)
+{
+    WhereBuild *build = (WhereBuild *)context;
+    (void)taskIndex;
+
+    for (size_t k = begin; k < end; ++k) {
+        const WhereCopy *copy = &build->copies[k];
+        const RecordChunk *chunk = copy->source;
+        RecordChunk *out = build->viewChunks[copy->target];
+        unsigned offset = copy->targetOffset;
+        size_t textOffset = copy->textOffset;
+
+        // the space was reserved when the view was laid out, tasks never share it
+        for (unsigned i = 0; i < chunk->used; ++i) {
+            if (!chunk->live[i] || !filterMatchesRow(build->filter, chunk, i)) {
+                continue;
+            }
+            out->ids[offset] = chunk->ids[i];
+            out->marks[offset] = chunk->marks[i];
+            const ChunkText *from[2] = { &chunk->names[i], &chunk->programmes[i] };
+            ChunkText *to[2] = { &out->names[offset], &out->programmes[offset] };
+            for (int f = 0; f < 2; ++f) {
+                to[f]->offset = (uint32_t)textOffset;
+                to[f]->length = from[f]->length;
+                memcpy(out->text + textOffset, chunk->text + from[f]->offset, from[f]->length + 1);
+                textOffset += from[f]->length + 1;
+            }
+            offset++;
+        }
+    }
+}
+
+/*
+make a snapshot that only holds the rows matching "filter"
+    - segments (and chunks) whose zone map cannot match are skipped without
+      reading a single row: this is the partition pruning
+    - chunks whose zone map is completely inside the filter are shared
+      with "snapshot" (one more reference, nothing copied)
+    - only the chunks on the edge are read row by row; their matching rows
+      are packed into new chunks (in parallel)
+the rows keep their table order. on the thread that changes the table the
+planner may instead get the rows through the bitmap indexes (see ACCESS PATH).
+returns "snapshot" itself when the filter is not active; release the result
+with tableSnapshotWhereEnd
+*/
+static TableSnapshot *tableSnapshotWhere(TableSnapshot *snapshot, const QueryFilter *filter)
+{
+    if (!filter->active) {
+        return snapshot;
+    }
+    if (!pinnedSnapshot) {
+        WherePlan plan;
+        statsRefreshIfStale();
+        planWhere(snapshot, filter, &plan);
+        if (plan.useBitmaps) {
+            return tableSnapshotWhereBitmaps(snapshot, filter, plan.bitmapGrades);
+        }
+    }
+
+    TableSnapshot *view = (TableSnapshot *)memoryAlloc(MEMORY_SNAPSHOTS, sizeof(TableSnapshot));
+    // every kept chunk gives at most two view chunks (a packed one before a shared one)
+    RecordChunk **chunks =
+        (RecordChunk **)memoryAlloc(MEMORY_SNAPSHOTS, (2 * snapshot->chunkCount + 1) * sizeof(RecordChunk *));
+    SnapshotSegment *segments =
+        (SnapshotSegment *)memoryAlloc(MEMORY_SNAPSHOTS, (snapshot->segmentCount + 1) * sizeof(SnapshotSegment));
+    WhereCopy *copies = (WhereCopy *)memoryAlloc(MEMORY_SNAPSHOTS, (snapshot->chunkCount + 1) * sizeof(WhereCopy));
+    unsigned char *shared = (unsigned char *)memoryCalloc(MEMORY_SNAPSHOTS, snapshot->chunkCount + 1, 1);
+    if (!view || !chunks || !segments || !copies || !shared) {
+        fprintf(stderr, "CMS: Out of memory when filtering a snapshot.\n");
+        exit(1);
+    }
+
+    // 1. decide for every chunk: skip, share (1) or copy some rows (2)
+    size_t copyCount = 0;
+    for (size_t s = 0; s < snapshot->segmentCount; ++s) {
+        const SnapshotSegment *segment = &snapshot->segments[s];
+        if (filterSkipsZone(filter, &segment->zone)) {
+            continue;
+        }
+        int coversSegment = filterCoversZone(filter, &segment->zone);
+        for (size_t c = segment->firstChunk; c < segment->firstChunk + segment->chunkCount; ++c) {
+            const RecordChunk *chunk = snapshot->chunks[c];
+            if (chunk->liveRows == 0 || (!coversSegment && filterSkipsZone(filter, &chunk->zone))) {
+                continue;
+            }
+            if (coversSegment || filterCoversZone(filter, &chunk->zone)) {
+                shared[c] = 1;
+            } else {
+                shared[c] = 2;
+                copies[copyCount].source = chunk;
+                copies[copyCount].matches = 0;
+                copyCount++;
+            }
+        }
+    }
+
+    WhereBuild build;
+    build.filter = filter;
+    build.copies = copies;
+    build.viewChunks = chunks;
+    parallelFor(copyCount, 1, whereCountTask, &build);
+
+    // 2. lay out the view: shared chunks as they are, copied rows packed
+    //    into new chunks that never cross a shared chunk or a segment
+    size_t viewChunkCount = 0;
+    size_t viewSegmentCount = 0;
+    size_t viewCount = 0;
+    size_t k = 0;
+    for (size_t s = 0; s < snapshot->segmentCount; ++s) {
+        const SnapshotSegment *segment = &snapshot->segments[s];
+        SnapshotSegment *out = &segments[viewSegmentCount];
+        out->key = segment->key;
+        out->firstChunk = viewChunkCount;
+        out->count = 0;
+        zoneMapClear(&out->zone);
+
+        RecordChunk *packed = NULL;     // the packed chunk still being filled
+        for (size_t c = segment->firstChunk; c < segment->firstChunk + segment->chunkCount; ++c) {
+            if (shared[c] == 1) {
+                RecordChunk *chunk = snapshot->chunks[c];
+                atomic_fetch_add_explicit(&chunk->refs, 1, memory_order_relaxed);
+                chunks[viewChunkCount++] = chunk;
+                zoneMapMerge(&out->zone, &chunk->zone);
+                out->count += chunk->liveRows;
+                packed = NULL;
+            } else if (shared[c] == 2) {
+                WhereCopy *copy = &copies[k++];
+                unsigned take = copy->matches;
+                if (take == 0) {
+                    continue;
+                }
+                // a chunk's matches (at most CHUNK_ROWS) all go into one packed chunk
+                if (!packed || packed->used + take > CHUNK_ROWS) {
+                    packed = chunkCreate(0);
+                    chunks[viewChunkCount++] = packed;
+                }
+                chunkReserveRows(packed, packed->used + take);
+                chunkReserveText(packed, copy->textBytes);
+                copy->target = viewChunkCount - 1;
+                copy->targetOffset = packed->used;
+                copy->textOffset = packed->textUsed;
+
+                memset(packed->live + packed->used, 1, take);
+                packed->used += take;
+                packed->liveRows += take;
+                packed->textUsed += copy->textBytes;
+                zoneMapMerge(&packed->zone, &copy->source->zone);
+                zoneMapMerge(&out->zone, &copy->source->zone);
+                out->count += take;
+            }
+        }
+
+        out->chunkCount = viewChunkCount - out->firstChunk;
+        if (out->count > 0) {
+            viewCount += out->count;
+            viewSegmentCount++;
+        } else {
+            // nothing matched, only empty packed chunks can be left
+            while (viewChunkCount > out->firstChunk) {
+                chunkRelease(chunks[--viewChunkCount]);
+            }
+        }
+    }
+
+    // 3. copy the matching rows of the edge chunks
+    parallelFor(copyCount, 1, whereCopyTask, &build);
+
+    view->chunks = chunks;
+    view->chunkCount = viewChunkCount;
+    view->count = viewCount;
+    view->segments = segments;
+    view->segmentCount = viewSegmentCount;
+    memcpy(view->databaseFileName, snapshot->databaseFileName, sizeof(view->databaseFileName));
+
+    memoryFree(copies);
+    memoryFree(shared);
+    return view;
+}
+
+static void tableSnapshotWhereEnd(TableSnapshot *view, TableSnapshot *snapshot)
+{
+    if (view != snapshot) {
+        tableSnapshotRelease(view);
+    }
+}
+
+/*
+count the rows of a snapshot that match "filter" without building a view:
+pruned segments and chunks are skipped, covered chunks add their liveRows,
+only the chunks on the edge are read (in parallel)
+*/
+static size_t countSnapshotWhere(const TableSnapshot *snapshot, const QueryFilter *filter)
+{
+    WhereCopy *copies = (WhereCopy *)memoryAlloc(MEMORY_QUERY, (snapshot->chunkCount + 1) * sizeof(WhereCopy));
+    if (!copies) {
+        fprintf(stderr, "CMS: Out of memory when counting rows.\n");
+        exit(1);
+    }
+
+    size_t total = 0;
+    size_t copyCount = 0;
+    for (size_t s = 0; s < snapshot->segmentCount; ++s) {
+        const SnapshotSegment *segment = &snapshot->segments[s];
+        if (filterSkipsZone(filter, &segment->zone)) {
+            continue;
+        }
+        if (filterCoversZone(filter, &segment->zone)) {
+            total += segment->count;
+            continue;
+        }
+        for (size_t c = segment->firstChunk; c < segment->firstChunk + segment->chunkCount; ++c) {
+            const RecordChunk *chunk = snapshot->chunks[c];
+            if (chunk->liveRows == 0 || filterSkipsZone(filter, &chunk->zone)) {
+                continue;
+            }
+            if (filterCoversZone(filter, &chunk->zone)) {
+                total += chunk->liveRows;
+            } else {
+                copies[copyCount].source = chunk;
+                copies[copyCount].matches = 0;
+                copyCount++;
+            }
+        }
+    }
+
+    WhereBuild build;
+    build.filter = filter;
+    build.copies = copies;
+    build.viewChunks = NULL;
+    parallelFor(copyCount, 1, whereCountTask, &build);
+
+    for (size_t k = 0; k < copyCount; ++k) {
+        total += copies[k].matches;
+    }
+    memoryFree(copies);
+    return total;
+}
+
+/*
+COUNT [WHERE ...] without reading records when the bitmap indexes can answer:
+PROGRAMME lists are ORed programme bitmaps, GRADE lists are ORed grade
+bitmaps, the two are ANDed and ID / INTAKE ranges are counted inside the
+result. a MARK range needs the rows: the planner picks a (pruned) scan of
+a snapshot or fetching the bitmaps' candidates, whichever costs less.
+must run on the thread that changes the table (the indexes belong to it)
+returns the number of matching records
+*/
+static size_t countStudentsWhere(const QueryFilter *filter)
+{
+    if (filterHasMarkRange(filter)) {
+        TableSnapshot *snapshot = tableSnapshotAcquire();
+        WherePlan plan;
+        statsRefreshIfStale();
+        planWhere(snapshot, filter, &plan);
+        size_t count = plan.useBitmaps ? whereBitmapRows(filter, plan.bitmapGrades, NULL)
+                                       : countSnapshotWhere(snapshot, filter);
+        tableSnapshotRelease(snapshot);
+        countRows(count);
+        return count;
+    }
+    if (filter->idMin > filter->idMax) {
+        return 0;
+    }
+
+    Roaring programmes = { NULL, 0, 0 };
+    Roaring grades = { NULL, 0, 0 };
+    const Roaring *result = whereBitmaps(filter, filter->gradeMask, &programmes, &grades);
+
+    size_t count;
+    if (filter->idMin == INT_MIN && filter->idMax == INT_MAX) {
+        count = (size_t)roaringCardinality(result);
+    } else {
+        count = (size_t)roaringRangeCardinality(result, roaringValueOfId(filter->idMin),
+                                                roaringValueOfId(filter->idMax));
+    }
+
+    roaringFree(&programmes);
+    roaringFree(&grades);
+    return count;
+}
+
+/*
+list the partitions of a snapshot with their zone maps (SHOW PARTITIONS)
+*/
+static void showPartitions(const TableSnapshot *snapshot)
+{
+    size_t used = 0;
+    for (size_t s = 0; s < snapshot->segmentCount; ++s) {
+        used += snapshot->segments[s].count > 0;
+    }
+
+    outputPrintf("CMS: %zu partition%s (intake = ID / %d).\n",
+                 used, used == 1 ? "" : "s", partitionDivisor);
+    if (used == 0) {
+        return;
+    }
+
+    outputPrintf("Intake Rows Chunks IDs Marks\n");
+    for (size_t s = 0; s < snapshot->segmentCount; ++s) {
+        const SnapshotSegment *segment = &snapshot->segments[s];
+        if (segment->count == 0) {
+            continue;
+        }
+        outputPrintf("%d %zu %zu %d-%d %.1f-%.1f\n",
+                     segment->key,
+                     segment->count,
+                     segment->chunkCount,
+                     segment->zone.idMin,
+                     segment->zone.idMax,
+                     markToDouble(segment->zone.markMin),
+                     markToDouble(segment->zone.markMax));
+    }
+}
+
+
+/*
+try to open a file for reading
+
+1. try the name exactly as the user typed.
+2. if fail and the name is relative, also try "<programDirectoryPath>/<name>".
+
+parameters:
+    fileName   : what user typed
+    actualUsed : will point to the path that successfully opened (for debug, if needed)
+*/
+static FILE *openFileForReadSearch(const char *fileName, const char **actualUsed)
+{
+    FILE *fp = fopen(fileName, "r");
+    *actualUsed = fileName;
+
+    if (!fp && isPathRelative(fileName) && programDirectoryPath[0]) {
+        static char alternativePath[1024];
+        joinPath(alternativePath, sizeof(alternativePath), programDirectoryPath, fileName);
+
+        fp = fopen(alternativePath, "r");
+        if (fp) {
+            *actualUsed = alternativePath;
+        }
+    }
+
+    return fp; //if opened successfully
+}
+
+/*
+open a file for writing. if the file name is relative, we write it into
+the same folder as the .exe / if absolute, use as it is.
+
+parameters:
+    fileName      : logical file name (e.g. "P10-4-CMS.txt" or "output.csv")
+    actualPathOut : buffer to store actual full path
+    pathCapacity  : size of buffer
+*/
+static FILE *openFileForWriteInProgramFolder(const char *fileName,
+                                             char *actualPathOut,
+                                             size_t pathCapacity)
+{
+    if (!fileName || !fileName[0]) {
+        return NULL;
+    }
+
+    if (isPathRelative(fileName) && programDirectoryPath[0]) {
+        joinPath(actualPathOut, pathCapacity, programDirectoryPath, fileName);
+        return fopen(actualPathOut, "w");
+    } else {
+        if (pathCapacity) {
+            strncpy(actualPathOut, fileName, pathCapacity - 1);
+            actualPathOut[pathCapacity - 1] = '\0';
+        }
+        return fopen(fileName, "w");
+    }
+}
+
+/*
+read a tab-separated database file into the global studentTable
+
+file format (TSV):
+    ID<TAB>Name<TAB>Programme<TAB>Mark
+*/
+static int loadDatabaseFromFile(const char *fileName)
+{
+    const char *usedPath = NULL;
+
+    uint64_t span = traceBegin();
+    FILE *fp = openFileForReadSearch(fileName, &usedPath);
+    traceEnd(span, "open file", "%s", fileName);
+    if (!fp) {
+        char cwd[1024];
+
+        if (!getcwd(cwd, sizeof(cwd))) {
+            strncpy(cwd, "<unknown>", sizeof(cwd));
+        }
+
+        fprintf(stderr, "CMS: fopen failed for \"%s\": %s\n",
+                fileName, strerror(errno));
+        fprintf(stderr, "CMS: Current working directory: %s\n", cwd);
+        fprintf(stderr, "CMS: Executable directory   : %s\n",
+                programDirectoryPath[0] ? programDirectoryPath : "<unknown>");
+
+        return 0;
+    }
+
+    // reset table before loading new data
+    span = traceBegin();
+    studentTableClear(&studentTable);
+    traceEnd(span, "clear table", NULL);
 
     char line[1024];
+    size_t rowsRead = 0;        // every line with a row on it, also the ones skipped
+    size_t rowsAdded = 0;
+    TraceBatch batch;
+    traceBatchBegin(&batch);
+    uint64_t phase = phaseStart();
     while (fgets(line, sizeof(line), fp)) {
+        phaseLap(PHASE_READ, &phase);
+        traceBatchRow(&batch, "load rows");
         trimSpaces(line);
         if (!line[0]) {
             continue;   // skip empty lines
         }
+        rowsRead++;
+
+        // split by TAB into 4 tokens
+        char *tokenId   = strtok(line, "\t");
+        char *tokenName = strtok(NULL, "\t");
+        char *tokenProg = strtok(NULL, "\t");
+        char *tokenMark = strtok(NULL, "\t");
+
+        if (!tokenId || !tokenName || !tokenProg || !tokenMark) {
+            continue;   // skip malformed lines
+        }
+
+        int  id = atoi(tokenId);
+        Mark mark;
+        if (!markFromText(tokenMark, &mark)) {
+            continue;   // skip lines without a usable mark
+        }
+        phaseLap(PHASE_PARSE, &phase);
+
+        rowsAdded += (size_t)addStudentRecord(id, tokenName, tokenProg, mark);
+        phaseLap(PHASE_INSERT, &phase);
+    }
+    phaseLap(PHASE_READ, &phase);
+    traceBatchEnd(&batch, "load rows");
+
+    // addStudentRecord counted the rows it added, the rest were read all the same
+    countRows(rowsRead - rowsAdded);
+
+    countBytesRead((uint64_t)ftell(fp));
+    fclose(fp);
+
+    // remember file name logically (for SAVE with no argument)
+    strncpy(lastDatabaseFileName, fileName, sizeof(lastDatabaseFileName) - 1);
+    lastDatabaseFileName[sizeof(lastDatabaseFileName) - 1] = '\0';
+
+    return 1;
+}
+
+// turns one record into one line of text (SAVE, EXPORT CSV, EXPORT SQL)
+typedef void (*RowFormatter)(OutputBuffer *out, const StudentRecord *student);
+
+typedef struct {
+    const TableSnapshot *snapshot;
+    size_t firstChunk;      // first chunk of the current batch
+    OutputBuffer *texts;    // text of every chunk in the batch
+    RowFormatter format;
+} RowWriteBatch;
+
+static void formatChunkRowsTask(void *context, size_t taskIndex, size_t begin, size_t end)
+{
+    RowWriteBatch *batch = (RowWriteBatch *)context;
+    (void)taskIndex;
+
+    for (size_t c = begin; c < end; ++c) {
+        const RecordChunk *chunk = batch->snapshot->chunks[batch->firstChunk + c];
+        OutputBuffer *text = &batch->texts[c];
+        text->length = 0;
+
+        for (unsigned i = 0; i < chunk->used; ++i) {
+            if (chunk->live[i]) {
+                StudentRecord student;
+                chunkReadRow(chunk, i, &student);
+                batch->format(text, &student);
+            }
+        }
+    }
+}
+
+/*
+write every record of a snapshot into fp, in table order
+the chunks are formatted in parallel a batch at a time (so memory stays
+bounded for big tables), then each batch is written out in order
+*/
+static void writeSnapshotRows(FILE *fp, const TableSnapshot *snapshot, RowFormatter format)
+{
+    size_t batchChunks = (size_t)threadPoolWorkerCount() * 4;
+    if (batchChunks < 16) {
+        batchChunks = 16;
+    }
+
+    RowWriteBatch batch;
+    batch.snapshot = snapshot;
+    batch.format = format;
+    batch.texts = (OutputBuffer *)memoryCalloc(MEMORY_OUTPUT, batchChunks, sizeof(OutputBuffer));
+    if (!batch.texts) {
+        fprintf(stderr, "CMS: Out of memory when writing records.\n");
+        exit(1);
+    }
+    countRows(snapshot->count);
+
+    uint64_t phase = phaseStart();
+    for (size_t first = 0; first < snapshot->chunkCount; first += batchChunks) {
+        size_t n = snapshot->chunkCount - first;
+        if (n > batchChunks) {
+            n = batchChunks;
+        }
+
+        batch.firstChunk = first;
+        uint64_t span = traceBegin();
+        parallelFor(n, 1, formatChunkRowsTask, &batch);
+        phaseLap(PHASE_FORMAT, &phase);
+        traceEnd(span, "format rows", "%zu chunks", n);
+
+        span = traceBegin();
+        size_t bytes = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (batch.texts[i].length) {    // a chunk of deleted rows has no text at all
+                fwrite(batch.texts[i].data, 1, batch.texts[i].length, fp);
+                bytes += batch.texts[i].length;
+            }
+        }
+        countBytesWritten(bytes);
+        phaseLap(PHASE_WRITE, &phase);
+        traceEnd(span, "write rows", "%zu bytes", bytes);
+    }
+
+    for (size_t i = 0; i < batchChunks; ++i) {
+        outputFree(&batch.texts[i]);
+    }
+    memoryFree(batch.texts);
+}
+
+// one line of the database file: ID<TAB>Name<TAB>Programme<TAB>Mark
+static void writeDatabaseRow(OutputBuffer *out, const StudentRecord *student)
+{
+    outputAppendPrintf(out, "%d\t%s\t%s\t%.1f\n",
+                       student->id,
+                       student->name,
+                       student->programme,
+                       markToDouble(student->mark));
+}
+
+// save a snapshot of studentTable into a tab-separated file
+// if fileName is NULL or empty, we use the file that was open when the snapshot was taken
+static int saveDatabaseToFile(const TableSnapshot *snapshot, const char *fileName)
+{
+    const char *logicalName =
+        (fileName && fileName[0]) ? fileName : snapshot->databaseFileName;
+
+    if (!logicalName || !logicalName[0]) {
+        return 0;   // we don't know where to save yet
+    }
+
+    char actualPath[1024];
+    FILE *fp = openFileForWriteInProgramFolder(logicalName, actualPath, sizeof(actualPath));
+    if (!fp) {
+        return 0;
+    }
+
+    // each line: ID<TAB>Name<TAB>Programme<TAB>Mark
+    writeSnapshotRows(fp, snapshot, writeDatabaseRow);
+
+    fclose(fp);
+    return 1;
+}
+
+// SUMMARY AND SORTING
+/*
+SORT BY engine, used by SHOW ALL ... SORT BY <col> [ASC|DESC], <col> [ASC|DESC]
+
+every row of the snapshot gets a key string that sorts byte by byte in
+the wanted order (sortKeyWindow):
+    - ID        : 4 bytes, the id with its sign bit flipped
+    - MARK      : 2 bytes, the tenths with their sign bit flipped
+    - NAME,
+      PROGRAMME : the text lowercased (so "tan" and "Tan" sort together),
+                  then a 0 byte so "Tan" comes before "Tan Wei"
+    - DESC      : the bytes of that column inverted
+a SortItem is the row's slot plus the first 8 bytes of its key string as
+one 64-bit number, so most comparisons are one integer compare.
+
+    - ID/MARK only, one column : parallel LSD radix sort (11 bits per pass,
+                                 passes that change nothing are skipped;
+                                 MARK needs only 2 passes)
+    - ID/MARK only, two columns: parallel merge sort on the whole key
+    - with NAME or PROGRAMME   : MSD radix sort on the key string, 8 bytes
+                                 at a time, buckets sorted in parallel
+when two 8-byte keys are equal but the key strings may still differ, the
+rows themselves are compared (compareSortRows), and only then.
+
+all of them are stable, so rows that are equal stay in table order (also
+for DESC, because the key is inverted instead of the result reversed).
+*/
+typedef enum {
+    SORT_COLUMN_ID,
+    SORT_COLUMN_MARK,
+    SORT_COLUMN_NAME,
+    SORT_COLUMN_PROGRAMME
+} SortColumn;
+
+typedef enum {
+    SORT_ASCENDING,
+    SORT_DESCENDING
+} SortDirection;
+
+typedef struct {
+    SortColumn column;
+    SortDirection direction;
+} SortKey;
+
+// every column may appear once, so this is also the number of columns
+#define SORT_MAX_KEYS 4
+
+// keyCount 0 means "table order"
+typedef struct {
+    SortKey keys[SORT_MAX_KEYS];
+    size_t keyCount;
+} SortSpec;
+
+typedef struct {
+    uint64_t key;
+    uint32_t slot;      // chunk * CHUNK_ROWS + row inside the chunk
+} SortItem;
+
+// how to order two items whose keys are equal (NULL: they are equal rows)
+typedef struct {
+    const TableSnapshot *snapshot;
+    const SortSpec *spec;
+} SortTieBreak;
+
+// the values of one row that a sort looks at (a chunk row or a StudentRecord)
+typedef struct {
+    int id;
+    Mark mark;
+    const char *name;
+    const char *programme;
+} SortRowValues;
+
+// below this many items per task, splitting a sort is not worth it
+#define SORT_MIN_GRAIN 16384
+
+#define RADIX_BITS 11
+#define RADIX_BUCKETS (1u << RADIX_BITS)
+
+static size_t sortGrain(size_t count)
+{
+    size_t tasks = (size_t)threadPoolWorkerCount() * PARALLEL_TASKS_PER_WORKER;
+    size_t grain = (count + tasks - 1) / tasks;
+    return grain < SORT_MIN_GRAIN ? SORT_MIN_GRAIN : grain;
+}
+
+/*
+parse the text after "SORT BY" (already uppercase), for example:
+    MARK DESC, ID
+prints what is wrong and returns 0 if the list is not valid
+*/
+static int parseSortSpec(const char *text, SortSpec *spec)
+{
+    char list[256];
+    strncpy(list, text, sizeof(list) - 1);
+    list[sizeof(list) - 1] = '\0';
+
+    spec->keyCount = 0;
+
+    char *rest = list;
+    while (rest) {
+        char *comma = strchr(rest, ',');
+        if (comma) {
+            *comma = '\0';
+        }
+
+        char column[32] = "";
+        char direction[32] = "";
+        char extra[32] = "";
+        int words = sscanf(rest, "%31s %31s %31s", column, direction, extra);
+
+        if (words <= 0) {
+            outputPrintf("CMS: Missing column after SORT BY (use ID, MARK, NAME or PROGRAMME).\n");
+            return 0;
+        }
+        if (words == 3) {
+            outputPrintf("CMS: Unexpected \"%s\" in SORT BY.\n", extra);
+            return 0;
+        }
+
+        SortKey key;
+        if (strcmp(column, "ID") == 0) {
+            key.column = SORT_COLUMN_ID;
+        } else if (strcmp(column, "MARK") == 0) {
+            key.column = SORT_COLUMN_MARK;
+        } else if (strcmp(column, "NAME") == 0) {
+            key.column = SORT_COLUMN_NAME;
+        } else if (strcmp(column, "PROGRAMME") == 0) {
+            key.column = SORT_COLUMN_PROGRAMME;
+        } else {
+            outputPrintf("CMS: Cannot sort by \"%s\" (use ID, MARK, NAME or PROGRAMME).\n", column);
+            return 0;
+        }
+
+        if (words == 1 || strcmp(direction, "ASC") == 0) {
+            key.direction = SORT_ASCENDING;
+        } else if (strcmp(direction, "DESC") == 0) {
+            key.direction = SORT_DESCENDING;
+        } else {
+            outputPrintf("CMS: Expected ASC or DESC after %s, got \"%s\".\n", column, direction);
+            return 0;
+        }
+
+        for (size_t k = 0; k < spec->keyCount; ++k) {
+            if (spec->keys[k].column == key.column) {
+                outputPrintf("CMS: %s appears more than once in SORT BY.\n", column);
+                return 0;
+            }
+        }
+
+        spec->keys[spec->keyCount++] = key;
+        rest = comma ? comma + 1 : NULL;
+    }
+    return 1;
+}
+
+static int isTextColumn(SortColumn column)
+{
+    return column == SORT_COLUMN_NAME || column == SORT_COLUMN_PROGRAMME;
+}
+
+static int sortSpecHasText(const SortSpec *spec)
+{
+    for (size_t k = 0; k < spec->keyCount; ++k) {
+        if (isTextColumn(spec->keys[k].column)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static SortRowValues chunkRowValues(const RecordChunk *chunk, unsigned i)
+{
+    SortRowValues values;
+    values.id = chunk->ids[i];
+    values.mark = chunk->marks[i];
+    values.name = chunkName(chunk, i);
+    values.programme = chunkProgramme(chunk, i);
+    return values;
+}
+
+/*
+the sort key of a row, written out as one string of bytes that sorts
+byte by byte in the wanted order (see SORT BY engine above):
+    - ID, MARK        : 4 / 2 bytes (sign bit flipped)
+    - NAME, PROGRAMME : the text lowercased, then a 0 byte as terminator
+    - DESC            : those bytes inverted
+SortItem.key holds 8 bytes of it, normally from offset 0; the MSD radix
+sort moves to the next 8 bytes for rows whose first 8 are all equal
+*/
+typedef struct {
+    size_t offset;      // first byte we want
+    size_t position;    // bytes produced so far
+    uint64_t window;
+    unsigned filled;
+} SortKeyBytes;
+
+static void sortKeyPush(SortKeyBytes *bytes, unsigned char byte)
+{
+    if (bytes->position >= bytes->offset && bytes->filled < 8) {
+        bytes->window = (bytes->window << 8) | byte;
+        bytes->filled++;
+    }
+    bytes->position++;
+}
+
+/*
+8 bytes of the row's key string from "offset" on (0 bytes after its end)
+length (if not NULL) receives the length of the whole key string
+*/
+static uint64_t sortKeyWindow(const SortSpec *spec, const SortRowValues *row,
+                              size_t offset, size_t *length)
+{
+    SortKeyBytes bytes = { offset, 0, 0, 0 };
+
+    for (size_t k = 0; k < spec->keyCount; ++k) {
+        const SortKey *sortKey = &spec->keys[k];
+        unsigned char invert = sortKey->direction == SORT_DESCENDING ? 0xFF : 0x00;
+
+        // rows are compared from the front, so once the window is full only
+        // the length is still needed
+        if (bytes.filled == 8 && !length) {
+            break;
+        }
+
+        if (isTextColumn(sortKey->column)) {
+            const char *text = sortKey->column == SORT_COLUMN_NAME ? row->name : row->programme;
+            if (bytes.filled == 8 || bytes.position + strlen(text) + 1 <= offset) {
+                bytes.position += strlen(text) + 1;     // nothing of this text is in the window
+                continue;
+            }
+            for (const char *c = text; *c; ++c) {
+                sortKeyPush(&bytes, (unsigned char)tolower((unsigned char)*c) ^ invert);
+            }
+            sortKeyPush(&bytes, invert);
+        } else {
+            uint32_t bits;
+            int shift;
+            if (sortKey->column == SORT_COLUMN_ID) {
+                bits = (uint32_t)row->id ^ 0x80000000u;
+                shift = 24;
+            } else {
+                bits = (uint16_t)row->mark ^ 0x8000u;
+                shift = 8;
+            }
+            for (; shift >= 0; shift -= 8) {
+                sortKeyPush(&bytes, (unsigned char)(bits >> shift) ^ invert);
+            }
+        }
+    }
+
+    if (length) {
+        *length = bytes.position;
+    }
+    return bytes.filled ? bytes.window << (8 * (8 - bytes.filled)) : 0;
+}
+
+// the normal sort key of a row: the first 8 bytes of its key string
+static uint64_t sortRowKey(const SortSpec *spec, const RecordChunk *chunk, unsigned i)
+{
+    SortRowValues row = chunkRowValues(chunk, i);
+    return sortKeyWindow(spec, &row, 0, NULL);
+}
+
+// like strcmp, but "A" and "a" are the same letter
+static int compareFolded(const char *a, const char *b)
+{
+    while (*a && tolower((unsigned char)*a) == tolower((unsigned char)*b)) {
+        a++;
+        b++;
+    }
+    return tolower((unsigned char)*a) - tolower((unsigned char)*b);
+}
+
+// full comparison of two rows by every SORT BY column (<0, 0, >0)
+static int compareSortRows(const SortSpec *spec, const SortRowValues *a, const SortRowValues *b)
+{
+    for (size_t k = 0; k < spec->keyCount; ++k) {
+        int order;
+
+        switch (spec->keys[k].column) {
+        case SORT_COLUMN_ID:
+            order = (a->id > b->id) - (a->id < b->id);
+            break;
+        case SORT_COLUMN_MARK:
+            order = (a->mark > b->mark) - (a->mark < b->mark);
+            break;
+        case SORT_COLUMN_NAME:
+            order = compareFolded(a->name, b->name);
+            break;
+        default:
+            order = compareFolded(a->programme, b->programme);
+            break;
+        }
+
+        if (order) {
+            return spec->keys[k].direction == SORT_DESCENDING ? -order : order;
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    const TableSnapshot *snapshot;
+    const SortSpec *spec;
+    size_t firstChunk;
+    const size_t *firstItem;    // index of the first item of every chunk (from firstChunk on)
+    SortItem *items;
+} SortItemBuild;
+
+static void buildSortItemsTask(void *context, size_t taskIndex, size_t begin, size_t end)
+{
+    SortItemBuild *build = (SortItemBuild *)context;
+    const SortSpec *spec = build->spec;
+    (void)taskIndex;
+
+    for (size_t r = begin; r < end; ++r) {
+        size_t c = build->firstChunk + r;
+        const RecordChunk *chunk = build->snapshot->chunks[c];
+        SortItem *out = build->items + build->firstItem[r];
+
+        for (unsigned i = 0; i < chunk->used; ++i) {
+            if (!chunk->live[i]) {
+                continue;
+            }
+
+            out->key = sortRowKey(spec, chunk, i);
+            out->slot = (uint32_t)(c * CHUNK_ROWS + i);
+            out++;
+        }
+    }
+}
+
+typedef struct {
+    const SortItem *from;
+    SortItem *to;
+    unsigned shift;
+    size_t *counts;     // RADIX_BUCKETS per task: histogram, then write positions
+} RadixPass;
+
+static void radixCountTask(void *context, size_t taskIndex, size_t begin, size_t end)
+{
+    RadixPass *pass = (RadixPass *)context;
+    size_t *counts = pass->counts + taskIndex * RADIX_BUCKETS;
+
+    memset(counts, 0, RADIX_BUCKETS * sizeof(size_t));
+    for (size_t i = begin; i < end; ++i) {
+        counts[(pass->from[i].key >> pass->shift) & (RADIX_BUCKETS - 1)]++;
+    }
+}
+
+static void radixScatterTask(void *context, size_t taskIndex, size_t begin, size_t end)
+{
+    RadixPass *pass = (RadixPass *)context;
+    size_t *positions = pass->counts + taskIndex * RADIX_BUCKETS;
+
+    for (size_t i = begin; i < end; ++i) {
+        size_t digit = (pass->from[i].key >> pass->shift) & (RADIX_BUCKETS - 1);
+        pass->to[positions[digit]++] = pass->from[i];
+    }
+}
+
+/*
+stable LSD radix sort of items on key bits [lowBit, 64)
+every pass counts digits per task, turns the counts into write positions
+(bucket by bucket, task by task, so the order stays stable) and scatters
+returns the buffer that holds the sorted items (items or temp)
+*/
+static SortItem *radixSortItems(SortItem *items, SortItem *temp, size_t count, unsigned lowBit)
+{
+    size_t grain = sortGrain(count);
+    size_t taskCount = parallelTaskCount(count, grain);
+    RadixPass pass;
+
+    pass.counts = (size_t *)memoryAlloc(MEMORY_SORT, (taskCount ? taskCount : 1) * RADIX_BUCKETS * sizeof(size_t));
+    if (!pass.counts) {
+        fprintf(stderr, "CMS: Out of memory in radixSortItems.\n");
+        exit(1);
+    }
+
+    SortItem *from = items;
+    SortItem *to = temp;
+
+    for (unsigned shift = lowBit; shift < 64; shift += RADIX_BITS) {
+        pass.from = from;
+        pass.to = to;
+        pass.shift = shift;
+        parallelFor(count, grain, radixCountTask, &pass);
+
+        size_t position = 0;
+        int allOneDigit = 0;
+        for (size_t digit = 0; digit < RADIX_BUCKETS; ++digit) {
+            size_t bucketStart = position;
+            for (size_t t = 0; t < taskCount; ++t) {
+                size_t n = pass.counts[t * RADIX_BUCKETS + digit];
+                pass.counts[t * RADIX_BUCKETS + digit] = position;
+                position += n;
+            }
+            if (position - bucketStart == count) {
+                allOneDigit = 1;
+            }
+        }
+
+        // every key has the same digit here: this pass would only copy
+        if (allOneDigit) {
+            continue;
+        }
+
+        parallelFor(count, grain, radixScatterTask, &pass);
+        SortItem *swap = from;
+        from = to;
+        to = swap;
+    }
+
+    memoryFree(pass.counts);
+    return from;
+}
+
+static int sortItemLess(const SortTieBreak *ties, const SortItem *a, const SortItem *b)
+{
+    if (a->key != b->key || !ties) {
+        return a->key < b->key;
+    }
+
+    // same key prefix: compare the rows themselves, then keep table order
+    const TableSnapshot *snapshot = ties->snapshot;
+    SortRowValues x = chunkRowValues(snapshot->chunks[a->slot / CHUNK_ROWS], a->slot % CHUNK_ROWS);
+    SortRowValues y = chunkRowValues(snapshot->chunks[b->slot / CHUNK_ROWS], b->slot % CHUNK_ROWS);
+    int order = compareSortRows(ties->spec, &x, &y);
+    return order ? order < 0 : a->slot < b->slot;
+}
+
+// stable merge of two sorted runs (on equal keys "a" goes first)
+static void mergeSortedRuns(const SortItem *a, size_t na,
+                            const SortItem *b, size_t nb,
+                            SortItem *out, const SortTieBreak *ties)
+{
+    size_t i = 0;
+    size_t j = 0;
+
+    while (i < na && j < nb) {
+        if (sortItemLess(ties, &b[j], &a[i])) {
+            *out++ = b[j++];
+        } else {
+            *out++ = a[i++];
+        }
+    }
+    memcpy(out, a + i, (na - i) * sizeof(SortItem));
+    out += na - i;
+    memcpy(out, b + j, (nb - j) * sizeof(SortItem));
+}
+
+// single-threaded stable merge sort (insertion sort for small runs first)
+static void mergeSortSerial(SortItem *items, SortItem *temp, size_t count, const SortTieBreak *ties)
+{
+    const size_t smallRun = 32;
+
+    for (size_t start = 0; start < count; start += smallRun) {
+        size_t end = start + smallRun < count ? start + smallRun : count;
+        for (size_t i = start + 1; i < end; ++i) {
+            SortItem item = items[i];
+            size_t j = i;
+            while (j > start && sortItemLess(ties, &item, &items[j - 1])) {
+                items[j] = items[j - 1];
+                j--;
+            }
+            items[j] = item;
+        }
+    }
+
+    SortItem *from = items;
+    SortItem *to = temp;
+    for (size_t width = smallRun; width < count; width *= 2) {
+        for (size_t start = 0; start < count; start += 2 * width) {
+            size_t middle = start + width < count ? start + width : count;
+            size_t end = start + 2 * width < count ? start + 2 * width : count;
+            mergeSortedRuns(from + start, middle - start, from + middle, end - middle,
+                            to + start, ties);
+        }
+        SortItem *swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != items) {
+        memcpy(items, from, count * sizeof(SortItem));
+    }
+}
+
+/*
+how many items of run "a" are among the first k outputs of a stable merge
+of a and b (binary search, so one big merge can be cut into pieces)
+*/
+static size_t mergeSplitPoint(const SortItem *a, size_t na,
+                              const SortItem *b, size_t nb, size_t k,
+                              const SortTieBreak *ties)
+{
+    size_t low = k > nb ? k - nb : 0;
+    size_t high = k < na ? k : na;
+
+    // inside the loop i < na and 0 < j <= nb, so a[i] and b[j - 1] exist
+    while (low < high) {
+        size_t i = low + (high - low) / 2;
+        size_t j = k - i;
+        if (sortItemLess(ties, &b[j - 1], &a[i])) {
+            high = i;       // b[j - 1] goes before a[i]: too many from a
+        } else {
+            low = i + 1;    // a[i] goes before b[j - 1]: take more from a
+        }
+    }
+    return low;
+}
+
+typedef struct {
+    const SortItem *a;
+    size_t na;
+    const SortItem *b;
+    size_t nb;
+    SortItem *out;
+} MergePiece;
+
+typedef struct {
+    SortItem *items;
+    SortItem *temp;
+    size_t count;
+    size_t grain;
+    MergePiece *pieces;
+    const SortTieBreak *ties;
+} ParallelMergeSort;
+
+static void mergeSortRunTask(void *context, size_t taskIndex, size_t begin, size_t end)
+{
+    ParallelMergeSort *sort = (ParallelMergeSort *)context;
+    (void)taskIndex;
+    mergeSortSerial(sort->items + begin, sort->temp + begin, end - begin, sort->ties);
+}
+
+static void mergePieceTask(void *context, size_t taskIndex, size_t begin, size_t end)
+{
+    ParallelMergeSort *sort = (ParallelMergeSort *)context;
+    (void)taskIndex;
+
+    for (size_t p = begin; p < end; ++p) {
+        const MergePiece *piece = &sort->pieces[p];
+        mergeSortedRuns(piece->a, piece->na, piece->b, piece->nb, piece->out, sort->ties);
+    }
+}
+
+/*
+stable parallel merge sort:
+    1. every task sorts its own run (mergeSortSerial)
+    2. runs are merged in pairs, round after round; every merge is cut into
+       pieces of about one grain (mergeSplitPoint), so the last rounds with
+       only one or two big merges still use all workers
+*/
+static void parallelMergeSortItems(SortItem *items, SortItem *temp, size_t count,
+                                   const SortTieBreak *ties)
+{
+    ParallelMergeSort sort;
+    sort.ties = ties;
+    sort.items = items;
+    sort.temp = temp;
+    sort.count = count;
+    sort.grain = sortGrain(count);
+
+    size_t runLength = sort.grain;
+    parallelFor(count, runLength, mergeSortRunTask, &sort);
+
+    size_t maxPieces = count / sort.grain + 2 * parallelTaskCount(count, runLength) + 1;
+    sort.pieces = (MergePiece *)memoryAlloc(MEMORY_SORT, maxPieces * sizeof(MergePiece));
+    if (!sort.pieces) {
+        fprintf(stderr, "CMS: Out of memory in parallelMergeSortItems.\n");
+        exit(1);
+    }
+
+    SortItem *from = items;
+    SortItem *to = temp;
+    for (; runLength < count; runLength *= 2) {
+        size_t pieceCount = 0;
+
+        for (size_t start = 0; start < count; start += 2 * runLength) {
+            size_t middle = start + runLength < count ? start + runLength : count;
+            size_t end = start + 2 * runLength < count ? start + 2 * runLength : count;
+            const SortItem *a = from + start;
+            const SortItem *b = from + middle;
+            size_t na = middle - start;
+            size_t nb = end - middle;
+
+            size_t previousK = 0;
+            size_t previousI = 0;
+            for (size_t k = sort.grain; ; k += sort.grain) {
+                if (k > na + nb) {
+                    k = na + nb;
+                }
+                size_t i = mergeSplitPoint(a, na, b, nb, k, ties);
+
+                MergePiece *piece = &sort.pieces[pieceCount++];
+                piece->a = a + previousI;
+                piece->na = i - previousI;
+                piece->b = b + (previousK - previousI);
+                piece->nb = (k - i) - (previousK - previousI);
+                piece->out = to + start + previousK;
+
+                previousK = k;
+                previousI = i;
+                if (k == na + nb) {
+                    break;
+                }
+            }
+        }
+
+        parallelFor(pieceCount, 1, mergePieceTask, &sort);
+        SortItem *swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != items) {
+        memcpy(items, from, count * sizeof(SortItem));
+    }
+    memoryFree(sort.pieces);
+}
+
+// buckets this small are left to mergeSortSerial (insertion sort inside)
+#define MSD_SMALL_BUCKET 48
+
+typedef struct {
+    SortItem *items;
+    SortItem *temp;
+    size_t starts[256];
+    size_t counts[256];
+    size_t offset;
+    unsigned depth;
+    const SortTieBreak *ties;
+} MsdBuckets;
+
+static void msdRadixSort(SortItem *items, SortItem *temp, size_t count, size_t offset,
+                         unsigned depth, const SortTieBreak *ties, int parallel);
+
+static void msdBucketTask(void *context, size_t taskIndex, size_t begin, size_t end)
+{
+    MsdBuckets *buckets = (MsdBuckets *)context;
+    (void)taskIndex;
+
+    for (size_t b = begin; b < end; ++b) {
+        size_t start = buckets->starts[b];
+        msdRadixSort(buckets->items + start, buckets->temp + start, buckets->counts[b],
+                     buckets->offset, buckets->depth + 1, buckets->ties, 0);
+    }
+}
+
+/*
+MSD radix sort on the key strings (see sortKeyWindow), used when a column
+is a text. the items hold bytes [offset, offset + 8) of their key
+string and we are at byte "depth" of those 8:
+    - rows are spread over 256 buckets by that byte, every bucket is then
+      sorted on the next byte (with "parallel" set, on the thread pool)
+    - when all 8 bytes are used up, the keys are refilled with the next 8
+      bytes of the key string (so "Student 1..." names still sort fast)
+    - small buckets go to mergeSortSerial, which compares the full rows
+items start in table order and every step keeps the order of equal rows,
+so rows with the same key string stay in table order.
+note: this changes SortItem.key, which then no longer holds the row's key
+*/
+static void msdRadixSort(SortItem *items, SortItem *temp, size_t count, size_t offset,
+                         unsigned depth, const SortTieBreak *ties, int parallel)
+{
+    MsdBuckets buckets;
+
+    while (1) {
+        if (count < MSD_SMALL_BUCKET) {
+            mergeSortSerial(items, temp, count, ties);
+            return;
+        }
+
+        if (depth == 8) {
+            offset += 8;
+            depth = 0;
+
+            size_t longest = 0;
+            for (size_t i = 0; i < count; ++i) {
+                const TableSnapshot *snapshot = ties->snapshot;
+                SortRowValues row = chunkRowValues(snapshot->chunks[items[i].slot / CHUNK_ROWS],
+                                                   items[i].slot % CHUNK_ROWS);
+                size_t length;
+                items[i].key = sortKeyWindow(ties->spec, &row, offset, &length);
+                if (length > longest) {
+                    longest = length;
+                }
+            }
+
+            // every key string ended already: these rows are equal and in table order
+            if (longest <= offset) {
+                return;
+            }
+        }
+
+        unsigned shift = 56 - 8 * depth;
+        memset(buckets.counts, 0, sizeof(buckets.counts));
+        for (size_t i = 0; i < count; ++i) {
+            buckets.counts[(items[i].key >> shift) & 0xFF]++;
+        }
+
+        // all rows share this byte: look at the next one, nothing to move
+        if (buckets.counts[(items[0].key >> shift) & 0xFF] == count) {
+            depth++;
+            continue;
+        }
+        break;
+    }
+
+    size_t position = 0;
+    for (unsigned b = 0; b < 256; ++b) {
+        buckets.starts[b] = position;
+        position += buckets.counts[b];
+    }
+
+    size_t next[256];
+    memcpy(next, buckets.starts, sizeof(next));
+    unsigned shift = 56 - 8 * depth;
+    for (size_t i = 0; i < count; ++i) {
+        temp[next[(items[i].key >> shift) & 0xFF]++] = items[i];
+    }
+    memcpy(items, temp, count * sizeof(SortItem));
+
+    buckets.items = items;
+    buckets.temp = temp;
+    buckets.offset = offset;
+    buckets.depth = depth;
+    buckets.ties = ties;
+
+    if (parallel) {
+        parallelFor(256, 1, msdBucketTask, &buckets);
+    } else {
+        msdBucketTask(&buckets, 0, 0, 256);
+    }
+}
+
+/*
+sort the rows of the chunks [firstChunk, endChunk) of a snapshot
+returns a malloc'ed array of the live rows of those chunks in the wanted
+order (table order if spec->keyCount is 0) and their number in *countOut,
+or NULL if out of memory
+*/
+static SortItem *sortSnapshotChunks(const TableSnapshot *snapshot, const SortSpec *spec,
+                                    size_t firstChunk, size_t endChunk, size_t *countOut)
+{
+    size_t chunkCount = endChunk - firstChunk;
+    size_t *firstItem = (size_t *)memoryAlloc(MEMORY_SORT, (chunkCount + 1) * sizeof(size_t));
+    if (!firstItem) {
+        return NULL;
+    }
+
+    // where every chunk's rows start in the item array
+    size_t count = 0;
+    for (size_t c = 0; c < chunkCount; ++c) {
+        firstItem[c] = count;
+        count += snapshot->chunks[firstChunk + c]->liveRows;
+    }
+
+    SortItem *items = (SortItem *)memoryAlloc(MEMORY_SORT, (count ? count : 1) * sizeof(SortItem));
+    if (!items) {
+        memoryFree(firstItem);
+        return NULL;
+    }
+    uint64_t span = traceBegin();
+
+    SortItemBuild build;
+    build.snapshot = snapshot;
+    build.spec = spec;
+    build.firstChunk = firstChunk;
+    build.firstItem = firstItem;
+    build.items = items;
+    parallelFor(chunkCount, PARALLEL_AUTO_GRAIN, buildSortItemsTask, &build);
+    memoryFree(firstItem);
+    traceEnd(span, "build sort keys", "%zu rows", count);
+
+    *countOut = count;
+    if (spec->keyCount == 0 || count < 2) {
+        return items;
+    }
+    span = traceBegin();
+
+    SortItem *temp = (SortItem *)memoryAlloc(MEMORY_SORT, count * sizeof(SortItem));
+    if (!temp) {
+        memoryFree(items);
+        return NULL;
+    }
+
+    SortTieBreak ties;
+    ties.snapshot = snapshot;
+    ties.spec = spec;
+
+    if (sortSpecHasText(spec)) {
+        msdRadixSort(items, temp, count, 0, 0, &ties, 1);
+    } else if (spec->keyCount == 1) {
+        // the key is in the top 4 (ID) or 2 (MARK) bytes
+        unsigned lowBit = spec->keys[0].column == SORT_COLUMN_MARK ? 48 : 32;
+        SortItem *sorted = radixSortItems(items, temp, count, lowBit);
+        if (sorted != items) {
+            SortItem *swap = items;
+            items = temp;
+            temp = swap;
+        }
+    } else {
+        parallelMergeSortItems(items, temp, count, NULL);
+    }
+    traceEnd(span, "sort", "%zu rows", count);
+
+    memoryFree(temp);
+    return items;
+}
+
+// RESULT FORMATS (SET OUTPUT, COLUMNS, ... INTO <file>)
+/*
+the rows a query command answers with (SHOW ALL, SHOW TOP, FIND, QUERY) are
+its result: a column line and one line per row. SET OUTPUT chooses how the
+session gets them:
+    - text  : ID Name Programme Mark separated by spaces (the default)
+    - tsv   : the same columns separated by tabs; a tab, line end or
+              backslash in a name or programme is written as \t, \n, \r
+              or \\, so every row stays one line of four columns
+    - csv   : like EXPORT CSV, name and programme in quotes
+    - json  : one {"id":...,"name":"...","programme":"...","mark":...}
+              object per line, no column line
+    - binary: "CMSROWS1", a byte with the number of columns and one byte
+              per column (0 ID, 1 mark, 2 name, 3 programme), then per row
+              the ID (int32), the mark in tenths (int16), a name or a
+              programme as a length byte and its bytes, little-endian
+"SHOW ID, MARK ..." or "... COLUMNS ID, MARK" keeps only those columns, in
+that order; the chunks store every column apart, so the name and programme
+of a row are not even read when they are not shown (or searched, sorted)
+"... INTO <file>" at the end of a query command writes its result into a
+file instead; the CMS: lines around it (headings, page footers) still go to
+the screen
+the rows are written digit by digit, straight from the chunk columns into
+the output buffer (which goes to its file every 64 KB), no printf and no
+copy of the row
+*/
+typedef enum {
+    RESULT_TEXT,
+    RESULT_TSV,
+    RESULT_CSV,
+    RESULT_JSON,
+    RESULT_BINARY,
+    RESULT_FORMAT_COUNT
+} ResultFormat;
+
+static const char *const resultFormatNames[RESULT_FORMAT_COUNT] = { "text", "tsv", "csv", "json", "binary" };
+
+#define RESULT_MAX_COLUMNS 4
+
+// how result rows are written: the format and the columns, in order (given to the formatting threads)
+typedef struct {
+    ResultFormat format;
+    size_t columnCount;
+    SortColumn columns[RESULT_MAX_COLUMNS];
+} ResultLayout;
+
+/*
+the result of the running command, per thread like currentOutput
+    - layout   : SET OUTPUT of the session, the COLUMNS of the command
+    - projected: 1 if the command chose its columns
+    - into     : the buffer of the INTO file, NULL: the result goes to currentOutput
+    - rows     : rows written so far (for "CMS: 12 rows written to ...")
+*/
+typedef struct {
+    ResultLayout layout;
+    int projected;
+    OutputBuffer *into;
+    uint64_t rows;
+} ResultTarget;
+
+static CMS_THREAD_LOCAL ResultTarget currentResult = {
+    { RESULT_TEXT, 4, { SORT_COLUMN_ID, SORT_COLUMN_NAME, SORT_COLUMN_PROGRAMME, SORT_COLUMN_MARK } }, 0, NULL, 0
+};
+
+// a new command: all four columns again, in the session's format
+static void resultReset(ResultFormat format)
+{
+    currentResult.layout.format = format;
+    currentResult.layout.columnCount = 4;
+    currentResult.layout.columns[0] = SORT_COLUMN_ID;
+    currentResult.layout.columns[1] = SORT_COLUMN_NAME;
+    currentResult.layout.columns[2] = SORT_COLUMN_PROGRAMME;
+    currentResult.layout.columns[3] = SORT_COLUMN_MARK;
+    currentResult.projected = 0;
+}
+
+// the longest row: JSON with every character escaped (\u00XX)
+#define RESULT_ROW_MAX (6 * (NAME_MAX_LENGTH + PROGRAMME_MAX_LENGTH) + 64)
+
+static OutputBuffer *resultOutput(void)
+{
+    return currentResult.into ? currentResult.into : currentOutput;
+}
+
+// the digits of value, at p; returns the end
+static char *putInt(char *p, int value)
+{
+    char digits[12];
+    unsigned n = 0;
+    uint32_t rest = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+    if (value < 0) {
+        *p++ = '-';
+    }
+    do {
+        digits[n++] = (char)('0' + rest % 10);
+        rest /= 10;
+    } while (rest);
+    while (n) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+// a mark the way "%.1f" prints it: 88.8, -0.5, 0.0
+static char *putMark(char *p, Mark mark)
+{
+    int tenths = mark;
+    if (tenths < 0) {
+        *p++ = '-';
+        tenths = -tenths;
+    }
+    p = putInt(p, tenths / 10);
+    *p++ = '.';
+    *p++ = (char)('0' + tenths % 10);
+    return p;
+}
+
+static char *putText(char *p, const char *text)
+{
+    size_t length = strlen(text);
+    memcpy(p, text, length);
+    return p + length;
+}
+
+// "text" for CSV: in quotes, a quote doubled
+static char *putCsvText(char *p, const char *text)
+{
+    *p++ = '"';
+    for (; *text; ++text) {
+        if (*text == '"') {
+            *p++ = '"';
+        }
+        *p++ = *text;
+    }
+    *p++ = '"';
+    return p;
+}
+
+// text for TSV: tab, line ends and backslash escaped (\t \n \r \\)
+static char *putTsvText(char *p, const char *text)
+{
+    for (; *text; ++text) {
+        char c = *text;
+        if (c == '\t' || c == '\n' || c == '\r' || c == '\\') {
+            *p++ = '\\';
+            *p++ = c == '\t' ? 't' : c == '\n' ? 'n' : c == '\r' ? 'r' : '\\';
+        } else {
+            *p++ = c;
+        }
+    }
+    return p;
+}
+
+// "text" for JSON: quote, backslash and control characters escaped, other bytes as they are (UTF-8)
+static char *putJsonText(char *p, const char *text)
+{
+    static const char hex[] = "0123456789abcdef";
+    *p++ = '"';
+    for (; *text; ++text) {
+        unsigned char c = (unsigned char)*text;
+        if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = (char)c;
+        } else if (c < 0x20) {
+            p = putText(p, "\\u00");
+            *p++ = hex[c >> 4];
+            *p++ = hex[c & 15];
+        } else {
+            *p++ = (char)c;
+        }
+    }
+    *p++ = '"';
+    return p;
+}
+
+// a row was written straight into the free space of out (after outputReserve), up to end
+static void outputEndRow(OutputBuffer *out, char *end)
+{
+    out->length = (size_t)(end - out->data);
+    out->data[out->length] = '\0';
+    if (out->sink && out->length >= OUTPUT_FLUSH_THRESHOLD) {
+        outputFlush(out);
+    }
+}
+
+// a length byte, then the bytes (binary format)
+static char *putSizedText(char *p, const char *text)
+{
+    size_t length = strlen(text);
+    *p++ = (char)(unsigned char)length;
+    memcpy(p, text, length);
+    return p + length;
+}
+
+// little-endian, for the binary format
+static char *putLittleEndian(char *p, uint32_t value, unsigned bytes)
+{
+    for (unsigned b = 0; b < bytes; ++b) {
+        *p++ = (char)(unsigned char)(value >> (8 * b));
+    }
+    return p;
+}
+
+static char *putResultText(char *p, ResultFormat format, const char *text)
+{
+    switch (format) {
+    case RESULT_TSV:
+        return putTsvText(p, text);
+    case RESULT_CSV:
+        return putCsvText(p, text);
+    case RESULT_JSON:
+        return putJsonText(p, text);
+    case RESULT_BINARY:
+        return putSizedText(p, text);
+    default:
+        return putText(p, text);
+    }
+}
+
+/*
+append row i of a chunk to out, as the layout says
+only the columns of the layout are read from the chunk
+*/
+static void writeResultRow(OutputBuffer *out, const ResultLayout *layout, const RecordChunk *chunk, unsigned i)
+{
+    static const char separators[RESULT_FORMAT_COUNT] = { ' ', '\t', ',', ',', 0 };
+    static const char *const jsonKeys[RESULT_MAX_COLUMNS] = {
+        "\"id\":", "\"mark\":", "\"name\":", "\"programme\":"
+    };
+    ResultFormat format = layout->format;
+    int binary = format == RESULT_BINARY;
+
+    outputReserve(out, RESULT_ROW_MAX);
+    char *p = out->data + out->length;
+    if (format == RESULT_JSON) {
+        *p++ = '{';
+    }
+    for (size_t c = 0; c < layout->columnCount; ++c) {
+        if (c > 0 && !binary) {
+            *p++ = separators[format];
+        }
+        if (format == RESULT_JSON) {
+            p = putText(p, jsonKeys[layout->columns[c]]);
+        }
+        switch (layout->columns[c]) {
+        case SORT_COLUMN_ID:
+            p = binary ? putLittleEndian(p, (uint32_t)chunk->ids[i], 4) : putInt(p, chunk->ids[i]);
+            break;
+        case SORT_COLUMN_MARK:
+            p = binary ? putLittleEndian(p, (uint16_t)chunk->marks[i], 2) : putMark(p, chunk->marks[i]);
+            break;
+        case SORT_COLUMN_NAME:
+            p = putResultText(p, format, chunkName(chunk, i));
+            break;
+        case SORT_COLUMN_PROGRAMME:
+            p = putResultText(p, format, chunkProgramme(chunk, i));
+            break;
+        }
+    }
+    if (format == RESULT_JSON) {
+        *p++ = '}';
+    }
+    if (!binary) {
+        *p++ = '\n';
+    }
+    outputEndRow(out, p);
+}
+
+// the column line (or the binary signature and columns) that starts a result
+static void resultHeader(void)
+{
+    static const char separators[RESULT_FORMAT_COUNT] = { ' ', '\t', ',', ',', 0 };
+    static const char *const titles[RESULT_MAX_COLUMNS] = { "ID", "Mark", "Name", "Programme" };
+    const ResultLayout *layout = &currentResult.layout;
+    OutputBuffer *out = resultOutput();
+
+    if (layout->format == RESULT_JSON) {
+        return;
+    }
+    if (layout->format == RESULT_BINARY) {
+        outputAppend(out, "CMSROWS1", 8);
+        char columns[1 + RESULT_MAX_COLUMNS];
+        columns[0] = (char)layout->columnCount;
+        for (size_t c = 0; c < layout->columnCount; ++c) {
+            columns[1 + c] = (char)layout->columns[c];
+        }
+        outputAppend(out, columns, 1 + layout->columnCount);
+        return;
+    }
+    for (size_t c = 0; c < layout->columnCount; ++c) {
+        if (c > 0) {
+            outputAppend(out, &separators[layout->format], 1);
+        }
+        outputAppend(out, titles[layout->columns[c]], strlen(titles[layout->columns[c]]));
+    }
+    outputAppend(out, "\n", 1);
+}
+
+// rows another thread formatted for the result
+static void resultAppend(const OutputBuffer *text, size_t rows)
+{
+    if (text->length) {
+        outputAppend(resultOutput(), text->data, text->length);
+    }
+    currentResult.rows += rows;
+}
+
+static void resultWriteRow(const RecordChunk *chunk, unsigned i)
+{
+    writeResultRow(resultOutput(), &currentResult.layout, chunk, i);
+    currentResult.rows++;
+}
+
+typedef struct {
+    const TableSnapshot *snapshot;
+    const SortItem *items;
+    size_t first;       // first item of the current batch
+    size_t end;         // one past the last item
+    RowFormatter format;
+    const ResultLayout *layout;     // result rows, used instead of format if set
+    OutputBuffer *texts;
+} SortedRowsWrite;
+
+#define WRITE_PIECE_ROWS 4096
+
+static void formatSortedRowsTask(void *context, size_t taskIndex, size_t begin, size_t end)
+{
+    SortedRowsWrite *write = (SortedRowsWrite *)context;
+    (void)taskIndex;
+
+    for (size_t p = begin; p < end; ++p) {
+        OutputBuffer *text = &write->texts[p];
+        size_t from = write->first + p * WRITE_PIECE_ROWS;
+        size_t to = from + WRITE_PIECE_ROWS < write->end ? from + WRITE_PIECE_ROWS : write->end;
+
+        text->length = 0;
+        for (size_t i = from; i < to; ++i) {
+            uint32_t slot = write->items[i].slot;
+            const RecordChunk *chunk = write->snapshot->chunks[slot / CHUNK_ROWS];
+            if (write->layout) {
+                writeResultRow(text, write->layout, chunk, slot % CHUNK_ROWS);
+            } else {
+                StudentRecord student;
+                chunkReadRow(chunk, slot % CHUNK_ROWS, &student);
+                write->format(text, &student);
+            }
+        }
+    }
+}
+
+/*
+append the rows listed in items (in that order) to out, formatted by format
+or, if it is set, as result rows of layout
+the rows are formatted in parallel a batch at a time, then appended in order
+*/
+static void writeSortedRowsWith(OutputBuffer *out, const TableSnapshot *snapshot, const SortItem *items,
+                                size_t count, RowFormatter format, const ResultLayout *layout)
+{
+    size_t batchPieces = (size_t)threadPoolWorkerCount() * 4;
+    SortedRowsWrite write;
+    write.snapshot = snapshot;
+    write.items = items;
+    write.end = count;
+    write.format = format;
+    write.layout = layout;
+    write.texts = (OutputBuffer *)memoryCalloc(MEMORY_OUTPUT, batchPieces, sizeof(OutputBuffer));
+    if (!write.texts) {
+        fprintf(stderr, "CMS: Out of memory when writing sorted rows.\n");
+        exit(1);
+    }
+
+    uint64_t phase = phaseStart();
+    for (write.first = 0; write.first < count; write.first += batchPieces * WRITE_PIECE_ROWS) {
+        size_t pieces = (count - write.first + WRITE_PIECE_ROWS - 1) / WRITE_PIECE_ROWS;
+        if (pieces > batchPieces) {
+            pieces = batchPieces;
+        }
+
+        uint64_t span = traceBegin();
+        parallelFor(pieces, 1, formatSortedRowsTask, &write);
+        phaseLap(PHASE_FORMAT, &phase);
+        traceEnd(span, "format rows", "%zu pieces", pieces);
+
+        span = traceBegin();
+        for (size_t p = 0; p < pieces; ++p) {
+            outputAppend(out, write.texts[p].data, write.texts[p].length);
+        }
+        phaseLap(PHASE_WRITE, &phase);
+        traceEnd(span, "write rows", NULL);
+    }
+
+    for (size_t p = 0; p < batchPieces; ++p) {
+        outputFree(&write.texts[p]);
+    }
+    memoryFree(write.texts);
+}
+
+static void writeSortedRows(OutputBuffer *out, const TableSnapshot *snapshot,
+                            const SortItem *items, size_t count, RowFormatter format)
+{
+    writeSortedRowsWith(out, snapshot, items, count, format, NULL);
+}
+
+// the rows listed in items, in that order, as the command's result
+static void resultWriteSortedRows(const TableSnapshot *snapshot, const SortItem *items, size_t count)
+{
+    writeSortedRowsWith(resultOutput(), snapshot, items, count, NULL, &currentResult.layout);
+    currentResult.rows += count;
+}
+
+/*
+print all records to the console, in the order given by spec
+implementation:
+- sortSnapshotChunks sorts (slot, key) items, the records themselves are not copied
+- the rows are formatted in parallel, a batch at a time, and printed in order
+*/
+static void showAllStudents(const TableSnapshot *snapshot, const SortSpec *spec)
+{
+    size_t count = 0;
+    uint64_t phase = phaseStart();
+    SortItem *items = sortSnapshotChunks(snapshot, spec, 0, snapshot->chunkCount, &count);
+    phaseLap(PHASE_SORT, &phase);
+    if (!items) {
+        fprintf(stderr, "CMS: Out of memory in showAllStudents.\n");
+        return;
+    }
+
+    countRows(count);
+
+    // print heading and all rows
+    outputPrintf("CMS: Here are all the records found in the table \"StudentRecords\".\n");
+    resultHeader();
+
+    resultWriteSortedRows(snapshot, items, count);
+    memoryFree(items);
+}
+
+// EXTERNAL SORT (sorted exports)
+/*
+EXPORT CSV/SQL <file> SORT BY ... must work for tables whose sort data does
+not fit in memory, so it is an external merge sort under a memory budget:
+
+    1. runs: take as many chunks as fit in the budget, sort them in memory
+       (sortSnapshotChunks) and spill the sorted rows (key + record) into
+       a temporary file
+    2. merge: read runs side by side and always take the smallest head row,
+       using a loser tree (one comparison per tree level for every row).
+       as soon as MERGE_MAX_RUNS runs of the same size are waiting they are
+       merged into one longer run (like carrying in a base-64 counter), so
+       only a few files, each with a small buffer, are ever open
+    3. every row that comes out of the final merge goes straight to the
+       CSV/SQL formatting, through a 64 KB output buffer
+
+if the whole table fits in one run nothing is spilled at all.
+ties between runs go to the earlier run, so the export is stable like SHOW ALL.
+the budget is 64 MB, or CMS_SORT_MEMORY_MB megabytes.
+*/
+#define SORT_DEFAULT_MEMORY_MB 64
+#define MERGE_MAX_RUNS 64
+#define RUN_BUFFER_SIZE (64 * 1024)
+
+// one row inside a run file: this header, then the name and programme bytes
+typedef struct {
+    uint64_t key;
+    int32_t id;
+    Mark mark;
+    uint16_t nameLength;
+    uint16_t programmeLength;
+} RunRowHeader;
+
+// the current head row of a run during the merge
+typedef struct {
+    uint64_t key;
+    StudentRecord record;
+} RunRow;
+
+static size_t sortMemoryBudget(void)
+{
+    const char *setting = getenv("CMS_SORT_MEMORY_MB");
+    int megabytes;
+
+    if (setting && stringToInt(setting, &megabytes) && megabytes > 0) {
+        return (size_t)megabytes * 1024 * 1024;
+    }
+    return (size_t)SORT_DEFAULT_MEMORY_MB * 1024 * 1024;
+}
+
+static int writeRunRow(FILE *run, const RunRow *row)
+{
+    RunRowHeader header;
+    memset(&header, 0, sizeof(header));
+    header.key = row->key;
+    header.id = row->record.id;
+    header.mark = row->record.mark;
+    header.nameLength = (uint16_t)strlen(row->record.name);
+    header.programmeLength = (uint16_t)strlen(row->record.programme);
+    countBytesWritten(sizeof(header) + header.nameLength + header.programmeLength);
+
+    return fwrite(&header, sizeof(header), 1, run) == 1 &&
+           fwrite(row->record.name, 1, header.nameLength, run) == header.nameLength &&
+           fwrite(row->record.programme, 1, header.programmeLength, run) == header.programmeLength;
+}
+
+// returns 1 if a row was read, 0 at the end of the run
+static int readRunRow(FILE *run, RunRow *row)
+{
+    RunRowHeader header;
+    if (fread(&header, sizeof(header), 1, run) != 1 ||
+        header.nameLength >= NAME_MAX_LENGTH ||
+        header.programmeLength >= PROGRAMME_MAX_LENGTH) {
+        return 0;
+    }
+
+    countBytesRead(sizeof(header) + header.nameLength + header.programmeLength);
+    row->key = header.key;
+    row->record.id = header.id;
+    row->record.mark = header.mark;
+    if (fread(row->record.name, 1, header.nameLength, run) != header.nameLength ||
+        fread(row->record.programme, 1, header.programmeLength, run) != header.programmeLength) {
+        return 0;
+    }
+    row->record.name[header.nameLength] = '\0';
+    row->record.programme[header.programmeLength] = '\0';
+    return 1;
+}
+
+/*
+loser tree over k runs:
+    - leaf i (node k + i) is run i, internal nodes 1 .. k-1 keep the loser
+      of the match played there, node 0 keeps the overall winner
+    - after the winner's run moves to its next row, only the matches on
+      the path from that leaf to the root are replayed
+*/
+typedef struct {
+    size_t k;
+    FILE **runs;
+    RunRow *heads;      // current row of every run
+    int *alive;         // 0 once a run is used up
+    size_t *tree;
+    const SortSpec *ties;   // compare whole rows on equal keys (NULL: keys say it all)
+} LoserTree;
+
+// does run a's head come before run b's head?
+static int loserTreeBefore(const LoserTree *lt, size_t a, size_t b)
+{
+    if (!lt->alive[a] || !lt->alive[b]) {
+        return lt->alive[a];
+    }
+    if (lt->heads[a].key != lt->heads[b].key) {
+        return lt->heads[a].key < lt->heads[b].key;
+    }
+    if (lt->ties) {
+        const StudentRecord *x = &lt->heads[a].record;
+        const StudentRecord *y = &lt->heads[b].record;
+        SortRowValues xValues = { x->id, x->mark, x->name, x->programme };
+        SortRowValues yValues = { y->id, y->mark, y->name, y->programme };
+        int order = compareSortRows(lt->ties, &xValues, &yValues);
+        if (order) {
+            return order < 0;
+        }
+    }
+    return a < b;   // equal rows: the earlier run first (stable)
+}
+
+// play the matches below "node", return the winner, store losers in the tree
+static size_t loserTreeBuild(LoserTree *lt, size_t node)
+{
+    if (node >= lt->k) {
+        return node - lt->k;
+    }
+
+    size_t left = loserTreeBuild(lt, 2 * node);
+    size_t right = loserTreeBuild(lt, 2 * node + 1);
+    if (loserTreeBefore(lt, left, right)) {
+        lt->tree[node] = right;
+        return left;
+    }
+    lt->tree[node] = left;
+    return right;
+}
+
+// run "winner" has a new head: replay its matches up to the root
+static void loserTreeReplay(LoserTree *lt, size_t winner)
+{
+    for (size_t node = (winner + lt->k) / 2; node > 0; node /= 2) {
+        if (loserTreeBefore(lt, lt->tree[node], winner)) {
+            size_t swap = lt->tree[node];
+            lt->tree[node] = winner;
+            winner = swap;
+        }
+    }
+    lt->tree[0] = winner;
+}
+
+/*
+merge k sorted runs (each rewound to its start)
+ties: the sort columns, when equal keys still need the rows compared
+every row goes to "output" (a new run file) or, if output is NULL, through
+format into out
+returns 1 on success, 0 if writing a run failed
+*/
+static int mergeRuns(FILE **runs, size_t k, const SortSpec *ties,
+                     FILE *output, RowFormatter format, OutputBuffer *out)
+{
+    LoserTree lt;
+    lt.k = k;
+    lt.ties = ties;
+    lt.runs = runs;
+    lt.heads = (RunRow *)memoryAlloc(MEMORY_SORT, k * sizeof(RunRow));
+    lt.alive = (int *)memoryAlloc(MEMORY_SORT, k * sizeof(int));
+    lt.tree = (size_t *)memoryAlloc(MEMORY_SORT, k * sizeof(size_t));
+    if (!lt.heads || !lt.alive || !lt.tree) {
+        fprintf(stderr, "CMS: Out of memory in mergeRuns.\n");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < k; ++i) {
+        rewind(runs[i]);
+        lt.alive[i] = readRunRow(runs[i], &lt.heads[i]);
+    }
+    lt.tree[0] = loserTreeBuild(&lt, 1);
+
+    int ok = 1;
+    while (lt.alive[lt.tree[0]]) {
+        size_t winner = lt.tree[0];
+
+        if (output) {
+            if (!writeRunRow(output, &lt.heads[winner])) {
+                ok = 0;
+                break;
+            }
+        } else {
+            format(out, &lt.heads[winner].record);
+        }
+
+        lt.alive[winner] = readRunRow(runs[winner], &lt.heads[winner]);
+        loserTreeReplay(&lt, winner);
+    }
+
+    memoryFree(lt.heads);
+    memoryFree(lt.alive);
+    memoryFree(lt.tree);
+    return ok;
+}
+
+// temporary file for one run (deleted automatically when closed)
+static FILE *createRunFile(void)
+{
+    FILE *run = tmpfile();
+    if (run) {
+        setvbuf(run, NULL, _IOFBF, RUN_BUFFER_SIZE);
+    }
+    return run;
+}
+
+/*
+write all rows of a snapshot into fp, sorted by spec, formatted by format
+(see EXTERNAL SORT above). returns 1 on success, 0 if a temporary file
+could not be created or written
+*/
+static int writeSnapshotRowsSorted(FILE *fp, const TableSnapshot *snapshot,
+                                   const SortSpec *spec, RowFormatter format)
+{
+    // an item and its sort buffer cost 2 * sizeof(SortItem) per row
+    size_t runChunks = sortMemoryBudget() / (2 * sizeof(SortItem) * CHUNK_ROWS);
+    if (runChunks < 1) {
+        runChunks = 1;
+    }
+
+    OutputBuffer out = { NULL, 0, 0, fp };
+    const SortSpec *ties = sortSpecHasText(spec) ? spec : NULL;
+    countRows(snapshot->count);
+
+    // everything fits: one in-memory sort, no temporary files
+    uint64_t phase = phaseStart();
+    if (snapshot->chunkCount <= runChunks) {
+        size_t count = 0;
+        SortItem *items = sortSnapshotChunks(snapshot, spec, 0, snapshot->chunkCount, &count);
+        phaseLap(PHASE_SORT, &phase);
+        if (!items) {
+            return 0;
+        }
+        writeSortedRows(&out, snapshot, items, count, format);
+        outputFlush(&out);
+        outputFree(&out);
+        memoryFree(items);
+        return 1;
+    }
+
+    // waiting runs, oldest first; level L means made of MERGE_MAX_RUNS^L first runs
+    size_t totalRuns = (snapshot->chunkCount + runChunks - 1) / runChunks;
+    FILE **runs = (FILE **)memoryCalloc(MEMORY_SORT, totalRuns, sizeof(FILE *));
+    unsigned *levels = (unsigned *)memoryCalloc(MEMORY_SORT, totalRuns, sizeof(unsigned));
+    size_t runCount = 0;
+    int ok = runs && levels;
+
+    for (size_t firstChunk = 0; ok && firstChunk < snapshot->chunkCount; firstChunk += runChunks) {
+        // 1. sort the next piece of the table and spill it
+        size_t endChunk = firstChunk + runChunks < snapshot->chunkCount ? firstChunk + runChunks
+                                                                        : snapshot->chunkCount;
+        size_t count = 0;
+        SortItem *items = sortSnapshotChunks(snapshot, spec, firstChunk, endChunk, &count);
+        phaseLap(PHASE_SORT, &phase);
+        uint64_t span = traceBegin();
+        FILE *run = createRunFile();
+
+        if (!items || !run) {
+            memoryFree(items);
+            if (run) {
+                fclose(run);
+            }
+            ok = 0;
+            break;
+        }
+
+        for (size_t i = 0; i < count && ok; ++i) {
+            const RecordChunk *chunk = snapshot->chunks[items[i].slot / CHUNK_ROWS];
+            unsigned rowIndex = items[i].slot % CHUNK_ROWS;
+
+            // the sort may have reused item keys, so take the row's key again
+            RunRow row;
+            row.key = sortRowKey(spec, chunk, rowIndex);
+            chunkReadRow(chunk, rowIndex, &row.record);
+            ok = writeRunRow(run, &row);
+        }
+        memoryFree(items);
+        phaseLap(PHASE_WRITE, &phase);
+        traceEnd(span, "write run", "%zu rows", count);
+
+        runs[runCount] = run;
+        levels[runCount] = 0;
+        runCount++;
+
+        // 2. MERGE_MAX_RUNS runs of the same level become one run of the next level
+        while (ok && runCount >= MERGE_MAX_RUNS &&
+               levels[runCount - MERGE_MAX_RUNS] == levels[runCount - 1]) {
+            size_t first = runCount - MERGE_MAX_RUNS;
+            unsigned level = levels[first];
+            FILE *longer = createRunFile();
+
+            uint64_t span = traceBegin();
+            ok = longer && mergeRuns(runs + first, MERGE_MAX_RUNS, ties, longer, NULL, NULL);
+            phaseLap(PHASE_MERGE, &phase);
+            traceEnd(span, "merge runs", "%d runs, level %u", MERGE_MAX_RUNS, level);
+            for (size_t i = first; i < runCount; ++i) {
+                fclose(runs[i]);
+            }
+            runCount = first;
+
+            if (longer) {
+                runs[runCount] = longer;
+                levels[runCount] = level + 1;
+                runCount++;
+            }
+        }
+    }
+
+    // 3. final merge straight into the export file
+    if (ok) {
+        uint64_t span = traceBegin();
+        ok = mergeRuns(runs, runCount, ties, NULL, format, &out);
+        outputFlush(&out);
+        phaseLap(PHASE_MERGE, &phase);
+        traceEnd(span, "merge runs", "%zu runs into the file", runCount);
+    }
+
+    for (size_t r = 0; r < runCount; ++r) {
+        fclose(runs[r]);
+    }
+    memoryFree(runs);
+    memoryFree(levels);
+    outputFree(&out);
+    return ok;
+}
+
+/*
+MARK COLUMN KERNELS
+aggregates over the mark column of one chunk, counting only live rows.
+a mark is 16 bits, so one SSE2 register holds 8 of them: a dead row is
+masked out (0 for the sum, the highest / lowest Mark for min / max) instead
+of branching, and the sums are exact integers in tenths.
+*/
+typedef struct {
+    int64_t sum;        // in tenths
+    Mark lowest;        // MARK_HIGHEST / MARK_LOWEST when there are no live rows
+    Mark highest;
+} MarkAggregate;
+
+static void markColumnAggregate(const RecordChunk *chunk, MarkAggregate *out)
+{
+    unsigned i = 0;
+    int64_t sum = 0;
+    int lowest = MARK_HIGHEST, highest = MARK_LOWEST;
+
+#if CMS_HAVE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i high = _mm_set1_epi16(MARK_HIGHEST);
+    const __m128i low = _mm_set1_epi16(-32768);
+    __m128i sums = zero;                // 4 x 32-bit, at most 1024 * 32767 each
+    __m128i mins = high, maxs = low;
+
+    for (; i + 8 <= chunk->used; i += 8) {
+        __m128i live = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&chunk->live[i]), zero);
+        __m128i mask = _mm_cmpgt_epi16(live, zero);
+        __m128i marks = _mm_loadu_si128((const __m128i *)&chunk->marks[i]);
+        __m128i kept = _mm_and_si128(mask, marks);
+
+        sums = _mm_add_epi32(sums, _mm_madd_epi16(kept, ones));
+        mins = _mm_min_epi16(mins, _mm_or_si128(kept, _mm_andnot_si128(mask, high)));
+        maxs = _mm_max_epi16(maxs, _mm_or_si128(kept, _mm_andnot_si128(mask, low)));
+    }
+
+    int32_t sumLanes[4];
+    int16_t minLanes[8], maxLanes[8];
+    _mm_storeu_si128((__m128i *)sumLanes, sums);
+    _mm_storeu_si128((__m128i *)minLanes, mins);
+    _mm_storeu_si128((__m128i *)maxLanes, maxs);
+    for (int k = 0; k < 4; ++k) {
+        sum += sumLanes[k];
+    }
+    for (int k = 0; k < 8; ++k) {
+        lowest = minLanes[k] < lowest ? minLanes[k] : lowest;
+        highest = maxLanes[k] > highest ? maxLanes[k] : highest;
+    }
+#endif
+
+    for (; i < chunk->used; ++i) {
+        int mark = chunk->live[i] ? chunk->marks[i] : 0;
+        sum += mark;
+        lowest = chunk->live[i] && mark < lowest ? mark : lowest;
+        highest = chunk->live[i] && mark > highest ? mark : highest;
+    }
+
+    out->sum = sum;
+    out->lowest = (Mark)lowest;
+    out->highest = (Mark)highest;
+}
+
+/*
+histogram of the live marks of one chunk
+    edges : edgeCount ascending marks
+    counts: counts[0] gets the marks below edges[0], counts[k] the marks in
+            [edges[k - 1], edges[k]), counts[edgeCount] the rest (added to)
+every edge is one pass of "mark >= edge" compares over the column, which
+stays in the cache; the counts are the differences between the passes
+*/
+#define MARK_HISTOGRAM_MAX_EDGES 16
+
+static void markColumnHistogram(const RecordChunk *chunk, const Mark *edges, size_t edgeCount, size_t *counts)
+{
+    size_t atLeast[MARK_HISTOGRAM_MAX_EDGES + 1];
+    size_t liveRows = chunk->liveRows;
+
+    for (size_t e = 0; e < edgeCount; ++e) {
+        unsigned i = 0;
+        size_t count = 0;
+
+#if CMS_HAVE_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i below = _mm_set1_epi16((short)(edges[e] - 1));
+        __m128i lanes = zero;           // 8 x 16-bit, at most 1024 / 8 each
+
+        for (; i + 8 <= chunk->used; i += 8) {
+            __m128i live = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&chunk->live[i]), zero);
+            __m128i marks = _mm_loadu_si128((const __m128i *)&chunk->marks[i]);
+            __m128i hit = _mm_and_si128(_mm_cmpgt_epi16(live, zero), _mm_cmpgt_epi16(marks, below));
+            lanes = _mm_sub_epi16(lanes, hit);     // a hit is -1
+        }
+
+        uint16_t laneCounts[8];
+        _mm_storeu_si128((__m128i *)laneCounts, lanes);
+        for (int k = 0; k < 8; ++k) {
+            count += laneCounts[k];
+        }
+#endif
+
+        for (; i < chunk->used; ++i) {
+            count += chunk->live[i] && chunk->marks[i] >= edges[e];
+        }
+        atLeast[e] = count;
+    }
+
+    for (size_t e = 0; e <= edgeCount; ++e) {
+        size_t from = e == 0 ? liveRows : atLeast[e - 1];
+        size_t to = e == edgeCount ? 0 : atLeast[e];
+        counts[e] += from - to;
+    }
+}
+
+// the edges between the grade bands, lowest first (histogram counts F, C, B, A)
+static const Mark gradeEdges[GRADE_COUNT - 1] = { GRADE_C_MIN, GRADE_B_MIN, GRADE_A_MIN };
+
+// partial result of SHOW SUMMARY for a range of chunks
+typedef struct {
+    int64_t totalMark;          // in tenths
+    Mark lowestMark;
+    Mark highestMark;
+    const char *nameLowest;     // NULL while the range had no records
+    const char *nameHighest;
+    size_t bands[GRADE_COUNT];  // students per band, F first (see gradeEdges)
+} SummaryPartial;
+
+// the first live row of a chunk with this mark
+static unsigned chunkFindMark(const RecordChunk *chunk, Mark mark)
+{
+    unsigned i = 0;
+    while (!chunk->live[i] || chunk->marks[i] != mark) {
+        i++;
+    }
+    return i;
+}
+
+static void summaryMapChunks(void *context, void *partial, size_t begin, size_t end)
+{
+    const TableSnapshot *snapshot = (const TableSnapshot *)context;
+    SummaryPartial *part = (SummaryPartial *)partial;
+
+    for (size_t c = begin; c < end; ++c) {
+        const RecordChunk *chunk = snapshot->chunks[c];
+        if (chunk->liveRows == 0) {
+            continue;
+        }
+
+        MarkAggregate aggregate;
+        markColumnAggregate(chunk, &aggregate);
+        markColumnHistogram(chunk, gradeEdges, GRADE_COUNT - 1, part->bands);
+        part->totalMark += aggregate.sum;
+
+        // only a chunk that beats the current lowest / highest is looked at again
+        if (!part->nameLowest || aggregate.lowest < part->lowestMark) {
+            part->lowestMark = aggregate.lowest;
+            part->nameLowest = chunkName(chunk, chunkFindMark(chunk, aggregate.lowest));
+        }
+        if (!part->nameHighest || aggregate.highest > part->highestMark) {
+            part->highestMark = aggregate.highest;
+            part->nameHighest = chunkName(chunk, chunkFindMark(chunk, aggregate.highest));
+        }
+    }
+}
+
+// partials arrive in table order, so ties keep the first student like a plain loop
+static void summaryCombine(void *context, void *result, const void *partial)
+{
+    SummaryPartial *total = (SummaryPartial *)result;
+    const SummaryPartial *part = (const SummaryPartial *)partial;
+    (void)context;
+
+    total->totalMark += part->totalMark;
+    for (int b = 0; b < GRADE_COUNT; ++b) {
+        total->bands[b] += part->bands[b];
+    }
+
+    if (part->nameLowest && (!total->nameLowest || part->lowestMark < total->lowestMark)) {
+        total->lowestMark = part->lowestMark;
+        total->nameLowest = part->nameLowest;
+    }
+    if (part->nameHighest && (!total->nameHighest || part->highestMark > total->highestMark)) {
+        total->highestMark = part->highestMark;
+        total->nameHighest = part->nameHighest;
+    }
+}
+
+/*
+print summary statistics:
+- total number of students
+- average mark
+- highest mark (with student name)
+- lowest mark (with student name)
+- students per grade band
+the chunks are scanned in parallel (parallelReduce), each with the mark
+column kernels; the average comes from an exact sum of tenths
+*/
+static void showSummaryStatistics(const TableSnapshot *snapshot)
+{
+    if (snapshot->count == 0) {
+        outputPrintf("CMS: No records loaded.\n");
+        return;
+    }
+
+    size_t totalStudents = snapshot->count;
+    countRows(totalStudents);
+    SummaryPartial identity = { 0, 0, 0, NULL, NULL, { 0 } };
+    SummaryPartial summary;
+
+    parallelReduce(snapshot->chunkCount, PARALLEL_AUTO_GRAIN, (void *)snapshot,
+                   sizeof(SummaryPartial), &identity,
+                   summaryMapChunks, summaryCombine, &summary);
+
+    outputPrintf("CMS: SUMMARY\n");
+    outputPrintf("Total students: %zu\n", totalStudents);
+    outputPrintf("Average mark: %.2f\n", (double)summary.totalMark / 10.0 / (double)totalStudents);
+    outputPrintf("Highest: %.1f (%s)\n", markToDouble(summary.highestMark), summary.nameHighest);
+    outputPrintf("Lowest : %.1f (%s)\n", markToDouble(summary.lowestMark), summary.nameLowest);
+    outputPrintf("Grades : A %zu, B %zu, C %zu, F %zu\n",
+                 summary.bands[3], summary.bands[2], summary.bands[1], summary.bands[0]);
+}
+
+// TOP-N (SHOW TOP n BY MARK [PER PROGRAMME])
+#define TOP_MAX_COUNT 1000
+
+// one row that made it into a top list
+typedef struct {
+    Mark mark;
+    int id;
+    uint32_t chunk;     // where the row is in the snapshot
+    uint32_t row;
+} TopEntry;
+
+/*
+the best "limit" rows of one group seen so far
+kept as a bounded heap with the weakest kept row on top, so a new row only
+has to beat entries[0]; every row costs O(log limit), not a sort of the group
+*/
+typedef struct {
+    const char *programme;  // points into a snapshot chunk (NULL: whole table)
+    size_t students;        // rows of this group that were scanned
+    TopEntry *entries;
+    size_t count;
+    size_t capacity;
+} TopGroup;
+
+// the groups found by one task (programme name -> group, open addressing)
+typedef struct {
+    TopGroup *groups;
+    size_t groupCount;
+    size_t groupCapacity;
+    int *buckets;
+    size_t bucketCount;
+} TopGroupTable;
+
+typedef struct {
+    const TableSnapshot *snapshot;
+    size_t limit;
+    int perProgramme;
+    TopGroupTable *tables;      // one per task
+} TopScan;
+
+// higher mark first, then the smaller ID
+static int topEntryBetter(const TopEntry *a, const TopEntry *b)
+{
+    return a->mark > b->mark || (a->mark == b->mark && a->id < b->id);
+}
+
+static void topGroupPush(TopGroup *group, const TopEntry *entry, size_t limit)
+{
+    TopEntry *heap = group->entries;
+
+    if (group->count < limit) {
+        if (group->count == group->capacity) {
+            group->capacity = group->capacity ? group->capacity * 2 : 4;
+            if (group->capacity > limit) {
+                group->capacity = limit;
+            }
+            heap = (TopEntry *)memoryRealloc(MEMORY_QUERY, group->entries, group->capacity * sizeof(TopEntry));
+            if (!heap) {
+                fprintf(stderr, "CMS: Out of memory in SHOW TOP.\n");
+                exit(1);
+            }
+            group->entries = heap;
+        }
+
+        // sift up: the weaker row goes towards the top
+        size_t i = group->count++;
+        while (i > 0 && topEntryBetter(&heap[(i - 1) / 2], entry)) {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        heap[i] = *entry;
+        return;
+    }
+
+    if (!topEntryBetter(entry, &heap[0])) {
+        return;
+    }
+
+    // replace the weakest row and sift it down
+    size_t i = 0;
+    while (1) {
+        size_t child = 2 * i + 1;
+        if (child >= group->count) {
+            break;
+        }
+        if (child + 1 < group->count && topEntryBetter(&heap[child], &heap[child + 1])) {
+            child++;
+        }
+        if (!topEntryBetter(entry, &heap[child])) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = *entry;
+}
+
+static void topGroupBucketInsert(TopGroupTable *table, size_t g)
+{
+    size_t mask = table->bucketCount - 1;
+    size_t b = hashText(table->groups[g].programme) & mask;
+    while (table->buckets[b] != -1) {
+        b = (b + 1) & mask;
+    }
+    table->buckets[b] = (int)g;
+}
+
+// find (or add) the group of a programme; NULL is the single whole-table group
+static TopGroup *topGroupFind(TopGroupTable *table, const char *programme)
+{
+    if (!programme) {
+        programme = "";
+    }
+
+    if (table->bucketCount) {
+        size_t mask = table->bucketCount - 1;
+        for (size_t b = hashText(programme) & mask; table->buckets[b] != -1; b = (b + 1) & mask) {
+            TopGroup *group = &table->groups[table->buckets[b]];
+            if (strcmp(group->programme, programme) == 0) {
+                return group;
+            }
+        }
+    }
+
+    if (table->groupCount >= table->groupCapacity) {
+        table->groupCapacity = table->groupCapacity ? table->groupCapacity * 2 : 16;
+        TopGroup *newMemory =
+            (TopGroup *)memoryRealloc(MEMORY_QUERY, table->groups, table->groupCapacity * sizeof(TopGroup));
+        if (!newMemory) {
+            fprintf(stderr, "CMS: Out of memory in SHOW TOP.\n");
+            exit(1);
+        }
+        table->groups = newMemory;
+    }
+
+    size_t newIndex = table->groupCount++;
+    TopGroup *group = &table->groups[newIndex];
+    memset(group, 0, sizeof(*group));
+    group->programme = programme;
+
+    // keep the bucket array at most half full (rebuilt when it grows)
+    if (table->groupCount * 2 > table->bucketCount) {
+        memoryFree(table->buckets);
+        table->bucketCount = table->bucketCount ? table->bucketCount * 2 : 64;
+        table->buckets = (int *)memoryAlloc(MEMORY_QUERY, table->bucketCount * sizeof(int));
+        if (!table->buckets) {
+            fprintf(stderr, "CMS: Out of memory in SHOW TOP.\n");
+            exit(1);
+        }
+        for (size_t b = 0; b < table->bucketCount; ++b) {
+            table->buckets[b] = -1;
+        }
+        for (size_t g = 0; g < newIndex; ++g) {
+            topGroupBucketInsert(table, g);
+        }
+    }
+    topGroupBucketInsert(table, newIndex);
+    return group;
+}
+
+static void topGroupTableFree(TopGroupTable *table)
+{
+    for (size_t g = 0; g < table->groupCount; ++g) {
+        memoryFree(table->groups[g].entries);
+    }
+    memoryFree(table->groups);
+    memoryFree(table->buckets);
+}
+
+static void topScanTask(void *context, size_t taskIndex, size_t begin, size_t end)
+{
+    TopScan *scan = (TopScan *)context;
+    TopGroupTable *table = &scan->tables[taskIndex];
+    TopGroup *group = scan->perProgramme ? NULL : topGroupFind(table, NULL);
+
+    for (size_t c = begin; c < end; ++c) {
+        const RecordChunk *chunk = scan->snapshot->chunks[c];
+        for (unsigned i = 0; i < chunk->used; ++i) {
+            if (!chunk->live[i]) {
+                continue;
+            }
+
+            // rows of one programme usually come together, so try the last group first
+            if (scan->perProgramme &&
+                (!group || strcmp(group->programme, chunkProgramme(chunk, i)) != 0)) {
+                group = topGroupFind(table, chunkProgramme(chunk, i));
+            }
+
+            TopEntry entry;
+            entry.mark = chunk->marks[i];
+            entry.id = chunk->ids[i];
+            entry.chunk = (uint32_t)c;
+            entry.row = i;
+            group->students++;
+            topGroupPush(group, &entry, scan->limit);
+        }
+    }
+}
+
+static int compareTopEntries(const void *a, const void *b)
+{
+    const TopEntry *x = (const TopEntry *)a;
+    const TopEntry *y = (const TopEntry *)b;
+    return topEntryBetter(x, y) ? -1 : topEntryBetter(y, x) ? 1 : 0;
+}
+
+// programmes A-Z (case ignored like SORT BY PROGRAMME, then exact)
+static int compareTopGroups(const void *a, const void *b)
+{
+    const TopGroup *x = *(const TopGroup *const *)a;
+    const TopGroup *y = *(const TopGroup *const *)b;
+    int order = compareFolded(x->programme, y->programme);
+    return order ? order : strcmp(x->programme, y->programme);
+}
+
+/*
+print the "limit" best students by mark, for the whole table or for every
+programme (perProgramme = 1)
+every task keeps bounded heaps for the groups in its chunks; the heaps are
+then merged per group, so the work is one pass over the snapshot
+ties on the mark are broken by the smaller ID
+*/
+static void showTopStudents(const TableSnapshot *snapshot, size_t limit, int perProgramme)
+{
+    if (snapshot->count == 0) {
+        outputPrintf("CMS: No records loaded.\n");
+        return;
+    }
+
+    countRows(snapshot->count);
+    TopScan scan;
+    size_t taskCount = parallelTaskCount(snapshot->chunkCount, PARALLEL_AUTO_GRAIN);
+    scan.snapshot = snapshot;
+    scan.limit = limit;
+    scan.perProgramme = perProgramme;
+    scan.tables = (TopGroupTable *)memoryCalloc(MEMORY_QUERY, taskCount ? taskCount : 1, sizeof(TopGroupTable));
+    if (!scan.tables) {
+        fprintf(stderr, "CMS: Out of memory in showTopStudents.\n");
+        return;
+    }
+
+    parallelFor(snapshot->chunkCount, PARALLEL_AUTO_GRAIN, topScanTask, &scan);
+
+    // merge the task heaps group by group
+    TopGroupTable merged;
+    memset(&merged, 0, sizeof(merged));
+    for (size_t t = 0; t < taskCount; ++t) {
+        for (size_t g = 0; g < scan.tables[t].groupCount; ++g) {
+            const TopGroup *part = &scan.tables[t].groups[g];
+            TopGroup *group = topGroupFind(&merged, perProgramme ? part->programme : NULL);
+            group->students += part->students;
+            for (size_t e = 0; e < part->count; ++e) {
+                topGroupPush(group, &part->entries[e], limit);
+            }
+        }
+        topGroupTableFree(&scan.tables[t]);
+    }
+    memoryFree(scan.tables);
+
+    TopGroup **order = (TopGroup **)memoryAlloc(MEMORY_QUERY, (merged.groupCount + 1) * sizeof(TopGroup *));
+    if (!order) {
+        fprintf(stderr, "CMS: Out of memory in showTopStudents.\n");
+        topGroupTableFree(&merged);
+        return;
+    }
+    for (size_t g = 0; g < merged.groupCount; ++g) {
+        order[g] = &merged.groups[g];
+    }
+    qsort(order, merged.groupCount, sizeof(TopGroup *), compareTopGroups);
+
+    if (perProgramme) {
+        outputPrintf("CMS: Top %zu by mark per programme.\n", limit);
+    } else {
+        outputPrintf("CMS: Top %zu by mark.\n", limit);
+    }
+
+    // other result formats and chosen columns get plain rows, best first (per programme: one after the other)
+    OutputBuffer *out = resultOutput();
+    int text = currentResult.layout.format == RESULT_TEXT && !currentResult.projected;
+    if (!text) {
+        resultHeader();
+    }
+    for (size_t g = 0; g < merged.groupCount; ++g) {
+        TopGroup *group = order[g];
+        qsort(group->entries, group->count, sizeof(TopEntry), compareTopEntries);
+
+        if (text && perProgramme) {
+            outputAppendPrintf(out, "%s (%zu student%s)\n", group->programme, group->students,
+                               group->students == 1 ? "" : "s");
+            outputAppendPrintf(out, "No. ID Name Mark\n");
+        } else if (text) {
+            outputAppendPrintf(out, "No. ID Name Programme Mark\n");
+        }
+
+        for (size_t e = 0; e < group->count; ++e) {
+            const RecordChunk *chunk = snapshot->chunks[group->entries[e].chunk];
+            unsigned i = group->entries[e].row;
+            if (!text) {
+                resultWriteRow(chunk, i);
+            } else if (perProgramme) {
+                outputAppendPrintf(out, "%zu %d %s %.1f\n", e + 1, chunk->ids[i], chunkName(chunk, i),
+                                   markToDouble(chunk->marks[i]));
+                currentResult.rows++;
+            } else {
+                outputAppendPrintf(out, "%zu %d %s %s %.1f\n", e + 1, chunk->ids[i], chunkName(chunk, i),
+                                   chunkProgramme(chunk, i), markToDouble(chunk->marks[i]));
+                currentResult.rows++;
+            }
+        }
+    }
+
+    memoryFree(order);
+    topGroupTableFree(&merged);
+}
+
+// CSV / SQL IMPORT / EXPORT
+/*
+parse a line of CSV into 4 fields:
+f0: ID
+f1: Name
+f2: Programme
+f3: Mark
+supports:
+- quoted fields ("...") that may contain commas
+- escaped quotes inside fields ("" -> ")
+*/
+static int csvSplitLineInto4Fields(const char *line,
+                                   char *f0, size_t n0,
+                                   char *f1, size_t n1,
+                                   char *f2, size_t n2,
+                                   char *f3, size_t n3)
+{
+    const char *p = line;
+
+    char *outputs[4] = { f0, f1, f2, f3 };
+    size_t caps[4]   = { n0, n1, n2, n3 };
+
+    for (int col = 0; col < 4; ++col) {
+        // skip spaces before field
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+
+        // check if field is quoted
+        if (*p == '"') {
+            p++;  // skip opening quote
+            size_t k = 0;
+
+            while (*p) {
+                if (*p == '"') {
+                    if (*(p + 1) == '"') {
+                        // double quote inside field -> single quote in value
+                        if (k + 1 < caps[col]) {
+                            outputs[col][k++] = '"';
+                        }
+                        p += 2;
+                    } else {
+                        // end of quoted field
+                        p++;
+                        // skip spaces after quote
+                        while (*p == ' ' || *p == '\t') {
+                            p++;
+                        }
+                        if (col < 3) {
+                            if (*p != ',') return 0;
+                            p++;    // skip comma
+                        }
+                        break;
+                    }
+                } else {
+                    if (k + 1 < caps[col]) {
+                        outputs[col][k++] = *p;
+                    }
+                    p++;
+                }
+            }
+
+            outputs[col][k] = '\0';
+        } else {
+            // unquoted field: read until comma or end-of-line
+            size_t k = 0;
+            while (*p && *p != ',' && *p != '\r' && *p != '\n') {
+                if (k + 1 < caps[col]) {
+                    outputs[col][k++] = *p;
+                }
+                p++;
+            }
+            outputs[col][k] = '\0';
+
+            if (col < 3) {
+                if (*p != ',') return 0;
+                p++;    // skip comma
+            }
+        }
+    }
+
+    // ignore trailing whitespace/newlines
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+        p++;
+    }
+
+    // if extra text after 4 fields, treat as error
+    if (*p != '\0') {
+        return 0;
+    }
+
+    return 1;
+}
+
+// write one student as a CSV row: id,"name","programme",mark
+// (quotes doubled by putCsvText, the same encoder as SET OUTPUT csv)
+static void writeCsvRow(OutputBuffer *out, const StudentRecord *student)
+{
+    outputReserve(out, RESULT_ROW_MAX);
+    char *p = putInt(out->data + out->length, student->id);
+    *p++ = ',';
+    p = putCsvText(p, student->name);
+    *p++ = ',';
+    p = putCsvText(p, student->programme);
+    *p++ = ',';
+    p = putMark(p, student->mark);
+    *p++ = '\n';
+    outputEndRow(out, p);
+}
+
+/*
+export a snapshot of studentTable to a CSV file in the program folder
+format of exporting:
+    header:
+        ID,Name,Programme,Mark
+    rows:
+        id,"name","programme",mark
+rows are in table order, or sorted by spec (external merge sort, see above)
+*/
+static int exportToCsvFile(const TableSnapshot *snapshot, const char *csvFileName, const SortSpec *spec)
+{
+    if (!csvFileName || !csvFileName[0]) {
+        return 0;
+    }
+
+    char actualPath[1024];
+    FILE *fp = openFileForWriteInProgramFolder(csvFileName, actualPath, sizeof(actualPath));
+    if (!fp) {
+        return 0;
+    }
+
+    // header
+    fprintf(fp, "ID,Name,Programme,Mark\n");
+
+    int ok = 1;
+    if (spec->keyCount) {
+        ok = writeSnapshotRowsSorted(fp, snapshot, spec, writeCsvRow);
+    } else {
+        writeSnapshotRows(fp, snapshot, writeCsvRow);
+    }
+
+    fclose(fp);
+    return ok;
+}
+
+// write one student as an SQL INSERT statement
+static void writeSqlRow(OutputBuffer *out, const StudentRecord *student)
+{
+    // escape single quotes for SQL
+    char escapedName[2 * NAME_MAX_LENGTH] = { 0 };
+    char escapedProgramme[2 * PROGRAMME_MAX_LENGTH] = { 0 };
+
+    size_t k = 0;
+    for (size_t j = 0; j < strlen(student->name) && k + 2 < sizeof(escapedName); ++j) {
+        if (student->name[j] == '\'') {
+            escapedName[k++] = '\'';
+            escapedName[k++] = '\'';
+        } else {
+            escapedName[k++] = student->name[j];
+        }
+    }
+
+    k = 0;
+    for (size_t j = 0; j < strlen(student->programme) && k + 2 < sizeof(escapedProgramme); ++j) {
+        if (student->programme[j] == '\'') {
+            escapedProgramme[k++] = '\'';
+            escapedProgramme[k++] = '\'';
+        } else {
+            escapedProgramme[k++] = student->programme[j];
+        }
+    }
+
+    outputAppendPrintf(out,
+                       "INSERT INTO StudentRecords(id,name,programme,mark) "
+                       "VALUES(%d,'%s','%s',%.1f);\n",
+                       student->id,
+                       escapedName,
+                       escapedProgramme,
+                       markToDouble(student->mark));
+}
+
+/*
+export a snapshot of studentTable as SQL statements:
+- DROP TABLE IF EXISTS StudentRecords;
+- CREATE TABLE ...
+- INSERT INTO StudentRecords(...) VALUES(...);
+
+file is saved next to the .exe (programDirectoryPath)
+rows are in table order, or sorted by spec
+*/
+static int exportToSqlFile(const TableSnapshot *snapshot, const char *sqlFileName, const SortSpec *spec)
+{
+    if (!sqlFileName || !sqlFileName[0]) {
+        return 0;
+    }
+
+    char actualPath[1024];
+    FILE *fp = openFileForWriteInProgramFolder(sqlFileName, actualPath, sizeof(actualPath));
+    if (!fp) {
+        return 0;
+    }
+
+    fprintf(fp, "-- SQL dump generated by CMS\n");
+    fprintf(fp, "DROP TABLE IF EXISTS StudentRecords;\n");
+    fprintf(fp, "CREATE TABLE StudentRecords (\n"
+                "  id INTEGER PRIMARY KEY,\n"
+                "  name TEXT NOT NULL,\n"
+                "  programme TEXT NOT NULL,\n"
+                "  mark REAL NOT NULL\n"
+                ");\n");
+
+    int ok = 1;
+    if (spec->keyCount) {
+        ok = writeSnapshotRowsSorted(fp, snapshot, spec, writeSqlRow);
+    } else {
+        writeSnapshotRows(fp, snapshot, writeSqlRow);
+    }
+
+    fclose(fp);
+    return ok;
+}
+
+/*
+read students from a CSV file and add them into studentTable
+there is a check for the following:
+- first line may be a header "ID,Name,Programme,Mark" (case-insensitive)
+- lines may be quoted
+- if a student ID already exists, that record is skipped (no duplicate)
+*/
+static int importFromCsvFile(const char *csvFileName)
+{
+    const char *usedPath = NULL;
+    FILE *fp = openFileForReadSearch(csvFileName, &usedPath);
+    if (!fp) {
+        return 0;
+    }
+
+    char line[2048];
+    size_t rowsRead = 0;        // every data line, also the ones skipped (bad or a known ID)
+    size_t rowsAdded = 0;
+
+    // read first line (might be header or first data row)
+    if (fgets(line, sizeof(line), fp) == NULL) {
+        fclose(fp);
+        return 0;
+    }
+
+    {
+        char temp[2048];
+        strncpy(temp, line, sizeof(temp) - 1);
+        temp[sizeof(temp) - 1] = '\0';
+        trimSpaces(temp);
+
+        if (temp[0] != '\0') {
+            char f0[64], f1[NAME_MAX_LENGTH], f2[PROGRAMME_MAX_LENGTH], f3[64];
+
+            if (csvSplitLineInto4Fields(temp, f0, sizeof(f0),
+                                        f1, sizeof(f1),
+                                        f2, sizeof(f2),
+                                        f3, sizeof(f3))) {
+                // check if this line is the header "ID,Name,Programme,Mark"
+                if (equalsIgnoreCase(f0, "ID") &&
+                    equalsIgnoreCase(f1, "Name") &&
+                    equalsIgnoreCase(f2, "Programme") &&
+                    equalsIgnoreCase(f3, "Mark")) {
+                    // it is a header, so we ignore it and move on
+                } else {
+                    // not a header, so treat this as actual data
+                    int  id = atoi(f0);
+                    Mark mark;
+
+                    RowLocation where;
+                    rowsRead++;
+                    if (markFromText(f3, &mark) && !findIndexById(id, &where)) {
+                        rowsAdded += (size_t)addStudentRecord(id, f1, f2, mark);
+                    }
+                }
+            } else {
+                rowsRead++;     // a malformed first line
+            }
+        }
+    }
+
+    // read remaining lines
+    TraceBatch batch;
+    traceBatchBegin(&batch);
+    uint64_t phase = phaseStart();
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        phaseLap(PHASE_READ, &phase);
+        traceBatchRow(&batch, "import rows");
+        char trimmed[2048];
+        strncpy(trimmed, line, sizeof(trimmed) - 1);
+        trimmed[sizeof(trimmed) - 1] = '\0';
+        trimSpaces(trimmed);
+
+        if (trimmed[0] == '\0') {
+            continue;   // skip empty line
+        }
+
+        char f0[64], f1[NAME_MAX_LENGTH], f2[PROGRAMME_MAX_LENGTH], f3[64];
+        if (!csvSplitLineInto4Fields(trimmed, f0, sizeof(f0),
+                                     f1, sizeof(f1),
+                                     f2, sizeof(f2),
+                                     f3, sizeof(f3))) {
+            rowsRead++;
+            continue;   // skip malformed line
+        }
+
+        // extra safety precaution: skip repeated header mid-file
+        if (equalsIgnoreCase(f0, "ID") &&
+            equalsIgnoreCase(f1, "Name") &&
+            equalsIgnoreCase(f2, "Programme") &&
+            equalsIgnoreCase(f3, "Mark")) {
+            continue;
+        }
+        rowsRead++;
+
+        int  id = atoi(f0);
+        Mark mark;
+        if (!markFromText(f3, &mark)) {
+            continue;   // skip a line without a usable mark
+        }
+        phaseLap(PHASE_PARSE, &phase);
+
+        RowLocation where;
+        if (!findIndexById(id, &where)) {
+            rowsAdded += (size_t)addStudentRecord(id, f1, f2, mark);
+        }
+        phaseLap(PHASE_INSERT, &phase);
+    }
+    phaseLap(PHASE_READ, &phase);
+    traceBatchEnd(&batch, "import rows");
+
+    // addStudentRecord counted the rows it added, the rest were parsed all the same
+    countRows(rowsRead - rowsAdded);
+
+    countBytesRead((uint64_t)ftell(fp));
+    fclose(fp);
+    return 1;
+}
+
+// JSON LINES IMPORT / EXPORT (IMPORT JSONL / EXPORT JSONL)
+/*
+one student per line, the same objects SET OUTPUT json prints:
+    {"id":2501234,"name":"Tan Wei","programme":"Computer Science","mark":88.8}
+EXPORT JSONL writes them like EXPORT CSV does its rows (formatted in
+parallel, with WHERE and SORT BY).
+IMPORT JSONL reads the file through one 64 KB buffer and parses it a byte at
+a time, without allocating anything:
+    - a string goes straight into the fixed name / programme buffer of the
+      row: escapes are decoded, \uXXXX (and surrogate pairs) becomes UTF-8,
+      other bytes are kept as they are but have to be valid UTF-8 (checked
+      on the way, Utf8Check); a string that is too long is cut at a
+      character boundary, like a long CSV field
+    - the ID and the mark (numbers, or numbers in a string) must follow the
+      JSON number grammar, as a whole (jsonNumberScaled): the ID has to be a
+      whole number that fits an int, the mark is rounded to tenths like
+      everywhere else (88.85 is 88.9, 1e2 is 100.0) and has to fit a Mark
+    - a name or programme may not hold control characters (\n, \t, \u0001,
+      ...): the database file is tab separated with one student per line,
+      so such a row is skipped instead of breaking the file at the next SAVE
+    - the keys may come in any order and in any case; other keys are skipped,
+      whatever their value (objects and arrays too)
+    - the row goes into studentTable with addStudentRecord
+a line that is not one object with the four keys (an object may not go on
+over the line end, and nothing but spaces may follow it), that has an ID or
+mark that does not fit, or whose ID is already in the table, is skipped;
+after a syntax error the parser carries on at the next line
+*/
+#define JSONL_BUFFER_SIZE (64 * 1024)
+
+typedef struct {
+    FILE *fp;
+    size_t length;
+    size_t position;
+    char buffer[JSONL_BUFFER_SIZE];
+} JsonReader;
+
+// the fields of one row, as they were read
+#define JSONL_HAS_ID        1
+#define JSONL_HAS_NAME      2
+#define JSONL_HAS_PROGRAMME 4
+#define JSONL_HAS_MARK      8
+#define JSONL_HAS_ALL       15
+
+typedef struct {
+    unsigned fields;
+    char id[32];
+    char name[NAME_MAX_LENGTH];
+    char programme[PROGRAMME_MAX_LENGTH];
+    char mark[32];
+} JsonRow;
+
+// the next byte without taking it, -1 at the end of the file
+// (a caller only moves past a byte it got, never past the end)
+static int jsonPeek(JsonReader *r)
+{
+    if (r->position >= r->length) {
+        r->length = fread(r->buffer, 1, sizeof(r->buffer), r->fp);
+        r->position = 0;
+        if (r->length == 0) {
+            return -1;
+        }
+    }
+    return (unsigned char)r->buffer[r->position];
+}
+
+// spaces and line ends between rows; returns the byte after them
+static int jsonSkipSpace(JsonReader *r)
+{
+    int c;
+    while ((c = jsonPeek(r)) == ' ' || c == '\t' || c == '\r' || c == '\n') {
+        r->position++;
+    }
+    return c;
+}
+
+// spaces between tokens of one row (a line end is not skipped); returns the byte after them
+static int jsonSkipBlank(JsonReader *r)
+{
+    int c;
+    while ((c = jsonPeek(r)) == ' ' || c == '\t' || c == '\r') {
+        r->position++;
+    }
+    return c;
+}
+
+// after a syntax error: drop the rest of the line
+static void jsonSkipLine(JsonReader *r)
+{
+    int c;
+    while ((c = jsonPeek(r)) >= 0) {
+        r->position++;
+        if (c == '\n') {
+            break;
+        }
+    }
+}
+
+// the four hex digits of \uXXXX, -1 if they are not
+static long jsonReadHex4(JsonReader *r)
+{
+    long code = 0;
+    for (int k = 0; k < 4; ++k) {
+        int c = jsonPeek(r);
+        int digit = c >= '0' && c <= '9' ? c - '0'
+                  : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                  : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (digit < 0) {
+            return -1;
+        }
+        r->position++;
+        code = code * 16 + digit;
+    }
+    return code;
+}
+
+// a code point as UTF-8 into bytes; returns how many
+static size_t utf8Encode(unsigned long code, char *bytes)
+{
+    if (code < 0x80) {
+        bytes[0] = (char)code;
+        return 1;
+    }
+    if (code < 0x800) {
+        bytes[0] = (char)(0xC0 | (code >> 6));
+        bytes[1] = (char)(0x80 | (code & 0x3F));
+        return 2;
+    }
+    if (code < 0x10000) {
+        bytes[0] = (char)(0xE0 | (code >> 12));
+        bytes[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+        bytes[2] = (char)(0x80 | (code & 0x3F));
+        return 3;
+    }
+    bytes[0] = (char)(0xF0 | (code >> 18));
+    bytes[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+    bytes[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+    bytes[3] = (char)(0x80 | (code & 0x3F));
+    return 4;
+}
+
+/*
+Utf8Check: checks raw UTF-8 a byte at a time (a character may be split over
+two reads of the buffer)
+- need: continuation bytes still to come
+- low / high: the range the next continuation byte must be in, which rules
+  out overlong forms, surrogates and code points above U+10FFFF
+*/
+typedef struct {
+    int need;
+    unsigned char low;
+    unsigned char high;
+} Utf8Check;
+
+// returns 0 if the byte cannot come next in valid UTF-8
+static int utf8CheckByte(Utf8Check *check, unsigned char byte)
+{
+    if (check->need > 0) {
+        if (byte < check->low || byte > check->high) {
+            return 0;
+        }
+        check->need--;
+        check->low = 0x80;
+        check->high = 0xBF;
+        return 1;
+    }
+    if (byte < 0x80) {
+        return 1;
+    }
+
+    check->low = 0x80;
+    check->high = 0xBF;
+    if (byte >= 0xC2 && byte <= 0xDF) {
+        check->need = 1;
+    } else if (byte >= 0xE0 && byte <= 0xEF) {
+        check->need = 2;
+        if (byte == 0xE0) {
+            check->low = 0xA0;
+        } else if (byte == 0xED) {
+            check->high = 0x9F;
+        }
+    } else if (byte >= 0xF0 && byte <= 0xF4) {
+        check->need = 3;
+        if (byte == 0xF0) {
+            check->low = 0x90;
+        } else if (byte == 0xF4) {
+            check->high = 0x8F;
+        }
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/*
+read a string (its opening quote is next) into out, at most size - 1 bytes
+returns 0 on a syntax error (also for a line end, \u0000 or bytes that are
+not valid UTF-8 in the string: they could not be written out as JSON again)
+*/
+static int jsonReadString(JsonReader *r, char *out, size_t size)
+{
+    if (jsonPeek(r) != '"') {
+        return 0;
+    }
+    r->position++;
+
+    size_t k = 0;
+    int full = 0;
+    Utf8Check check = { 0, 0x80, 0xBF };
+    while (1) {
+        // plain bytes are checked and copied a run at a time, straight out of the buffer
+        size_t run = r->position;
+        while (run < r->length && (unsigned char)r->buffer[run] >= 0x20 &&
+               r->buffer[run] != '"' && r->buffer[run] != '\\') {
+            unsigned char byte = (unsigned char)r->buffer[run];
+            if ((byte >= 0x80 || check.need) && !utf8CheckByte(&check, byte)) {
+                return 0;
+            }
+            run++;
+        }
+        if (!full && run > r->position) {
+            size_t length = run - r->position;
+            if (k + length >= size) {
+                // too long: keep whole characters only
+                length = size > k ? size - 1 - k : 0;
+                full = 1;
+                if (((unsigned char)r->buffer[r->position + length] & 0xC0) == 0x80) {
+                    while (length > 0 && ((unsigned char)r->buffer[r->position + length - 1] & 0xC0) == 0x80) {
+                        length--;
+                    }
+                    if (length > 0 && (unsigned char)r->buffer[r->position + length - 1] >= 0xC0) {
+                        length--;
+                    } else if (length == 0) {
+                        // the character began in the previous buffer
+                        while (k > 0 && ((unsigned char)out[k - 1] & 0xC0) == 0x80) {
+                            k--;
+                        }
+                        if (k > 0 && (unsigned char)out[k - 1] >= 0xC0) {
+                            k--;
+                        }
+                    }
+                }
+            }
+            memcpy(out + k, r->buffer + r->position, length);
+            k += length;
+        }
+        r->position = run;
+
+        int c = jsonPeek(r);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;       // the run went on in the next buffer
+        }
+        if (c < 0x20 || check.need) {   // also the end of the file (-1), or a cut character
+            return 0;
+        }
+        r->position++;
+        if (c == '"') {
+            break;
+        }
+
+        char bytes[4];
+        size_t n = 1;
+        bytes[0] = (char)c;
+        if (c == '\\') {
+            c = jsonPeek(r);
+            if (c < 0) {
+                return 0;
+            }
+            r->position++;
+            switch (c) {
+            case '"':
+            case '\\':
+            case '/':
+                bytes[0] = (char)c;
+                break;
+            case 'b':
+                bytes[0] = '\b';
+                break;
+            case 'f':
+                bytes[0] = '\f';
+                break;
+            case 'n':
+                bytes[0] = '\n';
+                break;
+            case 'r':
+                bytes[0] = '\r';
+                break;
+            case 't':
+                bytes[0] = '\t';
+                break;
+            case 'u': {
+                long code = jsonReadHex4(r);
+                if (code >= 0xD800 && code <= 0xDBFF) {
+                    // a high surrogate: the low one has to follow
+                    long low = -1;
+                    if (jsonPeek(r) == '\\') {
+                        r->position++;
+                        if (jsonPeek(r) == 'u') {
+                            r->position++;
+                            low = jsonReadHex4(r);
+                        }
+                    }
+                    if (low < 0xDC00 || low > 0xDFFF) {
+                        return 0;
+                    }
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                } else if (code <= 0 || (code >= 0xDC00 && code <= 0xDFFF)) {
+                    return 0;
+                }
+                n = utf8Encode((unsigned long)code, bytes);
+                break;
+            }
+            default:
+                return 0;
+            }
+        }
+
+        // an escape gives whole characters, one that does not fit ends the copy
+        if (!full && k + n < size) {
+            memcpy(out + k, bytes, n);
+            k += n;
+        } else {
+            full = 1;
+        }
+    }
+    if (size) {
+        out[k] = '\0';
+    }
+    return 1;
+}
+
+// a number (or true / false / null) as text; returns 0 if there is none or it does not fit
+static int jsonReadScalar(JsonReader *r, char *out, size_t size)
+{
+    size_t k = 0;
+    int c;
+    while ((c = jsonPeek(r)) >= 0 && (isalnum(c) || c == '-' || c == '+' || c == '.')) {
+        if (k + 1 >= size) {
+            return 0;
+        }
+        out[k++] = (char)c;
+        r->position++;
+    }
+    out[k] = '\0';
+    return k > 0;
+}
+
+// skip any value: a string, a scalar, or an object / array with everything in it
+static int jsonSkipValue(JsonReader *r)
+{
+    char scratch[32];
+    int c = jsonSkipBlank(r);
+    if (c == '"') {
+        return jsonReadString(r, scratch, sizeof(scratch));
+    }
+    if (c != '{' && c != '[') {
+        return jsonReadScalar(r, scratch, sizeof(scratch));
+    }
+
+    int depth = 0;
+    do {
+        c = jsonSkipBlank(r);
+        if (c == '"') {
+            if (!jsonReadString(r, scratch, sizeof(scratch))) {
+                return 0;
+            }
+            continue;
+        }
+        if (c < 0 || c == '\n') {
+            return 0;
+        }
+        r->position++;
+        if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            depth--;
+        }
+    } while (depth > 0);
+    return 1;
+}
+
+/*
+read the next object into row, with the end of its line
+returns 1 for an object (row->fields says which keys it had), 0 on a syntax
+error (also for anything but spaces after the object), -1 at the end of the file
+*/
+static int jsonReadRow(JsonReader *r, JsonRow *row)
+{
+    row->fields = 0;
+    int c = jsonSkipSpace(r);
+    if (c < 0) {
+        return -1;
+    }
+    if (c != '{') {
+        return 0;
+    }
+    r->position++;
+    c = jsonSkipBlank(r);
+
+    while (c != '}') {
+        char key[16];
+        if (c != '"' || !jsonReadString(r, key, sizeof(key)) || jsonSkipBlank(r) != ':') {
+            return 0;
+        }
+        r->position++;
+
+        int ok;
+        c = jsonSkipBlank(r);
+        if (equalsIgnoreCase(key, "name")) {
+            ok = jsonReadString(r, row->name, sizeof(row->name));
+            row->fields |= JSONL_HAS_NAME;
+        } else if (equalsIgnoreCase(key, "programme")) {
+            ok = jsonReadString(r, row->programme, sizeof(row->programme));
+            row->fields |= JSONL_HAS_PROGRAMME;
+        } else if (equalsIgnoreCase(key, "id")) {
+            ok = c == '"' ? jsonReadString(r, row->id, sizeof(row->id))
+                          : jsonReadScalar(r, row->id, sizeof(row->id));
+            row->fields |= JSONL_HAS_ID;
+        } else if (equalsIgnoreCase(key, "mark")) {
+            ok = c == '"' ? jsonReadString(r, row->mark, sizeof(row->mark))
+                          : jsonReadScalar(r, row->mark, sizeof(row->mark));
+            row->fields |= JSONL_HAS_MARK;
+        } else {
+            ok = jsonSkipValue(r);
+        }
+        if (!ok) {
+            return 0;
+        }
+
+        c = jsonSkipBlank(r);
+        if (c == ',') {
+            r->position++;
+            c = jsonSkipBlank(r);
+            if (c == '}') {
+                return 0;   // no trailing comma
+            }
+        } else if (c != '}') {
+            return 0;
+        }
+    }
+    r->position++;
+
+    // the object has to be the last thing on its line
+    c = jsonSkipBlank(r);
+    if (c == '\n') {
+        r->position++;
+    } else if (c >= 0) {
+        return 0;
+    }
+    return 1;
+}
+
+/*
+a JSON number (-12, 0.5, 1e2, 8.85E+1) as a whole number of 10^-decimals,
+rounded half away from zero like markParse
+parameters:
+    text    : the number; all of it has to follow the grammar, nothing may come after it
+    decimals: 0 for a whole number, 1 for tenths
+    exact   : set if the number must not need rounding (an ID)
+    out     : gets the scaled number
+returns:
+    0 if the text is not a JSON number, needs rounding when exact is set, or is
+    bigger than 10^15
+*/
+static int jsonNumberScaled(const char *text, int decimals, int exact, long long *out)
+{
+    const char *p = text;
+    int negative = *p == '-';
+    if (negative) {
+        p++;
+    }
+
+    // the digits are the whole part then the fraction, without the point
+    const char *whole = p;
+    if (*p == '0') {
+        p++;
+    } else if (*p >= '1' && *p <= '9') {
+        while (isdigit((unsigned char)*p)) {
+            p++;
+        }
+    } else {
+        return 0;
+    }
+    int wholeDigits = (int)(p - whole);
+
+    const char *fraction = p;
+    int fractionDigits = 0;
+    if (*p == '.') {
+        fraction = ++p;
+        while (isdigit((unsigned char)*p)) {
+            p++;
+        }
+        fractionDigits = (int)(p - fraction);
+        if (fractionDigits == 0) {
+            return 0;
+        }
+    }
+
+    long exponent = 0;
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        int negativeExponent = *p == '-';
+        if (*p == '+' || *p == '-') {
+            p++;
+        }
+        if (!isdigit((unsigned char)*p)) {
+            return 0;
+        }
+        while (isdigit((unsigned char)*p)) {
+            if (exponent < 1000) {
+                exponent = exponent * 10 + (*p - '0');
+            }
+            p++;
+        }
+        if (negativeExponent) {
+            exponent = -exponent;
+        }
+    }
+    if (*p) {
+        return 0;
+    }
+
+    // digits before "kept" make the scaled number, the one at "kept" rounds it
+    int digits = wholeDigits + fractionDigits;
+    long kept = wholeDigits + exponent + decimals;
+    long long value = 0;
+    int roundUp = 0;
+    int rest = 0;
+    for (long k = 0; k < digits || k < kept; ++k) {
+        int digit = k >= digits ? 0
+                  : k < wholeDigits ? whole[k] - '0' : fraction[k - wholeDigits] - '0';
+        if (k < kept) {
+            if (value >= 100000000000000LL) {
+                return 0;   // more than 10^15
+            }
+            value = value * 10 + digit;
+        } else if (k == kept) {
+            roundUp = digit >= 5;
+            rest |= digit;
+        } else {
+            rest |= digit;
+        }
+    }
+    if (exact && rest) {
+        return 0;
+    }
+
+    value += roundUp;
+    *out = negative ? -value : value;
+    return 1;
+}
+
+// 1 if a decoded name / programme has no control characters (see above)
+static int jsonTextIsPlain(const char *text)
+{
+    for (; *text; ++text) {
+        if ((unsigned char)*text < 0x20 || *text == 0x7F) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+IMPORT JSONL <file>: see above
+    added  : gets the number of students added
+    skipped: gets the number of lines that were not (bad, incomplete or a known ID)
+returns 0 if the file could not be opened
+*/
+static int importFromJsonlFile(const char *fileName, size_t *added, size_t *skipped)
+{
+    const char *usedPath = NULL;
+    FILE *fp = openFileForReadSearch(fileName, &usedPath);
+    *added = 0;
+    *skipped = 0;
+    if (!fp) {
+        return 0;
+    }
+
+    JsonReader reader;
+    reader.fp = fp;
+    reader.length = 0;
+    reader.position = 0;
+
+    TraceBatch batch;
+    traceBatchBegin(&batch);
+    uint64_t phase = phaseStart();
+    while (1) {
+        JsonRow row;
+        int status = jsonReadRow(&reader, &row);
+        if (status < 0) {
+            break;
+        }
+        traceBatchRow(&batch, "import rows");
+        if (status == 0) {
+            jsonSkipLine(&reader);
+            (*skipped)++;
+            continue;
+        }
+
+        long long id = 0;
+        long long mark = 0;
+        int valid = row.fields == JSONL_HAS_ALL &&
+                    jsonTextIsPlain(row.name) && jsonTextIsPlain(row.programme) &&
+                    jsonNumberScaled(row.id, 0, 1, &id) && id >= INT_MIN && id <= INT_MAX &&
+                    jsonNumberScaled(row.mark, 1, 0, &mark) && mark >= MARK_LOWEST && mark <= MARK_HIGHEST;
+        phaseLap(PHASE_PARSE, &phase);
+
+        RowLocation where;
+        if (valid && !findIndexById((int)id, &where) &&
+            addStudentRecord((int)id, row.name, row.programme, (Mark)mark)) {
+            (*added)++;
+        } else {
+            (*skipped)++;
+        }
+        phaseLap(PHASE_INSERT, &phase);
+    }
+    traceBatchEnd(&batch, "import rows");
+
+    // addStudentRecord counted the rows it added, the skipped lines were parsed too
+    countRows(*skipped);
+    countBytesRead((uint64_t)ftell(fp));
+    fclose(fp);
+    return 1;
+}
+
+// one student as a JSON line (the same as SET OUTPUT json)
+static void writeJsonlRow(OutputBuffer *out, const StudentRecord *student)
+{
+    outputReserve(out, RESULT_ROW_MAX);
+    char *p = putText(out->data + out->length, "{\"id\":");
+    p = putInt(p, student->id);
+    p = putText(p, ",\"name\":");
+    p = putJsonText(p, student->name);
+    p = putText(p, ",\"programme\":");
+    p = putJsonText(p, student->programme);
+    p = putText(p, ",\"mark\":");
+    p = putMark(p, student->mark);
+    p = putText(p, "}\n");
+    outputEndRow(out, p);
+}
+
+// EXPORT JSONL <file>: every student of the snapshot as a JSON line, in table order or sorted by spec
+static int exportToJsonlFile(const TableSnapshot *snapshot, const char *fileName, const SortSpec *spec)
+{
+    if (!fileName || !fileName[0]) {
+        return 0;
+    }
+
+    char actualPath[1024];
+    FILE *fp = openFileForWriteInProgramFolder(fileName, actualPath, sizeof(actualPath));
+    if (!fp) {
+        return 0;
+    }
+
+    int ok = 1;
+    if (spec->keyCount) {
+        ok = writeSnapshotRowsSorted(fp, snapshot, spec, writeJsonlRow);
+    } else {
+        writeSnapshotRows(fp, snapshot, writeJsonlRow);
+    }
+
+    if (fclose(fp) != 0) {
+        ok = 0;
+    }
+    return ok;
+}
+
+// SYNTHETIC DATA (GENERATE <n> [seed])
+/*
+made-up but realistic rosters for testing and benchmarks:
+    - IDs: one cohort per intake up to intake 25 (2501234, 2501236, ...),
+      numbered upwards, with small gaps while a cohort leaves room for them.
+      the roster covers at least GENERATE_MIN_INTAKES intakes and as many
+      more as needed to keep the average cohort at GENERATE_COHORT_AVERAGE;
+      every cohort is 80% to 120% of the average (GenerateLayout).
+      intakes start at 10 so IDs have seven digits; a roster too big for
+      intakes 10 to 25 (more than about a million rows) goes on past 25,
+      from intake 100 on with eight digit IDs
+    - programmes: a few popular ones and a long tail (weight 1 / rank)
+    - names: a surname and one to three given names (common ones picked more
+      often), now and then a long double-barrelled name
+    - marks: bell-shaped around 65 (sum of four random numbers), 15 to 100
+every row only depends on (seed, roster size, row number), so the same
+command always gives the same roster; rows past the roster size are late
+enrolments of the newest cohort (the benchmark inserts those)
+*/
+#define GENERATE_COHORT_AVERAGE 65000
+#define GENERATE_MIN_INTAKES 4
+#define GENERATE_FIRST_INTAKE 10
+#define GENERATE_LAST_INTAKE 25
+#define GENERATE_MAX_ROWS 100000000
+
+static const char *const generateProgrammes[] = {
+    "Computer Science", "Information Technology", "Software Engineering",
+    "Data Analytics", "Information Security", "Digital Supply Chain",
+    "Computer Engineering", "Game Development", "Applied Artificial Intelligence",
+    "Interactive Media", "Telematics and Wireless Systems", "Digital Art and Animation"
+};
+
+static const char *const generateSurnames[] = {
+    "Tan", "Lim", "Lee", "Ng", "Wong", "Goh", "Chua", "Chan", "Koh", "Teo",
+    "Ong", "Low", "Sim", "Yeo", "Ho", "Toh", "Kumar", "Pillai", "Rahman", "Abdullah",
+    "Fernandez", "Nair", "Ismail", "Quek"
+};
+
+static const char *const generateGivenNames[] = {
+    "Wei", "Ming", "Jun", "Hui", "Xin", "Yi", "Jia", "Kai", "Li", "En",
+    "Brian", "Alice", "David", "Han", "Yong", "Jerrel", "Kendrick", "Xian", "Yang", "Rachel",
+    "Nur", "Aisyah", "Muhammad", "Siti", "Arjun", "Priya", "Daniel", "Sarah", "Marcus", "Chloe",
+    "Ethan", "Natalie", "Ryan", "Megan", "Jonathan", "Samantha", "Benjamin", "Gabrielle", "Zhi", "Hao"
+};
+
+#define GENERATE_COUNT(list) (sizeof(list) / sizeof((list)[0]))
+
+// splitmix64: a good 64-bit mix of (seed, row, stream)
+static uint64_t generateRandom(uint64_t seed, uint64_t row, uint64_t stream)
+{
+    uint64_t z = seed + row * 0x9E3779B97F4A7C15ull + stream * 0xD1B54A32D192ED03ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// an index in [0, count), index k picked with weight 1 / (k + 1)
+static size_t generateSkewedIndex(uint64_t random, size_t count)
+{
+    double total = 0.0;
+    for (size_t k = 0; k < count; ++k) {
+        total += 1.0 / (double)(k + 1);
+    }
+
+    double target = (double)(random >> 11) / 9007199254740992.0 * total;     // [0, total)
+    for (size_t k = 0; k < count; ++k) {
+        target -= 1.0 / (double)(k + 1);
+        if (target < 0.0) {
+            return k;
+        }
+    }
+    return count - 1;
+}
+
+/*
+GenerateLayout: how a roster of "rows" students is split into cohorts
+- firstIntake / intakes: the intakes the roster covers
+- cohortStart: first row of every cohort, cohortStart[intakes] = rows
+every cohort stays below 100000 IDs (with its gaps), so an ID never runs
+into the next intake
+*/
+typedef struct {
+    uint64_t seed;
+    size_t rows;
+    int firstIntake;
+    size_t intakes;
+    size_t *cohortStart;
+} GenerateLayout;
+
+static void generateLayoutInit(GenerateLayout *layout, size_t rows, uint64_t seed)
+{
+    size_t intakes = (rows + GENERATE_COHORT_AVERAGE - 1) / GENERATE_COHORT_AVERAGE;
+    if (intakes < GENERATE_MIN_INTAKES) {
+        intakes = GENERATE_MIN_INTAKES;
+    }
+    layout->seed = seed;
+    layout->rows = rows;
+    layout->intakes = intakes;
+    layout->firstIntake = intakes <= GENERATE_LAST_INTAKE - GENERATE_FIRST_INTAKE + 1
+                              ? GENERATE_LAST_INTAKE + 1 - (int)intakes : GENERATE_FIRST_INTAKE;
+    layout->cohortStart = (size_t *)memoryAlloc(MEMORY_OTHER, (intakes + 1) * sizeof(size_t));
+    double *weights = (double *)memoryAlloc(MEMORY_OTHER, intakes * sizeof(double));
+    if (!layout->cohortStart || !weights) {
+        fprintf(stderr, "CMS: Out of memory when generating students.\n");
+        exit(1);
+    }
+
+    // every cohort gets a weight from 0.8 to 1.2, its share of the rows
+    double total = 0.0;
+    for (size_t k = 0; k < intakes; ++k) {
+        weights[k] = 0.8 + 0.4 * (double)(generateRandom(seed, k, 9) >> 11) / 9007199254740992.0;
+        total += weights[k];
+    }
+    double before = 0.0;
+    for (size_t k = 0; k < intakes; ++k) {
+        layout->cohortStart[k] = (size_t)((double)rows * before / total);
+        before += weights[k];
+    }
+    layout->cohortStart[intakes] = rows;
+    memoryFree(weights);
+}
+
+static void generateLayoutFree(GenerateLayout *layout)
+{
+    memoryFree(layout->cohortStart);
+    layout->cohortStart = NULL;
+}
+
+// the ID of generated row "row": ascending inside its cohort, unique overall
+static int generatedStudentId(const GenerateLayout *layout, size_t row)
+{
+    // the cohort holding the row (rows past the end join the newest one)
+    size_t low = 0;
+    size_t high = layout->intakes - 1;
+    while (low < high) {
+        size_t middle = low + (high - low + 1) / 2;
+        if (layout->cohortStart[middle] <= row) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    // a gap of one ID now and then while the cohort has room for it
+    size_t size = layout->cohortStart[low + 1] - layout->cohortStart[low];
+    size_t index = row - layout->cohortStart[low];
+    size_t serial = size <= 45000 ? index * 2 + (generateRandom(layout->seed, row, 0) & 1) : index;
+    return (int)(((size_t)layout->firstIntake + low) * 100000 + serial);
+}
+
+// fill in one generated student (the ID comes from generatedStudentId)
+static void generateStudent(const GenerateLayout *layout, size_t row, StudentRecord *out)
+{
+    uint64_t seed = layout->seed;
+    out->id = generatedStudentId(layout, row);
+
+    uint64_t random = generateRandom(seed, row, 1);
+    strcpy(out->programme, generateProgrammes[generateSkewedIndex(random, GENERATE_COUNT(generateProgrammes))]);
+
+    // one to three given names (30% / 55% / 15%) after the surname
+    random = generateRandom(seed, row, 2);
+    unsigned percent = (unsigned)(random % 100);
+    int givenCount = percent < 30 ? 1 : (percent < 85 ? 2 : 3);
+
+    size_t length = 0;
+    size_t surname = generateSkewedIndex(generateRandom(seed, row, 3), GENERATE_COUNT(generateSurnames));
+    length += (size_t)snprintf(out->name, NAME_MAX_LENGTH, "%s", generateSurnames[surname]);
+    if ((random >> 8) % 20 == 0) {
+        // about one in twenty gets a second surname, never the first one again
+        size_t second = (random >> 16) % GENERATE_COUNT(generateSurnames);
+        second = second == surname ? (second + 1) % GENERATE_COUNT(generateSurnames) : second;
+        length += (size_t)snprintf(out->name + length, NAME_MAX_LENGTH - length, "-%s", generateSurnames[second]);
+    }
+
+    // the given names are drawn without replacement: a name already picked moves on to the next one
+    size_t picked[3];
+    for (int g = 0; g < givenCount && length < NAME_MAX_LENGTH; ++g) {
+        uint64_t pick = generateRandom(seed, row, 4 + (uint64_t)g);
+        size_t given = generateSkewedIndex(pick, GENERATE_COUNT(generateGivenNames));
+        for (int earlier = 0; earlier < g;) {
+            if (picked[earlier] == given) {
+                given = (given + 1) % GENERATE_COUNT(generateGivenNames);
+                earlier = 0;
+            } else {
+                earlier++;
+            }
+        }
+        picked[g] = given;
+        length += (size_t)snprintf(out->name + length, NAME_MAX_LENGTH - length, " %s", generateGivenNames[given]);
+    }
+
+    // four 0..250 tenths numbers add up to a bell curve around 50; shift it to about 65
+    random = generateRandom(seed, row, 8);
+    int tenths = 150;
+    for (int k = 0; k < 4; ++k) {
+        tenths += (int)((random >> (16 * k)) & 0xFFFF) % 251;
+    }
+    out->mark = (Mark)(tenths > 1000 ? 1000 : tenths);
+}
+
+/*
+add "count" generated students to the table (see SYNTHETIC DATA above)
+rows whose ID is already in the table are skipped
+returns how many were added
+*/
+static size_t generateStudents(size_t count, uint64_t seed)
+{
+    GenerateLayout layout;
+    generateLayoutInit(&layout, count, seed);
+    size_t added = 0;
+    for (size_t row = 0; row < count; ++row) {
+        StudentRecord student;
+        generateStudent(&layout, row, &student);
+        added += (size_t)addStudentRecord(student.id, student.name, student.programme, student.mark);
+    }
+    generateLayoutFree(&layout);
+    return added;
+}
+
+// matches found by one FIND task (one range of chunks)
+typedef struct {
+    OutputBuffer text;
+    int hitCount;
+} FindTaskResult;
+
+typedef struct {
+    const TableSnapshot *snapshot;
+    const char *needle;
+    int searchName;             // 1: NAME, 0: PROGRAMME
+    ResultLayout layout;        // of the command's result
+    size_t taskCount;
+    FindTaskResult *results;    // one per task, in table order
+} FindScan;
+
+static void findMatchesTask(void *context, size_t taskIndex, size_t begin, size_t end)
+{
+    FindScan *scan = (FindScan *)context;
+    FindTaskResult *result = &scan->results[taskIndex];
+
+    for (size_t c = begin; c < end; ++c) {
+        const RecordChunk *chunk = scan->snapshot->chunks[c];
+        for (unsigned i = 0; i < chunk->used; ++i) {
+            if (!chunk->live[i]) {
+                continue;
+            }
+
+            const char *haystack = scan->searchName ? chunkName(chunk, i) : chunkProgramme(chunk, i);
+            if (containsIgnoreCase(haystack, scan->needle)) {
+                writeResultRow(&result->text, &scan->layout, chunk, i);
+                result->hitCount++;
+            }
+        }
+    }
+}
+
+/*
+
+simple case-insensitive search by Name or Programme
+the parameters:
+    fieldName: "NAME" or "PROGRAMME"
+    needle   : search text (substring)
+example:
+    FIND NAME "brian"
+    FIND PROGRAMME "Digital Supply Chain"
+returns the number of matches
+*/
+static int findStudentsByField(const TableSnapshot *snapshot, const char *fieldName, const char *needle)
+{
+    if (!needle || !needle[0]) {
+        outputPrintf("CMS: Please provide a search string.\n");
+        return 0;
+    }
+
+    outputPrintf("CMS: Search results for %s contains \"%s\":\n", fieldName, needle);
+    resultHeader();
+    countRows(snapshot->count);
+
+    FindScan scan;
+    scan.snapshot = snapshot;
+    scan.needle = needle;
+    scan.searchName = equalsIgnoreCase(fieldName, "NAME");
+    scan.layout = currentResult.layout;
+    scan.taskCount = parallelTaskCount(snapshot->chunkCount, PARALLEL_AUTO_GRAIN);
+    scan.results = (FindTaskResult *)memoryCalloc(MEMORY_QUERY, scan.taskCount ? scan.taskCount : 1,
+                                                  sizeof(FindTaskResult));
+    if (!scan.results) {
+        fprintf(stderr, "CMS: Out of memory in findStudentsByField.\n");
+        return 0;
+    }
+
+    parallelFor(snapshot->chunkCount, PARALLEL_AUTO_GRAIN, findMatchesTask, &scan);
+
+    // print the matches in table order
+    int hitCount = 0;
+    for (size_t t = 0; t < scan.taskCount; ++t) {
+        resultAppend(&scan.results[t].text, (size_t)scan.results[t].hitCount);
+        hitCount += scan.results[t].hitCount;
+        outputFree(&scan.results[t].text);
+    }
+    memoryFree(scan.results);
+
+    if (!hitCount) {
+        outputPrintf("(no matches)\n");
+    }
+    return hitCount;
+}
+
+// PAGINATION (LIMIT / OFFSET / AFTER ID=)
+/*
+SHOW ALL and FIND can print one page of their rows:
+    ... LIMIT n            at most n rows
+    ... OFFSET m           skip the first m rows
+    SHOW ALL AFTER ID=x    keyset paging: the rows with an ID above x, in ID order
+without SORT BY a cursor walks the snapshot in table order: chunks are
+skipped by their row count (or their zone map), and only the rows of the
+page are formatted, straight into the output buffer, so the first page of
+a huge table is printed at once. with SORT BY every key is still sorted,
+but only the page is formatted.
+AFTER ID=x walks the bitmap of all IDs (or the WHERE clause's bitmaps) from
+x on and fetches each row through the ID index, so a page costs the same at
+the start and at the end of the table. on a server worker thread (the
+indexes belong to the table thread) it is WHERE ID > x SORT BY ID instead.
+*/
+#define PAGE_NO_LIMIT SIZE_MAX
+#define PAGE_KEYSET_BATCH 1024      // IDs taken from the bitmap at a time
+
+typedef struct {
+    int active;
+    size_t limit;
+    size_t offset;
+    int after;                  // AFTER ID= was given
+    int afterId;
+} RowPage;
+
+// the rows of a snapshot that match a filter (NULL: every live row), one at a time in table order
+typedef struct {
+    const TableSnapshot *snapshot;
+    const QueryFilter *filter;
+    size_t segment;
+    size_t chunk;
+    unsigned row;               // next row of the chunk (0: the chunk is not entered yet)
+    int covered;                // every live row of the chunk matches
+} RowCursor;
+
+static void rowCursorInit(RowCursor *cursor, const TableSnapshot *snapshot, const QueryFilter *filter)
+{
+    cursor->snapshot = snapshot;
+    cursor->filter = filter && filter->active ? filter : NULL;
+    cursor->segment = 0;
+    cursor->chunk = 0;
+    cursor->row = 0;
+    cursor->covered = 0;
+}
+
+// go to the next chunk that can have a matching row; returns 0 at the end
+static int rowCursorSeekChunk(RowCursor *cursor)
+{
+    const TableSnapshot *snapshot = cursor->snapshot;
+    const QueryFilter *filter = cursor->filter;
+
+    while (cursor->segment < snapshot->segmentCount) {
+        const SnapshotSegment *segment = &snapshot->segments[cursor->segment];
+        size_t end = segment->firstChunk + segment->chunkCount;
+        if (cursor->chunk < end && !(filter && filterSkipsZone(filter, &segment->zone))) {
+            const RecordChunk *chunk = snapshot->chunks[cursor->chunk];
+            if (chunk->liveRows > 0 && !(filter && filterSkipsZone(filter, &chunk->zone))) {
+                cursor->covered = !filter || filterCoversZone(filter, &chunk->zone);
+                return 1;
+            }
+            cursor->chunk++;
+            continue;
+        }
+        cursor->segment++;
+        cursor->chunk = end;
+    }
+    return 0;
+}
+
+// the next matching row; returns 0 when there is none
+static int rowCursorNext(RowCursor *cursor, const RecordChunk **chunkOut, unsigned *rowOut)
+{
+    while (cursor->row > 0 || rowCursorSeekChunk(cursor)) {
+        const RecordChunk *chunk = cursor->snapshot->chunks[cursor->chunk];
+        while (cursor->row < chunk->used) {
+            unsigned i = cursor->row++;
+            if (chunk->live[i] && (cursor->covered || filterMatchesRow(cursor->filter, chunk, i))) {
+                *chunkOut = chunk;
+                *rowOut = i;
+                return 1;
+            }
+        }
+        cursor->chunk++;
+        cursor->row = 0;
+    }
+    return 0;
+}
+
+// step over "count" matching rows; a chunk whose rows all match is skipped whole
+static void rowCursorSkip(RowCursor *cursor, size_t count)
+{
+    while (count > 0) {
+        if (cursor->row == 0) {
+            if (!rowCursorSeekChunk(cursor)) {
+                return;
+            }
+            unsigned live = cursor->snapshot->chunks[cursor->chunk]->liveRows;
+            if (cursor->covered && live <= count) {
+                count -= live;
+                cursor->chunk++;
+                continue;
+            }
+        }
+        const RecordChunk *chunk;
+        unsigned i;
+        if (!rowCursorNext(cursor, &chunk, &i)) {
+            return;
+        }
+        count--;
+    }
+}
+
+// the last line of a page: which rows it had and where the next one starts
+static void printPageFooter(const RowPage *page, size_t shown, int more, int lastId)
+{
+    if (shown == 0) {
+        outputPrintf("CMS: No rows on this page.\n");
+    } else if (page->after) {
+        outputPrintf(more ? "CMS: %zu rows shown; the next page is AFTER ID=%d.\n"
+                          : "CMS: %zu rows shown, the last one has ID=%d.\n", shown, lastId);
+    } else if (more) {
+        outputPrintf("CMS: Rows %zu to %zu shown; the next page starts at OFFSET %zu.\n",
+                     page->offset + 1, page->offset + shown, page->offset + shown);
+    } else {
+        outputPrintf("CMS: Rows %zu to %zu shown, that is all.\n", page->offset + 1, page->offset + shown);
+    }
+}
+
+// AFTER ID=x on the thread that owns the indexes: walk the bitmaps in ID order
+static size_t showAllAfterId(const QueryFilter *filter, const RowPage *page)
+{
+    Roaring programmes = { NULL, 0, 0 };
+    Roaring grades = { NULL, 0, 0 };
+    const Roaring *ids = whereBitmaps(filter, filterBitmapGrades(filter), &programmes, &grades);
+
+    int from = page->afterId < filter->idMin ? filter->idMin : page->afterId;
+    int exclusive = from == page->afterId;      // the AFTER ID itself is not on the page
+    uint32_t next = roaringValueOfId(from);
+    uint32_t last = roaringValueOfId(filter->idMax);
+    int done = (exclusive && next == UINT32_MAX) || filter->idMin > filter->idMax;
+    if (exclusive) {
+        next++;
+    }
+
+    int batch[PAGE_KEYSET_BATCH];
+    size_t skip = page->offset;
+    size_t shown = 0;
+    int lastId = page->afterId;
+    int more = 0;
+    while (!done && next <= last) {
+        size_t n = roaringCollectIds(ids, next, last, batch, PAGE_KEYSET_BATCH);
+        if (n == 0) {
+            break;
+        }
+        countRows(n);
+        for (size_t k = 0; k < n && !done; ++k) {
+            RowLocation where;
+            if (!idIndexFind(batch[k], &where)) {
+                continue;
+            }
+            const RecordChunk *chunk = studentTable.segments[where.segment].chunks[where.slot / CHUNK_ROWS];
+            unsigned i = (unsigned)(where.slot % CHUNK_ROWS);
+            if (!filterMatchesRow(filter, chunk, i)) {
+                continue;
+            }
+            if (skip > 0) {
+                skip--;
+            } else if (shown == page->limit) {
+                more = 1;
+                done = 1;
+            } else {
+                resultWriteRow(chunk, i);
+                lastId = batch[k];
+                shown++;
+            }
+        }
+        uint32_t reached = roaringValueOfId(batch[n - 1]);
+        if (reached == UINT32_MAX) {
+            break;
+        }
+        next = reached + 1;
+    }
+
+    roaringFree(&programmes);
+    roaringFree(&grades);
+    printPageFooter(page, shown, more, lastId);
+    return shown;
+}
+
+/*
+SHOW ALL [WHERE ...] [SORT BY ...] with LIMIT / OFFSET / AFTER ID= (see above)
+the snapshot must be fresh when the command runs on the table thread
+returns: the rows on the page
+*/
+static size_t showAllPage(TableSnapshot *snapshot, const QueryFilter *filter, const SortSpec *spec,
+                          const RowPage *page)
+{
+    outputPrintf("CMS: Here are the records found in the table \"StudentRecords\".\n");
+    resultHeader();
+
+    if (page->after && !pinnedSnapshot) {
+        return showAllAfterId(filter, page);
+    }
+
+    // AFTER ID=x without the indexes is WHERE ID > x SORT BY ID
+    QueryFilter rows = *filter;
+    SortSpec order = *spec;
+    if (page->after) {
+        rows.active = 1;
+        if (page->afterId == INT_MAX) {
+            filterMatchNothing(&rows);
+        } else if (rows.idMin <= page->afterId) {
+            rows.idMin = page->afterId + 1;
+        }
+        order.keyCount = 1;
+        order.keys[0].column = SORT_COLUMN_ID;
+        order.keys[0].direction = SORT_ASCENDING;
+    }
+
+    size_t shown = 0;
+    int more = 0;
+    int lastId = page->afterId;
+    if (order.keyCount == 0) {
+        RowCursor cursor;
+        rowCursorInit(&cursor, snapshot, &rows);
+        uint64_t phase = phaseStart();
+        rowCursorSkip(&cursor, page->offset);
+        const RecordChunk *chunk;
+        unsigned i;
+        while (rowCursorNext(&cursor, &chunk, &i)) {
+            if (shown == page->limit) {
+                more = 1;
+                break;
+            }
+            resultWriteRow(chunk, i);
+            lastId = chunk->ids[i];
+            shown++;
+        }
+        phaseLap(PHASE_FORMAT, &phase);
+        countRows(shown);
+    } else {
+        // the WHERE view counts as reading, EXPLAIN ANALYZE shows each phase as its own step
+        uint64_t phase = phaseStart();
+        TableSnapshot *view = tableSnapshotWhere(snapshot, &rows);
+        phaseLap(PHASE_READ, &phase);
+        size_t count = 0;
+        SortItem *items = sortSnapshotChunks(view, &order, 0, view->chunkCount, &count);
+        phaseLap(PHASE_SORT, &phase);
+        if (!items) {
+            fprintf(stderr, "CMS: Out of memory in showAllPage.\n");
+            tableSnapshotWhereEnd(view, snapshot);
+            return 0;
+        }
+        countRows(count);
+
+        size_t first = page->offset < count ? page->offset : count;
+        shown = count - first < page->limit ? count - first : page->limit;
+        more = first + shown < count;
+        resultWriteSortedRows(view, items + first, shown);
+        phaseLap(PHASE_FORMAT, &phase);
+        if (shown > 0) {
+            uint32_t slot = items[first + shown - 1].slot;
+            lastId = view->chunks[slot / CHUNK_ROWS]->ids[slot % CHUNK_ROWS];
+        }
+        memoryFree(items);
+        tableSnapshotWhereEnd(view, snapshot);
+    }
+    printPageFooter(page, shown, more, lastId);
+    return shown;
+}
+
+/*
+FIND NAME / PROGRAMME "..." with LIMIT / OFFSET: the rows are searched in
+table order and the search stops at the end of the page (one thread)
+returns the number of matches shown
+*/
+static int findStudentsPage(const TableSnapshot *snapshot, const char *fieldName, const char *needle,
+                            const RowPage *page)
+{
+    if (!needle || !needle[0]) {
+        outputPrintf("CMS: Please provide a search string.\n");
+        return 0;
+    }
+    if (page->after) {
+        outputPrintf("CMS: FIND pages with LIMIT and OFFSET; AFTER ID= only works with SHOW ALL.\n");
+        return 0;
+    }
+
+    outputPrintf("CMS: Search results for %s contains \"%s\":\n", fieldName, needle);
+    resultHeader();
+
+    int searchName = equalsIgnoreCase(fieldName, "NAME");
+    RowCursor cursor;
+    rowCursorInit(&cursor, snapshot, NULL);
+    size_t skip = page->offset;
+    size_t shown = 0;
+    size_t read = 0;
+    int more = 0;
+    const RecordChunk *chunk;
+    unsigned i;
+    while (rowCursorNext(&cursor, &chunk, &i)) {
+        read++;
+        if (!containsIgnoreCase(searchName ? chunkName(chunk, i) : chunkProgramme(chunk, i), needle)) {
+            continue;
+        }
+        if (skip > 0) {
+            skip--;
+        } else if (shown == page->limit) {
+            more = 1;
+            break;
+        } else {
+            resultWriteRow(chunk, i);
+            shown++;
+        }
+    }
+    countRows(read);
+    printPageFooter(page, shown, more, 0);
+    return (int)shown;
+}
+
+/*
+function to create a timestamped backup of the current database file
+eg:
+    if the snapshot's database file is "P10-4-CMS.txt", backup file might be "P10-4-CMS.bak-20251125-153012.txt".
+the implementation:
+- use getFileNameStem to get base name without extension
+- append ".bak-YYYYMMDD-HHMMSS.txt"
+- reuse saveDatabaseToFile() to create the backup content
+*/
+static int makeTimestampedBackup(const TableSnapshot *snapshot)
+{
+    if (!snapshot->databaseFileName[0]) {
+        return 0;   // we need to know which file is the "current" DB
+    }
+
+    char stem[256];
+    getFileNameStem(snapshot->databaseFileName, stem, sizeof(stem));
+
+    // localtime_r / localtime_s: a backup may run on a server worker thread
+    time_t now = time(NULL);
+    struct tm tmValue;
+#ifdef _WIN32
+    localtime_s(&tmValue, &now);
+#else
+    localtime_r(&now, &tmValue);
+#endif
+
+    char timestamp[64];
+    strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", &tmValue);
+
+    char backupFileName[512];
+    snprintf(backupFileName, sizeof(backupFileName),
+             "%s.bak-%s.txt", stem, timestamp);
+
+    return saveDatabaseToFile(snapshot, backupFileName);
+}
+
+
+// print our declaration at the start of the program
+static void printDeclaration(void)
+{
+    //time_t now = time(NULL);
+    //struct tm *tmPtr = localtime(&now);
+    const char *dateString = "24/11/2025"; //change to hard code for submission date
+
+    //char dateString[32];
+    //strftime(dateString, sizeof(dateString), "%Y-%m-%d", tmPtr);
+    printf("Date of submission: %s\n\n", dateString);
+
+    printf("\nDeclaration\n");
+    printf("SIT's policy on copying does not allow the students to copy source code as well as assessment solutions\n");
+    printf("from another person AI or other places. It is the students' responsibility to guarantee that their\n");
+    printf("assessment solutions are their own work. Meanwhile, the students must also ensure that their work is\n");
+    printf("not accessible by others. Where such plagiarism is detected, both of the assessments involved will\n");
+    printf("receive ZERO mark.\n\n");
+
+    printf("We hereby declare that:\n");
+    printf("- We fully understand and agree to the abovementioned plagiarism policy.\n");
+    printf("- We did not copy any code from others or from other places.\n");
+    printf("- We did not share our codes with others or upload to any other places for public access and will not do that in the future.\n");
+    printf("- We agree that our project will receive Zero mark if there is any plagiarism detected.\n");
+    printf("- We agree that we will not disclose any information or material of the group project to others or upload to any other places for public access.\n");
+    printf("- We agree that we did not copy any code directly from AI generated sources.\n\n");
+
+    printf("Declared by: %s\n", OUR_GROUP_NAME);
+    printf("Team members:\n");
+    printf("1. BRIAN GOH JUN WEI\n");
+    printf("2. HAN YONG\n");
+    printf("3. JERREL\n");
+    printf("4. KENDRICK\n");
+    printf("5. XIAN YANG\n");
+    printf("Date: %s\n\n", dateString);
+}
+
+/*
+prompts the user to enter the database password before using our CMS
+if correct password is entered within MAX_PASSWORD_ATTEMPTS,
+return 1 (success).
+if all attempts fail, return 0 and the program will exit
+
+additional unique feature (just a simple standard authentication for databases i guess?)
+*/
+static int checkDatabasePassword(void)
+{
+    char inputBuffer[256];
+
+    for (int attempt = 1; attempt <= MAX_PASSWORD_ATTEMPTS; ++attempt) {
+        printf("Please enter database password to continue (attempt %d of %d): ",
+               attempt, MAX_PASSWORD_ATTEMPTS);
+
+        if (!fgets(inputBuffer, sizeof(inputBuffer), stdin)) {
+            printf("\nCMS: Input error.\n");
+            return 0;
+        }
+
+        trimSpaces(inputBuffer);
+
+        if (strcmp(inputBuffer, DATABASE_PASSWORD) == 0) {
+            printf("CMS: Password accepted. Welcome to the Class Management System.\n\n");
+            return 1;
+        } else {
+            printf("CMS: Incorrect password.\n");
+        }
+    }
+
+    printf("CMS: Too many invalid password attempts. Exiting program.\n");
+    return 0;
+}
+
+// show all commands supported by this program, with examples (to allow user to just copy paste)
+static void printHelp(void)
+{
+    outputPuts("Commands (examples included!):\n");
+
+    outputPuts("OPEN / SAVE");
+    outputPuts("  OPEN <file>                 e.g.  OPEN db.txt");
+    outputPuts("  SAVE                        (saves back to last OPEN file)");
+    outputPuts("  SAVE <file>                 e.g.  SAVE db.txt\n");
+
+    outputPuts("VIEW");
+    outputPuts("  SHOW ALL                    list all rows");
+    outputPuts("  SHOW ALL SORT BY ID ASC     or DESC");
+    outputPuts("  SHOW ALL SORT BY MARK ASC   or DESC");
+    outputPuts("  SHOW ALL SORT BY MARK DESC, ID ASC   several columns (ties keep table order)");
+    outputPuts("  SHOW ALL SORT BY NAME       or PROGRAMME, NAME (A-Z, upper/lower case ignored)");
+    outputPuts("  SHOW ID, MARK SORT BY MARK DESC   only some columns (FIND/QUERY ... COLUMNS ID, MARK)");
+    outputPuts("  SHOW ALL ... LIMIT 20 OFFSET 40   one page (also FIND NAME/PROGRAMME \"...\" LIMIT n)");
+    outputPuts("  SHOW ALL ... AFTER ID=<id> LIMIT 20   next page in ID order, after the last ID shown");
+    outputPuts("  SHOW SUMMARY                show count/average/highest/lowest");
+    outputPuts("  SHOW ALL WHERE INTAKE = 25 AND MARK >= 50   also for SHOW SUMMARY/TOP, EXPORT");
+    outputPuts("    WHERE uses ID, MARK, INTAKE with = < <= > >= or BETWEEN <low> AND <high>");
+    outputPuts("    WHERE PROGRAMME = \"...\" or IN (\"...\", \"...\"), GRADE = A or IN (A, B)");
+    outputPuts("  COUNT WHERE GRADE = A       count rows (answered from bitmap indexes)");
+    outputPuts("  EXPLAIN SHOW ALL WHERE ...  how the rows are found (index, bitmaps or scan), estimated rows");
+    outputPuts("  EXPLAIN ANALYZE <command>   also runs it: real rows and time of every step");
+    outputPuts("  ANALYZE                     rebuild the column statistics the planner uses");
+    outputPuts("  SHOW STATISTICS             distinct names / programmes, mark and ID histograms");
+    outputPuts("  SHOW PARTITIONS             rows and ID/mark ranges of every intake");
+    outputPuts("  SHOW MEMORY                 used / reserved memory of records, indexes and buffers");
+    outputPuts("  SHOW TOP 3 BY MARK          best 3 marks (ties: smaller ID first)");
+    outputPuts("  SHOW TOP 3 BY MARK PER PROGRAMME   best 3 of every programme\n");
+
+    outputPuts("ADD / LOOKUP / EDIT / REMOVE");
+    outputPuts("  INSERT ID=<int> Name=\"...\" Programme=\"...\" Mark=<float>");
+    outputPuts("    e.g. INSERT ID=2501066 Name=\"Brian Goh\" Programme=\"Digital Supply Chain\" Mark=88.8");
+    outputPuts("  QUERY ID=<int>              e.g. QUERY ID=2501066");
+    outputPuts("  RANK ID=<int>               rank by mark inside the student's programme");
+    outputPuts("  UPDATE ID=<int> [Name=...] [Programme=...] [Mark=<float>]");
+    outputPuts("    e.g. UPDATE ID=2501066 Programme=\"Game Development\" Mark=95.5");
+    outputPuts("  DELETE ID=<int>             comes with Y/N confirmation\n");
+
+    outputPuts("SEARCH");
+    outputPuts("  FIND NAME \"...\"         e.g. FIND NAME \"brian\"");
+    outputPuts("  FIND PROGRAMME \"...\"    e.g. FIND PROGRAMME \"Digital Supply Chain\"\n");
+
+    outputPuts("IMPORT / EXPORT / BACKUP");
+    outputPuts("  IMPORT CSV <file.csv>       Header in CSV must be: ID,Name,Programme,Mark");
+    outputPuts("  EXPORT CSV <file.csv>       Open in Excel/Sheets to verify");
+    outputPuts("  IMPORT JSONL <file.jsonl>   One {\"id\":...,\"name\":...,\"programme\":...,\"mark\":...} per line");
+    outputPuts("  EXPORT JSONL <file.jsonl>   Same format as SET OUTPUT json (WHERE / SORT BY too)");
+    outputPuts("  EXPORT SQL <file.sql>       SQLite/MySQL compatible INSERTs");
+    outputPuts("  EXPORT CSV <file.csv> SORT BY MARK DESC, ID   (also for SQL, works for any table size)");
+    outputPuts("  SHOW ALL ... INTO <file>    rows of SHOW ALL/TOP, FIND, QUERY into a file instead of the screen");
+    outputPuts("  SET OUTPUT csv              rows as text (default), tsv, csv, json (a line per row) or binary");
+    outputPuts("  BACKUP                      writes <stem>.bak-YYYYMMDD-HHMMSS.txt");
+    outputPuts("  GENERATE <rows> [seed]      add made-up students, e.g. GENERATE 100000 7\n");
+
+    outputPuts("OTHER");
+    outputPuts("  STATS                       count and p50/p99/max time of every command type");
+    outputPuts("  STATS RESET                 start counting again");
+    outputPuts("  TIMING ON | TIMING OFF      print time, cpu time and phases after every command");
+    outputPuts("  TRACE START <file.json>     record spans for chrome://tracing / ui.perfetto.dev");
+    outputPuts("  TRACE STOP");
+    outputPuts("  CAPTURE START <file>        record every command line (run it again with --replay)");
+    outputPuts("  CAPTURE STOP");
+    outputPuts("  SET SLOWLOG <ms> [FILE <path>]  remember commands that take at least <ms>");
+    outputPuts("  SET SLOWLOG OFF");
+    outputPuts("  SHOW SLOWLOG                the slowest recent commands with their phases");
+    outputPuts("  HELP");
+    outputPuts("  EXIT\n");
+}
+
+/*
+one user of the CMS: the local terminal, or one client connection in --serve mode
+    - hasPendingDelete / pendingDeleteId: DELETE asks for Y/N and the answer
+      arrives as the next line, so we remember which ID is waiting for it
+    - timing: TIMING ON prints the time of every command after its output
+    - outputFormat: SET OUTPUT, how query results are written
+    - captureClient: which client its lines belong to in a CAPTURE file
+      (0: the terminal)
+*/
+typedef struct {
+    int hasPendingDelete;
+    int pendingDeleteId;
+    int timing;
+    ResultFormat outputFormat;
+    unsigned captureClient;
+} CommandSession;
+
+// handle the Y/N line that answers "Type Y to Confirm or N to cancel"
+static void finishPendingDelete(CommandSession *session, char *line)
+{
+    int id = session->pendingDeleteId;
+    session->hasPendingDelete = 0;
+
+    trimSpaces(line);
+
+    if (line[0] == 'Y' || line[0] == 'y') {
+        if (deleteStudentRecord(id)) {
+            outputPrintf("CMS: The record with ID=%d is successfully deleted.\n", id);
+        } else {
+            outputPrintf("CMS: Delete failed.\n");
+        }
+    } else {
+        outputPrintf("CMS: Delete cancelled.\n");
+    }
+}
+
+/*
+cut an optional "SORT BY <col> [ASC|DESC], ..." off the end of an argument
+    argument      : text after the command word, e.g. "out.csv SORT BY MARK DESC"
+                    (becomes just "out.csv")
+    upperArgument : the same text in uppercase
+returns 0 (after printing why) if the sort list is not valid
+*/
+static int takeSortByClause(char *argument, const char *upperArgument, SortSpec *spec)
+{
+    spec->keyCount = 0;
+
+    const char *sortBy = strstr(upperArgument, "SORT BY");
+    if (!sortBy) {
+        return 1;
+    }
+
+    if (!parseSortSpec(sortBy + 7, spec)) {
+        return 0;
+    }
+
+    argument[sortBy - upperArgument] = '\0';
+    trimSpaces(argument);
+    return 1;
+}
+
+// copy "src" into "dst" in uppercase (for matching command words)
+static void copyUppercase(char *dst, const char *src, size_t size)
+{
+    size_t i = 0;
+    for (; src[i] && i + 1 < size; ++i) {
+        dst[i] = (char)toupper((unsigned char)src[i]);
+    }
+    dst[i] = '\0';
+}
+
+/*
+cut an optional "WHERE <conditions>" off the end of an argument
+(call it after takeSortByClause: the WHERE clause comes before SORT BY)
+    argument : e.g. "out.csv WHERE INTAKE = 25" (becomes just "out.csv")
+returns 0 (after printing why) if the conditions are not valid
+*/
+static int takeWhereClause(char *argument, QueryFilter *filter)
+{
+    queryFilterInit(filter);
+
+    char upperArgument[1024];
+    copyUppercase(upperArgument, argument, sizeof(upperArgument));
+
+    // WHERE as a word of its own (a file could be called "somewhere.csv")
+    const char *where = upperArgument;
+    while ((where = strstr(where, "WHERE")) != NULL) {
+        int startsWord = where == upperArgument || isspace((unsigned char)where[-1]);
+        int endsWord = !where[5] || isspace((unsigned char)where[5]);
+        if (startsWord && endsWord) {
+            break;
+        }
+        where += 5;
+    }
+    if (!where) {
+        return 1;
+    }
+
+    if (!parseWhereClause(argument + (where - upperArgument) + 5, filter)) {
+        return 0;
+    }
+
+    argument[where - upperArgument] = '\0';
+    trimSpaces(argument);
+    return 1;
+}
+
+// does a LIMIT / OFFSET / AFTER clause start at "word" (uppercase text, outside quotes)?
+static size_t pageKeywordLength(const char *upperArgument, const char *word)
+{
+    static const char *const keywords[] = { "LIMIT", "OFFSET", "AFTER" };
+    if (word != upperArgument && !isspace((unsigned char)word[-1])) {
+        return 0;
+    }
+    for (size_t k = 0; k < 3; ++k) {
+        size_t length = strlen(keywords[k]);
+        if (strncmp(word, keywords[k], length) != 0 || !isspace((unsigned char)word[length])) {
+            continue;
+        }
+        const char *next = word + length;
+        while (isspace((unsigned char)*next)) {
+            next++;
+        }
+        // AFTER needs ID= (so FIND NAME After is not a clause)
+        if (k < 2 || strncmp(next, "ID", 2) == 0) {
+            return length;
+        }
+    }
+    return 0;
+}
+
+/*
+cut an optional "LIMIT n", "OFFSET m" and "AFTER ID=x" (any order, at the
+end) off an argument; call it before takeSortByClause and takeWhereClause
+    argument : e.g. " WHERE INTAKE = 25 LIMIT 20 OFFSET 40" (becomes " WHERE INTAKE = 25")
+returns 0 (after printing why) if the clause is not valid
+*/
+static int takePageClause(char *argument, RowPage *page)
+{
+    page->active = 0;
+    page->limit = PAGE_NO_LIMIT;
+    page->offset = 0;
+    page->after = 0;
+    page->afterId = 0;
+
+    char upperArgument[1024];
+    copyUppercase(upperArgument, argument, sizeof(upperArgument));
+
+    // the first keyword outside quotes
+    const char *start = NULL;
+    int quoted = 0;
+    for (const char *p = upperArgument; *p && !start; ++p) {
+        if (*p == '"') {
+            quoted = !quoted;
+        } else if (!quoted && pageKeywordLength(upperArgument, p)) {
+            start = p;
+        }
+    }
+    if (!start) {
+        return 1;
+    }
+
+    const char *p = start;
+    int seen[3] = { 0, 0, 0 };
+    while (*p) {
+        size_t length = pageKeywordLength(upperArgument, p);
+        int which = length == 5 ? (*p == 'L' ? 0 : 2) : 1;
+        if (!length || seen[which]) {
+            outputPrintf("CMS: Use LIMIT <rows>, OFFSET <rows> and AFTER ID=<id>, each once, at the end.\n");
+            return 0;
+        }
+        seen[which] = 1;
+        p += length;
+        while (isspace((unsigned char)*p)) {
+            p++;
+        }
+
+        char *end;
+        if (which == 2) {
+            p += 2;             // ID
+            while (isspace((unsigned char)*p)) {
+                p++;
+            }
+            if (*p != '=') {
+                outputPrintf("CMS: Use AFTER ID=<id>.\n");
+                return 0;
+            }
+            p++;
+            long long id = strtoll(p, &end, 10);
+            if (end == p || id < INT_MIN || id > INT_MAX) {
+                outputPrintf("CMS: AFTER ID= needs a student ID.\n");
+                return 0;
+            }
+            page->after = 1;
+            page->afterId = (int)id;
+        } else {
+            // digits only: strtoull would take "-1" as the largest number
+            errno = 0;
+            unsigned long long rows = isdigit((unsigned char)*p) ? strtoull(p, &end, 10) : 0;
+            if (!isdigit((unsigned char)*p) || errno == ERANGE || (*end && !isspace((unsigned char)*end))) {
+                outputPrintf("CMS: %s needs a number of rows.\n", which == 0 ? "LIMIT" : "OFFSET");
+                return 0;
+            }
+            if (which == 0) {
+                page->limit = (size_t)rows;
+            } else {
+                page->offset = (size_t)rows;
+            }
+        }
+        p = end;
+        while (isspace((unsigned char)*p)) {
+            p++;
+        }
+    }
+
+    page->active = 1;
+    argument[start - upperArgument] = '\0';
+    trimSpaces(argument);
+    return 1;
+}
+
+// a column name (ID, MARK, NAME, PROGRAMME) as a word at upper; returns its length, 0 if there is none
+static size_t resultColumnWord(const char *upper, SortColumn *column)
+{
+    static const char *const names[RESULT_MAX_COLUMNS] = { "ID", "MARK", "NAME", "PROGRAMME" };
+    for (int k = 0; k < RESULT_MAX_COLUMNS; ++k) {
+        size_t length = strlen(names[k]);
+        if (strncmp(upper, names[k], length) == 0 &&
+            (!upper[length] || upper[length] == ',' || isspace((unsigned char)upper[length]))) {
+            *column = (SortColumn)k;
+            return length;
+        }
+    }
+    return 0;
+}
+
+/*
+parse a column list like "ID, MARK" at upper (uppercase text); after it
+only the end of the command or another clause (WHERE, SORT BY, LIMIT,
+OFFSET, AFTER, INTO, or BY / PER of SHOW TOP) may follow
+    layout: gets the columns, in that order
+returns the length of the list, 0 (after printing why) if it is not valid
+*/
+static size_t parseColumnList(const char *upper, ResultLayout *layout)
+{
+    static const char *const clauses[] = { "WHERE", "SORT", "LIMIT", "OFFSET", "AFTER", "INTO", "BY", "PER" };
+    const char *p = upper;
+    layout->columnCount = 0;
+    while (1) {
+        while (isspace((unsigned char)*p)) {
+            p++;
+        }
+        SortColumn column;
+        size_t length = resultColumnWord(p, &column);
+        if (!length) {
+            outputPrintf("CMS: Expected a column (ID, NAME, PROGRAMME or MARK) in the column list.\n");
+            return 0;
+        }
+        for (size_t c = 0; c < layout->columnCount; ++c) {
+            if (layout->columns[c] == column) {
+                outputPrintf("CMS: %.*s appears more than once in the column list.\n", (int)length, p);
+                return 0;
+            }
+        }
+        layout->columns[layout->columnCount++] = column;
+        p += length;
+
+        const char *next = p;
+        while (isspace((unsigned char)*next)) {
+            next++;
+        }
+        if (*next == ',') {
+            p = next + 1;
+            continue;
+        }
+        if (!*next) {
+            return (size_t)(p - upper);
+        }
+        for (size_t k = 0; k < sizeof(clauses) / sizeof(clauses[0]); ++k) {
+            size_t clause = strlen(clauses[k]);
+            if (strncmp(next, clauses[k], clause) == 0 && (!next[clause] || isspace((unsigned char)next[clause]))) {
+                return (size_t)(p - upper);
+            }
+        }
+        size_t word = strcspn(next, " \t\r\n");
+        outputPrintf("CMS: Unexpected \"%.*s\" after the column list (columns are separated by commas).\n",
+                     (int)word, next);
+        return 0;
+    }
+}
+
+// SHOW ID, MARK ...: SHOW followed by a column instead of ALL
+static int isShowColumnsCommand(const char *line)
+{
+    char upper[32];
+    while (isspace((unsigned char)*line)) {
+        line++;
+    }
+    copyUppercase(upper, line, sizeof(upper));
+    if (strncmp(upper, "SHOW", 4) != 0 || !isspace((unsigned char)upper[4])) {
+        return 0;
+    }
+    const char *word = upper + 5;
+    while (isspace((unsigned char)*word)) {
+        word++;
+    }
+    SortColumn column;
+    return resultColumnWord(word, &column) > 0;
+}
+
+/*
+cut "COLUMNS <column>, <column>..." out of a query command (anywhere
+outside quotes) and keep only those columns in the result
+    line: e.g. "FIND NAME \"tan\" COLUMNS ID, MARK LIMIT 5" (becomes "FIND NAME \"tan\" LIMIT 5")
+returns 0 (after printing why) if the list is not valid
+*/
+static int takeColumnsClause(char *line)
+{
+    char upperLine[1024];
+    copyUppercase(upperLine, line, sizeof(upperLine));
+
+    const char *columns = NULL;
+    int quoted = 0;
+    for (const char *p = upperLine; *p && !columns; ++p) {
+        if (*p == '"') {
+            quoted = !quoted;
+        } else if (!quoted && p != upperLine && isspace((unsigned char)p[-1]) && strncmp(p, "COLUMNS", 7) == 0 &&
+                   (!p[7] || isspace((unsigned char)p[7]))) {
+            columns = p;
+        }
+    }
+    if (!columns) {
+        return 1;
+    }
+
+    size_t length = parseColumnList(columns + 7, &currentResult.layout);
+    if (!length) {
+        return 0;
+    }
+    currentResult.projected = 1;
+
+    // cut the clause with the spaces in front of it
+    size_t from = (size_t)(columns - upperLine);
+    size_t to = from + 7 + length;
+    while (from > 0 && isspace((unsigned char)line[from - 1])) {
+        from--;
+    }
+    memmove(line + from, line + to, strlen(line + to) + 1);
+    trimSpaces(line);
+    return 1;
+}
+
+// the commands whose rows are a result (SET OUTPUT, COLUMNS, INTO); upperLine is trimmed
+static int isResultCommand(const char *upperLine)
+{
+    if (isShowColumnsCommand(upperLine)) {
+        return 1;
+    }
+
+    static const char *const prefixes[] = { "SHOW ALL", "SHOW TOP", "FIND NAME", "FIND PROGRAMME", "QUERY" };
+    for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); ++i) {
+        if (strncmp(upperLine, prefixes[i], strlen(prefixes[i])) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+cut "INTO <file>" off the end of a query command (the file name in quotes
+if it has spaces)
+    line: e.g. "SHOW ALL WHERE INTAKE = 25 INTO cohort25.csv" (becomes "SHOW ALL WHERE INTAKE = 25")
+    file: gets "cohort25.csv"
+returns 1 if the command had one, 0 if not, -1 (after printing why) if it is not valid
+*/
+static int takeIntoClause(char *line, char *file, size_t fileSize)
+{
+    char upperLine[1024];
+    copyUppercase(upperLine, line, sizeof(upperLine));
+
+    // the last INTO outside quotes
+    const char *into = NULL;
+    int quoted = 0;
+    for (const char *p = upperLine; *p; ++p) {
+        if (*p == '"') {
+            quoted = !quoted;
+        } else if (!quoted && p != upperLine && isspace((unsigned char)p[-1]) && strncmp(p, "INTO", 4) == 0 &&
+                   (!p[4] || isspace((unsigned char)p[4]))) {
+            into = p;
+        }
+    }
+    if (!into) {
+        return 0;
+    }
+
+    char *name = line + (into - upperLine) + 4;
+    while (isspace((unsigned char)*name)) {
+        name++;
+    }
+    size_t length = strlen(name);
+    if (length >= 2 && name[0] == '"' && name[length - 1] == '"') {
+        name++;
+        length -= 2;
+    } else {
+        for (size_t k = 0; k < length; ++k) {
+            if (isspace((unsigned char)name[k]) || name[k] == '"') {
+                outputPrintf("CMS: INTO takes one file name, in quotes if it has spaces.\n");
+                return -1;
+            }
+        }
+    }
+    if (length == 0 || length >= fileSize) {
+        outputPrintf("CMS: INTO needs a file name.\n");
+        return -1;
+    }
+    memcpy(file, name, length);
+    file[length] = '\0';
+
+    line[into - upperLine] = '\0';
+    trimSpaces(line);
+    return 1;
+}
+
+// QUERY PLANS (EXPLAIN / EXPLAIN ANALYZE)
+/*
+EXPLAIN <command> prints how a command would get its rows, without running it:
+    - QUERY / RANK ID=...             ID index probe (and the rank index for RANK)
+    - FIND NAME / PROGRAMME "..."     full scan, every row of the snapshot compared
+    - COUNT [WHERE ...]               the table's row count, the bitmap indexes, or
+                                      (with a MARK range) the access path the planner picks
+    - SHOW ALL / SHOW SUMMARY [WHERE ...] [SORT BY ...]
+                                      the WHERE filter (zone map scan or bitmap indexes),
+                                      then the sort / summary and the printing
+for every step it shows the rows it should give (estimated) and its cost, the rows
+it has to read one by one (an ID fetched through the ID index counts as
+WHERE_FETCH_COST rows). the estimates come from partition and chunk row counts,
+zone maps, the programme / grade bitmaps and the column statistics (histograms
+of marks and IDs, distinct names); inside a bucket the values are taken as
+evenly spread.
+EXPLAIN ANALYZE also runs the steps (their output is thrown away) and adds the
+rows each step really gave and its time.
+*/
+#define EXPLAIN_MAX_STEPS 4
+
+// one step of a plan; the steps are kept in the order they run, each one feeds the next
+typedef struct {
+    char text[256];
+    double estimatedRows;
+    double cost;
+    int ran;                    // EXPLAIN ANALYZE: rows / nanoseconds are filled in
+    uint64_t rows;
+    uint64_t nanoseconds;
+} ExplainStep;
+
+typedef struct {
+    ExplainStep steps[EXPLAIN_MAX_STEPS];
+    size_t count;
+    int usesStatistics;         // an estimate came from the histograms or distinct counts
+} ExplainPlan;
+
+// add the next step of a plan and return it (its text is printf style)
+static ExplainStep *explainAddStep(ExplainPlan *plan, double estimatedRows, double cost, const char *format, ...)
+{
+    ExplainStep *step = &plan->steps[plan->count < EXPLAIN_MAX_STEPS ? plan->count++ : EXPLAIN_MAX_STEPS - 1];
+    memset(step, 0, sizeof(*step));
+    step->estimatedRows = estimatedRows;
+    step->cost = cost;
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(step->text, sizeof(step->text), format, args);
+    va_end(args);
+    return step;
+}
+
+static void explainRan(ExplainStep *step, uint64_t rows, uint64_t nanoseconds)
+{
+    step->ran = 1;
+    step->rows = rows;
+    step->nanoseconds = nanoseconds;
+}
+
+// the last step first, every step indented under the one it feeds
+static void explainPrint(const ExplainPlan *plan, const char *command, int analyze)
+{
+    outputPrintf("CMS: Plan for \"%s\":\n", command);
+    if (analyze) {
+        outputPrintf("%10s %10s %10s %10s  %s\n", "Est. rows", "Cost", "Rows", "ms", "Step");
+    } else {
+        outputPrintf("%10s %10s  %s\n", "Est. rows", "Cost", "Step");
+    }
+
+    for (size_t k = plan->count; k-- > 0;) {
+        const ExplainStep *step = &plan->steps[k];
+        int indent = (int)(2 * (plan->count - 1 - k));
+        outputPrintf("%10.0f %10.0f", step->estimatedRows, step->cost);
+        if (analyze && step->ran) {
+            outputPrintf(" %10llu %10.3f", (unsigned long long)step->rows, (double)step->nanoseconds / 1e6);
+        } else if (analyze) {
+            outputPrintf(" %10s %10s", "-", "-");
+        }
+        outputPrintf("  %*s%s\n", indent, "", step->text);
+    }
+    if (plan->usesStatistics && statsAreStale()) {
+        outputPrintf("CMS: The column statistics are stale (%llu changes since they were built), "
+                     "the estimates may be off; ANALYZE or the query itself rebuilds them.\n",
+                     (unsigned long long)columnStats.changes);
+    }
+}
+
+// "OR of the programme bitmaps, AND the grade bitmaps" for a plan
+static void explainBitmapText(const QueryFilter *filter, unsigned gradeMask, char *text, size_t size)
+{
+    int grades = gradeMask != GRADE_ANY;
+    snprintf(text, size, "%s%s", filter->programmeCount ? "OR of the programme bitmaps"
+                                                         : (grades ? "OR of the grade bitmaps" : "all students"),
+             filter->programmeCount && grades ? ", AND the grade bitmaps" : "");
+}
+
+// the WHERE step of SHOW ALL / SHOW SUMMARY (or the whole snapshot without WHERE)
+static ExplainStep *explainWhereStep(ExplainPlan *plan, const TableSnapshot *snapshot, const QueryFilter *filter)
+{
+    if (!filter->active) {
+        return explainAddStep(plan, (double)snapshot->count, 0, "Snapshot of the table: %zu rows in %zu chunks",
+                              snapshot->count, snapshot->chunkCount);
+    }
+    WherePlan where;
+    planWhere(snapshot, filter, &where);
+    plan->usesStatistics = 1;
+    char bitmaps[96];
+    explainBitmapText(filter, where.bitmapGrades, bitmaps, sizeof(bitmaps));
+    if (where.useBitmaps) {
+        return explainAddStep(plan, where.estimatedRows, where.bitmapCost,
+                              "WHERE: %s, about %.0f IDs fetched through the ID index "
+                              "(a zone map scan would read %zu rows)",
+                              bitmaps, where.bitmapRows, where.rowsRead);
+    }
+    return explainAddStep(plan, where.estimatedRows, where.scanCost,
+                          "WHERE: zone maps keep %zu of %zu partitions; chunks: %zu match whole, "
+                          "%zu read row by row, %zu skipped",
+                          where.partitionsKept, snapshot->segmentCount, where.chunksShared,
+                          where.chunksRead, where.chunksSkipped);
+}
+
+// "MARK DESC, NAME" for a plan
+static void explainSortText(const SortSpec *spec, char *text, size_t size)
+{
+    static const char *const columnNames[] = { "ID", "MARK", "NAME", "PROGRAMME" };
+    size_t length = 0;
+    text[0] = '\0';
+    for (size_t k = 0; k < spec->keyCount && length < size; ++k) {
+        length += (size_t)snprintf(text + length, size - length, "%s%s%s", k ? ", " : "",
+                                   columnNames[spec->keys[k].column],
+                                   spec->keys[k].direction == SORT_DESCENDING ? " DESC" : "");
+    }
+}
+
+// the estimate for an ID probe: 1 if the ID's partition exists and its zone map holds the ID
+static double explainIdEstimate(int id)
+{
+    int number = studentTableSegment(&studentTable, partitionKeyOf(id), 0);
+    if (number < 0) {
+        return 0.0;
+    }
+    const ZoneMap *zone = &studentTable.segments[number].zone;
+    return id >= zone->idMin && id <= zone->idMax ? 1.0 : 0.0;
+}
+
+/*
+the steps of a SHOW ALL page: a keyset walk, a cursor in table order, or a sort cut to the page
+*/
+static void explainPageSteps(ExplainPlan *plan, const TableSnapshot *snapshot, const QueryFilter *filter,
+                             const SortSpec *spec, const RowPage *page)
+{
+    double wanted = (double)page->offset + (double)page->limit;
+    char limit[32];
+    if (page->limit == PAGE_NO_LIMIT) {
+        snprintf(limit, sizeof(limit), "no limit");
+    } else {
+        snprintf(limit, sizeof(limit), "%zu rows", page->limit);
+    }
+    if (page->after) {
+        QueryFilter rows = *filter;
+        rows.active = 1;
+        if (page->afterId == INT_MAX) {
+            filterMatchNothing(&rows);
+        } else if (rows.idMin <= page->afterId) {
+            rows.idMin = page->afterId + 1;
+        }
+        WherePlan where;
+        planWhere(snapshot, &rows, &where);
+        plan->usesStatistics = 1;
+        double found = where.estimatedRows - (double)page->offset;
+        found = found < 0.0 ? 0.0 : (found > (double)page->limit ? (double)page->limit : found);
+        if (!pinnedSnapshot) {
+            char bitmaps[96];
+            explainBitmapText(filter, where.bitmapGrades, bitmaps, sizeof(bitmaps));
+            // without a narrowing bitmap every ID in the range is a candidate
+            double candidates = where.bitmapsUsable ? where.bitmapRows : where.estimatedRows;
+            double fetched = candidates < wanted ? candidates : wanted;
+            explainAddStep(plan, found, fetched * WHERE_FETCH_COST,
+                           "Keyset page: walk %s from ID=%d in ID order, fetch each ID through the ID index, "
+                           "skip %zu, print %s", bitmaps, page->afterId, page->offset, limit);
+            return;
+        }
+        ExplainStep *step = explainWhereStep(plan, snapshot, &rows);
+        explainAddStep(plan, found, step->estimatedRows,
+                       "Sort by ID: radix sort of 64-bit keys, print %s after ID=%d", limit,
+                       page->afterId);
+        return;
+    }
+
+    if (spec->keyCount == 0) {
+        WherePlan where;
+        planWhere(snapshot, filter, &where);
+        plan->usesStatistics = filter->active;
+        double found = where.estimatedRows - (double)page->offset;
+        found = found < 0.0 ? 0.0 : (found > (double)page->limit ? (double)page->limit : found);
+        double share = snapshot->count ? where.estimatedRows / (double)snapshot->count : 0.0;
+        double read = share > 0.0 && wanted / share < (double)snapshot->count ? wanted / share
+                                                                              : (double)snapshot->count;
+        explainAddStep(plan, found, read,
+                       "Cursor in table order%s: skip %zu rows (whole chunks by their counts), "
+                       "print %s", filter->active ? ", zone maps and WHERE per row" : "",
+                       page->offset, limit);
+        return;
+    }
+
+    ExplainStep *where = explainWhereStep(plan, snapshot, filter);
+    double rows = where->estimatedRows;
+    char order[96];
+    explainSortText(spec, order, sizeof(order));
+    explainAddStep(plan, rows, rows, "Sort by %s: radix sort of 64-bit keys%s", order,
+                   sortSpecHasText(spec) ? ", equal keys compared by text" : "");
+    double found = rows - (double)page->offset;
+    found = found < 0.0 ? 0.0 : (found > (double)page->limit ? (double)page->limit : found);
+    explainAddStep(plan, found, found, "Print the sorted rows: skip %zu, print %s", page->offset, limit);
+}
+
+/*
+EXPLAIN [ANALYZE] <command>: see above
+    command: the text after EXPLAIN [ANALYZE], as typed
+*/
+static void explainCommand(char *command, int analyze)
+{
+    char shown[1024];
+    snprintf(shown, sizeof(shown), "%s", command);
+
+    // SHOW ID, MARK ... is SHOW ALL ... with only those columns, the same as when it runs
+    char rewritten[1100];
+    if (isShowColumnsCommand(command)) {
+        snprintf(rewritten, sizeof(rewritten), "SHOW ALL COLUMNS %s", command + 5);
+        command = rewritten;
+    }
+
+    char upper[1024];
+    copyUppercase(upper, command, sizeof(upper));
+    if (isResultCommand(upper)) {
+        if (!takeColumnsClause(command)) {
+            return;
+        }
+        copyUppercase(upper, command, sizeof(upper));
+    }
+
+    ExplainPlan plan;
+    plan.count = 0;
+    plan.usesStatistics = 0;
+
+    // ANALYZE runs the steps into a scratch buffer, with its own counters for the phase times
+    OutputBuffer scratch = { NULL, 0, 0, NULL };
+    OutputBuffer *realOutput = currentOutput;
+    CommandCounters *outerCounters = currentCounters;
+    CommandCounters counters = { 0 };
+    counters.timePhases = 1;
+    uint64_t start = 0;
+
+    if (strncmp(upper, "QUERY", 5) == 0 || strncmp(upper, "RANK", 4) == 0) {
+        int rank = upper[0] == 'R';
+        char idBuffer[64] = "";
+        int id;
+        if (!readKeyValueFromCommand(command, "ID", idBuffer, sizeof(idBuffer)) || !stringToInt(idBuffer, &id)) {
+            outputPrintf("CMS: Use EXPLAIN [ANALYZE] %s ID=<id>.\n", rank ? "RANK" : "QUERY");
+            return;
+        }
+
+        ExplainStep *probe = explainAddStep(&plan, explainIdEstimate(id), 1,
+                                            "ID index probe for ID=%d (hash table of %zu IDs)", id, idIndex.count);
+        ExplainStep *descent = rank ? explainAddStep(&plan, probe->estimatedRows, 1,
+                                                     "Rank index: walk down the programme's tree (%zu programmes)",
+                                                     programmeDictionary.count)
+                                    : NULL;
+        if (analyze) {
+            StudentRecord student;
+            size_t position, groupSize;
+            start = monotonicNanoseconds();
+            int found = getStudentRecordById(id, &student);
+            explainRan(probe, (uint64_t)found, monotonicNanoseconds() - start);
+            if (descent && found) {
+                start = monotonicNanoseconds();
+                int ranked = rankIndexLookup(student.programme, student.mark, &position, &groupSize);
+                explainRan(descent, (uint64_t)ranked, monotonicNanoseconds() - start);
+            }
+        }
+    }
+
+    else if (strncmp(upper, "FIND NAME", 9) == 0 || strncmp(upper, "FIND PROGRAMME", 14) == 0) {
+        int byName = upper[5] == 'N';
+        RowPage page;
+        if (!takePageClause(command + (byName ? 9 : 14), &page)) {
+            return;
+        }
+        char *needle = command + (byName ? 9 : 14);
+        while (*needle && isspace((unsigned char)*needle)) {
+            needle++;
+        }
+        if (*needle == '"') {
+            needle++;
+            char *endQuote = strrchr(needle, '"');
+            if (endQuote) {
+                *endQuote = '\0';
+            }
+        }
+        if (!*needle) {
+            outputPrintf("CMS: Please provide a search string.\n");
+            return;
+        }
+
+        // names: the rows of one name (distinct names from the statistics);
+        // programmes: every programme whose name has the text, counted in its bitmap
+        double names = columnStats.rows ? hllEstimate(columnStats.names) : 0.0;
+        double estimate = names >= 1.0 ? (double)columnStats.rows / names : 0.0;
+        plan.usesStatistics = byName;
+        if (!byName) {
+            estimate = 0.0;
+            for (size_t code = 0; code < programmeDictionary.count; ++code) {
+                if (containsIgnoreCase(programmeDictionary.entries[code].name, needle)) {
+                    estimate += (double)roaringCardinality(&programmeDictionary.entries[code].ids);
+                }
+            }
+        }
+
+        TableSnapshot *snapshot = commandSnapshotBegin();
+        ExplainStep *scan;
+        if (page.active) {
+            // the scan stops once the page is full: about (offset + limit) / share of the rows are read
+            double wanted = (double)page.offset + (double)page.limit;
+            double share = snapshot->count ? estimate / (double)snapshot->count : 0.0;
+            double read = share > 0.0 && wanted / share < (double)snapshot->count ? wanted / share
+                                                                                  : (double)snapshot->count;
+            double rows = estimate - (double)page.offset;
+            rows = rows < 0.0 ? 0.0 : (rows > (double)page.limit ? (double)page.limit : rows);
+            scan = explainAddStep(&plan, rows, read,
+                                  "Scan in table order on one thread, %s contains \"%s\"%s; "
+                                  "skip %zu matches, stop after %zu",
+                                  byName ? "NAME" : "PROGRAMME", needle,
+                                  byName ? " (one name's rows guessed)" : "", page.offset, page.limit);
+        } else {
+            scan = explainAddStep(&plan, estimate, (double)snapshot->count,
+                                  "Full scan: %zu rows in %zu chunks on %zu parallel tasks, "
+                                  "%s contains \"%s\"%s",
+                                  snapshot->count, snapshot->chunkCount,
+                                  parallelTaskCount(snapshot->chunkCount, PARALLEL_AUTO_GRAIN),
+                                  byName ? "NAME" : "PROGRAMME", needle,
+                                  byName ? " (one name's rows guessed)" : "");
+        }
+        if (analyze) {
+            currentOutput = &scratch;
+            start = monotonicNanoseconds();
+            int found = page.active ? findStudentsPage(snapshot, byName ? "NAME" : "PROGRAMME", needle, &page)
+                                    : findStudentsByField(snapshot, byName ? "NAME" : "PROGRAMME", needle);
+            explainRan(scan, (uint64_t)found, monotonicNanoseconds() - start);
+            currentOutput = realOutput;
+        }
+        commandSnapshotEnd(snapshot);
+    }
+
+    else if (strncmp(upper, "COUNT", 5) == 0) {
+        QueryFilter filter;
+        if (!takeWhereClause(command + 5, &filter)) {
+            return;
+        }
+
+        ExplainStep *count;
+        if (!filter.active) {
+            count = explainAddStep(&plan, (double)studentTable.count, 0, "Row count of the table, nothing is read");
+        } else if (filterHasMarkRange(&filter)) {
+            TableSnapshot *snapshot = tableSnapshotAcquire();
+            WherePlan where;
+            planWhere(snapshot, &filter, &where);
+            plan.usesStatistics = 1;
+            char bitmaps[96];
+            explainBitmapText(&filter, where.bitmapGrades, bitmaps, sizeof(bitmaps));
+            if (where.useBitmaps) {
+                count = explainAddStep(&plan, where.estimatedRows, where.bitmapCost,
+                                       "Count through the bitmaps: %s, about %.0f IDs fetched through the ID index "
+                                       "(a zone map count would read %zu rows)",
+                                       bitmaps, where.bitmapRows, where.rowsRead);
+            } else {
+                count = explainAddStep(&plan, where.estimatedRows, where.scanCost,
+                                       "Count over zone maps: %zu of %zu partitions kept; chunks: %zu counted from "
+                                       "their row count, %zu read row by row",
+                                       where.partitionsKept, snapshot->segmentCount, where.chunksShared,
+                                       where.chunksRead);
+            }
+            tableSnapshotRelease(snapshot);
+        } else {
+            // the bitmaps: programmes and grades are exact counts, the ID range goes by the ID histogram
+            double all = (double)roaringCardinality(&bitmapIndex.all);
+            double gradeRows = 0.0;
+            for (int g = 0; g < GRADE_COUNT; ++g) {
+                if (filter.gradeMask & (1u << g)) {
+                    gradeRows += (double)roaringCardinality(&bitmapIndex.grades[g]);
+                }
+            }
+            int ranged = filter.idMin != INT_MIN || filter.idMax != INT_MAX;
+            double idRows = ranged ? histogramRows(&columnStats.ids, filter.idMin, filter.idMax) : all;
+            plan.usesStatistics = ranged;
+            double estimate = all > 0 ? all * whereProgrammeShare(&filter) * (gradeRows / all) * (idRows / all) : 0.0;
+            char bitmaps[96];
+            explainBitmapText(&filter, filter.gradeMask, bitmaps, sizeof(bitmaps));
+            count = explainAddStep(&plan, estimate, 0, "Bitmap index count: %s%s, no rows read", bitmaps,
+                                   ranged ? ", counted in the ID range" : "");
+        }
+        if (analyze) {
+            start = monotonicNanoseconds();
+            size_t found = countStudentsWhere(&filter);
+            explainRan(count, found, monotonicNanoseconds() - start);
+        }
+    }
+
+    else if (strncmp(upper, "SHOW ALL", 8) == 0 || strncmp(upper, "SHOW SUMMARY", 12) == 0) {
+        int summary = upper[5] == 'S';
+        size_t skip = summary ? 12 : 8;
+        SortSpec spec;
+        spec.keyCount = 0;
+        QueryFilter filter;
+        RowPage page;
+        page.active = 0;
+        if (!summary) {
+            if (!takePageClause(command + skip, &page)) {
+                return;
+            }
+            copyUppercase(upper, command, sizeof(upper));
+        }
+        if ((!summary && !takeSortByClause(command + skip, upper + skip, &spec)) ||
+            !takeWhereClause(command + skip, &filter)) {
+            return;
+        }
+        if (page.after && spec.keyCount &&
+            (spec.keyCount > 1 || spec.keys[0].column != SORT_COLUMN_ID || spec.keys[0].direction != SORT_ASCENDING)) {
+            outputPrintf("CMS: AFTER ID= pages in ID order, it only goes with SORT BY ID.\n");
+            return;
+        }
+
+        TableSnapshot *snapshot = commandSnapshotBegin();
+        if (page.active) {
+            explainPageSteps(&plan, snapshot, &filter, &spec, &page);
+            if (analyze) {
+                currentOutput = &scratch;
+                currentCounters = &counters;
+                start = monotonicNanoseconds();
+                size_t rows = showAllPage(snapshot, &filter, &spec, &page);
+                uint64_t elapsed = monotonicNanoseconds() - start;
+                currentCounters = outerCounters;
+                if (outerCounters) {
+                    outerCounters->rows += counters.rows;
+                }
+                // a page cut from a sorted WHERE view: the view is the read phase (its rows are
+                // the rows counted), the sort the sort phase; the rest goes on the last step
+                uint64_t measured = 0;
+                if (plan.count > 1) {
+                    measured = counters.phaseNanoseconds[PHASE_READ];
+                    explainRan(&plan.steps[0], counters.rows, measured);
+                }
+                if (plan.count > 2) {
+                    explainRan(&plan.steps[1], counters.rows, counters.phaseNanoseconds[PHASE_SORT]);
+                    measured += counters.phaseNanoseconds[PHASE_SORT];
+                }
+                explainRan(&plan.steps[plan.count - 1], rows, elapsed - measured);
+                currentOutput = realOutput;
+            }
+            commandSnapshotEnd(snapshot);
+            outputFree(&scratch);
+            explainPrint(&plan, shown, analyze);
+            return;
+        }
+        ExplainStep *where = explainWhereStep(&plan, snapshot, &filter);
+        double rows = where->estimatedRows;
+        ExplainStep *sort = NULL;
+        ExplainStep *last;
+        if (summary) {
+            last = explainAddStep(&plan, rows, rows, "Summary: mark sums, lowest and highest per chunk, "
+                                                     "grades and programmes per row");
+        } else {
+            if (spec.keyCount) {
+                char order[96];
+                explainSortText(&spec, order, sizeof(order));
+                sort = explainAddStep(&plan, rows, rows, "Sort by %s: radix sort of 64-bit keys%s", order,
+                                      sortSpecHasText(&spec) ? ", equal keys compared by text" : "");
+            }
+            last = explainAddStep(&plan, rows, rows, "Print the rows%s", spec.keyCount ? " in sorted order"
+                                                                                      : " in table order");
+        }
+
+        if (analyze) {
+            currentOutput = &scratch;
+            start = monotonicNanoseconds();
+            TableSnapshot *view = tableSnapshotWhere(snapshot, &filter);
+            explainRan(where, view->count, monotonicNanoseconds() - start);
+
+            if (!filter.active || view->count > 0) {
+                currentCounters = &counters;
+                start = monotonicNanoseconds();
+                if (summary) {
+                    showSummaryStatistics(view);
+                } else {
+                    showAllStudents(view, &spec);
+                }
+                uint64_t elapsed = monotonicNanoseconds() - start;
+                currentCounters = outerCounters;
+                if (outerCounters) {
+                    outerCounters->rows += counters.rows;
+                }
+
+                uint64_t sorting = sort ? counters.phaseNanoseconds[PHASE_SORT] : 0;
+                if (sort) {
+                    explainRan(sort, view->count, sorting);
+                }
+                explainRan(last, view->count, elapsed - sorting);
+            }
+            tableSnapshotWhereEnd(view, snapshot);
+            currentOutput = realOutput;
+        }
+        commandSnapshotEnd(snapshot);
+    }
+
+    else {
+        outputPrintf("CMS: EXPLAIN works with QUERY, RANK, FIND, COUNT, SHOW ALL, SHOW <columns> and SHOW SUMMARY.\n");
+        return;
+    }
+
+    outputFree(&scratch);
+    explainPrint(&plan, shown, analyze);
+}
+
+// MEMORY REPORT (SHOW MEMORY)
+
+// bytes a bitmap really needs: its container list and each container's values / words
+static size_t roaringUsedBytes(const Roaring *r)
+{
+    size_t bytes = r->count * sizeof(RoaringContainer);
+    for (size_t c = 0; c < r->count; ++c) {
+        const RoaringContainer *container = &r->containers[c];
+        bytes += container->isBitmap ? ROARING_WORDS * sizeof(uint64_t)
+                                     : container->cardinality * sizeof(uint16_t);
+    }
+    return bytes;
+}
+
+/*
+SHOW MEMORY: per part of the CMS what its data needs ("used"), what is
+allocated for it right now ("reserved"), the difference ("slack": spare
+capacity of arrays that grow by doubling, deleted row slots, old strings in
+chunk text, block headers, old chunks still held by snapshots), the highest
+reserved so far and the number of blocks. temporary buffers only have a
+reserved size (0 between commands).
+*/
+static void showMemory(void)
+{
+    size_t used[MEMORY_KIND_COUNT];
+    int known[MEMORY_KIND_COUNT] = { 0 };
+    memset(used, 0, sizeof(used));
+
+    // records: one row needs its ID, mark, live flag, string references and strings
+    const size_t rowBytes = sizeof(int) + sizeof(Mark) + 1 + 2 * sizeof(ChunkText);
+    used[MEMORY_RECORDS] = studentTable.count * rowBytes;
+    for (size_t s = 0; s < studentTable.segmentCount; ++s) {
+        const TableSegment *segment = &studentTable.segments[s];
+        for (size_t c = 0; c < segment->chunkCount; ++c) {
+            const RecordChunk *chunk = segment->chunks[c];
+            for (unsigned i = 0; i < chunk->used; ++i) {
+                if (chunk->live[i]) {
+                    used[MEMORY_RECORDS] += chunk->names[i].length + chunk->programmes[i].length + 2;
+                }
+            }
+        }
+    }
+    known[MEMORY_RECORDS] = 1;
+
+    used[MEMORY_TABLE] = studentTable.segmentCount * (sizeof(TableSegment) + sizeof(size_t));
+    for (size_t s = 0; s < studentTable.segmentCount; ++s) {
+        used[MEMORY_TABLE] += studentTable.segments[s].chunkCount * sizeof(RecordChunk *);
+    }
+    known[MEMORY_TABLE] = 1;
+
+    used[MEMORY_ID_INDEX] = idIndex.count * sizeof(IdSlot);
+    known[MEMORY_ID_INDEX] = 1;
+
+    size_t freeNodes = 0;
+    for (int node = rankIndex.freeNodes; node != -1; node = rankIndex.nodes[node].left) {
+        freeNodes++;
+    }
+    used[MEMORY_RANK_INDEX] = (rankIndex.nodeCount - freeNodes) * sizeof(RankNode);
+    known[MEMORY_RANK_INDEX] = 1;
+
+    used[MEMORY_BITMAPS] = roaringUsedBytes(&bitmapIndex.all);
+    for (int band = 0; band < GRADE_COUNT; ++band) {
+        used[MEMORY_BITMAPS] += roaringUsedBytes(&bitmapIndex.grades[band]);
+    }
+    for (size_t code = 0; code < programmeDictionary.count; ++code) {
+        used[MEMORY_BITMAPS] += roaringUsedBytes(&programmeDictionary.entries[code].ids);
+    }
+    known[MEMORY_BITMAPS] = 1;
+
+    used[MEMORY_PROGRAMMES] = programmeDictionary.count * (sizeof(ProgrammeEntry) + sizeof(int));
+    known[MEMORY_PROGRAMMES] = 1;
+
+    outputPrintf("CMS: Memory in KB (%zu records).\n", studentTable.count);
+    outputPrintf("%-16s %12s %12s %12s %12s %10s\n",
+                 "Part", "Used", "Reserved", "Slack", "Peak", "Blocks");
+
+    double totalUsed = 0.0;
+    for (int kind = 0; kind < MEMORY_KIND_COUNT; ++kind) {
+        const MemoryCounter *counter = &memoryCounters[kind];
+        double reserved = (double)atomic_load_explicit(&counter->bytes, memory_order_relaxed) / 1024.0;
+        double peak = (double)atomic_load_explicit(&counter->peakBytes, memory_order_relaxed) / 1024.0;
+        unsigned long long blocks = atomic_load_explicit(&counter->blocks, memory_order_relaxed);
+        if (peak == 0.0) {
+            continue;
+        }
+
+        char usedText[32] = "-";
+        char slackText[32] = "-";
+        if (known[kind]) {
+            double usedKb = (double)used[kind] / 1024.0;
+            snprintf(usedText, sizeof(usedText), "%.1f", usedKb);
+            snprintf(slackText, sizeof(slackText), "%.1f", reserved - usedKb);
+            totalUsed += usedKb;
+        }
+        outputPrintf("%-16s %12s %12.1f %12s %12.1f %10llu\n",
+                     memoryKindNames[kind], usedText, reserved, slackText, peak, blocks);
+    }
+    outputPrintf("%-16s %12.1f %12.1f %12s %12.1f %10llu\n", "total", totalUsed,
+                 (double)atomic_load_explicit(&memoryTotal.bytes, memory_order_relaxed) / 1024.0, "",
+                 (double)atomic_load_explicit(&memoryTotal.peakBytes, memory_order_relaxed) / 1024.0,
+                 (unsigned long long)atomic_load_explicit(&memoryTotal.blocks, memory_order_relaxed));
+}
+
+// COMMAND STATISTICS (STATS)
+/*
+every command that runs (typed or from a client) is timed and counted under
+its command type, so STATS can show which commands are slow:
+    - latency: an HDR-style histogram, every power of two of nanoseconds is
+      split into 8 buckets, so a percentile is off by at most 12.5%, with 496
+      buckets covering everything from 1 ns to centuries
+    - rows / bytes read / bytes written (CommandCounters of the command)
+the counters are atomics: snapshot commands run on worker threads in --serve
+mode. recording is a clock read and a few relaxed atomic adds, so it stays on.
+*/
+#define LATENCY_SUB_BUCKETS 8
+#define LATENCY_BUCKETS (62 * LATENCY_SUB_BUCKETS)
+
+typedef enum {
+    COMMAND_SHOW_ALL,
+    COMMAND_SHOW_SUMMARY,
+    COMMAND_SHOW_TOP,
+    COMMAND_SHOW_PARTITIONS,
+    COMMAND_SHOW_MEMORY,
+    COMMAND_INSERT,
+    COMMAND_QUERY,
+    COMMAND_RANK,
+    COMMAND_UPDATE,
+    COMMAND_DELETE,
+    COMMAND_FIND,
+    COMMAND_COUNT,
+    COMMAND_OPEN,
+    COMMAND_SAVE,
+    COMMAND_IMPORT,
+    COMMAND_EXPORT,
+    COMMAND_BACKUP,
+    COMMAND_GENERATE,
+    COMMAND_STATS,
+    COMMAND_OTHER,
+    COMMAND_KIND_COUNT
+} CommandKind;
+
+// the command words of every CommandKind (in the same order)
+static const char *const commandKindNames[COMMAND_KIND_COUNT] = {
+    "SHOW ALL", "SHOW SUMMARY", "SHOW TOP", "SHOW PARTITIONS", "SHOW MEMORY", "INSERT", "QUERY",
+    "RANK", "UPDATE", "DELETE", "FIND", "COUNT", "OPEN", "SAVE", "IMPORT", "EXPORT", "BACKUP",
+    "GENERATE", "STATS", "OTHER"
+};
+
+typedef struct {
+    atomic_ullong count;
+    atomic_ullong totalNanoseconds;
+    atomic_ullong maxNanoseconds;
+    atomic_ullong rows;
+    atomic_ullong bytesRead;
+    atomic_ullong bytesWritten;
+    atomic_ullong buckets[LATENCY_BUCKETS];
+} CommandStats;
+
+static CommandStats commandStats[COMMAND_KIND_COUNT];
+
+// position of the highest set bit (x must not be 0)
+static unsigned highestBit64(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return 63u - (unsigned)__builtin_clzll(x);
+#else
+    unsigned bit = 0;
+    while (x >>= 1) {
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+// histogram bucket of a latency: 0..7 exact, then 8 buckets per power of two
+static size_t latencyBucket(uint64_t nanoseconds)
+{
+    if (nanoseconds < LATENCY_SUB_BUCKETS) {
+        return (size_t)nanoseconds;
+    }
+    unsigned bit = highestBit64(nanoseconds);
+    return (size_t)(bit - 2) * LATENCY_SUB_BUCKETS + (size_t)((nanoseconds >> (bit - 3)) & 7);
+}
+
+// the largest latency that falls into a bucket
+static uint64_t latencyBucketHighest(size_t bucket)
+{
+    if (bucket < LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+    unsigned bit = (unsigned)(bucket / LATENCY_SUB_BUCKETS) + 2;
+    uint64_t sub = bucket % LATENCY_SUB_BUCKETS;
+    return ((LATENCY_SUB_BUCKETS + sub + 1) << (bit - 3)) - 1;
+}
+
+// the command type of a line (the line as typed, any case)
+static CommandKind commandKindOf(const char *line)
+{
+    while (*line && isspace((unsigned char)*line)) {
+        line++;
+    }
+    if (isShowColumnsCommand(line)) {
+        return COMMAND_SHOW_ALL;
+    }
+
+    for (int kind = 0; kind < COMMAND_OTHER; ++kind) {
+        const char *name = commandKindNames[kind];
+        size_t k = 0;
+        while (name[k] && toupper((unsigned char)line[k]) == name[k]) {
+            k++;
+        }
+        if (!name[k]) {
+            return (CommandKind)kind;
+        }
+    }
+    return COMMAND_OTHER;
+}
+
+static void commandStatsRecord(CommandKind kind, uint64_t nanoseconds, const CommandCounters *counters)
+{
+    CommandStats *stats = &commandStats[kind];
+    atomic_fetch_add_explicit(&stats->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->totalNanoseconds, nanoseconds, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->rows, counters->rows, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->bytesRead, counters->bytesRead, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->bytesWritten, counters->bytesWritten, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->buckets[latencyBucket(nanoseconds)], 1, memory_order_relaxed);
+
+    unsigned long long longest = atomic_load_explicit(&stats->maxNanoseconds, memory_order_relaxed);
+    while (nanoseconds > longest &&
+           !atomic_compare_exchange_weak_explicit(&stats->maxNanoseconds, &longest, nanoseconds,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+static void commandStatsReset(void)
+{
+    for (int kind = 0; kind < COMMAND_KIND_COUNT; ++kind) {
+        CommandStats *stats = &commandStats[kind];
+        atomic_store_explicit(&stats->count, 0, memory_order_relaxed);
+        atomic_store_explicit(&stats->totalNanoseconds, 0, memory_order_relaxed);
+        atomic_store_explicit(&stats->maxNanoseconds, 0, memory_order_relaxed);
+        atomic_store_explicit(&stats->rows, 0, memory_order_relaxed);
+        atomic_store_explicit(&stats->bytesRead, 0, memory_order_relaxed);
+        atomic_store_explicit(&stats->bytesWritten, 0, memory_order_relaxed);
+        for (size_t b = 0; b < LATENCY_BUCKETS; ++b) {
+            atomic_store_explicit(&stats->buckets[b], 0, memory_order_relaxed);
+        }
+    }
+}
+
+// the latency below which "fraction" of the commands finished (bucket upper bound, at most the max)
+static uint64_t commandStatsPercentile(const CommandStats *stats, uint64_t count, double fraction)
+{
+    uint64_t wanted = (uint64_t)(fraction * (double)count + 0.999999);
+    uint64_t seen = 0;
+    uint64_t longest = atomic_load_explicit(&stats->maxNanoseconds, memory_order_relaxed);
+
+    for (size_t b = 0; b < LATENCY_BUCKETS; ++b) {
+        seen += atomic_load_explicit(&stats->buckets[b], memory_order_relaxed);
+        if (seen >= wanted) {
+            uint64_t highest = latencyBucketHighest(b);
+            return highest < longest ? highest : longest;
+        }
+    }
+    return longest;
+}
+
+/*
+STATS: one line per command type that ran since the start (or STATS RESET)
+    Count, p50/p99/max latency, rows per second (over the command's own time),
+    MB read and written
+*/
+static void showCommandStats(void)
+{
+    int printed = 0;
+
+    for (int kind = 0; kind < COMMAND_KIND_COUNT; ++kind) {
+        const CommandStats *stats = &commandStats[kind];
+        uint64_t count = atomic_load_explicit(&stats->count, memory_order_relaxed);
+        if (count == 0) {
+            continue;
+        }
+
+        if (!printed) {
+            outputPrintf("CMS: Command statistics (since start or STATS RESET).\n");
+            outputPrintf("%-16s %8s %10s %10s %10s %12s %9s %9s\n",
+                         "Command", "Count", "p50 ms", "p99 ms", "Max ms", "Rows/s", "Read MB", "Write MB");
+            printed = 1;
+        }
+
+        double seconds = (double)atomic_load_explicit(&stats->totalNanoseconds, memory_order_relaxed) / 1e9;
+        double rows = (double)atomic_load_explicit(&stats->rows, memory_order_relaxed);
+        outputPrintf("%-16s %8llu %10.3f %10.3f %10.3f %12.0f %9.1f %9.1f\n",
+                     commandKindNames[kind],
+                     (unsigned long long)count,
+                     (double)commandStatsPercentile(stats, count, 0.50) / 1e6,
+                     (double)commandStatsPercentile(stats, count, 0.99) / 1e6,
+                     (double)atomic_load_explicit(&stats->maxNanoseconds, memory_order_relaxed) / 1e6,
+                     seconds > 0 ? rows / seconds : 0.0,
+                     (double)atomic_load_explicit(&stats->bytesRead, memory_order_relaxed) / 1e6,
+                     (double)atomic_load_explicit(&stats->bytesWritten, memory_order_relaxed) / 1e6);
+    }
+
+    if (!printed) {
+        outputPrintf("CMS: No commands recorded yet.\n");
+    }
+}
+
+// SLOW COMMAND LOG (SET SLOWLOG / SHOW SLOWLOG)
+/*
+every command that takes at least the SET SLOWLOG threshold is remembered
+with when it ran, how long it took, how many rows it went through and its
+phases (read / parse / insert / sort / ...), so a stall that cannot be
+reproduced can still be looked at afterwards.
+    - the last SLOWLOG_ENTRIES slow commands stay in memory (SHOW SLOWLOG)
+    - SET SLOWLOG <ms> FILE <path> also appends every entry to a file
+names, programmes and marks in the command text are masked (student data
+must not end up in a log file), IDs stay so the command can be repeated.
+*/
+#define SLOWLOG_ENTRIES 128
+#define SLOWLOG_TEXT_LENGTH 128
+
+typedef struct {
+    time_t when;
+    uint64_t nanoseconds;
+    uint64_t rows;
+    uint64_t phaseNanoseconds[PHASE_COUNT];
+    char text[SLOWLOG_TEXT_LENGTH];     // masked command line
+} SlowLogEntry;
+
+static struct {
+    atomic_ullong thresholdNanoseconds;     // 0: slow log is off
+    SlowLogEntry entries[SLOWLOG_ENTRIES];  // ring, "next" is the oldest once full
+    size_t next;
+    size_t count;
+    FILE *file;
+    char fileName[256];
+#if CMS_HAVE_THREADS
+    pthread_mutex_t lock;                   // commands may finish on server worker threads
+#endif
+} slowLog = {
+#if CMS_HAVE_THREADS
+    .lock = PTHREAD_MUTEX_INITIALIZER
+#else
+    .next = 0
+#endif
+};
+
+static int slowLogOn(void)
+{
+    return atomic_load_explicit(&slowLog.thresholdNanoseconds, memory_order_relaxed) != 0;
+}
+
+// does a word (any case) start at c, with a space or the end after it? returns its length, 0 if not
+static size_t maskWordAt(const char *c, const char *word)
+{
+    size_t length = strlen(word);
+    return whereKeyword(c, word) && (!c[length] || isspace((unsigned char)c[length])) ? length : 0;
+}
+
+/*
+where the search text of FIND NAME / PROGRAMME ends: before a LIMIT, OFFSET,
+AFTER ID=, COLUMNS or INTO clause outside quotes (the spaces in front of it
+stay), else at the end of the line
+*/
+static const char *maskFindTextEnd(const char *c)
+{
+    static const char *const clauses[] = { "LIMIT", "OFFSET", "AFTER", "COLUMNS", "INTO" };
+    const char *p = c;
+    int quoted = 0;
+    for (; *p && *p != '\r' && *p != '\n'; ++p) {
+        if (*p == '"') {
+            quoted = !quoted;
+            continue;
+        }
+        if (quoted || p == c || !isspace((unsigned char)p[-1])) {
+            continue;
+        }
+        size_t clause = 0;
+        for (size_t k = 0; k < sizeof(clauses) / sizeof(clauses[0]) && !clause; ++k) {
+            clause = maskWordAt(p, clauses[k]);
+        }
+        if (clause && (clause != 5 || toupper((unsigned char)*p) != 'A' ||
+                       whereKeyword(whereSkipSpaces(p + clause), "ID"))) {
+            break;
+        }
+    }
+    while (p > c && isspace((unsigned char)p[-1])) {
+        p--;
+    }
+    return p;
+}
+
+/*
+copy a command line with its student data masked:
+    INSERT ID=2501234 Name="Jerrel" Programme="IS" Mark=84.8
+    -> INSERT ID=2501234 Name=*** Programme=*** Mark=***
+the keys are matched like readKeyValueFromCommand does (spaces around the
+= too, "Mark = 84.8" -> "Mark = ***");
+quoted text (WHERE PROGRAMME = "...") becomes *** as well, and so do the
+search text of FIND NAME / PROGRAMME, quoted or not, and each item of a
+PROGRAMME IN (...) list:
+    FIND NAME tan LIMIT 5 -> FIND NAME *** LIMIT 5
+    COUNT WHERE PROGRAMME IN (Law, Medicine) -> COUNT WHERE PROGRAMME IN (***, ***)
+*/
+static void maskCommandText(const char *line, char *text, size_t size)
+{
+    static const char *const maskedFields[] = { "NAME", "PROGRAMME", "MARK" };
+    size_t length = 0;
+    const char *c = line;
+
+    while (*c && *c != '\r' && *c != '\n' && length + 4 < size) {
+        if (*c == '"') {
+            const char *endQuote = strchr(c + 1, '"');
+            memcpy(text + length, "***", 3);
+            length += 3;
+            c = endQuote ? endQuote + 1 : c + strlen(c);
+            continue;
+        }
+
+        int startsWord = c == line || !isalpha((unsigned char)c[-1]);
+
+        // FIND NAME / FIND PROGRAMME: the length of the command with its spaces, up to the search text
+        size_t find = startsWord ? maskWordAt(c, "FIND") : 0;
+        if (find) {
+            const char *field = whereSkipSpaces(c + find);
+            size_t fieldLength = maskWordAt(field, "NAME");
+            fieldLength = fieldLength ? fieldLength : maskWordAt(field, "PROGRAMME");
+            const char *search = fieldLength ? whereSkipSpaces(field + fieldLength) : field;
+            find = fieldLength && *search && *search != '\r' && *search != '\n' ? (size_t)(search - c) : 0;
+        }
+        if (find && length + find + 4 < size) {
+            memcpy(text + length, c, find);
+            memcpy(text + length + find, "***", 3);
+            length += find + 3;
+            c = maskFindTextEnd(c + find);
+            continue;
+        }
+
+        // PROGRAMME IN (...): the list is copied with every item masked
+        size_t list = startsWord ? maskWordAt(c, "PROGRAMME") : 0;
+        if (list) {
+            const char *in = whereSkipSpaces(c + list);
+            const char *open = maskWordAt(in, "IN") || whereKeyword(in, "IN(") ? whereSkipSpaces(in + 2) : in;
+            list = open != in && *open == '(' ? (size_t)(open + 1 - c) : 0;
+        }
+        if (list && length + list + 4 < size) {
+            memcpy(text + length, c, list);
+            length += list;
+            c += list;
+            while (*c && *c != ')' && *c != '\r' && *c != '\n' && length + 4 < size) {
+                if (*c == ',' || isspace((unsigned char)*c)) {
+                    text[length++] = *c++;
+                    continue;
+                }
+                memcpy(text + length, "***", 3);
+                length += 3;
+                while (*c && *c != ',' && *c != ')' && *c != '\r' && *c != '\n') {
+                    if (*c == '"') {
+                        const char *endQuote = strchr(c + 1, '"');
+                        c = endQuote ? endQuote : c + strlen(c) - 1;
+                    }
+                    c++;
+                }
+            }
+            continue;
+        }
+
+        // field: the length of "key =" with its spaces, up to the value
+        size_t field = 0;
+        for (size_t f = 0; f < sizeof(maskedFields) / sizeof(maskedFields[0]) && !field; ++f) {
+            size_t k = 0;
+            while (maskedFields[f][k] && toupper((unsigned char)c[k]) == maskedFields[f][k]) {
+                k++;
+            }
+            if (maskedFields[f][k] || !startsWord) {
+                continue;
+            }
+            while (c[k] == ' ' || c[k] == '\t') {
+                k++;
+            }
+            if (c[k] == '=') {
+                k++;
+                while (c[k] == ' ' || c[k] == '\t') {
+                    k++;
+                }
+                field = k;
+            }
+        }
+        if (field && length + field + 4 < size) {
+            memcpy(text + length, c, field);
+            memcpy(text + length + field, "***", 3);
+            length += field + 3;
+            c += field;
+            if (*c == '"') {
+                const char *endQuote = strchr(c + 1, '"');
+                c = endQuote ? endQuote + 1 : c + strlen(c);
+            } else {
+                while (*c && !isspace((unsigned char)*c)) {
+                    c++;
+                }
+            }
+            continue;
+        }
+
+        text[length++] = *c++;
+    }
+    text[length] = '\0';
+}
+
+// "read 1.203 ms, parse 3.004 ms" (only the phases that took time)
+static void formatPhases(const uint64_t *phaseNanoseconds, char *text, size_t size)
+{
+    size_t length = 0;
+    text[0] = '\0';
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+        if (phaseNanoseconds[p] && length < size) {
+            length += (size_t)snprintf(text + length, size - length, "%s%s %.3f ms",
+                                       length ? ", " : "", commandPhaseNames[p],
+                                       phaseNanoseconds[p] / 1e6);
+        }
+    }
+}
+
+static void formatLocalTime(time_t when, char *text, size_t size)
+{
+    struct tm tmValue;
+#ifdef _WIN32
+    localtime_s(&tmValue, &when);
+#else
+    localtime_r(&when, &tmValue);
+#endif
+    strftime(text, size, "%Y-%m-%d %H:%M:%S", &tmValue);
+}
+
+// remember a command that took at least the threshold (maskedText is already masked)
+static void slowLogRecord(const char *maskedText, uint64_t nanoseconds, const CommandCounters *counters)
+{
+    SlowLogEntry entry;
+    entry.when = time(NULL);
+    entry.nanoseconds = nanoseconds;
+    entry.rows = counters->rows;
+    memcpy(entry.phaseNanoseconds, counters->phaseNanoseconds, sizeof(entry.phaseNanoseconds));
+    snprintf(entry.text, sizeof(entry.text), "%s", maskedText);
+
+#if CMS_HAVE_THREADS
+    pthread_mutex_lock(&slowLog.lock);
+#endif
+    slowLog.entries[slowLog.next] = entry;
+    slowLog.next = (slowLog.next + 1) % SLOWLOG_ENTRIES;
+    if (slowLog.count < SLOWLOG_ENTRIES) {
+        slowLog.count++;
+    }
+
+    if (slowLog.file) {
+        char when[32];
+        char phases[256];
+        formatLocalTime(entry.when, when, sizeof(when));
+        formatPhases(entry.phaseNanoseconds, phases, sizeof(phases));
+        fprintf(slowLog.file, "%s\t%.3f ms\t%llu rows\t%s\t%s\n", when, nanoseconds / 1e6,
+                (unsigned long long)entry.rows, entry.text, phases[0] ? phases : "-");
+        fflush(slowLog.file);
+    }
+#if CMS_HAVE_THREADS
+    pthread_mutex_unlock(&slowLog.lock);
+#endif
+}
+
+/*
+SET SLOWLOG <ms> [FILE <path>] / SET SLOWLOG OFF
+    argument: what follows "SET SLOWLOG"
+*/
+static void setSlowLog(const char *argument)
+{
+    while (isspace((unsigned char)*argument)) {
+        argument++;
+    }
+
+    char upperArgument[512];
+    copyUppercase(upperArgument, argument, sizeof(upperArgument));
+    int off = equalsIgnoreCase(upperArgument, "OFF");
+
+    char number[32] = "";
+    int milliseconds = 0;
+    int consumed = 0;
+    if (!off && (sscanf(argument, "%31s%n", number, &consumed) != 1 ||
+                 !stringToInt(number, &milliseconds) || milliseconds < 0)) {
+        outputPrintf("CMS: Usage: SET SLOWLOG <ms> [FILE <path>] | SET SLOWLOG OFF\n");
+        return;
+    }
+
+    // optional FILE <path>
+    const char *rest = argument + consumed;
+    while (isspace((unsigned char)*rest)) {
+        rest++;
+    }
+    char fileName[256] = "";
+    if (!off && *rest) {
+        if (toupper((unsigned char)rest[0]) != 'F' || toupper((unsigned char)rest[1]) != 'I' ||
+            toupper((unsigned char)rest[2]) != 'L' || toupper((unsigned char)rest[3]) != 'E' ||
+            !isspace((unsigned char)rest[4])) {
+            outputPrintf("CMS: Usage: SET SLOWLOG <ms> [FILE <path>] | SET SLOWLOG OFF\n");
+            return;
+        }
+        snprintf(fileName, sizeof(fileName), "%s", rest + 5);
+        trimSpaces(fileName);
+    }
+
+    FILE *file = NULL;
+    if (fileName[0] && !(file = fopen(fileName, "a"))) {
+        outputPrintf("CMS: Cannot open slow log file \"%s\": %s\n", fileName, strerror(errno));
+        return;
+    }
+
+#if CMS_HAVE_THREADS
+    pthread_mutex_lock(&slowLog.lock);
+#endif
+    // a new SET SLOWLOG without FILE keeps writing to the file it had
+    if (off || file) {
+        if (slowLog.file) {
+            fclose(slowLog.file);
+        }
+        slowLog.file = file;
+        snprintf(slowLog.fileName, sizeof(slowLog.fileName), "%s", fileName);
+    }
+    // (0 ms means log every command, stored as 1 ns so that 0 stays "off")
+    atomic_store(&slowLog.thresholdNanoseconds,
+                 off ? 0 : (milliseconds ? (unsigned long long)milliseconds * 1000000ull : 1));
+#if CMS_HAVE_THREADS
+    pthread_mutex_unlock(&slowLog.lock);
+#endif
+
+    if (off) {
+        outputPrintf("CMS: Slow log is off.\n");
+    } else if (slowLog.file) {
+        outputPrintf("CMS: Logging commands of %d ms or more, also to \"%s\".\n", milliseconds, slowLog.fileName);
+    } else {
+        outputPrintf("CMS: Logging commands of %d ms or more.\n", milliseconds);
+    }
+}
+
+// SHOW SLOWLOG: the remembered slow commands, newest first
+static void showSlowLog(void)
+{
+#if CMS_HAVE_THREADS
+    pthread_mutex_lock(&slowLog.lock);
+#endif
+    unsigned long long threshold = atomic_load(&slowLog.thresholdNanoseconds);
+    if (!threshold) {
+        outputPrintf("CMS: Slow log is off (SET SLOWLOG <ms> to start it).\n");
+    } else {
+        outputPrintf("CMS: Slow log, commands of %.0f ms or more%s%s%s.\n", threshold / 1e6,
+                     slowLog.file ? " (also in \"" : "", slowLog.file ? slowLog.fileName : "",
+                     slowLog.file ? "\")" : "");
+    }
+
+    if (slowLog.count == 0) {
+        outputPrintf("CMS: No slow commands recorded.\n");
+    } else {
+        outputPrintf("%-19s %12s %10s  %s\n", "When", "ms", "Rows", "Command");
+    }
+    for (size_t k = 1; k <= slowLog.count; ++k) {
+        const SlowLogEntry *entry = &slowLog.entries[(slowLog.next + SLOWLOG_ENTRIES - k) % SLOWLOG_ENTRIES];
+        char when[32];
+        char phases[256];
+        formatLocalTime(entry->when, when, sizeof(when));
+        formatPhases(entry->phaseNanoseconds, phases, sizeof(phases));
+
+        outputPrintf("%-19s %12.3f %10llu  %s\n", when, entry->nanoseconds / 1e6,
+                     (unsigned long long)entry->rows, entry->text);
+        if (phases[0]) {
+            outputPrintf("%-19s %12s %10s    %s\n", "", "", "", phases);
+        }
+    }
+#if CMS_HAVE_THREADS
+    pthread_mutex_unlock(&slowLog.lock);
+#endif
+}
+
+// WORKLOAD CAPTURE (CAPTURE START / CAPTURE STOP, replayed with --replay)
+/*
+CAPTURE START <file> writes every command line that runs from then on into a
+compact binary file, so a real day of work can be run again later against a
+copy of the database (see runReplay) to compare two builds.
+
+file layout:
+    "CMSCAP1\n"                                 8 byte header
+    then per command line, in the order they started:
+        varint  microseconds since the previous line (the first: since CAPTURE START)
+        varint  client (0: the terminal, 1, 2, ...: --serve connections)
+        varint  length
+        bytes   the line as typed, without the newline
+varints are 7 bits per byte, low bits first, high bit set on all but the last.
+the lines are not masked (a replay needs the real names and marks), so a
+capture file holds student data like the database file does.
+*/
+#define CAPTURE_MAGIC "CMSCAP1\n"
+#define CAPTURE_MAX_LINE 4096
+
+static struct {
+    atomic_int on;
+    FILE *file;
+    char fileName[256];
+    uint64_t previous;                  // start time of the last captured line
+    unsigned long long lines;
+    unsigned long long bytes;
+#if CMS_HAVE_THREADS
+    pthread_mutex_t lock;               // commands also run on server worker threads
+#endif
+} capture = {
+#if CMS_HAVE_THREADS
+    .lock = PTHREAD_MUTEX_INITIALIZER
+#else
+    .lines = 0
+#endif
+};
+
+#if CMS_HAVE_SERVER
+// the client number of the next --serve connection (0 is the terminal)
+static atomic_uint captureNextClient = 1;
+#endif
+
+// append one varint; returns how many bytes it took
+static size_t captureWriteVarint(FILE *file, uint64_t value)
+{
+    unsigned char bytes[10];
+    size_t length = 0;
+    do {
+        bytes[length] = (unsigned char)(value & 0x7f);
+        value >>= 7;
+        if (value) {
+            bytes[length] |= 0x80;
+        }
+        length++;
+    } while (value);
+    return fwrite(bytes, 1, length, file);
+}
+
+// read one varint; returns 0 at the end of the file or on a broken one
+static int captureReadVarint(FILE *file, uint64_t *value)
+{
+    *value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(file);
+        if (c == EOF) {
+            return 0;
+        }
+        *value |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// is the first word of the line CAPTURE (those lines are never captured)
+static int isCaptureCommand(const char *line)
+{
+    while (isspace((unsigned char)*line)) {
+        line++;
+    }
+    const char *word = "CAPTURE";
+    for (size_t k = 0; word[k]; ++k) {
+        if (toupper((unsigned char)line[k]) != word[k]) {
+            return 0;
+        }
+    }
+    return line[7] == '\0' || isspace((unsigned char)line[7]);
+}
+
+// write one command line into the capture (does nothing while no capture runs)
+static void captureRecord(const CommandSession *session, const char *line)
+{
+    if (!atomic_load_explicit(&capture.on, memory_order_relaxed) || isCaptureCommand(line)) {
+        return;
+    }
+    size_t length = strcspn(line, "\r\n");
+
+#if CMS_HAVE_THREADS
+    pthread_mutex_lock(&capture.lock);
+#endif
+    if (capture.file) {
+        // the clock is read under the lock, so the times in the file never go back
+        uint64_t now = monotonicNanoseconds();
+        size_t written = captureWriteVarint(capture.file, (now - capture.previous) / 1000);
+        written += captureWriteVarint(capture.file, session->captureClient);
+        written += captureWriteVarint(capture.file, length);
+        written += fwrite(line, 1, length, capture.file);
+        capture.previous = now;
+        capture.lines++;
+        capture.bytes += written;
+    }
+#if CMS_HAVE_THREADS
+    pthread_mutex_unlock(&capture.lock);
+#endif
+}
+
+/*
+CAPTURE START: start writing command lines into fileName
+the check and the open are done under the lock, so two clients of --serve
+cannot both start one (and a running capture file is never truncated)
+returns 1 if the capture started, -1 if one is already running, 0 if the
+file cannot be created (errno says why)
+*/
+static int captureStart(const char *fileName)
+{
+#if CMS_HAVE_THREADS
+    pthread_mutex_lock(&capture.lock);
+#endif
+    FILE *file = capture.file ? NULL : fopen(fileName, "wb");
+    if (!file) {
+        int running = capture.file != NULL;
+        int openError = errno;
+#if CMS_HAVE_THREADS
+        pthread_mutex_unlock(&capture.lock);
+#endif
+        errno = openError;
+        return running ? -1 : 0;
+    }
+    fwrite(CAPTURE_MAGIC, 1, strlen(CAPTURE_MAGIC), file);
+
+    capture.file = file;
+    snprintf(capture.fileName, sizeof(capture.fileName), "%s", fileName);
+    capture.previous = monotonicNanoseconds();
+    capture.lines = 0;
+    capture.bytes = strlen(CAPTURE_MAGIC);
+    atomic_store(&capture.on, 1);
+#if CMS_HAVE_THREADS
+    pthread_mutex_unlock(&capture.lock);
+#endif
+    return 1;
+}
+
+/*
+CAPTURE STOP: close the file
+    lines / bytes: what went into the file (may be NULL)
+returns 0 if no capture was running, -1 if the file could not be written completely
+*/
+static int captureStop(unsigned long long *lines, unsigned long long *bytes)
+{
+#if CMS_HAVE_THREADS
+    pthread_mutex_lock(&capture.lock);
+#endif
+    FILE *file = capture.file;
+    atomic_store(&capture.on, 0);
+    capture.file = NULL;
+    int failed = file && (ferror(file) | fclose(file)) != 0;
+#if CMS_HAVE_THREADS
+    pthread_mutex_unlock(&capture.lock);
+#endif
+
+    if (lines) {
+        *lines = capture.lines;
+    }
+    if (bytes) {
+        *bytes = capture.bytes;
+    }
+    return !file ? 0 : failed ? -1 : 1;
+}
+
+/*
+execute one command line (typed in the shell or sent by a client)
+steps:
+    1. if a DELETE is waiting for confirmation, this line is the Y/N answer
+    2. trim the line and skip it if empty
+    3. convert a copy to uppercase for command matching
+    4. compare and execute the correct command
+all output goes through outputPrintf() into currentOutput
+
+returns:
+    0 if the user typed EXIT or QUIT, otherwise 1
+*/
+static int dispatchCommandLine(CommandSession *session, char *line)
+{
+    if (session->hasPendingDelete) {
+        finishPendingDelete(session, line);
+        return 1;
+    }
+
+    // remove extra spaces and skip empty lines
+    trimSpaces(line);
+    if (!line[0]) {
+        return 1;
+    }
+
+    // uppercase copy for easy comparison of commands
+    char upperLine[1024];
+    copyUppercase(upperLine, line, sizeof(upperLine));
+    resultReset(session->outputFormat);
+
+    // <query command> ... INTO <file>: the command runs as usual, its result goes into the file
+    if (!currentResult.into && isResultCommand(upperLine)) {
+        char file[512];
+        int into = takeIntoClause(line, file, sizeof(file));
+        if (into < 0) {
+            return 1;
+        }
+        if (into) {
+            char actualPath[1024];
+            FILE *fp = openFileForWriteInProgramFolder(file, actualPath, sizeof(actualPath));
+            if (!fp) {
+                outputPrintf("CMS: Cannot write to \"%s\".\n", file);
+                return 1;
+            }
+            OutputBuffer result = { NULL, 0, 0, fp };
+            currentResult.into = &result;
+            currentResult.rows = 0;
+            int keepRunning = dispatchCommandLine(session, line);
+            outputFlush(&result);
+            outputFree(&result);
+            currentResult.into = NULL;
+
+            int failed = ferror(fp);
+            if (fclose(fp) != 0 || failed) {
+                outputPrintf("CMS: Writing \"%s\" failed.\n", actualPath);
+            } else {
+                outputPrintf("CMS: %llu row%s written to %s (%s).\n", (unsigned long long)currentResult.rows,
+                             currentResult.rows == 1 ? "" : "s", actualPath, resultFormatNames[currentResult.layout.format]);
+            }
+            return keepRunning;
+        }
+    }
+
+    // SHOW ID, MARK ... is SHOW ALL ... with only those columns
+    if (isShowColumnsCommand(upperLine)) {
+        char rewritten[1100];
+        snprintf(rewritten, sizeof(rewritten), "SHOW ALL COLUMNS %s", line + 5);
+        return dispatchCommandLine(session, rewritten);
+    }
+    if (isResultCommand(upperLine)) {
+        if (!takeColumnsClause(line)) {
+            return 1;
+        }
+        copyUppercase(upperLine, line, sizeof(upperLine));
+    }
+
+    // EXIT / QUIT
+    if (equalsIgnoreCase(upperLine, "EXIT") ||
+        equalsIgnoreCase(upperLine, "QUIT")) {
+        return 0;
+    }
+
+    // HELP
+    else if (strncmp(upperLine, "HELP", 4) == 0) {
+        printHelp();
+    }
+
+    // OPEN <file>
+    else if (strncmp(upperLine, "OPEN", 4) == 0) {
+        char *p = line + 4;
+        while (*p && isspace((unsigned char)*p)) {
+            p++;
+        }
+
+        if (!*p) {
+            outputPrintf("CMS: Please provide a filename.\n");
+            return 1;
+        }
+
+        char *fileName = p;
+        if (*p == '"') {
+            p++;
+            char *endQuote = strrchr(p, '"');
+            if (endQuote) {
+                *endQuote = '\0';
+            }
+            fileName = p;
+        }
 
-        // split by TAB into 4 tokens
-        char *tokenId   = strtok(line, "\t");
-        char *tokenName = strtok(NULL, "\t");
-        char *tokenProg = strtok(NULL, "\t");
-        char *tokenMark = strtok(NULL, "\t");
+        if (loadDatabaseFromFile(fileName)) {
+            outputPrintf("CMS: The database file \"%s\" is successfully opened.\n", fileName);
+        } else {
+            outputPrintf("CMS: Failed to open file \"%s\".\n", fileName);
+        }
+    }
 
-        if (!tokenId || !tokenName || !tokenProg || !tokenMark) {
-            continue;   // skip malformed lines
+    // SAVE [file]
+    else if (strncmp(upperLine, "SAVE", 4) == 0) {
+        char *p = line + 4;
+        while (*p && isspace((unsigned char)*p)) {
+            p++;
+        }
+
+        const char *fileName = *p ? p : NULL;  // NULL means reuse lastDatabaseFileName
+
+        TableSnapshot *snapshot = commandSnapshotBegin();
+        if (saveDatabaseToFile(snapshot, fileName)) {
+            outputPrintf("CMS: The database file is successfully saved.\n");
+        } else {
+            outputPrintf("CMS: Failed to save. Please OPEN a file first or provide a filename.\n");
+        }
+        commandSnapshotEnd(snapshot);
+    }
+
+    // SHOW ALL [WHERE ...] [SORT BY <col> [ASC|DESC], <col> [ASC|DESC]] [LIMIT n] [OFFSET m] [AFTER ID=x]
+    else if (strncmp(upperLine, "SHOW ALL", 8) == 0) {
+        SortSpec spec;
+        QueryFilter filter;
+        RowPage page;
+        if (!takePageClause(line + 8, &page)) {
+            return 1;
+        }
+        copyUppercase(upperLine, line, sizeof(upperLine));
+        if (!takeSortByClause(line + 8, upperLine + 8, &spec) ||
+            !takeWhereClause(line + 8, &filter)) {
+            return 1;
+        }
+        if (page.after && spec.keyCount &&
+            (spec.keyCount > 1 || spec.keys[0].column != SORT_COLUMN_ID || spec.keys[0].direction != SORT_ASCENDING)) {
+            outputPrintf("CMS: AFTER ID= pages in ID order, it only goes with SORT BY ID.\n");
+            return 1;
+        }
+
+        TableSnapshot *snapshot = commandSnapshotBegin();
+        if (page.active) {
+            showAllPage(snapshot, &filter, &spec, &page);
+        } else {
+            TableSnapshot *view = tableSnapshotWhere(snapshot, &filter);
+            if (filter.active && view->count == 0) {
+                outputPrintf("CMS: No records match the WHERE clause.\n");
+            } else {
+                showAllStudents(view, &spec);
+            }
+            tableSnapshotWhereEnd(view, snapshot);
+        }
+        commandSnapshotEnd(snapshot);
+    }
+
+    // SHOW PARTITIONS
+    else if (strncmp(upperLine, "SHOW PARTITIONS", 15) == 0) {
+        TableSnapshot *snapshot = commandSnapshotBegin();
+        showPartitions(snapshot);
+        commandSnapshotEnd(snapshot);
+    }
+
+    // SHOW MEMORY
+    else if (equalsIgnoreCase(upperLine, "SHOW MEMORY")) {
+        showMemory();
+    }
+
+    // INSERT ID=... Name="..." Programme="..." Mark=...
+    else if (strncmp(upperLine, "INSERT", 6) == 0) {
+        char idBuffer[64] = "";
+        char nameBuffer[NAME_MAX_LENGTH] = "";
+        char programmeBuffer[PROGRAMME_MAX_LENGTH] = "";
+        char markBuffer[64] = "";
+
+        if (!readKeyValueFromCommand(line, "ID", idBuffer, sizeof(idBuffer))) {
+            outputPrintf("CMS: Missing ID=\n");
+            return 1;
+        }
+        if (!readKeyValueFromCommand(line, "Name", nameBuffer, sizeof(nameBuffer))) {
+            outputPrintf("CMS: Missing Name=\n");
+            return 1;
+        }
+        if (!readKeyValueFromCommand(line, "Programme", programmeBuffer, sizeof(programmeBuffer))) {
+            outputPrintf("CMS: Missing Programme=\n");
+            return 1;
+        }
+        if (!readKeyValueFromCommand(line, "Mark", markBuffer, sizeof(markBuffer))) {
+            outputPrintf("CMS: Missing Mark=\n");
+            return 1;
+        }
+
+        int id;
+        Mark mark;
+        if (!stringToInt(idBuffer, &id)) {
+            outputPrintf("CMS: Invalid ID.\n");
+            return 1;
+        }
+        if (!markFromText(markBuffer, &mark)) {
+            outputPrintf("CMS: Invalid Mark.\n");
+            return 1;
+        }
+
+        if (addStudentRecord(id, nameBuffer, programmeBuffer, mark)) {
+            outputPrintf("CMS: A new record with ID=%d is successfully inserted.\n", id);
+        } else {
+            outputPrintf("CMS: The record with ID=%d already exists.\n", id);
+        }
+    }
+
+    // QUERY ID=...
+    else if (strncmp(upperLine, "QUERY", 5) == 0) {
+        char idBuffer[64] = "";
+
+        if (!readKeyValueFromCommand(line, "ID", idBuffer, sizeof(idBuffer))) {
+            outputPrintf("CMS: Missing ID=\n");
+            return 1;
+        }
+
+        int id;
+        if (!stringToInt(idBuffer, &id)) {
+            outputPrintf("CMS: Invalid ID.\n");
+            return 1;
+        }
+
+        RowLocation where;
+        if (!findIndexById(id, &where)) {
+            outputPrintf("CMS: The record with ID=%d does not exist.\n", id);
+        } else {
+            outputPrintf("CMS: The record with ID=%d is found in the data table.\n", id);
+            resultHeader();
+            resultWriteRow(studentTable.segments[where.segment].chunks[where.slot / CHUNK_ROWS],
+                           (unsigned)(where.slot % CHUNK_ROWS));
+            countRows(1);
+        }
+    }
+
+    // COUNT [WHERE ...]
+    else if (strncmp(upperLine, "COUNT", 5) == 0) {
+        QueryFilter filter;
+        if (!takeWhereClause(line + 5, &filter)) {
+            return 1;
+        }
+        outputPrintf("CMS: Count: %zu\n", countStudentsWhere(&filter));
+    }
+
+    // RANK ID=...
+    else if (strncmp(upperLine, "RANK", 4) == 0) {
+        char idBuffer[64] = "";
+
+        if (!readKeyValueFromCommand(line, "ID", idBuffer, sizeof(idBuffer))) {
+            outputPrintf("CMS: Missing ID=\n");
+            return 1;
+        }
+
+        int id;
+        if (!stringToInt(idBuffer, &id)) {
+            outputPrintf("CMS: Invalid ID.\n");
+            return 1;
+        }
+
+        StudentRecord student;
+        size_t rank, groupSize;
+        if (!getStudentRecordById(id, &student)) {
+            outputPrintf("CMS: The record with ID=%d does not exist.\n", id);
+        } else if (rankIndexLookup(student.programme, student.mark, &rank, &groupSize)) {
+            outputPrintf("CMS: ID=%d (%s) is rank %zu of %zu in \"%s\" with mark %.1f.\n",
+                         student.id,
+                         student.name,
+                         rank,
+                         groupSize,
+                         student.programme,
+                         markToDouble(student.mark));
+        }
+    }
+
+    // UPDATE ID=... [Name=...] [Programme=...] [Mark=...]
+    else if (strncmp(upperLine, "UPDATE", 6) == 0) {
+        char idBuffer[64] = "";
+        char nameBuffer[NAME_MAX_LENGTH] = "";
+        char programmeBuffer[PROGRAMME_MAX_LENGTH] = "";
+        char markBuffer[64] = "";
+
+        if (!readKeyValueFromCommand(line, "ID", idBuffer, sizeof(idBuffer))) {
+            outputPrintf("CMS: Missing ID=\n");
+            return 1;
+        }
+
+        int id;
+        if (!stringToInt(idBuffer, &id)) {
+            outputPrintf("CMS: Invalid ID.\n");
+            return 1;
+        }
+
+        int hasName = readKeyValueFromCommand(line, "Name", nameBuffer, sizeof(nameBuffer));
+        int hasProgramme = readKeyValueFromCommand(line, "Programme", programmeBuffer, sizeof(programmeBuffer));
+        int hasMark = readKeyValueFromCommand(line, "Mark", markBuffer, sizeof(markBuffer));
+
+        Mark markValue;
+        Mark *markPtr = NULL;
+
+        if (hasMark) {
+            if (!markFromText(markBuffer, &markValue)) {
+                outputPrintf("CMS: Invalid Mark.\n");
+                return 1;
+            }
+            markPtr = &markValue;
+        }
+
+        if (updateStudentRecord(id,
+                                hasName ? nameBuffer : NULL,
+                                hasProgramme ? programmeBuffer : NULL,
+                                markPtr)) {
+            outputPrintf("CMS: The record with ID=%d is successfully updated.\n", id);
+        } else {
+            outputPrintf("CMS: The record with ID=%d does not exist.\n", id);
+        }
+    }
+
+    // DELETE ID=...
+    else if (strncmp(upperLine, "DELETE", 6) == 0) {
+        char idBuffer[64] = "";
+
+        if (!readKeyValueFromCommand(line, "ID", idBuffer, sizeof(idBuffer))) {
+            outputPrintf("CMS: Missing ID=\n");
+            return 1;
+        }
+
+        int id;
+        if (!stringToInt(idBuffer, &id)) {
+            outputPrintf("CMS: Invalid ID.\n");
+            return 1;
+        }
+
+        RowLocation where;
+        if (!findIndexById(id, &where)) {
+            outputPrintf("CMS: The record with ID=%d does not exist.\n", id);
+            return 1;
+        }
+
+        // the Y/N answer arrives as the next line (see finishPendingDelete)
+        outputPrintf("CMS: Type Y to Confirm or N to cancel: ");
+        session->hasPendingDelete = 1;
+        session->pendingDeleteId = id;
+    }
+
+    // SHOW SUMMARY [WHERE ...]
+    else if (strncmp(upperLine, "SHOW SUMMARY", 12) == 0) {
+        QueryFilter filter;
+        if (!takeWhereClause(line + 12, &filter)) {
+            return 1;
+        }
+
+        TableSnapshot *snapshot = commandSnapshotBegin();
+        TableSnapshot *view = tableSnapshotWhere(snapshot, &filter);
+        if (filter.active && view->count == 0) {
+            outputPrintf("CMS: No records match the WHERE clause.\n");
+        } else {
+            showSummaryStatistics(view);
+        }
+        tableSnapshotWhereEnd(view, snapshot);
+        commandSnapshotEnd(snapshot);
+    }
+
+    // SHOW TOP <n> BY MARK [PER PROGRAMME] [WHERE ...]
+    else if (strncmp(upperLine, "SHOW TOP", 8) == 0) {
+        QueryFilter filter;
+        if (!takeWhereClause(line + 8, &filter)) {
+            return 1;
+        }
+        copyUppercase(upperLine + 8, line + 8, sizeof(upperLine) - 8);
+
+        char *end = NULL;
+        long limit = strtol(upperLine + 8, &end, 10);
+
+        while (*end && isspace((unsigned char)*end)) {
+            end++;
+        }
+        int byMark = strncmp(end, "BY MARK", 7) == 0;
+        if (byMark) {
+            end += 7;
+            while (*end && isspace((unsigned char)*end)) {
+                end++;
+            }
+        }
+        int perProgramme = strcmp(end, "PER PROGRAMME") == 0;
+
+        if (end == upperLine + 8 || !byMark || (*end && !perProgramme) ||
+            limit < 1 || limit > TOP_MAX_COUNT) {
+            outputPrintf("CMS: Use SHOW TOP <n> BY MARK [PER PROGRAMME], n from 1 to %d.\n",
+                         TOP_MAX_COUNT);
+            return 1;
+        }
+
+        TableSnapshot *snapshot = commandSnapshotBegin();
+        TableSnapshot *view = tableSnapshotWhere(snapshot, &filter);
+        if (filter.active && view->count == 0) {
+            outputPrintf("CMS: No records match the WHERE clause.\n");
+        } else {
+            showTopStudents(view, (size_t)limit, perProgramme);
+        }
+        tableSnapshotWhereEnd(view, snapshot);
+        commandSnapshotEnd(snapshot);
+    }
+
+    // EXPORT CSV <file.csv> [WHERE ...] [SORT BY ...]
+    else if (strncmp(upperLine, "EXPORT CSV", 10) == 0) {
+        char *p = line + 10;
+        while (*p && isspace((unsigned char)*p)) {
+            p++;
+        }
+
+        SortSpec spec;
+        QueryFilter filter;
+        if (!takeSortByClause(p, upperLine + (p - line), &spec) ||
+            !takeWhereClause(p, &filter)) {
+            return 1;
+        }
+
+        if (!*p) {
+            outputPrintf("CMS: Please provide CSV filename.\n");
+            return 1;
+        }
+
+        TableSnapshot *snapshot = commandSnapshotBegin();
+        TableSnapshot *view = tableSnapshotWhere(snapshot, &filter);
+        int exported = exportToCsvFile(view, p, &spec);
+        tableSnapshotWhereEnd(view, snapshot);
+        if (exported) {
+            outputPrintf("CMS: CSV exported to \"%s\".\n", p);
+        } else {
+            outputPrintf("CMS: Failed to export CSV.\n");
+        }
+        commandSnapshotEnd(snapshot);
+    }
+
+    // EXPORT SQL <file.sql> [WHERE ...] [SORT BY ...]
+    else if (strncmp(upperLine, "EXPORT SQL", 10) == 0) {
+        char *p = line + 10;
+        while (*p && isspace((unsigned char)*p)) {
+            p++;
+        }
+
+        SortSpec spec;
+        QueryFilter filter;
+        if (!takeSortByClause(p, upperLine + (p - line), &spec) ||
+            !takeWhereClause(p, &filter)) {
+            return 1;
+        }
+
+        if (!*p) {
+            outputPrintf("CMS: Please provide SQL filename.\n");
+            return 1;
+        }
+
+        TableSnapshot *snapshot = commandSnapshotBegin();
+        TableSnapshot *view = tableSnapshotWhere(snapshot, &filter);
+        int exported = exportToSqlFile(view, p, &spec);
+        tableSnapshotWhereEnd(view, snapshot);
+        if (exported) {
+            outputPrintf("CMS: SQL exported to \"%s\".\n", p);
+        } else {
+            outputPrintf("CMS: Failed to export SQL.\n");
+        }
+        commandSnapshotEnd(snapshot);
+    }
+
+    // EXPORT JSONL <file.jsonl> [WHERE ...] [SORT BY ...]
+    else if (strncmp(upperLine, "EXPORT JSONL", 12) == 0) {
+        char *p = line + 12;
+        while (*p && isspace((unsigned char)*p)) {
+            p++;
+        }
+
+        SortSpec spec;
+        QueryFilter filter;
+        if (!takeSortByClause(p, upperLine + (p - line), &spec) ||
+            !takeWhereClause(p, &filter)) {
+            return 1;
+        }
+
+        if (!*p) {
+            outputPrintf("CMS: Please provide JSONL filename.\n");
+            return 1;
+        }
+
+        TableSnapshot *snapshot = commandSnapshotBegin();
+        TableSnapshot *view = tableSnapshotWhere(snapshot, &filter);
+        int exported = exportToJsonlFile(view, p, &spec);
+        tableSnapshotWhereEnd(view, snapshot);
+        if (exported) {
+            outputPrintf("CMS: JSON Lines exported to \"%s\".\n", p);
+        } else {
+            outputPrintf("CMS: Failed to export JSON Lines.\n");
+        }
+        commandSnapshotEnd(snapshot);
+    }
+
+    // IMPORT JSONL <file.jsonl>
+    else if (strncmp(upperLine, "IMPORT JSONL", 12) == 0) {
+        char *p = line + 12;
+        while (*p && isspace((unsigned char)*p)) {
+            p++;
+        }
+
+        if (!*p) {
+            outputPrintf("CMS: Please provide JSONL filename.\n");
+            return 1;
+        }
+
+        size_t added;
+        size_t skipped;
+        if (importFromJsonlFile(p, &added, &skipped)) {
+            outputPrintf("CMS: JSON Lines imported from \"%s\" (%zu added, %zu skipped).\n", p, added, skipped);
+        } else {
+            outputPrintf("CMS: Failed to import JSON Lines.\n");
+        }
+    }
+
+    // IMPORT CSV <file.csv>
+    else if (strncmp(upperLine, "IMPORT CSV", 10) == 0) {
+        char *p = line + 10;
+        while (*p && isspace((unsigned char)*p)) {
+            p++;
+        }
+
+        if (!*p) {
+            outputPrintf("CMS: Please provide CSV filename.\n");
+            return 1;
+        }
+
+        if (importFromCsvFile(p)) {
+            outputPrintf("CMS: CSV imported from \"%s\".\n", p);
+        } else {
+            outputPrintf("CMS: Failed to import CSV.\n");
+        }
+    }
+
+    // GENERATE <n> [seed]
+    else if (strncmp(upperLine, "GENERATE", 8) == 0) {
+        char *end = NULL;
+        long long count = strtoll(line + 8, &end, 10);
+        unsigned long long seed = 1;
+        if (end != line + 8 && *end) {
+            char *seedEnd = NULL;
+            seed = strtoull(end, &seedEnd, 10);
+            if (seedEnd == end || *seedEnd) {
+                count = 0;  // not a number
+            }
+        }
+
+        if (end == line + 8 || count < 1 || count > GENERATE_MAX_ROWS) {
+            outputPrintf("CMS: Use GENERATE <rows> [seed], rows from 1 to %d.\n", GENERATE_MAX_ROWS);
+            return 1;
+        }
+
+        size_t added = generateStudents((size_t)count, (uint64_t)seed);
+        outputPrintf("CMS: Generated %zu records (seed %llu).\n", added, seed);
+        if (added < (size_t)count) {
+            outputPrintf("CMS: %zu generated IDs were already in the table and skipped.\n",
+                         (size_t)count - added);
+        }
+    }
+
+    // FIND NAME "..." or FIND PROGRAMME "..." [LIMIT n] [OFFSET m]
+    else if (strncmp(upperLine, "FIND NAME", 9) == 0) {
+        RowPage page;
+        if (!takePageClause(line + 9, &page)) {
+            return 1;
+        }
+        char *p = line + 9;
+        while (*p && isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (*p == '"') {
+            p++;
+            char *endQuote = strrchr(p, '"');
+            if (endQuote) {
+                *endQuote = '\0';
+            }
+        }
+        TableSnapshot *snapshot = commandSnapshotBegin();
+        if (page.active) {
+            findStudentsPage(snapshot, "NAME", p, &page);
+        } else {
+            findStudentsByField(snapshot, "NAME", p);
+        }
+        commandSnapshotEnd(snapshot);
+    }
+
+    else if (strncmp(upperLine, "FIND PROGRAMME", 14) == 0) {
+        RowPage page;
+        if (!takePageClause(line + 14, &page)) {
+            return 1;
+        }
+        char *p = line + 14;
+        while (*p && isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (*p == '"') {
+            p++;
+            char *endQuote = strrchr(p, '"');
+            if (endQuote) {
+                *endQuote = '\0';
+            }
+        }
+        TableSnapshot *snapshot = commandSnapshotBegin();
+        if (page.active) {
+            findStudentsPage(snapshot, "PROGRAMME", p, &page);
+        } else {
+            findStudentsByField(snapshot, "PROGRAMME", p);
+        }
+        commandSnapshotEnd(snapshot);
+    }
+
+    // EXPLAIN [ANALYZE] <command>
+    else if (strncmp(upperLine, "EXPLAIN ANALYZE", 15) == 0) {
+        explainCommand(line + 15 + strspn(line + 15, " \t"), 1);
+    }
+    else if (strncmp(upperLine, "EXPLAIN", 7) == 0) {
+        explainCommand(line + 7 + strspn(line + 7, " \t"), 0);
+    }
+
+    // ANALYZE / SHOW STATISTICS
+    else if (equalsIgnoreCase(upperLine, "ANALYZE")) {
+        statsAnalyze();
+        showColumnStatistics();
+    }
+    else if (equalsIgnoreCase(upperLine, "SHOW STATISTICS")) {
+        showColumnStatistics();
+    }
+
+    // STATS / STATS RESET
+    else if (strncmp(upperLine, "STATS", 5) == 0) {
+        if (equalsIgnoreCase(upperLine, "STATS RESET")) {
+            commandStatsReset();
+            outputPrintf("CMS: Command statistics cleared.\n");
+        } else {
+            showCommandStats();
+        }
+    }
+
+    // SET SLOWLOG <ms> [FILE <path>] / SET SLOWLOG OFF
+    else if (strncmp(upperLine, "SET SLOWLOG", 11) == 0) {
+        setSlowLog(line + 11);
+    }
+
+    // SHOW SLOWLOG
+    else if (equalsIgnoreCase(upperLine, "SHOW SLOWLOG")) {
+        showSlowLog();
+    }
+
+    // TRACE START <file> / TRACE STOP
+    else if (strncmp(upperLine, "TRACE START", 11) == 0) {
+        char *fileName = line + 11;
+        while (*fileName && isspace((unsigned char)*fileName)) {
+            fileName++;
+        }
+        if (*fileName == '"') {
+            fileName++;
+            char *endQuote = strrchr(fileName, '"');
+            if (endQuote) {
+                *endQuote = '\0';
+            }
+        }
+
+        if (!*fileName) {
+            outputPrintf("CMS: Usage: TRACE START <file.json>\n");
+        } else if (tracer.file) {
+            outputPrintf("CMS: A trace is already running. Use TRACE STOP first.\n");
+        } else if (!traceStart(fileName)) {
+            outputPrintf("CMS: Cannot create trace file \"%s\": %s\n", fileName, strerror(errno));
+        } else {
+            outputPrintf("CMS: Tracing into \"%s\".\n", fileName);
+        }
+    }
+    else if (equalsIgnoreCase(upperLine, "TRACE STOP")) {
+        unsigned long long written = 0;
+        unsigned long long dropped = 0;
+        if (traceStop(&written, &dropped)) {
+            outputPrintf("CMS: Trace stopped, %llu spans written", written);
+            if (dropped) {
+                outputPrintf(", %llu dropped (rings were full)", dropped);
+            }
+            outputPrintf(".\n");
+        } else {
+            outputPrintf("CMS: No trace is running.\n");
+        }
+    }
+
+    // CAPTURE START <file> / CAPTURE STOP
+    else if (strncmp(upperLine, "CAPTURE START", 13) == 0) {
+        char *fileName = line + 13;
+        while (*fileName && isspace((unsigned char)*fileName)) {
+            fileName++;
+        }
+        if (*fileName == '"') {
+            fileName++;
+            char *endQuote = strrchr(fileName, '"');
+            if (endQuote) {
+                *endQuote = '\0';
+            }
+        }
+
+        int started = *fileName ? captureStart(fileName) : 0;
+        if (!*fileName) {
+            outputPrintf("CMS: Usage: CAPTURE START <file>\n");
+        } else if (started < 0) {
+            outputPrintf("CMS: A capture is already running. Use CAPTURE STOP first.\n");
+        } else if (!started) {
+            outputPrintf("CMS: Cannot create capture file \"%s\": %s\n", fileName, strerror(errno));
+        } else {
+            outputPrintf("CMS: Capturing commands into \"%s\".\n", fileName);
+        }
+    }
+    else if (equalsIgnoreCase(upperLine, "CAPTURE STOP")) {
+        unsigned long long lines = 0;
+        unsigned long long bytes = 0;
+        int stopped = captureStop(&lines, &bytes);
+        if (stopped == 0) {
+            outputPrintf("CMS: No capture is running.\n");
+        } else if (stopped < 0) {
+            outputPrintf("CMS: Capture stopped, but the file could not be written completely.\n");
+        } else {
+            outputPrintf("CMS: Capture stopped, %llu command lines (%.1f KB) written.\n",
+                         lines, (double)bytes / 1024.0);
         }
-
-        int   id   = atoi(tokenId);
-        float mark = (float)atof(tokenMark);
-
-        addStudentRecord(id, tokenName, tokenProg, mark);
     }
 
-    fclose(fp);
-
-    // remember file name logically (for SAVE with no argument)
-    strncpy(lastDatabaseFileName, fileName, sizeof(lastDatabaseFileName) - 1);
-    lastDatabaseFileName[sizeof(lastDatabaseFileName) - 1] = '\0';
-
-    return 1;
-}
+    // SET OUTPUT text|tsv|csv|json|binary
+    else if (strncmp(upperLine, "SET OUTPUT", 10) == 0) {
+        const char *name = line + 10;
+        while (isspace((unsigned char)*name)) {
+            name++;
+        }
+        int format = -1;
+        for (int k = 0; k < RESULT_FORMAT_COUNT && *name; ++k) {
+            if (equalsIgnoreCase(name, resultFormatNames[k])) {
+                format = k;
+            }
+        }
+        if (*name && format < 0) {
+            outputPrintf("CMS: Usage: SET OUTPUT text | tsv | csv | json | binary\n");
+            return 1;
+        }
+        if (format >= 0) {
+            session->outputFormat = (ResultFormat)format;
+        }
+        outputPrintf("CMS: Query results are written as %s.\n", resultFormatNames[session->outputFormat]);
+    }
 
-// save studentTable into a tab-separated file
-// if fileName is NULL or empty, we use lastDatabaseFileName
-static int saveDatabaseToFile(const char *fileName)
-{
-    const char *logicalName =
-        (fileName && fileName[0]) ? fileName : lastDatabaseFileName;
+    // TIMING ON / TIMING OFF
+    else if (strncmp(upperLine, "TIMING", 6) == 0) {
+        if (equalsIgnoreCase(upperLine, "TIMING ON")) {
+            session->timing = 1;
+            perfEnable();
+        } else if (equalsIgnoreCase(upperLine, "TIMING OFF")) {
+            session->timing = 0;
+        } else if (!equalsIgnoreCase(upperLine, "TIMING")) {
+            outputPrintf("CMS: Usage: TIMING ON | TIMING OFF\n");
+            return 1;
+        }
 
-    if (!logicalName || !logicalName[0]) {
-        return 0;   // we don't know where to save yet
+        if (session->timing && !perfAvailable()) {
+            char reason[128];
+            perfUnavailableReason(reason, sizeof(reason));
+            outputPrintf("CMS: Timing is on, without hardware counters (%s).\n", reason);
+        } else {
+            outputPrintf("CMS: Timing is %s.\n", session->timing ? "on" : "off");
+        }
     }
 
-    char actualPath[1024];
-    FILE *fp = openFileForWriteInProgramFolder(logicalName, actualPath, sizeof(actualPath));
-    if (!fp) {
-        return 0;
+    // BACKUP
+    else if (strncmp(upperLine, "BACKUP", 6) == 0) {
+        TableSnapshot *snapshot = commandSnapshotBegin();
+        if (makeTimestampedBackup(snapshot)) {
+            outputPrintf("CMS: Backup file created.\n");
+        } else {
+            outputPrintf("CMS: Backup failed. Please OPEN and SAVE first.\n");
+        }
+        commandSnapshotEnd(snapshot);
     }
 
-    // each line: ID<TAB>Name<TAB>Programme<TAB>Mark
-    for (size_t i = 0; i < studentTable.count; ++i) {
-        StudentRecord *student = &studentTable.records[i];
-        fprintf(fp, "%d\t%s\t%s\t%.1f\n",
-                student->id,
-                student->name,
-                student->programme,
-                student->mark);
+    // Unknown command
+    else {
+        outputPrintf("CMS: Unknown command. Type HELP.\n");
     }
 
-    fclose(fp);
     return 1;
 }
 
-// SUMMARY AND SORTING
-typedef enum {
-    SORT_NONE,
-    SORT_BY_ID,
-    SORT_BY_MARK
-} SortField;
-
-typedef enum {
-    SORT_ASCENDING,
-    SORT_DESCENDING
-} SortDirection;
-
-// comparator for qsort: compares students by ID ascending
-static int compareByIdAscending(const void *a, const void *b)
+// TIMING ON: how long the command took, where the time went and what the cpu counted
+static void printCommandTiming(uint64_t elapsed, uint64_t cpu, const CommandCounters *counters,
+                               const PerfCounts *perfBefore, const PerfCounts *perfAfter)
 {
-    const StudentRecord *x = (const StudentRecord *)a;
-    const StudentRecord *y = (const StudentRecord *)b;
-    if (x->id > y->id) return 1;
-    if (x->id < y->id) return -1;
-    return 0;
-}
+    outputPrintf("CMS: Time: %.3f ms real, %.3f ms cpu, %llu rows.\n",
+                 elapsed / 1e6, cpu / 1e6, (unsigned long long)counters->rows);
 
-// comparator for qsort: compares students by Mark ascending
-static int compareByMarkAscending(const void *a, const void *b)
-{
-    const StudentRecord *x = (const StudentRecord *)a;
-    const StudentRecord *y = (const StudentRecord *)b;
-    if (x->mark > y->mark) return 1;
-    if (x->mark < y->mark) return -1;
-    return 0;
+    char perfText[256];
+    if (perfDescribe(perfBefore, perfAfter, counters->rows, perfText, sizeof(perfText))) {
+        outputPrintf("CMS: Counters: %s.\n", perfText);
+    }
+
+    char phases[256];
+    formatPhases(counters->phaseNanoseconds, phases, sizeof(phases));
+    if (phases[0]) {
+        outputPrintf("CMS: Phases: %s.\n", phases);
+    }
 }
 
 /*
-print all records to the console
-- optionally sort by ID or Mark
-- optionally sort ascending or descending
-
-implementation:
-- we make a temporary copy of the student array
-- sort the copy so the original order in memory is not changed
+run one command line with dispatchCommandLine and record it for STATS
+(a DELETE is recorded when its Y/N answer arrives, empty lines and EXIT not at all)
+with TIMING ON the time of the command is printed after its output,
+a command slower than SET SLOWLOG goes into the slow log,
+and while a CAPTURE runs the line is written into it first
 */
-static void showAllStudents(SortField field, SortDirection direction)
+static int executeCommandLine(CommandSession *session, char *line)
 {
-    // allocate temporary array
-    StudentRecord *copy =
-        (StudentRecord *)malloc(studentTable.count * sizeof(StudentRecord));
-    if (!copy) {
-        fprintf(stderr, "CMS: Out of memory in showAllStudents.\n");
-        return;
+    CommandKind kind = session->hasPendingDelete ? COMMAND_DELETE : commandKindOf(line);
+    int answersDelete = session->hasPendingDelete;
+    int timing = session->timing;
+    captureRecord(session, line);
+
+    CommandCounters counters = { 0 };
+    counters.timePhases = timing || atomic_load(&tracer.session) || slowLogOn();
+    CommandCounters *outerCounters = currentCounters;
+    currentCounters = &counters;
+    size_t outputBefore = currentOutput->length;
+    PerfCounts perfBefore;
+    PerfCounts perfAfter;
+    if (timing) {
+        perfRead(&perfBefore);
     }
-
-    // copy all records into temporary array
-    for (size_t i = 0; i < studentTable.count; ++i) {
-        copy[i] = studentTable.records[i];
+    uint64_t cpuStart = timing ? processCpuNanoseconds() : 0;
+    uint64_t span = traceBegin();
+
+    // the text for the trace and the slow log, taken now: the command may change the line
+    char maskedLine[SLOWLOG_TEXT_LENGTH] = "";
+    if (span || slowLogOn()) {
+        char answered[64];
+        if (answersDelete) {
+            snprintf(answered, sizeof(answered), "DELETE ID=%d (answered)", session->pendingDeleteId);
+        }
+        maskCommandText(answersDelete ? answered : line, maskedLine, sizeof(maskedLine));
     }
+    uint64_t start = monotonicNanoseconds();
 
-    // sort the temporary copy if requested
-    if (field == SORT_BY_ID) {
-        qsort(copy, studentTable.count, sizeof(StudentRecord), compareByIdAscending);
-    } else if (field == SORT_BY_MARK) {
-        qsort(copy, studentTable.count, sizeof(StudentRecord), compareByMarkAscending);
-    }
+    int keepRunning = dispatchCommandLine(session, line);
+    traceEnd(span, "command", "%s", maskedLine);
 
-    // if descending, reverse the array in place
-    if (direction == SORT_DESCENDING) {
-        for (size_t i = 0; i < studentTable.count / 2; ++i) {
-            StudentRecord temp = copy[i];
-            copy[i] = copy[studentTable.count - 1 - i];
-            copy[studentTable.count - 1 - i] = temp;
-        }
+    // the output of the command counts as written: flush it to the terminal,
+    // or measure what it added to an in-memory reply
+    if (currentOutput->sink) {
+        outputFlush(currentOutput);
+    } else if (currentOutput->length > outputBefore) {
+        countBytesWritten(currentOutput->length - outputBefore);
     }
+    uint64_t elapsed = monotonicNanoseconds() - start;
+    uint64_t cpu = timing ? processCpuNanoseconds() - cpuStart : 0;
+    if (timing) {
+        perfRead(&perfAfter);
+    }
+    currentCounters = outerCounters;
 
-    // print heading and all rows
-    printf("CMS: Here are all the records found in the table \"StudentRecords\".\n");
-    printf("ID Name Programme Mark\n");
+    if (keepRunning && line[0] && (answersDelete || !session->hasPendingDelete)) {
+        commandStatsRecord(kind, elapsed, &counters);
 
-    for (size_t i = 0; i < studentTable.count; ++i) {
-        printf("%d %s %s %.1f\n",
-               copy[i].id,
-               copy[i].name,
-               copy[i].programme,
-               copy[i].mark);
-    }
+        unsigned long long slow = atomic_load_explicit(&slowLog.thresholdNanoseconds, memory_order_relaxed);
+        if (slow && elapsed >= slow && maskedLine[0]) {
+            slowLogRecord(maskedLine, elapsed, &counters);
+        }
 
-    free(copy);
+        // (TIMING ON itself is not timed, TIMING OFF is not either)
+        if (timing && session->timing) {
+            printCommandTiming(elapsed, cpu, &counters, &perfBefore, &perfAfter);
+            if (currentOutput->sink) {
+                outputFlush(currentOutput);
+            }
+        }
+    }
+    traceAfterCommand();
+    return keepRunning;
 }
 
 /*
-print summary statistics:
-- total number of students
-- average mark
-- highest mark (with student name)
-- lowest mark (with student name)
+main interactive command loop
+steps per iteration:
+    1. print prompt: "<OUR_GROUP_NAME>: " (not while a DELETE waits for Y/N)
+    2. read a full line from user
+    3. run it with executeCommandLine()
+    4. Loop until user types EXIT or QUIT
 */
-static void showSummaryStatistics(void)
+static void runCommandShell(void)
 {
-    if (studentTable.count == 0) {
-        printf("CMS: No records loaded.\n");
-        return;
-    }
-
-    size_t totalStudents = studentTable.count;
-    float totalMark = 0.0f;
+    char line[1024];
+    CommandSession session = { 0 };
 
-    float lowestMark = studentTable.records[0].mark;
-    float highestMark = studentTable.records[0].mark;
-    size_t indexLowest = 0;
-    size_t indexHighest = 0;
+    // the terminal session prints straight to stdout
+    OutputBuffer terminalOutput = { NULL, 0, 0, stdout };
+    currentOutput = &terminalOutput;
 
-    for (size_t i = 0; i < totalStudents; ++i) {
-        float mark = studentTable.records[i].mark;
-        totalMark += mark;
+    while (1) {
+        // display prompt (which will be our group number)
+        if (!session.hasPendingDelete) {
+            outputPrintf(OUR_GROUP_NAME ": ");
+        }
+        outputFlush(&terminalOutput);
 
-        if (mark < lowestMark) {
-            lowestMark = mark;
-            indexLowest = i;
+        // read one line from stdin; break on EOF (Ctrl+D / Ctrl+Z)
+        if (!fgets(line, sizeof(line), stdin)) {
+            if (session.hasPendingDelete) {
+                // EOF while asking Y/N: treat as no answer
+                session.hasPendingDelete = 0;
+                outputPrintf("\n");
+                continue;
+            }
+            break;
         }
-        if (mark > highestMark) {
-            highestMark = mark;
-            indexHighest = i;
+
+        if (!executeCommandLine(&session, line)) {
+            break;
         }
     }
 
-    printf("CMS: SUMMARY\n");
-    printf("Total students: %zu\n", totalStudents);
-    printf("Average mark: %.2f\n", totalMark / (float)totalStudents);
-    printf("Highest: %.1f (%s)\n", highestMark, studentTable.records[indexHighest].name);
-    printf("Lowest : %.1f (%s)\n", lowestMark, studentTable.records[indexLowest].name);
+    outputFlush(&terminalOutput);
+    outputFree(&terminalOutput);
+    currentOutput = NULL;
 }
 
-// CSV / SQL IMPORT / EXPORT
+// ======================= SERVER MODE (--serve) ===========================
 /*
-parse a line of CSV into 4 fields:
-f0: ID
-f1: Name
-f2: Programme
-f3: Mark
-supports:
-- quoted fields ("...") that may contain commas
-- escaped quotes inside fields ("" -> ")
+lets several registrar staff work on one shared in-memory database at once
+
+usage:
+    ./project --serve                       (unix socket /tmp/cms-P10-4.sock)
+    ./project --serve unix:/path/cms.sock
+    ./project --serve tcp:5555              (listens on 127.0.0.1 only)
+
+protocol (client.c speaks it):
+    - a client sends command lines, exactly what it would type at the prompt
+    - right after connecting the server sends one greeting frame, and the
+      first lines must be the database password (3 attempts, like the shell)
+    - every line gets exactly one reply frame:  "<length>\n" + <length> bytes
+    - clients may send many lines without waiting (pipelining), the replies
+      that are ready get batched into a single write
+
+one epoll loop handles every connection and runs every command that changes
+the table, one at a time. read-only commands (SHOW ALL, FIND, EXPORT, SAVE,
+BACKUP, SHOW SUMMARY) get a snapshot pinned on the loop thread and then run on
+their own worker thread, so a long export never holds up other clients'
+INSERT/UPDATE/DELETE and still writes one consistent version of the table.
+a client's own lines are still answered in the order it sent them.
 */
-static int csvSplitLineInto4Fields(const char *line,
-                                   char *f0, size_t n0,
-                                   char *f1, size_t n1,
-                                   char *f2, size_t n2,
-                                   char *f3, size_t n3)
+#if CMS_HAVE_SERVER
+
+#define SERVER_DEFAULT_ADDRESS "unix:/tmp/cms-" OUR_GROUP_NAME ".sock"
+#define SERVER_MAX_EVENTS 64
+#define SERVER_MAX_LINE 1024            // same as the shell's line buffer
+#define SERVER_READ_CHUNK (64 * 1024)
+
+// one client connection
+typedef struct ServerConnection {
+    int fd;
+
+    char  *input;                       // bytes received but not yet run
+    size_t inputLength;
+    size_t inputCapacity;
+
+    OutputBuffer output;                // reply frames waiting to be sent
+    size_t outputSent;                  // how much of output is already sent
+
+    int authenticated;
+    int passwordAttempts;
+    int closeAfterFlush;                // EXIT / QUIT or too many bad passwords
+    int peerClosed;                     // client finished sending
+    int jobRunning;                     // a read-only command is running on a worker
+    unsigned watchedEvents;             // what epoll is watching right now
+
+    CommandSession session;
+
+    struct ServerConnection *prev;      // list of open connections (for cleanup)
+    struct ServerConnection *next;
+} ServerConnection;
+
+static ServerConnection *serverConnections = NULL;
+static size_t serverConnectionCount = 0;
+
+// closed connections are freed after the current batch of epoll events
+// (a later event in the same batch may still point at them)
+static ServerConnection *serverClosedConnections = NULL;
+
+// one read-only command handed to a worker thread
+typedef struct ServerJob {
+    ServerConnection *conn;
+    char *line;
+    TableSnapshot *snapshot;            // pinned when the command was accepted
+    CommandSession session;             // copy of the client's settings (TIMING, SET OUTPUT)
+    OutputBuffer reply;
+    struct ServerJob *next;
+} ServerJob;
+
+// finished jobs wait here until the event loop picks them up;
+// workers write one byte into the wake pipe so epoll notices
+static pthread_mutex_t serverFinishedJobsLock = PTHREAD_MUTEX_INITIALIZER;
+static ServerJob *serverFinishedJobs = NULL;
+static int serverWakePipe[2] = { -1, -1 };
+static int serverWakeMarker;            // epoll data.ptr of the wake pipe
+static size_t serverRunningJobs = 0;    // only touched by the loop thread
+
+// set by Ctrl+C / kill, checked by the event loop
+static volatile sig_atomic_t serverStopRequested = 0;
+
+static void serverHandleStopSignal(int signalNumber)
 {
-    const char *p = line;
+    (void)signalNumber;
+    serverStopRequested = 1;
+}
 
-    char *outputs[4] = { f0, f1, f2, f3 };
-    size_t caps[4]   = { n0, n1, n2, n3 };
+static int setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
 
-    for (int col = 0; col < 4; ++col) {
-        // skip spaces before field
-        while (*p == ' ' || *p == '\t') {
-            p++;
+/*
+create the listening socket from an address string:
+    "unix:<path>", "tcp:<port>", or a bare path (treated as unix)
+returns the socket fd, or -1 on error
+*/
+static int serverOpenListener(const char *address, char *unixPathOut, size_t unixPathSize)
+{
+    int fd;
+    unixPathOut[0] = '\0';
+
+    if (strncmp(address, "tcp:", 4) == 0) {
+        int port;
+        if (!stringToInt(address + 4, &port) || port <= 0 || port > 65535) {
+            fprintf(stderr, "CMS: Invalid TCP port in \"%s\".\n", address);
+            return -1;
         }
 
-        // check if field is quoted
-        if (*p == '"') {
-            p++;  // skip opening quote
-            size_t k = 0;
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            fprintf(stderr, "CMS: socket failed: %s\n", strerror(errno));
+            return -1;
+        }
 
-            while (*p) {
-                if (*p == '"') {
-                    if (*(p + 1) == '"') {
-                        // double quote inside field -> single quote in value
-                        if (k + 1 < caps[col]) {
-                            outputs[col][k++] = '"';
-                        }
-                        p += 2;
-                    } else {
-                        // end of quoted field
-                        p++;
-                        // skip spaces after quote
-                        while (*p == ' ' || *p == '\t') {
-                            p++;
-                        }
-                        if (col < 3) {
-                            if (*p != ',') return 0;
-                            p++;    // skip comma
-                        }
-                        break;
-                    }
-                } else {
-                    if (k + 1 < caps[col]) {
-                        outputs[col][k++] = *p;
-                    }
-                    p++;
-                }
-            }
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
-            outputs[col][k] = '\0';
-        } else {
-            // unquoted field: read until comma or end-of-line
-            size_t k = 0;
-            while (*p && *p != ',' && *p != '\r' && *p != '\n') {
-                if (k + 1 < caps[col]) {
-                    outputs[col][k++] = *p;
-                }
-                p++;
-            }
-            outputs[col][k] = '\0';
+        // localhost only: the database has a single shared password
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((unsigned short)port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
 
-            if (col < 3) {
-                if (*p != ',') return 0;
-                p++;    // skip comma
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            fprintf(stderr, "CMS: bind to %s failed: %s\n", address, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    } else {
+        const char *path = strncmp(address, "unix:", 5) == 0 ? address + 5 : address;
+
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (!path[0] || strlen(path) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "CMS: Invalid socket path in \"%s\".\n", address);
+            return -1;
+        }
+        strcpy(addr.sun_path, path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            fprintf(stderr, "CMS: socket failed: %s\n", strerror(errno));
+            return -1;
+        }
+
+        // a socket file left over from a crashed server is removed,
+        // but never take over one that another server is still using
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            fprintf(stderr, "CMS: Another server is already running on \"%s\".\n", path);
+            close(fd);
+            return -1;
+        }
+        close(fd);
+        unlink(path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            fprintf(stderr, "CMS: bind to %s failed: %s\n", path, strerror(errno));
+            if (fd >= 0) {
+                close(fd);
             }
+            return -1;
         }
+
+        strncpy(unixPathOut, path, unixPathSize - 1);
+        unixPathOut[unixPathSize - 1] = '\0';
     }
 
-    // ignore trailing whitespace/newlines
-    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
-        p++;
+    if (listen(fd, SOMAXCONN) != 0 || !setNonBlocking(fd)) {
+        fprintf(stderr, "CMS: listen failed: %s\n", strerror(errno));
+        close(fd);
+        return -1;
     }
 
-    // if extra text after 4 fields, treat as error
-    if (*p != '\0') {
-        return 0;
+    return fd;
+}
+
+// add one reply frame ("<length>\n" + text) to the connection's send queue
+static void serverQueueFrame(ServerConnection *conn, const OutputBuffer *reply)
+{
+    char header[32];
+    int headerLength = snprintf(header, sizeof(header), "%zu\n", reply->length);
+
+    outputAppend(&conn->output, header, (size_t)headerLength);
+    if (reply->length) {
+        outputAppend(&conn->output, reply->data, reply->length);
     }
+}
 
-    return 1;
+// is this one of the read-only commands that can run on a snapshot?
+static int isSnapshotCommand(const char *line)
+{
+    static const char *const prefixes[] = {
+        "SHOW ALL", "SHOW SUMMARY", "SHOW TOP", "SHOW PARTITIONS", "FIND NAME", "FIND PROGRAMME",
+        "EXPORT CSV", "EXPORT SQL", "EXPORT JSONL", "SAVE", "BACKUP"
+    };
+
+    while (*line && isspace((unsigned char)*line)) {
+        line++;
+    }
+    if (isShowColumnsCommand(line)) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); ++i) {
+        size_t length = strlen(prefixes[i]);
+        size_t k = 0;
+        while (k < length && line[k] &&
+               toupper((unsigned char)line[k]) == prefixes[i][k]) {
+            k++;
+        }
+        if (k == length) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// worker thread: run one read-only command against its pinned snapshot
+static void *serverJobThread(void *arg)
+{
+    ServerJob *job = (ServerJob *)arg;
+
+    currentOutput = &job->reply;
+    pinnedSnapshot = job->snapshot;
+    executeCommandLine(&job->session, job->line);
+    pinnedSnapshot = NULL;
+    currentOutput = NULL;
+
+    tableSnapshotRelease(job->snapshot);
+    job->snapshot = NULL;
+
+    pthread_mutex_lock(&serverFinishedJobsLock);
+    job->next = serverFinishedJobs;
+    serverFinishedJobs = job;
+    pthread_mutex_unlock(&serverFinishedJobsLock);
+
+    char wake = 1;
+    while (write(serverWakePipe[1], &wake, 1) < 0 && errno == EINTR) {
+    }
+    return NULL;
 }
 
 /*
-export current studentTable to a CSV file in the program folder
-format of exporting:
-    header:
-        ID,Name,Programme,Mark
-    rows:
-        id,"name","programme",mark
+start a worker thread for a read-only command
+returns 0 if no thread could be started (the caller then runs it inline)
 */
-static int exportToCsvFile(const char *csvFileName)
+static int serverStartJob(ServerConnection *conn, const char *line)
 {
-    if (!csvFileName || !csvFileName[0]) {
+    ServerJob *job = (ServerJob *)memoryCalloc(MEMORY_SERVER, 1, sizeof(ServerJob));
+    if (!job || !(job->line = memoryStrdup(MEMORY_SERVER, line))) {
+        memoryFree(job);
         return 0;
     }
-
-    char actualPath[1024];
-    FILE *fp = openFileForWriteInProgramFolder(csvFileName, actualPath, sizeof(actualPath));
-    if (!fp) {
+    job->conn = conn;
+    job->session = conn->session;
+    job->snapshot = tableSnapshotAcquire();
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, serverJobThread, job) != 0) {
+        tableSnapshotRelease(job->snapshot);
+        memoryFree(job->line);
+        memoryFree(job);
         return 0;
     }
+    pthread_detach(thread);
 
-    // header
-    fprintf(fp, "ID,Name,Programme,Mark\n");
-
-    for (size_t i = 0; i < studentTable.count; ++i) {
-        const StudentRecord *student = &studentTable.records[i];
+    conn->jobRunning = 1;
+    serverRunningJobs++;
+    return 1;
+}
 
-        fprintf(fp, "%d,\"", student->id);
+/*
+run one line from a client and queue its reply frame
+before login, the line is checked as the database password instead
+read-only commands go to a worker thread; their frame is queued when they finish
+*/
+static void serverHandleLine(ServerConnection *conn, char *line, OutputBuffer *reply)
+{
+    if (conn->authenticated && !conn->session.hasPendingDelete &&
+        strlen(line) < SERVER_MAX_LINE && isSnapshotCommand(line) &&
+        serverStartJob(conn, line)) {
+        return;
+    }
 
-        // write name, escaping quotes
-        for (const char *c = student->name; *c; ++c) {
-            if (*c == '"') fputc('"', fp);
-            fputc(*c, fp);
-        }
+    reply->length = 0;
+    currentOutput = reply;
 
-        fprintf(fp, "\",\"");
+    if (strlen(line) >= SERVER_MAX_LINE) {
+        outputPrintf("CMS: Command too long.\n");
+    } else if (!conn->authenticated) {
+        trimSpaces(line);
 
-        // write programme, escaping quotes
-        for (const char *c = student->programme; *c; ++c) {
-            if (*c == '"') fputc('"', fp);
-            fputc(*c, fp);
+        if (strcmp(line, DATABASE_PASSWORD) == 0) {
+            conn->authenticated = 1;
+            outputPrintf("CMS: Password accepted. Welcome to the Class Management System.\n");
+        } else if (++conn->passwordAttempts >= MAX_PASSWORD_ATTEMPTS) {
+            outputPrintf("CMS: Too many invalid password attempts. Closing connection.\n");
+            conn->closeAfterFlush = 1;
+        } else {
+            outputPrintf("CMS: Incorrect password.\n");
+            outputPrintf("Please enter database password to continue (attempt %d of %d): ",
+                         conn->passwordAttempts + 1, MAX_PASSWORD_ATTEMPTS);
         }
-
-        fprintf(fp, "\",%.1f\n", student->mark);
+    } else if (!executeCommandLine(&conn->session, line)) {
+        conn->closeAfterFlush = 1;      // EXIT / QUIT ends this client only
     }
 
-    fclose(fp);
-    return 1;
+    serverQueueFrame(conn, reply);
+    currentOutput = NULL;
 }
 
 /*
-export studentTable as SQL statements:
-- DROP TABLE IF EXISTS StudentRecords;
-- CREATE TABLE ...
-- INSERT INTO StudentRecords(...) VALUES(...);
-
-file is saved next to the .exe (programDirectoryPath)
+run every complete line received so far (pipelined requests, in order)
+stops early while a worker thread is busy with this client's previous line,
+the rest of the lines run once that job is finished
 */
-static int exportToSqlFile(const char *sqlFileName)
+static void serverRunLines(ServerConnection *conn, OutputBuffer *reply)
 {
-    if (!sqlFileName || !sqlFileName[0]) {
-        return 0;
-    }
+    // after EXIT or a failed login the rest of the input is ignored
+    size_t start = 0;
+    for (size_t i = 0; i < conn->inputLength && !conn->closeAfterFlush && !conn->jobRunning; ++i) {
+        if (conn->input[i] != '\n') {
+            continue;
+        }
 
-    char actualPath[1024];
-    FILE *fp = openFileForWriteInProgramFolder(sqlFileName, actualPath, sizeof(actualPath));
-    if (!fp) {
-        return 0;
+        conn->input[i] = '\0';
+        serverHandleLine(conn, conn->input + start, reply);
+        start = i + 1;
     }
 
-    fprintf(fp, "-- SQL dump generated by CMS\n");
-    fprintf(fp, "DROP TABLE IF EXISTS StudentRecords;\n");
-    fprintf(fp, "CREATE TABLE StudentRecords (\n"
-                "  id INTEGER PRIMARY KEY,\n"
-                "  name TEXT NOT NULL,\n"
-                "  programme TEXT NOT NULL,\n"
-                "  mark REAL NOT NULL\n"
-                ");\n");
+    if (conn->closeAfterFlush) {
+        start = conn->inputLength;
+    }
 
-    for (size_t i = 0; i < studentTable.count; ++i) {
-        const StudentRecord *student = &studentTable.records[i];
+    // last line without a newline, sent right before the client hung up
+    if (conn->peerClosed && !conn->jobRunning && start < conn->inputLength &&
+        !memchr(conn->input + start, '\n', conn->inputLength - start)) {
+        conn->input[conn->inputLength] = '\0';
+        serverHandleLine(conn, conn->input + start, reply);
+        start = conn->inputLength;
+    }
 
-        // escape single quotes for SQL
-        char escapedName[2 * NAME_MAX_LENGTH] = { 0 };
-        char escapedProgramme[2 * PROGRAMME_MAX_LENGTH] = { 0 };
+    memmove(conn->input, conn->input + start, conn->inputLength - start);
+    conn->inputLength -= start;
+}
 
-        size_t k = 0;
-        for (size_t j = 0; j < strlen(student->name) && k + 2 < sizeof(escapedName); ++j) {
-            if (student->name[j] == '\'') {
-                escapedName[k++] = '\'';
-                escapedName[k++] = '\'';
-            } else {
-                escapedName[k++] = student->name[j];
+/*
+read everything the client has sent so far and run every complete line
+returns 0 if the connection is broken and should be closed right away
+*/
+static int serverReadInput(ServerConnection *conn, OutputBuffer *reply)
+{
+    while (!conn->peerClosed) {
+        if (conn->inputCapacity - conn->inputLength < SERVER_READ_CHUNK) {
+            size_t newCapacity = conn->inputLength + SERVER_READ_CHUNK;
+            char *newMemory = (char *)memoryRealloc(MEMORY_SERVER, conn->input, newCapacity + 1);
+            if (!newMemory) {
+                return 0;
             }
+            conn->input = newMemory;
+            conn->inputCapacity = newCapacity;
         }
 
-        k = 0;
-        for (size_t j = 0; j < strlen(student->programme) && k + 2 < sizeof(escapedProgramme); ++j) {
-            if (student->programme[j] == '\'') {
-                escapedProgramme[k++] = '\'';
-                escapedProgramme[k++] = '\'';
-            } else {
-                escapedProgramme[k++] = student->programme[j];
-            }
+        ssize_t received = recv(conn->fd, conn->input + conn->inputLength,
+                                conn->inputCapacity - conn->inputLength, 0);
+        if (received > 0) {
+            conn->inputLength += (size_t)received;
+            continue;
+        }
+        if (received == 0) {
+            // client finished sending; still answer what it already sent
+            conn->peerClosed = 1;
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
         }
+        return 0;
+    }
+
+    serverRunLines(conn, reply);
 
-        fprintf(fp,
-                "INSERT INTO StudentRecords(id,name,programme,mark) "
-                "VALUES(%d,'%s','%s',%.1f);\n",
-                student->id,
-                escapedName,
-                escapedProgramme,
-                student->mark);
+    // a client that keeps sending without any newline is dropped
+    // (while a job runs, lines simply wait, so only count the unfinished tail)
+    const char *lastNewline = NULL;
+    for (size_t i = conn->inputLength; i > 0; --i) {
+        if (conn->input[i - 1] == '\n') {
+            lastNewline = conn->input + i - 1;
+            break;
+        }
+    }
+    size_t tail = lastNewline ? (size_t)(conn->input + conn->inputLength - lastNewline - 1)
+                              : conn->inputLength;
+    if (tail > 64 * SERVER_MAX_LINE) {
+        return 0;
     }
 
-    fclose(fp);
     return 1;
 }
 
 /*
-read students from a CSV file and add them into studentTable
-there is a check for the following:
-- first line may be a header "ID,Name,Programme,Mark" (case-insensitive)
-- lines may be quoted
-- if a student ID already exists, that record is skipped (no duplicate)
+send as much of the queued replies as the socket takes
+returns 0 if the connection is broken
 */
-static int importFromCsvFile(const char *csvFileName)
+static int serverFlushOutput(ServerConnection *conn)
 {
-    const char *usedPath = NULL;
-    FILE *fp = openFileForReadSearch(csvFileName, &usedPath);
-    if (!fp) {
-        return 0;
+    while (conn->outputSent < conn->output.length) {
+        ssize_t sent = send(conn->fd,
+                            conn->output.data + conn->outputSent,
+                            conn->output.length - conn->outputSent,
+                            MSG_NOSIGNAL);
+        if (sent > 0) {
+            conn->outputSent += (size_t)sent;
+        } else if (sent < 0 && errno == EINTR) {
+            continue;
+        } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 1;   // try again when epoll says the socket is writable
+        } else {
+            return 0;
+        }
     }
 
-    char line[2048];
+    conn->output.length = 0;
+    conn->outputSent = 0;
+    return 1;
+}
 
-    // read first line (might be header or first data row)
-    if (fgets(line, sizeof(line), fp) == NULL) {
-        fclose(fp);
-        return 0;
-    }
+static void serverCloseConnection(int epollFd, ServerConnection *conn)
+{
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
 
-    {
-        char temp[2048];
-        strncpy(temp, line, sizeof(temp) - 1);
-        temp[sizeof(temp) - 1] = '\0';
-        trimSpaces(temp);
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        serverConnections = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
+    serverConnectionCount--;
 
-        if (temp[0] != '\0') {
-            char f0[64], f1[NAME_MAX_LENGTH], f2[PROGRAMME_MAX_LENGTH], f3[64];
+    printf("CMS: Client disconnected (%zu connected).\n", serverConnectionCount);
+    fflush(stdout);
 
-            if (csvSplitLineInto4Fields(temp, f0, sizeof(f0),
-                                        f1, sizeof(f1),
-                                        f2, sizeof(f2),
-                                        f3, sizeof(f3))) {
-                // check if this line is the header "ID,Name,Programme,Mark"
-                if (equalsIgnoreCase(f0, "ID") &&
-                    equalsIgnoreCase(f1, "Name") &&
-                    equalsIgnoreCase(f2, "Programme") &&
-                    equalsIgnoreCase(f3, "Mark")) {
-                    // it is a header, so we ignore it and move on
-                } else {
-                    // not a header, so treat this as actual data
-                    int   id   = atoi(f0);
-                    float mark = (float)atof(f3);
+    conn->fd = -1;
+    conn->prev = NULL;
+    conn->next = serverClosedConnections;
+    serverClosedConnections = conn;
+}
 
-                    if (findIndexById(id) == -1) {
-                        addStudentRecord(id, f1, f2, mark);
-                    }
-                }
-            }
+// free closed connections, except those whose worker job is still running
+static void serverFreeClosedConnections(void)
+{
+    ServerConnection **link = &serverClosedConnections;
+    while (*link) {
+        ServerConnection *conn = *link;
+        if (conn->jobRunning) {
+            link = &conn->next;
+            continue;
         }
+        *link = conn->next;
+        memoryFree(conn->input);
+        outputFree(&conn->output);
+        memoryFree(conn);
     }
+}
 
-    // read remaining lines
-    while (fgets(line, sizeof(line), fp) != NULL) {
-        char trimmed[2048];
-        strncpy(trimmed, line, sizeof(trimmed) - 1);
-        trimmed[sizeof(trimmed) - 1] = '\0';
-        trimSpaces(trimmed);
-
-        if (trimmed[0] == '\0') {
-            continue;   // skip empty line
+// accept every waiting client and send each one the greeting frame
+static void serverAcceptConnections(int epollFd, int listenFd)
+{
+    while (1) {
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                fprintf(stderr, "CMS: accept failed: %s\n", strerror(errno));
+            }
+            return;
         }
 
-        char f0[64], f1[NAME_MAX_LENGTH], f2[PROGRAMME_MAX_LENGTH], f3[64];
-        if (!csvSplitLineInto4Fields(trimmed, f0, sizeof(f0),
-                                     f1, sizeof(f1),
-                                     f2, sizeof(f2),
-                                     f3, sizeof(f3))) {
-            continue;   // skip malformed line
+        ServerConnection *conn = (ServerConnection *)memoryCalloc(MEMORY_SERVER, 1, sizeof(ServerConnection));
+        if (!conn || !setNonBlocking(fd)) {
+            memoryFree(conn);
+            close(fd);
+            continue;
         }
-
-        // extra safety precaution: skip repeated header mid-file
-        if (equalsIgnoreCase(f0, "ID") &&
-            equalsIgnoreCase(f1, "Name") &&
-            equalsIgnoreCase(f2, "Programme") &&
-            equalsIgnoreCase(f3, "Mark")) {
+        conn->fd = fd;
+        conn->watchedEvents = EPOLLIN;
+        conn->session.captureClient = atomic_fetch_add(&captureNextClient, 1);
+
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = conn->watchedEvents;
+        event.data.ptr = conn;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            memoryFree(conn);
+            close(fd);
             continue;
         }
 
-        int   id   = atoi(f0);
-        float mark = (float)atof(f3);
-
-        if (findIndexById(id) == -1) {
-            addStudentRecord(id, f1, f2, mark);
+        conn->next = serverConnections;
+        if (serverConnections) {
+            serverConnections->prev = conn;
         }
+        serverConnections = conn;
+        serverConnectionCount++;
+
+        OutputBuffer greeting = { NULL, 0, 0, NULL };
+        currentOutput = &greeting;
+        outputPrintf("CMS: Connected to the Class Management System (%s).\n", OUR_GROUP_NAME);
+        outputPrintf("Please enter database password to continue (attempt 1 of %d): ",
+                     MAX_PASSWORD_ATTEMPTS);
+        currentOutput = NULL;
+        serverQueueFrame(conn, &greeting);
+        outputFree(&greeting);
+
+        printf("CMS: Client connected (%zu connected).\n", serverConnectionCount);
+        fflush(stdout);
     }
+}
 
-    fclose(fp);
-    return 1;
+// watch for writability only while replies are queued
+static void serverUpdateInterest(int epollFd, ServerConnection *conn)
+{
+    unsigned wanted = (conn->closeAfterFlush || conn->peerClosed) ? 0u : (unsigned)EPOLLIN;
+    if (conn->outputSent < conn->output.length) {
+        wanted |= EPOLLOUT;
+    }
+    if (wanted == conn->watchedEvents) {
+        return;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = wanted;
+    event.data.ptr = conn;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, conn->fd, &event);
+    conn->watchedEvents = wanted;
 }
 
-/*
+// after reading or finishing a job: send replies, then close or re-arm the connection
+static void serverAfterActivity(int epollFd, ServerConnection *conn, int alive)
+{
+    if (alive) {
+        alive = serverFlushOutput(conn);
+    }
 
-simple case-insensitive search by Name or Programme
-the parameters:
-    fieldName: "NAME" or "PROGRAMME"
-    needle   : search text (substring)
-example:
-    FIND NAME "brian"
-    FIND PROGRAMME "Digital Supply Chain"
+    int finished = conn->closeAfterFlush || conn->peerClosed;
+    if (!alive || (finished && !conn->jobRunning && conn->outputSent >= conn->output.length)) {
+        serverCloseConnection(epollFd, conn);
+    } else {
+        serverUpdateInterest(epollFd, conn);
+    }
+}
+
+/*
+hand the replies of finished worker jobs back to their connections,
+then continue with the lines those clients sent in the meantime
 */
-static void findStudentsByField(const char *fieldName, const char *needle)
+static void serverCollectFinishedJobs(int epollFd, OutputBuffer *reply)
 {
-    if (!needle || !needle[0]) {
-        printf("CMS: Please provide a search string.\n");
-        return;
+    char drain[256];
+    while (read(serverWakePipe[0], drain, sizeof(drain)) > 0) {
     }
 
-    printf("CMS: Search results for %s contains \"%s\":\n", fieldName, needle);
-    printf("ID Name Programme Mark\n");
+    pthread_mutex_lock(&serverFinishedJobsLock);
+    ServerJob *job = serverFinishedJobs;
+    serverFinishedJobs = NULL;
+    pthread_mutex_unlock(&serverFinishedJobsLock);
 
-    int hitCount = 0;
+    while (job) {
+        ServerJob *next = job->next;
+        ServerConnection *conn = job->conn;
+
+        conn->jobRunning = 0;
+        serverRunningJobs--;
 
-    for (size_t i = 0; i < studentTable.count; ++i) {
-        if (equalsIgnoreCase(fieldName, "NAME") &&
-            containsIgnoreCase(studentTable.records[i].name, needle)) {
-            printf("%d %s %s %.1f\n",
-                   studentTable.records[i].id,
-                   studentTable.records[i].name,
-                   studentTable.records[i].programme,
-                   studentTable.records[i].mark);
-            hitCount++;
-        } else if (equalsIgnoreCase(fieldName, "PROGRAMME") &&
-                   containsIgnoreCase(studentTable.records[i].programme, needle)) {
-            printf("%d %s %s %.1f\n",
-                   studentTable.records[i].id,
-                   studentTable.records[i].name,
-                   studentTable.records[i].programme,
-                   studentTable.records[i].mark);
-            hitCount++;
+        // (a client that went away meanwhile is freed with the closed connections)
+        if (conn->fd >= 0) {
+            serverQueueFrame(conn, &job->reply);
+            serverRunLines(conn, reply);
+            serverAfterActivity(epollFd, conn, 1);
         }
-    }
 
-    if (!hitCount) {
-        printf("(no matches)\n");
+        outputFree(&job->reply);
+        memoryFree(job->line);
+        memoryFree(job);
+        job = next;
     }
 }
 
 /*
-function to create a timestamped backup of the current database file
-eg:
-    if lastDatabaseFileName is "P10-4-CMS.txt", backup file might be "P10-4-CMS.bak-20251125-153012.txt".
-the implementation:
-- use getFileNameStem to get base name without extension
-- append ".bak-YYYYMMDD-HHMMSS.txt"
-- reuse saveDatabaseToFile() to create the backup content
+main loop of --serve mode
+returns the process exit status
 */
-static int makeTimestampedBackup(void)
+static int runServer(const char *address)
 {
-    if (!lastDatabaseFileName[0]) {
-        return 0;   // we need to know which file is the "current" DB
+    char unixPath[256];
+    int listenFd = serverOpenListener(address, unixPath, sizeof(unixPath));
+    if (listenFd < 0) {
+        return 1;
     }
 
-    char stem[256];
-    getFileNameStem(lastDatabaseFileName, stem, sizeof(stem));
+    int epollFd = epoll_create1(0);
+    if (epollFd < 0) {
+        fprintf(stderr, "CMS: epoll_create1 failed: %s\n", strerror(errno));
+        close(listenFd);
+        return 1;
+    }
 
-    time_t now = time(NULL);
-    struct tm *tmPtr = localtime(&now);
+    struct epoll_event listenEvent;
+    memset(&listenEvent, 0, sizeof(listenEvent));
+    listenEvent.events = EPOLLIN;
+    listenEvent.data.ptr = NULL;    // NULL marks the listening socket
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &listenEvent);
+
+    // worker threads wake the loop through this pipe when a job is done
+    if (pipe(serverWakePipe) != 0 ||
+        !setNonBlocking(serverWakePipe[0]) || !setNonBlocking(serverWakePipe[1])) {
+        fprintf(stderr, "CMS: pipe failed: %s\n", strerror(errno));
+        close(epollFd);
+        close(listenFd);
+        return 1;
+    }
 
-    char timestamp[64];
-    strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", tmPtr);
+    struct epoll_event wakeEvent;
+    memset(&wakeEvent, 0, sizeof(wakeEvent));
+    wakeEvent.events = EPOLLIN;
+    wakeEvent.data.ptr = &serverWakeMarker;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, serverWakePipe[0], &wakeEvent);
 
-    char backupFileName[512];
-    snprintf(backupFileName, sizeof(backupFileName),
-             "%s.bak-%s.txt", stem, timestamp);
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, serverHandleStopSignal);
+    signal(SIGTERM, serverHandleStopSignal);
 
-    return saveDatabaseToFile(backupFileName);
-}
+    printf("CMS: Serving the Class Management System on %s (Ctrl+C to stop).\n", address);
+    fflush(stdout);
 
+    OutputBuffer reply = { NULL, 0, 0, NULL };
+    struct epoll_event events[SERVER_MAX_EVENTS];
 
-// print our declaration at the start of the program
-static void printDeclaration(void)
-{
-    //time_t now = time(NULL);
-    //struct tm *tmPtr = localtime(&now);
-    const char *dateString = "24/11/2025"; //change to hard code for submission date
+    while (!serverStopRequested) {
+        int ready = epoll_wait(epollFd, events, SERVER_MAX_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "CMS: epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
 
-    //char dateString[32];
-    //strftime(dateString, sizeof(dateString), "%Y-%m-%d", tmPtr);
-    printf("Date of submission: %s\n\n", dateString);
+        for (int i = 0; i < ready; ++i) {
+            ServerConnection *conn = (ServerConnection *)events[i].data.ptr;
 
-    printf("\nDeclaration\n");
-    printf("SIT's policy on copying does not allow the students to copy source code as well as assessment solutions\n");
-    printf("from another person AI or other places. It is the students' responsibility to guarantee that their\n");
-    printf("assessment solutions are their own work. Meanwhile, the students must also ensure that their work is\n");
-    printf("not accessible by others. Where such plagiarism is detected, both of the assessments involved will\n");
-    printf("receive ZERO mark.\n\n");
+            if (!conn) {
+                serverAcceptConnections(epollFd, listenFd);
+                continue;
+            }
+            if (events[i].data.ptr == &serverWakeMarker) {
+                serverCollectFinishedJobs(epollFd, &reply);
+                continue;
+            }
+            if (conn->fd < 0) {
+                continue;   // closed earlier in this batch
+            }
 
-    printf("We hereby declare that:\n");
-    printf("- We fully understand and agree to the abovementioned plagiarism policy.\n");
-    printf("- We did not copy any code from others or from other places.\n");
-    printf("- We did not share our codes with others or upload to any other places for public access and will not do that in the future.\n");
-    printf("- We agree that our project will receive Zero mark if there is any plagiarism detected.\n");
-    printf("- We agree that we will not disclose any information or material of the group project to others or upload to any other places for public access.\n");
-    printf("- We agree that we did not copy any code directly from AI generated sources.\n\n");
+            int alive = 1;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                alive = serverReadInput(conn, &reply);
+            }
+            serverAfterActivity(epollFd, conn, alive);
+        }
 
-    printf("Declared by: %s\n", OUR_GROUP_NAME);
-    printf("Team members:\n");
-    printf("1. BRIAN GOH JUN WEI\n");
-    printf("2. HAN YONG\n");
-    printf("3. JERREL\n");
-    printf("4. KENDRICK\n");
-    printf("5. XIAN YANG\n");
-    printf("Date: %s\n\n", dateString);
+        serverFreeClosedConnections();
+    }
+
+    // let running exports/backups finish before the snapshots go away
+    while (serverRunningJobs > 0) {
+        struct pollfd wakeFd = { serverWakePipe[0], POLLIN, 0 };
+        poll(&wakeFd, 1, -1);
+        serverCollectFinishedJobs(epollFd, &reply);
+    }
+
+    while (serverConnections) {
+        serverCloseConnection(epollFd, serverConnections);
+    }
+    serverFreeClosedConnections();
+
+    outputFree(&reply);
+    close(serverWakePipe[0]);
+    close(serverWakePipe[1]);
+    close(epollFd);
+    close(listenFd);
+    if (unixPath[0]) {
+        unlink(unixPath);
+    }
+
+    printf("CMS: Server stopped.\n");
+    return 0;
 }
 
-/*
-prompts the user to enter the database password before using our CMS
-if correct password is entered within MAX_PASSWORD_ATTEMPTS,
-return 1 (success).
-if all attempts fail, return 0 and the program will exit
+#else
 
-additional unique feature (just a simple standard authentication for databases i guess?)
-*/
-static int checkDatabasePassword(void)
+#define SERVER_DEFAULT_ADDRESS ""
+
+static int runServer(const char *address)
 {
-    char inputBuffer[256];
+    (void)address;
+    fprintf(stderr, "CMS: --serve is only available on Linux (it uses epoll).\n");
+    return 1;
+}
 
-    for (int attempt = 1; attempt <= MAX_PASSWORD_ATTEMPTS; ++attempt) {
-        printf("Please enter database password to continue (attempt %d of %d): ",
-               attempt, MAX_PASSWORD_ATTEMPTS);
+#endif
 
-        if (!fgets(inputBuffer, sizeof(inputBuffer), stdin)) {
-            printf("\nCMS: Input error.\n");
-            return 0;
+// ======================= BENCHMARK MODE (--bench) ===========================
+/*
+    ./project --bench [max rows]        (default 1000000, at most 10000000)
+
+for 1000, 10000, ... up to max rows: GENERATE a roster (fixed seed), then
+time the commands on it, each through executeCommandLine like a typed line:
+    - bulk commands (GENERATE, SAVE, OPEN, FIND, SORT, EXPORT, IMPORT) run once
+      (FIND a few times), their speed is rows per second
+    - INSERT, QUERY, UPDATE, DELETE run BENCH_POINT_OPS times on random rows,
+      reported as operations per second and p50 / p99 latency
+the output of the commands is thrown away. the table has a fixed layout, so
+two builds can be compared line by line (e.g. with diff or a spreadsheet).
+the temporary files go to the program folder and are removed afterwards.
+*/
+#define BENCH_DEFAULT_MAX_ROWS 1000000
+#define BENCH_LIMIT_ROWS 10000000
+#define BENCH_POINT_OPS 1000
+#define BENCH_SEED 20250101ull
+#define BENCH_DATABASE_FILE "cms-bench.txt"
+#define BENCH_CSV_FILE "cms-bench.csv"
+
+// latencies of one benchmarked command
+typedef struct {
+    uint64_t *nanoseconds;
+    size_t count;
+    size_t capacity;
+} BenchSamples;
+
+typedef struct {
+    CommandSession session;
+    OutputBuffer output;        // in memory, emptied after every command
+    BenchSamples samples;
+    int counting;               // hardware counters are available
+    PerfCounts perfStart;       // counters when the current set of samples began
+} BenchRun;
+
+// run one command line and remember how long it took
+static void benchCommand(BenchRun *run, const char *format, ...)
+{
+    char line[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if (run->samples.count == run->samples.capacity) {
+        run->samples.capacity = run->samples.capacity ? run->samples.capacity * 2 : 1024;
+        uint64_t *newMemory = (uint64_t *)memoryRealloc(MEMORY_OTHER, run->samples.nanoseconds,
+                                                  run->samples.capacity * sizeof(uint64_t));
+        if (!newMemory) {
+            fprintf(stderr, "CMS: Out of memory in the benchmark.\n");
+            exit(1);
         }
+        run->samples.nanoseconds = newMemory;
+    }
 
-        trimSpaces(inputBuffer);
+    uint64_t start = monotonicNanoseconds();
+    executeCommandLine(&run->session, line);
+    run->samples.nanoseconds[run->samples.count++] = monotonicNanoseconds() - start;
+    run->output.length = 0;
+}
 
-        if (strcmp(inputBuffer, DATABASE_PASSWORD) == 0) {
-            printf("CMS: Password accepted. Welcome to the Class Management System.\n\n");
-            return 1;
-        } else {
-            printf("CMS: Incorrect password.\n");
+static int compareUint64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// print one line of the result table and start a new set of samples
+// (rows: how many rows the command went through in total)
+static void benchReport(BenchRun *run, size_t tableRows, const char *command, size_t rows)
+{
+    BenchSamples *samples = &run->samples;
+    uint64_t total = 0;
+    for (size_t k = 0; k < samples->count; ++k) {
+        total += samples->nanoseconds[k];
+    }
+    qsort(samples->nanoseconds, samples->count, sizeof(uint64_t), compareUint64);
+
+    double seconds = (double)total / 1e9;
+    uint64_t p50 = samples->nanoseconds[(samples->count - 1) / 2];
+    uint64_t p99 = samples->nanoseconds[(samples->count - 1) * 99 / 100];
+
+    printf("%9zu  %-9s %6zu %11.2f %12.1f %12.0f %10.1f %10.1f",
+           tableRows, command, samples->count, seconds * 1e3,
+           seconds > 0 ? (double)samples->count / seconds : 0.0,
+           seconds > 0 ? (double)rows / seconds : 0.0,
+           (double)p50 / 1e3, (double)p99 / 1e3);
+
+    // IPC and misses per row over everything since the last report
+    if (run->counting) {
+        PerfCounts now;
+        perfRead(&now);
+        double spent[PERF_EVENT_COUNT];
+        for (int e = 0; e < PERF_EVENT_COUNT; ++e) {
+            spent[e] = (double)(now.values[e] - run->perfStart.values[e]);
         }
+        printf(" %6.2f %10.2f %10.2f",
+               now.have[PERF_CYCLES] && spent[PERF_CYCLES] > 0 && now.have[PERF_INSTRUCTIONS]
+                   ? spent[PERF_INSTRUCTIONS] / spent[PERF_CYCLES] : 0.0,
+               now.have[PERF_LLC_MISSES] && rows ? spent[PERF_LLC_MISSES] / (double)rows : 0.0,
+               now.have[PERF_BRANCH_MISSES] && rows ? spent[PERF_BRANCH_MISSES] / (double)rows : 0.0);
+    }
+    printf("\n");
+    fflush(stdout);
+    samples->count = 0;
+    if (run->counting) {
+        perfRead(&run->perfStart);
     }
+}
 
-    printf("CMS: Too many invalid password attempts. Exiting program.\n");
-    return 0;
+// one round of the benchmark on a table of "rows" generated students
+static void benchTableSize(BenchRun *run, size_t rows)
+{
+    size_t pointOps = BENCH_POINT_OPS;
+    uint64_t pick = 0;
+    GenerateLayout layout;
+    generateLayoutInit(&layout, rows, BENCH_SEED);
+
+    studentTableClear(&studentTable);
+    benchCommand(run, "GENERATE %zu %llu", rows, BENCH_SEED);
+    benchReport(run, rows, "GENERATE", rows);
+
+    benchCommand(run, "SAVE %s", BENCH_DATABASE_FILE);
+    benchReport(run, rows, "SAVE", rows);
+
+    benchCommand(run, "OPEN %s", BENCH_DATABASE_FILE);
+    benchReport(run, rows, "OPEN", rows);
+
+    // new students: the rows GENERATE would make next
+    for (size_t k = 0; k < pointOps; ++k) {
+        StudentRecord student;
+        generateStudent(&layout, rows + k, &student);
+        benchCommand(run, "INSERT ID=%d Name=\"%s\" Programme=\"%s\" Mark=%.1f",
+                     student.id, student.name, student.programme, markToDouble(student.mark));
+    }
+    benchReport(run, rows, "INSERT", pointOps);
+
+    for (size_t k = 0; k < pointOps; ++k) {
+        pick = generateRandom(BENCH_SEED, k, 100);
+        benchCommand(run, "QUERY ID=%d", generatedStudentId(&layout, (size_t)(pick % rows)));
+    }
+    benchReport(run, rows, "QUERY", pointOps);
+
+    for (size_t k = 0; k < pointOps; ++k) {
+        pick = generateRandom(BENCH_SEED, k, 101);
+        benchCommand(run, "UPDATE ID=%d Mark=%d.%d", generatedStudentId(&layout, (size_t)(pick % rows)),
+                     (int)(pick >> 32) % 100, (int)(pick >> 40) % 10);
+    }
+    benchReport(run, rows, "UPDATE", pointOps);
+
+    // delete the inserted students again (DELETE asks for Y/N, the answer is part of it)
+    for (size_t k = 0; k < pointOps; ++k) {
+        char answer[] = "Y";
+        benchCommand(run, "DELETE ID=%d", generatedStudentId(&layout, rows + k));
+        uint64_t start = monotonicNanoseconds();
+        executeCommandLine(&run->session, answer);
+        run->samples.nanoseconds[run->samples.count - 1] += monotonicNanoseconds() - start;
+        run->output.length = 0;
+    }
+    benchReport(run, rows, "DELETE", pointOps);
+
+    for (size_t k = 0; k < 5; ++k) {
+        benchCommand(run, "FIND NAME \"%s\"", generateGivenNames[k * 7 % GENERATE_COUNT(generateGivenNames)]);
+    }
+    benchReport(run, rows, "FIND", rows * 5);
+
+    // the sort engine on its own (SHOW ALL would mostly time the printing)
+    SortSpec spec;
+    spec.keyCount = 2;
+    spec.keys[0].column = SORT_COLUMN_MARK;
+    spec.keys[0].direction = SORT_DESCENDING;
+    spec.keys[1].column = SORT_COLUMN_NAME;
+    spec.keys[1].direction = SORT_ASCENDING;
+    for (size_t k = 0; k < 3; ++k) {
+        TableSnapshot *snapshot = tableSnapshotAcquire();
+        size_t count = 0;
+        uint64_t start = monotonicNanoseconds();
+        SortItem *items = sortSnapshotChunks(snapshot, &spec, 0, snapshot->chunkCount, &count);
+        run->samples.nanoseconds[run->samples.count++] = monotonicNanoseconds() - start;
+        memoryFree(items);
+        tableSnapshotRelease(snapshot);
+    }
+    benchReport(run, rows, "SORT", rows * 3);
+
+    benchCommand(run, "EXPORT CSV %s", BENCH_CSV_FILE);
+    benchReport(run, rows, "EXPORT", rows);
+
+    studentTableClear(&studentTable);
+    benchCommand(run, "IMPORT CSV %s", BENCH_CSV_FILE);
+    benchReport(run, rows, "IMPORT", rows);
+    generateLayoutFree(&layout);
 }
 
-// show all commands supported by this program, with examples (to allow user to just copy paste)
-static void printHelp(void)
+/*
+benchmark mode: prints a throughput / latency table, see above
+returns the process exit status
+*/
+static int runBenchmark(const char *maxRowsText)
 {
-    puts("Commands (examples included!):\n");
+    int maxRows = BENCH_DEFAULT_MAX_ROWS;
+    if (maxRowsText && (!stringToInt(maxRowsText, &maxRows) || maxRows < 1000 || maxRows > BENCH_LIMIT_ROWS)) {
+        fprintf(stderr, "CMS: Use --bench [max rows], from 1000 to %d.\n", BENCH_LIMIT_ROWS);
+        return 1;
+    }
 
-    puts("OPEN / SAVE");
-    puts("  OPEN <file>                 e.g.  OPEN db.txt");
-    puts("  SAVE                        (saves back to last OPEN file)");
-    puts("  SAVE <file>                 e.g.  SAVE db.txt\n");
+    BenchRun run;
+    memset(&run, 0, sizeof(run));
+    currentOutput = &run.output;
 
-    puts("VIEW");
-    puts("  SHOW ALL                    list all rows");
-    puts("  SHOW ALL SORT BY ID ASC     or DESC");
-    puts("  SHOW ALL SORT BY MARK ASC   or DESC");
-    puts("  SHOW SUMMARY                show count/average/highest/lowest\n");
+#ifdef __VERSION__
+    const char *compiler = __VERSION__;
+#else
+    const char *compiler = "unknown compiler";
+#endif
+    printf("CMS: Benchmark, %u worker threads, %s, seed %llu\n",
+           threadPoolWorkerCount(), compiler, BENCH_SEED);
+
+    perfEnable();
+    run.counting = perfAvailable();
+    if (!run.counting) {
+        char reason[128];
+        perfUnavailableReason(reason, sizeof(reason));
+        printf("CMS: No hardware counters (%s), timings only.\n", reason);
+    }
 
-    puts("ADD / LOOKUP / EDIT / REMOVE");
-    puts("  INSERT ID=<int> Name=\"...\" Programme=\"...\" Mark=<float>");
-    puts("    e.g. INSERT ID=2501066 Name=\"Brian Goh\" Programme=\"Digital Supply Chain\" Mark=88.8");
-    puts("  QUERY ID=<int>              e.g. QUERY ID=2501066");
-    puts("  UPDATE ID=<int> [Name=...] [Programme=...] [Mark=<float>]");
-    puts("    e.g. UPDATE ID=2501066 Programme=\"Game Development\" Mark=95.5");
-    puts("  DELETE ID=<int>             comes with Y/N confirmation\n");
+    printf("%9s  %-9s %6s %11s %12s %12s %10s %10s",
+           "Rows", "Command", "Runs", "Total ms", "Ops/s", "Rows/s", "p50 us", "p99 us");
+    if (run.counting) {
+        printf(" %6s %10s %10s", "IPC", "LLC/row", "BrMiss/row");
+        perfRead(&run.perfStart);
+    }
+    printf("\n");
+    fflush(stdout);
+
+    // the run samples also hold the SORT timings, which are not taken by benchCommand
+    run.samples.capacity = BENCH_POINT_OPS;
+    run.samples.nanoseconds = (uint64_t *)memoryAlloc(MEMORY_OTHER, run.samples.capacity * sizeof(uint64_t));
+    if (!run.samples.nanoseconds) {
+        fprintf(stderr, "CMS: Out of memory in the benchmark.\n");
+        return 1;
+    }
 
-    puts("SEARCH");
-    puts("  FIND NAME \"...\"         e.g. FIND NAME \"brian\"");
-    puts("  FIND PROGRAMME \"...\"    e.g. FIND PROGRAMME \"Digital Supply Chain\"\n");
+    for (int rows = 1000; rows <= maxRows; rows *= 10) {
+        benchTableSize(&run, (size_t)rows);
+    }
 
-    puts("IMPORT / EXPORT / BACKUP");
-    puts("  IMPORT CSV <file.csv>       Header in CSV must be: ID,Name,Programme,Mark");
-    puts("  EXPORT CSV <file.csv>       Open in Excel/Sheets to verify");
-    puts("  EXPORT SQL <file.sql>       SQLite/MySQL compatible INSERTs");
-    puts("  BACKUP                      writes <stem>.bak-YYYYMMDD-HHMMSS.txt\n");
+    char path[1024];
+    joinPath(path, sizeof(path), programDirectoryPath, BENCH_DATABASE_FILE);
+    remove(path);
+    joinPath(path, sizeof(path), programDirectoryPath, BENCH_CSV_FILE);
+    remove(path);
 
-    puts("OTHER");
-    puts("  HELP");
-    puts("  EXIT\n");
+    memoryFree(run.samples.nanoseconds);
+    outputFree(&run.output);
+    currentOutput = NULL;
+    return 0;
 }
 
+// ======================= REPLAY MODE (--replay) ===========================
 /*
-main interactive command loop
-steps per iteration:
-    1. print prompt: "<OUR_GROUP_NAME>: "
-    2. read a full line from user
-    3. convert a copy to uppercase for command matching
-    4. compare and execute the correct command
-    5. Loop until user types EXIT or QUIT
+    ./project --replay <capture file> [--db <database file>] [--paced]
+
+runs the command lines of a CAPTURE file again, each through
+executeCommandLine like a typed line, and prints their latency:
+    - --db opens that database first (e.g. a copy of the file the capture
+      started from), otherwise the replay starts from an empty table
+    - without --paced the lines run back to back, as fast as possible; with
+      --paced each one waits for its time in the capture (a slow build then
+      falls behind, the report says how far)
+    - every client of a --serve capture gets its own session again, so a
+      DELETE still gets its own Y/N answer; all lines run one after another
+the output of the commands is thrown away. the report is the overall
+latency distribution and then the STATS table of the replayed commands.
 */
-static void runCommandShell(void)
-{
-    char line[1024];
 
-    while (1) {
-        // display prompt (which will be our group number)
-        printf(OUR_GROUP_NAME ": ");
+// wait (at least) this long
+static void sleepNanoseconds(uint64_t nanoseconds)
+{
+#ifdef _WIN32
+    Sleep((DWORD)(nanoseconds / 1000000));
+#else
+    struct timespec wait;
+    wait.tv_sec = (time_t)(nanoseconds / 1000000000ull);
+    wait.tv_nsec = (long)(nanoseconds % 1000000000ull);
+    while (nanosleep(&wait, &wait) != 0 && errno == EINTR) {
+    }
+#endif
+}
 
-        // read one line from stdin; break on EOF (Ctrl+D / Ctrl+Z)
-        if (!fgets(line, sizeof(line), stdin)) {
+/*
+replay mode: see above
+returns the process exit status
+*/
+static int runReplay(int argc, char **argv)
+{
+    const char *captureName = NULL;
+    const char *databaseName = NULL;
+    int paced = 0;
+    for (int k = 0; k < argc; ++k) {
+        if (strcmp(argv[k], "--paced") == 0) {
+            paced = 1;
+        } else if (strcmp(argv[k], "--db") == 0 && k + 1 < argc) {
+            databaseName = argv[++k];
+        } else if (!captureName && argv[k][0] != '-') {
+            captureName = argv[k];
+        } else {
+            captureName = NULL;
             break;
         }
+    }
+    if (!captureName) {
+        fprintf(stderr, "CMS: Use --replay <capture file> [--db <database file>] [--paced].\n");
+        return 1;
+    }
 
-        // remove extra spaces and skip empty lines
-        trimSpaces(line);
-        if (!line[0]) {
-            continue;
-        }
+    FILE *file = fopen(captureName, "rb");
+    if (!file) {
+        fprintf(stderr, "CMS: Cannot open capture \"%s\": %s\n", captureName, strerror(errno));
+        return 1;
+    }
+    char magic[sizeof(CAPTURE_MAGIC) - 1];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "CMS: \"%s\" is not a CAPTURE file.\n", captureName);
+        fclose(file);
+        return 1;
+    }
 
-        // uppercase copy for easy comparison of commands
-        char upperLine[1024];
-        strncpy(upperLine, line, sizeof(upperLine) - 1);
-        upperLine[sizeof(upperLine) - 1] = '\0';
+    OutputBuffer output = { NULL, 0, 0, NULL };
+    currentOutput = &output;
+
+    // one session per captured client, 0 is the terminal
+    CommandSession *sessions = NULL;
+    size_t sessionCount = 0;
+    char *line = (char *)memoryAlloc(MEMORY_OTHER, CAPTURE_MAX_LINE + 1);
+    if (!line) {
+        fprintf(stderr, "CMS: Out of memory in the replay.\n");
+        fclose(file);
+        return 1;
+    }
 
-        for (size_t i = 0; i < strlen(upperLine); ++i) {
-            upperLine[i] = (char)toupper((unsigned char)upperLine[i]);
-        }
+    if (databaseName) {
+        CommandSession setup = { 0 };
+        snprintf(line, CAPTURE_MAX_LINE + 1, "OPEN %s", databaseName);
+        executeCommandLine(&setup, line);
+        printf("%.*s", (int)output.length, output.data ? output.data : "");
+        output.length = 0;
+    }
+    commandStatsReset();
 
-        // EXIT / QUIT
-        if (equalsIgnoreCase(upperLine, "EXIT") ||
-            equalsIgnoreCase(upperLine, "QUIT")) {
-            break;
-        }
+    unsigned long long replayed = 0;
+    uint64_t due = 0;           // capture time of the current line, from the first one
+    uint64_t behind = 0;        // --paced: the latest a line started
+    int broken = 0;
+    uint64_t start = monotonicNanoseconds();
 
-        // HELP
-        else if (strncmp(upperLine, "HELP", 4) == 0) {
-            printHelp();
+    while (1) {
+        uint64_t gap = 0;
+        uint64_t client = 0;
+        uint64_t length = 0;
+        if (!captureReadVarint(file, &gap)) {
+            break;              // (the end of the file)
         }
-
-        // OPEN <file>
-        else if (strncmp(upperLine, "OPEN", 4) == 0) {
-            char *p = line + 4;
-            while (*p && isspace((unsigned char)*p)) {
-                p++;
-            }
-
-            if (!*p) {
-                printf("CMS: Please provide a filename.\n");
-                continue;
-            }
-
-            char *fileName = p;
-            if (*p == '"') {
-                p++;
-                char *endQuote = strrchr(p, '"');
-                if (endQuote) {
-                    *endQuote = '\0';
-                }
-                fileName = p;
+        if (!captureReadVarint(file, &client) || !captureReadVarint(file, &length) ||
+            length > CAPTURE_MAX_LINE || client > 1000000 || fread(line, 1, (size_t)length, file) != length) {
+            broken = 1;
+            break;
+        }
+        line[length] = '\0';
+
+        if (client >= sessionCount) {
+            size_t newCount = (size_t)client + 1;
+            CommandSession *newSessions = (CommandSession *)memoryRealloc(MEMORY_OTHER, sessions,
+                                                                          newCount * sizeof(CommandSession));
+            if (!newSessions) {
+                fprintf(stderr, "CMS: Out of memory in the replay.\n");
+                broken = 1;
+                break;
             }
+            memset(newSessions + sessionCount, 0, (newCount - sessionCount) * sizeof(CommandSession));
+            sessions = newSessions;
+            sessionCount = newCount;
+        }
 
-            if (loadDatabaseFromFile(fileName)) {
-                printf("CMS: The database file \"%s\" is successfully opened.\n", fileName);
-            } else {
-                printf("CMS: Failed to open file \"%s\".\n", fileName);
+        // the first line runs right away, the others keep their distance to it
+        due += replayed ? gap * 1000 : 0;
+        if (paced) {
+            uint64_t now = monotonicNanoseconds() - start;
+            if (now < due) {
+                sleepNanoseconds(due - now);
+            } else if (now - due > behind) {
+                behind = now - due;
             }
         }
 
-        // SAVE [file]
-        else if (strncmp(upperLine, "SAVE", 4) == 0) {
-            char *p = line + 4;
-            while (*p && isspace((unsigned char)*p)) {
-                p++;
-            }
+        // (EXIT ends only that client, the replay goes on)
+        executeCommandLine(&sessions[client], line);
+        output.length = 0;
+        replayed++;
+    }
+    double seconds = (double)(monotonicNanoseconds() - start) / 1e9;
+    fclose(file);
 
-            const char *fileName = *p ? p : NULL;  // NULL means reuse lastDatabaseFileName
+    if (broken) {
+        fprintf(stderr, "CMS: \"%s\" is cut off or damaged after %llu lines.\n", captureName, replayed);
+    }
+    printf("CMS: Replayed %llu lines from \"%s\" in %.3f s (%.1f lines/s), %s.\n",
+           replayed, captureName, seconds, seconds > 0 ? (double)replayed / seconds : 0.0,
+           paced ? "at the captured pace" : "as fast as possible");
+    if (paced) {
+        printf("CMS: At most %.3f ms behind the captured pace.\n", (double)behind / 1e6);
+    }
 
-            if (saveDatabaseToFile(fileName)) {
-                printf("CMS: The database file is successfully saved.\n");
-            } else {
-                printf("CMS: Failed to save. Please OPEN a file first or provide a filename.\n");
-            }
+    // every command type together
+    static CommandStats all;
+    uint64_t count = 0;
+    uint64_t longest = 0;
+    for (int kind = 0; kind < COMMAND_KIND_COUNT; ++kind) {
+        count += atomic_load(&commandStats[kind].count);
+        uint64_t kindLongest = atomic_load(&commandStats[kind].maxNanoseconds);
+        longest = kindLongest > longest ? kindLongest : longest;
+        for (size_t b = 0; b < LATENCY_BUCKETS; ++b) {
+            atomic_fetch_add(&all.buckets[b], atomic_load(&commandStats[kind].buckets[b]));
         }
+    }
+    atomic_store(&all.maxNanoseconds, longest);
+    if (count) {
+        printf("CMS: Latency of %llu commands: p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, max %.3f ms.\n",
+               (unsigned long long)count,
+               (double)commandStatsPercentile(&all, count, 0.50) / 1e6,
+               (double)commandStatsPercentile(&all, count, 0.90) / 1e6,
+               (double)commandStatsPercentile(&all, count, 0.99) / 1e6,
+               (double)commandStatsPercentile(&all, count, 0.999) / 1e6,
+               (double)longest / 1e6);
+    }
 
-        // SHOW ALL [SORT BY ID|MARK ASC|DESC]
-        else if (strncmp(upperLine, "SHOW ALL", 8) == 0) {
-            SortField field = SORT_NONE;
-            SortDirection direction = SORT_ASCENDING;
+    // the STATS table, per command type
+    output.sink = stdout;
+    showCommandStats();
+    outputFlush(&output);
 
-            if (strstr(upperLine, "SORT BY ID")) {
-                field = SORT_BY_ID;
-                direction = strstr(upperLine, "DESC") ? SORT_DESCENDING : SORT_ASCENDING;
-            } else if (strstr(upperLine, "SORT BY MARK")) {
-                field = SORT_BY_MARK;
-                direction = strstr(upperLine, "DESC") ? SORT_DESCENDING : SORT_ASCENDING;
-            }
+    memoryFree(line);
+    memoryFree(sessions);
+    outputFree(&output);
+    currentOutput = NULL;
+    return broken ? 1 : 0;
+}
 
-            showAllStudents(field, direction);
-        }
+// ======================= STRESS MODE (--stress) ===========================
+/*
+    ./project --stress [seconds] [seed]    (default 60 seconds, seed from the clock)
+
+a long random run straight against the table functions (addStudentRecord,
+updateStudentRecord, deleteStudentRecord, getStudentRecordById, FIND, the sort
+engine, COUNT, EXPORT + IMPORT in CSV or JSON Lines) that keeps its own copy of what the
+table should hold (the shadow) and checks every answer against it:
+    - every call: INSERT only works on a free ID, UPDATE / DELETE only on a
+      used one, QUERY / FIND / COUNT / SORT give what the shadow says
+    - every STRESS_REPORT_SECONDS, a full check: every ID once, every row as
+      in the shadow and inside its zone maps, the ID index pointing at it,
+      mark sum / lowest / highest per chunk, the rank and bitmap indexes
+      holding every programme's students
+and prints a line with the operations per second of that interval and the
+memory in use, so a slowdown or a leak over hours shows as a trend.
+the first broken invariant stops the run (exit status 1) with the seed,
+so the same run can be made again.
+*/
+#define STRESS_FIRST_INTAKE 21
+#define STRESS_INTAKES 6
+#define STRESS_PER_INTAKE 10000
+#define STRESS_SLOTS (STRESS_INTAKES * STRESS_PER_INTAKE)
+#define STRESS_REPORT_SECONDS 10
+#define STRESS_CSV_FILE "cms-stress.csv"
+#define STRESS_JSONL_FILE "cms-stress.jsonl"
+
+// the operations, and how often each one is picked (out of 10000)
+typedef enum {
+    STRESS_INSERT,
+    STRESS_UPDATE,
+    STRESS_DELETE,
+    STRESS_QUERY,
+    STRESS_COUNT,
+    STRESS_FIND,
+    STRESS_SORT,
+    STRESS_EXPORT_IMPORT,
+    STRESS_OPERATION_COUNT
+} StressOperation;
+
+static const char *const stressOperationNames[STRESS_OPERATION_COUNT] = {
+    "INSERT", "UPDATE", "DELETE", "QUERY", "COUNT", "FIND", "SORT", "EXPORT+IMPORT"
+};
+static const unsigned stressOperationWeights[STRESS_OPERATION_COUNT] = {
+    3000, 2000, 1500, 3000, 400, 48, 50, 2
+};
+
+// what the table should hold for one ID (names are made from "name", see stressName)
+typedef struct {
+    unsigned char present;
+    unsigned char programme;    // index into generateProgrammes
+    Mark mark;
+    uint32_t name;
+} StressRow;
 
-        // INSERT ID=... Name="..." Programme="..." Mark=...
-        else if (strncmp(upperLine, "INSERT", 6) == 0) {
-            char idBuffer[64] = "";
-            char nameBuffer[NAME_MAX_LENGTH] = "";
-            char programmeBuffer[PROGRAMME_MAX_LENGTH] = "";
-            char markBuffer[64] = "";
+typedef struct {
+    uint64_t seed;
+    uint64_t draws;             // random numbers taken so far
+    StressRow *rows;            // STRESS_SLOTS, slot = intake * STRESS_PER_INTAKE + serial
+    size_t present;
+    uint64_t operations[STRESS_OPERATION_COUNT];
+    uint64_t refused[STRESS_OPERATION_COUNT];   // INSERT of a used ID, UPDATE / DELETE of a free one
+    OutputBuffer output;
+    char failure[256];          // the first broken invariant
+} StressRun;
+
+static uint64_t stressRandom(StressRun *run)
+{
+    return generateRandom(run->seed, run->draws++, 9);
+}
 
-            if (!readKeyValueFromCommand(line, "ID", idBuffer, sizeof(idBuffer))) {
-                printf("CMS: Missing ID=\n");
-                continue;
-            }
-            if (!readKeyValueFromCommand(line, "Name", nameBuffer, sizeof(nameBuffer))) {
-                printf("CMS: Missing Name=\n");
-                continue;
-            }
-            if (!readKeyValueFromCommand(line, "Programme", programmeBuffer, sizeof(programmeBuffer))) {
-                printf("CMS: Missing Programme=\n");
-                continue;
-            }
-            if (!readKeyValueFromCommand(line, "Mark", markBuffer, sizeof(markBuffer))) {
-                printf("CMS: Missing Mark=\n");
-                continue;
-            }
+static int stressIdOf(size_t slot)
+{
+    return (int)((STRESS_FIRST_INTAKE + slot / STRESS_PER_INTAKE) * 100000 + slot % STRESS_PER_INTAKE);
+}
 
-            int id;
-            float mark;
-            if (!stringToInt(idBuffer, &id)) {
-                printf("CMS: Invalid ID.\n");
-                continue;
-            }
-            if (!stringToFloat(markBuffer, &mark)) {
-                printf("CMS: Invalid Mark.\n");
-                continue;
-            }
+// the slot of an ID, or -1 if the stress run never uses that ID
+static long stressSlotOf(int id)
+{
+    int intake = id / 100000 - STRESS_FIRST_INTAKE;
+    int serial = id % 100000;
+    if (id < 0 || intake < 0 || intake >= STRESS_INTAKES || serial >= STRESS_PER_INTAKE) {
+        return -1;
+    }
+    return (long)intake * STRESS_PER_INTAKE + serial;
+}
 
-            if (addStudentRecord(id, nameBuffer, programmeBuffer, mark)) {
-                printf("CMS: A new record with ID=%d is successfully inserted.\n", id);
-            } else {
-                printf("CMS: The record with ID=%d already exists.\n", id);
-            }
-        }
+static void stressName(uint32_t name, char *out)
+{
+    snprintf(out, NAME_MAX_LENGTH, "%s %s %u",
+             generateSurnames[name % GENERATE_COUNT(generateSurnames)],
+             generateGivenNames[(name / GENERATE_COUNT(generateSurnames)) % GENERATE_COUNT(generateGivenNames)],
+             (unsigned)(name % 1000));
+}
 
-        // QUERY ID=...
-        else if (strncmp(upperLine, "QUERY", 5) == 0) {
-            char idBuffer[64] = "";
+// remember the first broken invariant; returns 0 so callers can "return stressFail(...)"
+static int stressFail(StressRun *run, const char *format, ...)
+{
+    if (!run->failure[0]) {
+        va_list args;
+        va_start(args, format);
+        vsnprintf(run->failure, sizeof(run->failure), format, args);
+        va_end(args);
+    }
+    return 0;
+}
 
-            if (!readKeyValueFromCommand(line, "ID", idBuffer, sizeof(idBuffer))) {
-                printf("CMS: Missing ID=\n");
-                continue;
-            }
+// does a row of the table hold what the shadow says?
+static int stressRowMatches(const StressRow *expected, const char *name, const char *programme, Mark mark)
+{
+    char expectedName[NAME_MAX_LENGTH];
+    stressName(expected->name, expectedName);
+    return expected->present && mark == expected->mark && strcmp(name, expectedName) == 0 &&
+           strcmp(programme, generateProgrammes[expected->programme]) == 0;
+}
 
-            int id;
-            if (!stringToInt(idBuffer, &id)) {
-                printf("CMS: Invalid ID.\n");
-                continue;
-            }
+// a random new mark / programme / name for a row
+static void stressRandomRow(StressRun *run, StressRow *row)
+{
+    uint64_t random = stressRandom(run);
+    row->mark = (Mark)(random % 1001);
+    row->programme = (unsigned char)((random >> 16) % GENERATE_COUNT(generateProgrammes));
+    row->name = (uint32_t)(random >> 32);
+}
 
-            StudentRecord *student = getStudentRecordById(id);
-            if (!student) {
-                printf("CMS: The record with ID=%d does not exist.\n", id);
-            } else {
-                printf("CMS: The record with ID=%d is found in the data table.\n", id);
-                printf("ID Name Programme Mark\n");
-                printf("%d %s %s %.1f\n",
-                       student->id,
-                       student->name,
-                       student->programme,
-                       student->mark);
-            }
+// one INSERT / UPDATE / DELETE / QUERY on a random ID
+static int stressPointOperation(StressRun *run, StressOperation operation)
+{
+    size_t slot = (size_t)(stressRandom(run) % STRESS_SLOTS);
+    int id = stressIdOf(slot);
+    StressRow *row = &run->rows[slot];
+    char name[NAME_MAX_LENGTH];
+    int wasPresent = row->present;
+    int done = 0;
+
+    if (operation == STRESS_INSERT) {
+        StressRow fresh;
+        stressRandomRow(run, &fresh);
+        stressName(fresh.name, name);
+        done = addStudentRecord(id, name, generateProgrammes[fresh.programme], fresh.mark);
+        if (done) {
+            fresh.present = 1;
+            *row = fresh;
+            run->present++;
+        }
+    } else if (operation == STRESS_UPDATE) {
+        // any non-empty mix of the three fields
+        StressRow fresh;
+        stressRandomRow(run, &fresh);
+        unsigned fields = (unsigned)(stressRandom(run) % 7) + 1;
+        stressName(fresh.name, name);
+        done = updateStudentRecord(id, (fields & 1) ? name : NULL,
+                                   (fields & 2) ? generateProgrammes[fresh.programme] : NULL,
+                                   (fields & 4) ? &fresh.mark : NULL);
+        if (done) {
+            row->name = (fields & 1) ? fresh.name : row->name;
+            row->programme = (fields & 2) ? fresh.programme : row->programme;
+            row->mark = (fields & 4) ? fresh.mark : row->mark;
+        }
+    } else if (operation == STRESS_DELETE) {
+        done = deleteStudentRecord(id);
+        if (done) {
+            row->present = 0;
+            run->present--;
         }
+    } else {
+        StudentRecord student;
+        done = getStudentRecordById(id, &student);
+        if (done && !stressRowMatches(row, student.name, student.programme, student.mark)) {
+            return stressFail(run, "QUERY ID=%d returned a different record", id);
+        }
+    }
 
-        // UPDATE ID=... [Name=...] [Programme=...] [Mark=...]
-        else if (strncmp(upperLine, "UPDATE", 6) == 0) {
-            char idBuffer[64] = "";
-            char nameBuffer[NAME_MAX_LENGTH] = "";
-            char programmeBuffer[PROGRAMME_MAX_LENGTH] = "";
-            char markBuffer[64] = "";
+    // INSERT works exactly on free IDs, the others exactly on used ones
+    if (done != (operation == STRESS_INSERT ? !wasPresent : wasPresent)) {
+        return stressFail(run, "%s ID=%d %s", stressOperationNames[operation], id,
+                          done ? "worked on an ID it should not have" : "did not find a record that exists");
+    }
+    run->refused[operation] += !done;
+    return 1;
+}
 
-            if (!readKeyValueFromCommand(line, "ID", idBuffer, sizeof(idBuffer))) {
-                printf("CMS: Missing ID=\n");
-                continue;
-            }
+// COUNT with a random mark range or programme (scan or bitmap path)
+static int stressCount(StressRun *run)
+{
+    uint64_t random = stressRandom(run);
+    QueryFilter filter;
+    queryFilterInit(&filter);
+    filter.active = 1;
+
+    // a programme, a mark range or both (the planner may fetch through the bitmaps)
+    int byProgramme = random & 1;
+    int byMark = !byProgramme || (random & 2);
+    size_t programme = (size_t)((random >> 8) % GENERATE_COUNT(generateProgrammes));
+    if (byProgramme) {
+        snprintf(filter.programmes[0], PROGRAMME_MAX_LENGTH, "%s", generateProgrammes[programme]);
+        filter.programmeCount = 1;
+    }
+    if (byMark) {
+        Mark a = (Mark)((random >> 16) % 1001);
+        Mark b = (Mark)((random >> 32) % 1001);
+        filter.markMin = a < b ? a : b;
+        filter.markMax = a < b ? b : a;
+    }
 
-            int id;
-            if (!stringToInt(idBuffer, &id)) {
-                printf("CMS: Invalid ID.\n");
-                continue;
-            }
+    size_t expected = 0;
+    for (size_t slot = 0; slot < STRESS_SLOTS; ++slot) {
+        const StressRow *row = &run->rows[slot];
+        expected += row->present && (!byProgramme || row->programme == programme) &&
+                    (!byMark || (row->mark >= filter.markMin && row->mark <= filter.markMax));
+    }
 
-            int hasName = readKeyValueFromCommand(line, "Name", nameBuffer, sizeof(nameBuffer));
-            int hasProgramme = readKeyValueFromCommand(line, "Programme", programmeBuffer, sizeof(programmeBuffer));
-            int hasMark = readKeyValueFromCommand(line, "Mark", markBuffer, sizeof(markBuffer));
+    size_t count = countStudentsWhere(&filter);
+    if (count != expected) {
+        return stressFail(run, "COUNT WHERE %s%s%s gave %zu, expected %zu", byProgramme ? "PROGRAMME" : "",
+                          byProgramme && byMark ? " AND " : "", byMark ? "MARK BETWEEN" : "", count, expected);
+    }
+    return 1;
+}
 
-            float markValue;
-            float *markPtr = NULL;
+// FIND NAME with a random given name, the number of matches is checked
+static int stressFind(StressRun *run)
+{
+    const char *needle = generateGivenNames[stressRandom(run) % GENERATE_COUNT(generateGivenNames)];
+
+    size_t expected = 0;
+    for (size_t slot = 0; slot < STRESS_SLOTS; ++slot) {
+        char name[NAME_MAX_LENGTH];
+        if (run->rows[slot].present) {
+            stressName(run->rows[slot].name, name);
+            expected += containsIgnoreCase(name, needle) != 0;
+        }
+    }
 
-            if (hasMark) {
-                if (!stringToFloat(markBuffer, &markValue)) {
-                    printf("CMS: Invalid Mark.\n");
-                    continue;
-                }
-                markPtr = &markValue;
-            }
+    TableSnapshot *snapshot = tableSnapshotAcquire();
+    run->output.length = 0;
+    size_t found = (size_t)findStudentsByField(snapshot, "NAME", needle);
+    tableSnapshotRelease(snapshot);
+    if (found != expected) {
+        return stressFail(run, "FIND NAME \"%s\" found %zu, expected %zu", needle, found, expected);
+    }
+    return 1;
+}
 
-            if (updateStudentRecord(id,
-                                    hasName ? nameBuffer : NULL,
-                                    hasProgramme ? programmeBuffer : NULL,
-                                    markPtr)) {
-                printf("CMS: The record with ID=%d is successfully updated.\n", id);
-            } else {
-                printf("CMS: The record with ID=%d does not exist.\n", id);
-            }
+// the sort engine on a snapshot with one or two random keys
+static int stressSort(StressRun *run)
+{
+    uint64_t random = stressRandom(run);
+    SortSpec spec;
+    spec.keyCount = 1 + (size_t)(random & 1);
+    spec.keys[0].column = (SortColumn)((random >> 8) % 4);
+    spec.keys[0].direction = (SortDirection)((random >> 16) & 1);
+    spec.keys[1].column = (SortColumn)((spec.keys[0].column + 1 + (random >> 24) % 3) % 4);
+    spec.keys[1].direction = (SortDirection)((random >> 32) & 1);
+
+    TableSnapshot *snapshot = tableSnapshotAcquire();
+    size_t count = 0;
+    SortItem *items = sortSnapshotChunks(snapshot, &spec, 0, snapshot->chunkCount, &count);
+    int ok = items != NULL;
+    if (!ok) {
+        stressFail(run, "SORT ran out of memory");
+    } else if (count != run->present) {
+        ok = stressFail(run, "SORT returned %zu rows, the table has %zu", count, run->present);
+    }
+    for (size_t k = 1; ok && k < count; ++k) {
+        SortRowValues a = chunkRowValues(snapshot->chunks[items[k - 1].slot / CHUNK_ROWS],
+                                         items[k - 1].slot % CHUNK_ROWS);
+        SortRowValues b = chunkRowValues(snapshot->chunks[items[k].slot / CHUNK_ROWS], items[k].slot % CHUNK_ROWS);
+        if (compareSortRows(&spec, &a, &b) > 0) {
+            ok = stressFail(run, "SORT put ID=%d before ID=%d", a.id, b.id);
         }
+    }
+    memoryFree(items);
+    tableSnapshotRelease(snapshot);
+    return ok;
+}
 
-        // DELETE ID=...
-        else if (strncmp(upperLine, "DELETE", 6) == 0) {
-            char idBuffer[64] = "";
+// EXPORT, empty the table, IMPORT (CSV, or JSON Lines when jsonl is set): everything has to come back
+static int stressExportImport(StressRun *run, int jsonl)
+{
+    const char *format = jsonl ? "JSONL" : "CSV";
+    char path[1024];
+    joinPath(path, sizeof(path), programDirectoryPath, jsonl ? STRESS_JSONL_FILE : STRESS_CSV_FILE);
+
+    SortSpec tableOrder;
+    tableOrder.keyCount = 0;
+    TableSnapshot *snapshot = tableSnapshotAcquire();
+    run->output.length = 0;
+    int exported = jsonl ? exportToJsonlFile(snapshot, path, &tableOrder)
+                         : exportToCsvFile(snapshot, path, &tableOrder);
+    tableSnapshotRelease(snapshot);
+    if (!exported) {
+        return stressFail(run, "EXPORT %s to \"%s\" failed", format, path);
+    }
 
-            if (!readKeyValueFromCommand(line, "ID", idBuffer, sizeof(idBuffer))) {
-                printf("CMS: Missing ID=\n");
-                continue;
-            }
+    studentTableClear(&studentTable);
+    size_t added = 0;
+    size_t skipped = 0;
+    int imported = jsonl ? importFromJsonlFile(path, &added, &skipped) : importFromCsvFile(path);
+    remove(path);
+    if (!imported) {
+        return stressFail(run, "IMPORT %s from \"%s\" failed", format, path);
+    }
+    if (studentTable.count != run->present || skipped) {
+        return stressFail(run, "IMPORT %s brought back %zu rows of %zu", format, studentTable.count, run->present);
+    }
+    return 1;
+}
 
-            int id;
-            if (!stringToInt(idBuffer, &id)) {
-                printf("CMS: Invalid ID.\n");
-                continue;
-            }
+// the full check of the table and its indexes against the shadow (see above)
+static int stressCheckTable(StressRun *run)
+{
+    unsigned char *seen = (unsigned char *)memoryCalloc(MEMORY_OTHER, STRESS_SLOTS, 1);
+    if (!seen) {
+        return stressFail(run, "out of memory in the table check");
+    }
 
-            if (findIndexById(id) == -1) {
-                printf("CMS: The record with ID=%d does not exist.\n", id);
-                continue;
+    size_t rows = 0;
+    int ok = 1;
+    for (size_t s = 0; ok && s < studentTable.segmentCount; ++s) {
+        const TableSegment *segment = &studentTable.segments[s];
+        size_t segmentRows = 0;
+
+        for (size_t c = 0; ok && c < segment->chunkCount; ++c) {
+            const RecordChunk *chunk = segment->chunks[c];
+            int64_t sum = 0;
+            Mark lowest = MARK_HIGHEST;
+            Mark highest = MARK_LOWEST;
+            unsigned live = 0;
+
+            for (unsigned i = 0; ok && i < chunk->used; ++i) {
+                if (!chunk->live[i]) {
+                    continue;
+                }
+                int id = chunk->ids[i];
+                long slot = stressSlotOf(id);
+                RowLocation where;
+                if (slot < 0 || seen[slot]) {
+                    ok = stressFail(run, "ID=%d is in the table %s", id, slot < 0 ? "but was never inserted" : "twice");
+                } else if (!stressRowMatches(&run->rows[slot], chunkName(chunk, i), chunkProgramme(chunk, i), chunk->marks[i])) {
+                    ok = stressFail(run, "ID=%d does not hold what was written last", id);
+                } else if (!idIndexFind(id, &where) || where.segment != (int)s ||
+                           where.slot != (int)(c * CHUNK_ROWS + i)) {
+                    ok = stressFail(run, "the ID index does not point at ID=%d", id);
+                } else if (id < chunk->zone.idMin || id > chunk->zone.idMax || chunk->marks[i] < chunk->zone.markMin ||
+                           chunk->marks[i] > chunk->zone.markMax || id < segment->zone.idMin ||
+                           id > segment->zone.idMax || chunk->marks[i] < segment->zone.markMin ||
+                           chunk->marks[i] > segment->zone.markMax) {
+                    ok = stressFail(run, "ID=%d is outside the zone map of its chunk or segment", id);
+                }
+                if (slot >= 0) {
+                    seen[slot] = 1;
+                }
+                sum += chunk->marks[i];
+                lowest = chunk->marks[i] < lowest ? chunk->marks[i] : lowest;
+                highest = chunk->marks[i] > highest ? chunk->marks[i] : highest;
+                live++;
             }
 
-            printf("CMS: Type Y to Confirm or N to cancel: ");
-
-            char yesNoBuffer[16];
-            if (!fgets(yesNoBuffer, sizeof(yesNoBuffer), stdin)) {
-                printf("\n");
-                continue;
+            // the column kernels SHOW SUMMARY uses
+            MarkAggregate aggregate;
+            markColumnAggregate(chunk, &aggregate);
+            if (ok && (live != chunk->liveRows || aggregate.sum != sum ||
+                       aggregate.lowest != lowest || aggregate.highest != highest)) {
+                ok = stressFail(run, "the live count or mark sum / lowest / highest of a chunk of intake %d is wrong",
+                                segment->key);
             }
+            segmentRows += live;
+        }
+        if (ok && segmentRows != segment->count) {
+            ok = stressFail(run, "intake %d counts %zu rows but holds %zu", segment->key, segment->count, segmentRows);
+        }
+        rows += segmentRows;
+    }
+    memoryFree(seen);
 
-            trimSpaces(yesNoBuffer);
+    if (ok && (rows != run->present || studentTable.count != run->present)) {
+        ok = stressFail(run, "the table holds %zu rows and counts %zu, expected %zu",
+                        rows, studentTable.count, run->present);
+    }
 
-            if (yesNoBuffer[0] == 'Y' || yesNoBuffer[0] == 'y') {
-                if (deleteStudentRecord(id)) {
-                    printf("CMS: The record with ID=%d is successfully deleted.\n", id);
-                } else {
-                    printf("CMS: Delete failed.\n");
-                }
-            } else {
-                printf("CMS: Delete cancelled.\n");
-            }
+    // the column statistics count every row once in each histogram
+    const EquiDepthHistogram *histograms[2] = { &columnStats.marks, &columnStats.ids };
+    for (size_t h = 0; ok && h < 2; ++h) {
+        uint64_t bucketRows = 0;
+        for (size_t b = 0; b < histograms[h]->bucketCount; ++b) {
+            bucketRows += histograms[h]->rows[b];
+        }
+        if (columnStats.rows != rows || bucketRows != rows) {
+            ok = stressFail(run, "the column statistics count %llu rows, the %s histogram %llu, expected %zu",
+                            (unsigned long long)columnStats.rows, h ? "ID" : "mark",
+                            (unsigned long long)bucketRows, rows);
         }
+    }
 
-        // SHOW SUMMARY
-        else if (strncmp(upperLine, "SHOW SUMMARY", 12) == 0) {
-            showSummaryStatistics();
+    // every programme's group in the rank index and its bitmap
+    for (size_t p = 0; ok && p < GENERATE_COUNT(generateProgrammes); ++p) {
+        size_t expected = 0;
+        for (size_t slot = 0; slot < STRESS_SLOTS; ++slot) {
+            expected += run->rows[slot].present && run->rows[slot].programme == p;
+        }
+        size_t rank = 0;
+        size_t groupSize = 0;
+        if (!rankIndexLookup(generateProgrammes[p], MARK_LOWEST, &rank, &groupSize)) {
+            groupSize = 0;
         }
 
-        // EXPORT CSV <file.csv>
-        else if (strncmp(upperLine, "EXPORT CSV", 10) == 0) {
-            char *p = line + 10;
-            while (*p && isspace((unsigned char)*p)) {
-                p++;
-            }
+        QueryFilter filter;
+        queryFilterInit(&filter);
+        filter.active = 1;
+        snprintf(filter.programmes[0], PROGRAMME_MAX_LENGTH, "%s", generateProgrammes[p]);
+        filter.programmeCount = 1;
+        size_t bitmapCount = countStudentsWhere(&filter);
 
-            if (!*p) {
-                printf("CMS: Please provide CSV filename.\n");
-                continue;
-            }
+        if (groupSize != expected || bitmapCount != expected) {
+            ok = stressFail(run, "\"%s\" has %zu students, the rank index says %zu and the bitmap %zu",
+                            generateProgrammes[p], expected, groupSize, bitmapCount);
+        }
+    }
+    return ok;
+}
 
-            if (exportToCsvFile(p)) {
-                printf("CMS: CSV exported to \"%s\".\n", p);
-            } else {
-                printf("CMS: Failed to export CSV.\n");
-            }
+// marks are read the same way by INSERT, UPDATE, OPEN and IMPORT CSV: one whole number or nothing
+static int stressCheckMarks(StressRun *run)
+{
+    static const struct {
+        const char *text;
+        int valid;
+        Mark tenths;
+    } cases[] = {
+        { "88.8", 1, 888 },   { "70.25", 1, 703 }, { "-0.05", 1, -1 },  { " 55 ", 1, 550 },
+        { "77.", 1, 770 },    { ".5", 1, 5 },      { "1e2", 1, 1000 },  { "2.5E-1", 1, 3 },
+        { "0.0001e3", 1, 1 }, { "77abc", 0, 0 },   { "1e", 0, 0 },      { "1.2.3", 0, 0 },
+        { ".", 0, 0 },        { "", 0, 0 },        { "3276.8", 0, 0 },  { "4e3", 0, 0 },
+    };
+    for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); ++k) {
+        Mark mark = 0;
+        int valid = markFromText(cases[k].text, &mark);
+        if (valid != cases[k].valid || (valid && mark != cases[k].tenths)) {
+            return stressFail(run, "reading the mark \"%s\" gave %s %d", cases[k].text,
+                              valid ? "the tenths" : "no mark", valid ? mark : 0);
         }
+    }
+    return 1;
+}
 
-        // EXPORT SQL <file.sql>
-        else if (strncmp(upperLine, "EXPORT SQL", 10) == 0) {
-            char *p = line + 10;
-            while (*p && isspace((unsigned char)*p)) {
-                p++;
-            }
+// the slow log and captures must never show student data, however the keys are spaced
+static int stressCheckMasking(StressRun *run)
+{
+    static const char *const cases[][2] = {
+        { "INSERT ID=2501234 Name=\"Jerrel Tan\" Programme=\"IS\" Mark=84.8",
+          "INSERT ID=2501234 Name=*** Programme=*** Mark=***" },
+        { "UPDATE ID=2501234 Mark = 12.3", "UPDATE ID=2501234 Mark = ***" },
+        { "UPDATE ID=2501234 Name = Secret", "UPDATE ID=2501234 Name = ***" },
+        { "INSERT ID=2501234 name =\"A B\" PROGRAMME= CS Mark =55.5",
+          "INSERT ID=2501234 name =*** PROGRAMME= *** Mark =***" },
+        { "SHOW ALL WHERE MARK >= 90 SORT BY NAME", "SHOW ALL WHERE MARK >= 90 SORT BY NAME" },
+        { "FIND NAME \"Jerrel Tan\"", "FIND NAME ***" },
+        { "FIND NAME tan", "FIND NAME ***" },
+        { "FIND PROGRAMME law", "FIND PROGRAMME ***" },
+        { "find name lee wei LIMIT 5 OFFSET 10", "find name *** LIMIT 5 OFFSET 10" },
+        { "FIND PROGRAMME Data Science COLUMNS ID, MARK INTO out.csv",
+          "FIND PROGRAMME *** COLUMNS ID, MARK INTO out.csv" },
+        { "FIND NAME After Hours AFTER ID=2501234", "FIND NAME *** AFTER ID=2501234" },
+        { "COUNT WHERE PROGRAMME IN (Law, Medicine)", "COUNT WHERE PROGRAMME IN (***, ***)" },
+        { "SHOW ALL WHERE INTAKE = 25 AND PROGRAMME IN (\"Data Science\", Law) SORT BY MARK",
+          "SHOW ALL WHERE INTAKE = 25 AND PROGRAMME IN (***, ***) SORT BY MARK" },
+        { "EXPORT CSV out.csv WHERE PROGRAMME IN(Law,\"Applied AI\")", "EXPORT CSV out.csv WHERE PROGRAMME IN(***,***)" },
+        { "EXPLAIN FIND NAME tan", "EXPLAIN FIND NAME ***" },
+    };
+    for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); ++k) {
+        char masked[256];
+        maskCommandText(cases[k][0], masked, sizeof(masked));
+        if (strcmp(masked, cases[k][1]) != 0) {
+            return stressFail(run, "masking \"%s\" gave \"%s\"", cases[k][0], masked);
+        }
+    }
+    return 1;
+}
 
-            if (!*p) {
-                printf("CMS: Please provide SQL filename.\n");
-                continue;
-            }
+/*
+stress mode: see above
+returns the process exit status
+*/
+static int runStress(const char *secondsText, const char *seedText)
+{
+    int seconds = 60;
+    if (secondsText && (!stringToInt(secondsText, &seconds) || seconds < 1)) {
+        fprintf(stderr, "CMS: Use --stress [seconds] [seed].\n");
+        return 1;
+    }
 
-            if (exportToSqlFile(p)) {
-                printf("CMS: SQL exported to \"%s\".\n", p);
-            } else {
-                printf("CMS: Failed to export SQL.\n");
-            }
-        }
+    StressRun run;
+    memset(&run, 0, sizeof(run));
+    run.seed = seedText ? strtoull(seedText, NULL, 10) : (uint64_t)time(NULL);
+    run.rows = (StressRow *)memoryCalloc(MEMORY_OTHER, STRESS_SLOTS, sizeof(StressRow));
+    if (!run.rows) {
+        fprintf(stderr, "CMS: Out of memory in the stress run.\n");
+        return 1;
+    }
+    currentOutput = &run.output;
 
-        // IMPORT CSV <file.csv>
-        else if (strncmp(upperLine, "IMPORT CSV", 10) == 0) {
-            char *p = line + 10;
-            while (*p && isspace((unsigned char)*p)) {
-                p++;
-            }
+    printf("CMS: Stress run for %d s, seed %llu, %u worker threads.\n",
+           seconds, (unsigned long long)run.seed, threadPoolWorkerCount());
+    printf("%8s %12s %10s %8s %11s %11s %9s\n", "Time s", "Operations", "Ops/s", "Rows", "Memory KB", "Peak KB", "Check ms");
+    fflush(stdout);
 
-            if (!*p) {
-                printf("CMS: Please provide CSV filename.\n");
-                continue;
-            }
+    uint64_t total = 0;
+    for (int op = 0; op < STRESS_OPERATION_COUNT; ++op) {
+        total += stressOperationWeights[op];
+    }
 
-            if (importFromCsvFile(p)) {
-                printf("CMS: CSV imported from \"%s\".\n", p);
-            } else {
-                printf("CMS: Failed to import CSV.\n");
-            }
+    uint64_t start = monotonicNanoseconds();
+    uint64_t end = start + (uint64_t)seconds * 1000000000ull;
+    uint64_t intervalStart = start;
+    uint64_t intervalOperations = 0;
+    uint64_t operations = 0;
+    int ok = stressCheckMarks(&run) && stressCheckMasking(&run);
+
+    while (ok) {
+        uint64_t pick = stressRandom(&run) % total;
+        StressOperation operation = STRESS_INSERT;
+        while (pick >= stressOperationWeights[operation]) {
+            pick -= stressOperationWeights[operation];
+            operation = (StressOperation)(operation + 1);
         }
 
-        // FIND NAME "..." or FIND PROGRAMME "..."
-        else if (strncmp(upperLine, "FIND NAME", 9) == 0) {
-            char *p = line + 9;
-            while (*p && isspace((unsigned char)*p)) {
-                p++;
-            }
-            if (*p == '"') {
-                p++;
-                char *endQuote = strrchr(p, '"');
-                if (endQuote) {
-                    *endQuote = '\0';
-                }
-            }
-            findStudentsByField("NAME", p);
+        if (operation <= STRESS_QUERY) {
+            ok = stressPointOperation(&run, operation);
+        } else if (operation == STRESS_COUNT) {
+            ok = stressCount(&run);
+        } else if (operation == STRESS_FIND) {
+            ok = stressFind(&run);
+        } else if (operation == STRESS_SORT) {
+            ok = stressSort(&run);
+        } else {
+            ok = stressExportImport(&run, (int)(run.operations[operation] % 2)) && stressCheckTable(&run);
         }
-
-        else if (strncmp(upperLine, "FIND PROGRAMME", 14) == 0) {
-            char *p = line + 14;
-            while (*p && isspace((unsigned char)*p)) {
-                p++;
-            }
-            if (*p == '"') {
-                p++;
-                char *endQuote = strrchr(p, '"');
-                if (endQuote) {
-                    *endQuote = '\0';
-                }
+        run.operations[operation]++;
+        operations++;
+        intervalOperations++;
+
+        // the clock is read every 256 operations
+        if ((operations & 255) == 0 || !ok) {
+            uint64_t now = monotonicNanoseconds();
+            if (ok && now - intervalStart < STRESS_REPORT_SECONDS * 1000000000ull && now < end) {
+                continue;
             }
-            findStudentsByField("PROGRAMME", p);
-        }
-
-        // BACKUP
-        else if (strncmp(upperLine, "BACKUP", 6) == 0) {
-            if (makeTimestampedBackup()) {
-                printf("CMS: Backup file created.\n");
-            } else {
-                printf("CMS: Backup failed. Please OPEN and SAVE first.\n");
+            uint64_t checkStart = monotonicNanoseconds();
+            ok = ok && stressCheckTable(&run);
+            uint64_t checked = monotonicNanoseconds();
+
+            printf("%8.1f %12llu %10.0f %8zu %11.1f %11.1f %9.1f\n",
+                   (double)(now - start) / 1e9, (unsigned long long)operations,
+                   (double)intervalOperations * 1e9 / (double)(now - intervalStart), studentTable.count,
+                   (double)atomic_load(&memoryTotal.bytes) / 1024.0,
+                   (double)atomic_load(&memoryTotal.peakBytes) / 1024.0, (double)(checked - checkStart) / 1e6);
+            fflush(stdout);
+            intervalStart = monotonicNanoseconds();
+            intervalOperations = 0;
+            if (now >= end) {
+                break;
             }
         }
+    }
 
-        // Unknown command
-        else {
-            printf("CMS: Unknown command. Type HELP.\n");
+    printf("CMS: ");
+    for (int op = 0; op < STRESS_OPERATION_COUNT; ++op) {
+        printf("%s%s %llu", op ? ", " : "", stressOperationNames[op], (unsigned long long)run.operations[op]);
+        if (run.refused[op]) {
+            printf(" (%llu refused)", (unsigned long long)run.refused[op]);
         }
     }
+    printf(".\n");
+    if (ok) {
+        printf("CMS: All invariants held.\n");
+    } else {
+        printf("CMS: Invariant broken after %llu operations (seed %llu): %s.\n",
+               (unsigned long long)operations, (unsigned long long)run.seed, run.failure);
+    }
+
+    memoryFree(run.rows);
+    outputFree(&run.output);
+    currentOutput = NULL;
+    return ok ? 0 : 1;
 }
 
 // ======================= MAIN FUNCTION ===========================
 
-int main(void)
+/*
+usage:
+    ./project                    interactive shell (asks for the password first)
+    ./project --serve [address]  shared server for many clients, see runServer()
+    ./project --bench [max rows] throughput / latency table, see runBenchmark()
+    ./project --replay <capture> [--db <file>] [--paced]  run a CAPTURE again, see runReplay()
+    ./project --stress [seconds] [seed]  random operations checked against a shadow copy, see runStress()
+*/
+int main(int argc, char **argv)
 {
     // find the folder where the .exe is located
     fillProgramDirectoryPath(programDirectoryPath, sizeof(programDirectoryPath));
@@ -1646,6 +14268,40 @@ int main(void)
     // initialize our dynamic student table
     studentTableInit(&studentTable);
 
+    // server mode: every client logs in with the password by itself
+    if (argc >= 2 && strcmp(argv[1], "--serve") == 0) {
+        int status = runServer(argc >= 3 ? argv[2] : SERVER_DEFAULT_ADDRESS);
+        traceStop(NULL, NULL);
+        captureStop(NULL, NULL);
+        threadPoolStop();
+        studentTableFree(&studentTable);
+        return status;
+    }
+
+    // benchmark mode: no password, it only works on generated data
+    if (argc >= 2 && strcmp(argv[1], "--bench") == 0) {
+        int status = runBenchmark(argc >= 3 ? argv[2] : NULL);
+        threadPoolStop();
+        studentTableFree(&studentTable);
+        return status;
+    }
+
+    // stress mode: no password, it only works on made-up students
+    if (argc >= 2 && strcmp(argv[1], "--stress") == 0) {
+        int status = runStress(argc >= 3 ? argv[2] : NULL, argc >= 4 ? argv[3] : NULL);
+        threadPoolStop();
+        studentTableFree(&studentTable);
+        return status;
+    }
+
+    // replay mode: runs what was captured, the capture was made after a login
+    if (argc >= 2 && strcmp(argv[1], "--replay") == 0) {
+        int status = runReplay(argc - 2, argv + 2);
+        threadPoolStop();
+        studentTableFree(&studentTable);
+        return status;
+    }
+
     // print declaration
     printDeclaration();
 
@@ -1661,8 +14317,12 @@ int main(void)
     // run the main interactive command shell
     runCommandShell();
 
-    // free allocated memory before exit
+    // finish a trace or capture that is still running, stop the worker threads
+    // and free allocated memory before exit
+    traceStop(NULL, NULL);
+    captureStop(NULL, NULL);
+    threadPoolStop();
     studentTableFree(&studentTable);
 
     return 0;
-}
\ No newline at end of file
+}